@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include "delfem2/amg_mats.h"
+
+namespace dfm2 = delfem2;
+
+// ----------------------------------------------------
+
+// invert nxn matrix in place with the Gauss-Jordan elimination with partial pivoting
+// return false if the matrix is singular
+static bool InverseMat_Pivot(
+    double* a,
+    unsigned int n)
+{
+  std::vector<unsigned int> aPiv(n);
+  for(unsigned int i=0;i<n;++i){
+    unsigned int ip = i;
+    for(unsigned int j=i+1;j<n;++j){
+      if( fabs(a[j*n+i]) > fabs(a[ip*n+i]) ){ ip = j; }
+    }
+    aPiv[i] = ip;
+    if( ip != i ){
+      for(unsigned int k=0;k<n;++k){ std::swap(a[i*n+k],a[ip*n+k]); }
+    }
+    const double aii = a[i*n+i];
+    if( fabs(aii) < 1.0e-30 ){ return false; }
+    const double tmp0 = 1.0/aii;
+    a[i*n+i] = 1;
+    for(unsigned int k=0;k<n;++k){ a[i*n+k] *= tmp0; }
+    for(unsigned int j=0;j<n;++j){
+      if( j == i ){ continue; }
+      const double tmp1 = a[j*n+i];
+      a[j*n+i] = 0;
+      for(unsigned int k=0;k<n;++k){ a[j*n+k] -= tmp1*a[i*n+k]; }
+    }
+  }
+  for(int i=(int)n-1;i>=0;--i){ // undo the row exchanges as the column exchanges
+    const unsigned int ip = aPiv[i];
+    if( ip == (unsigned int)i ){ continue; }
+    for(unsigned int k=0;k<n;++k){ std::swap(a[k*n+i],a[k*n+ip]); }
+  }
+  return true;
+}
+
+// [C] += [A][B] where [A] is (ni x nk) and [B] is (nk x nj)
+static void MatMatAdd(
+    double* C,
+    const double* A, const double* B,
+    unsigned int ni, unsigned int nk, unsigned int nj)
+{
+  for(unsigned int i=0;i<ni;++i){
+    for(unsigned int k=0;k<nk;++k){
+      const double aik = A[i*nk+k];
+      for(unsigned int j=0;j<nj;++j){ C[i*nj+j] += aik*B[k*nj+j]; }
+    }
+  }
+}
+
+// inverse of the diagonal blocks
+static void DiaInv_Blk(
+    std::vector<double>& aDiaInv,
+    const dfm2::CMatrixSparse<double>& A)
+{
+  const unsigned int len = A.len_col;
+  aDiaInv = A.valDia;
+  for(unsigned int iblk=0;iblk<A.nblk_col;++iblk){
+    double* pa = aDiaInv.data()+iblk*len*len;
+    if( InverseMat_Pivot(pa,len) ){ continue; }
+    for(unsigned int i=0;i<len*len;++i){ pa[i] = 0.0; } // singular block is not smoothed
+  }
+}
+
+// one sweep of the block Gauss-Seidel method for [A]{x}={b}
+static void GaussSeidel_Blk(
+    double* x,
+    const double* b,
+    const dfm2::CMatrixSparse<double>& A,
+    const double* aDiaInv,
+    bool is_forward,
+    double* r) // work buffer for one block
+{
+  const unsigned int len = A.len_col;
+  const unsigned int blksize = len*len;
+  const unsigned int nblk = A.nblk_col;
+  for(unsigned int jblk=0;jblk<nblk;++jblk){
+    const unsigned int iblk = is_forward ? jblk : nblk-1-jblk;
+    for(unsigned int i=0;i<len;++i){ r[i] = b[iblk*len+i]; }
+    for(unsigned int icrs=A.colInd[iblk];icrs<A.colInd[iblk+1];++icrs){
+      const unsigned int kblk = A.rowPtr[icrs];
+      const double* pa = A.valCrs.data()+icrs*blksize;
+      const double* px = x+kblk*len;
+      for(unsigned int i=0;i<len;++i){
+        for(unsigned int j=0;j<len;++j){ r[i] -= pa[i*len+j]*px[j]; }
+      }
+    }
+    const double* pd = aDiaInv+iblk*blksize;
+    double* px = x+iblk*len;
+    for(unsigned int i=0;i<len;++i){
+      px[i] = 0.0;
+      for(unsigned int j=0;j<len;++j){ px[i] += pd[i*len+j]*r[j]; }
+    }
+  }
+}
+
+// aggregate the blocks connected strongly (Vanek, Mandel & Brezina 1996)
+// aAgg[iblk] is the aggregate of the block or -1 if the block is isolated (e.g., fixed boundary)
+// return the number of the aggregates
+static unsigned int Aggregation_Strength(
+    std::vector<int>& aAgg,
+    const dfm2::CMatrixSparse<double>& A,
+    double theta)
+{
+  const unsigned int nblk = A.nblk_col;
+  const unsigned int blksize = A.len_col*A.len_row;
+  std::vector<double> aNormDia(nblk,0.0);
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    double s = 0.0;
+    for(unsigned int i=0;i<blksize;++i){ s += A.valDia[iblk*blksize+i]*A.valDia[iblk*blksize+i]; }
+    aNormDia[iblk] = sqrt(s);
+  }
+  std::vector<unsigned int> strg_ind(nblk+1,0), strg;
+  strg.reserve(A.rowPtr.size());
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    for(unsigned int icrs=A.colInd[iblk];icrs<A.colInd[iblk+1];++icrs){
+      const unsigned int jblk = A.rowPtr[icrs];
+      if( jblk == iblk ){ continue; }
+      double s = 0.0;
+      for(unsigned int i=0;i<blksize;++i){ s += A.valCrs[icrs*blksize+i]*A.valCrs[icrs*blksize+i]; }
+      if( s <= theta*theta*aNormDia[iblk]*aNormDia[jblk] ){ continue; }
+      strg.push_back(jblk);
+    }
+    strg_ind[iblk+1] = (unsigned int)strg.size();
+  }
+  aAgg.assign(nblk,-1);
+  int nagg = 0;
+  // pass 1: a block and its strong neighbors form an aggregate if none of them are aggregated
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    if( aAgg[iblk] != -1 ){ continue; }
+    if( strg_ind[iblk] == strg_ind[iblk+1] ){ continue; } // isolated
+    bool is_free = true;
+    for(unsigned int is=strg_ind[iblk];is<strg_ind[iblk+1];++is){
+      if( aAgg[strg[is]] != -1 ){ is_free = false; break; }
+    }
+    if( !is_free ){ continue; }
+    aAgg[iblk] = nagg;
+    for(unsigned int is=strg_ind[iblk];is<strg_ind[iblk+1];++is){ aAgg[strg[is]] = nagg; }
+    nagg++;
+  }
+  // pass 2: join the aggregate of a strong neighbor aggregated in the pass 1
+  const std::vector<int> aAgg1 = aAgg;
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    if( aAgg1[iblk] != -1 ){ continue; }
+    for(unsigned int is=strg_ind[iblk];is<strg_ind[iblk+1];++is){
+      if( aAgg1[strg[is]] == -1 ){ continue; }
+      aAgg[iblk] = aAgg1[strg[is]];
+      break;
+    }
+  }
+  // pass 3: the remaining blocks form aggregates with their remaining strong neighbors
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    if( aAgg[iblk] != -1 ){ continue; }
+    if( strg_ind[iblk] == strg_ind[iblk+1] ){ continue; } // isolated
+    aAgg[iblk] = nagg;
+    for(unsigned int is=strg_ind[iblk];is<strg_ind[iblk+1];++is){
+      if( aAgg[strg[is]] == -1 ){ aAgg[strg[is]] = nagg; }
+    }
+    nagg++;
+  }
+  return (unsigned int)nagg;
+}
+
+// tentative prolongation by the QR decomposition of the near-nullspace restricted to each aggregate
+// aPt (out) (len x nk) block for each fine block. zero for the isolated blocks
+// aBc (out) near-nullspace for the coarse level (the R factor)
+// aFlgZero (out) 1 if the column of the coarse dof is zero (rank deficient)
+static void TentativeProlongation(
+    std::vector<double>& aPt,
+    std::vector<double>& aBc,
+    std::vector<int>& aFlgZero,
+    const std::vector<int>& aAgg,
+    unsigned int nagg,
+    const std::vector<double>& aB,
+    unsigned int nk,
+    unsigned int len)
+{
+  const unsigned int nblk = (unsigned int)aAgg.size();
+  std::vector<unsigned int> agg_ind(nagg+1,0), agg_blk;
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    if( aAgg[iblk] >= 0 ){ agg_ind[aAgg[iblk]+1]++; }
+  }
+  for(unsigned int iagg=0;iagg<nagg;++iagg){ agg_ind[iagg+1] += agg_ind[iagg]; }
+  agg_blk.resize(agg_ind[nagg]);
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    if( aAgg[iblk] < 0 ){ continue; }
+    agg_blk[agg_ind[aAgg[iblk]]++] = iblk;
+  }
+  for(int iagg=(int)nagg;iagg>0;--iagg){ agg_ind[iagg] = agg_ind[iagg-1]; }
+  agg_ind[0] = 0;
+  // --------
+  aPt.assign(nblk*len*nk,0.0);
+  aBc.assign(nagg*nk*nk,0.0);
+  aFlgZero.assign(nagg*nk,0);
+  std::vector<double> Q;
+  for(unsigned int iagg=0;iagg<nagg;++iagg){
+    const unsigned int nrow = (agg_ind[iagg+1]-agg_ind[iagg])*len;
+    Q.resize(nrow*nk);
+    for(unsigned int ib=agg_ind[iagg];ib<agg_ind[iagg+1];++ib){
+      const unsigned int iblk = agg_blk[ib];
+      for(unsigned int i=0;i<len*nk;++i){
+        Q[(ib-agg_ind[iagg])*len*nk+i] = aB[iblk*len*nk+i];
+      }
+    }
+    double* R = aBc.data()+iagg*nk*nk;
+    for(unsigned int ik=0;ik<nk;++ik){ // modified Gram-Schmidt with re-orthogonalization
+      double sqnrm0 = 0.0;
+      for(unsigned int i=0;i<nrow;++i){ sqnrm0 += Q[i*nk+ik]*Q[i*nk+ik]; }
+      for(int itr=0;itr<2;++itr){
+        for(unsigned int jk=0;jk<ik;++jk){
+          double d = 0.0;
+          for(unsigned int i=0;i<nrow;++i){ d += Q[i*nk+jk]*Q[i*nk+ik]; }
+          for(unsigned int i=0;i<nrow;++i){ Q[i*nk+ik] -= d*Q[i*nk+jk]; }
+          R[jk*nk+ik] += d;
+        }
+      }
+      double sqnrm = 0.0;
+      for(unsigned int i=0;i<nrow;++i){ sqnrm += Q[i*nk+ik]*Q[i*nk+ik]; }
+      if( sqnrm <= 1.0e-16*sqnrm0 || sqnrm < 1.0e-60 ){
+        for(unsigned int i=0;i<nrow;++i){ Q[i*nk+ik] = 0.0; }
+        aFlgZero[iagg*nk+ik] = 1;
+        continue;
+      }
+      const double nrm = sqrt(sqnrm);
+      for(unsigned int i=0;i<nrow;++i){ Q[i*nk+ik] /= nrm; }
+      R[ik*nk+ik] = nrm;
+    }
+    for(unsigned int ib=agg_ind[iagg];ib<agg_ind[iagg+1];++ib){
+      const unsigned int iblk = agg_blk[ib];
+      for(unsigned int i=0;i<len*nk;++i){
+        aPt[iblk*len*nk+i] = Q[(ib-agg_ind[iagg])*len*nk+i];
+      }
+    }
+  }
+}
+
+// estimate the spectral radius of [D]^-1[A] with the power iteration
+static double SpectralRadius_DiaInvA(
+    const dfm2::CMatrixSparse<double>& A,
+    const std::vector<double>& aDiaInv)
+{
+  const unsigned int len = A.len_col;
+  const unsigned int ndof = A.nblk_col*len;
+  std::vector<double> x(ndof), y(ndof,0.0);
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(0.0,1.0);
+  for(auto& v : x){ v = dist(rndeng); }
+  double rho = 0.0;
+  for(int itr=0;itr<20;++itr){
+    double sqnx = 0.0;
+    for(unsigned int i=0;i<ndof;++i){ sqnx += x[i]*x[i]; }
+    if( sqnx < 1.0e-60 ){ break; }
+    const double invnx = 1.0/sqrt(sqnx);
+    for(unsigned int i=0;i<ndof;++i){ x[i] *= invnx; }
+    A.MatVec(y.data(), 1.0, x.data(), 0.0);
+    double sqny = 0.0;
+    for(unsigned int iblk=0;iblk<A.nblk_col;++iblk){
+      const double* pd = aDiaInv.data()+iblk*len*len;
+      for(unsigned int i=0;i<len;++i){
+        double s = 0.0;
+        for(unsigned int j=0;j<len;++j){ s += pd[i*len+j]*y[iblk*len+j]; }
+        x[iblk*len+i] = s;
+        sqny += s*s;
+      }
+    }
+    rho = sqrt(sqny);
+  }
+  return rho;
+}
+
+// smoothed prolongation [P] = ([I] - omega [D]^-1[A]) [Pt]
+static void SmoothedProlongation(
+    dfm2::CMatrixSparse<double>& P,
+    const dfm2::CMatrixSparse<double>& A,
+    const std::vector<double>& aDiaInv,
+    double omega,
+    const std::vector<double>& aPt,
+    const std::vector<int>& aAgg,
+    unsigned int nagg,
+    unsigned int nk)
+{
+  const unsigned int nblk = A.nblk_col;
+  const unsigned int len = A.len_col;
+  const unsigned int blkA = len*len;
+  const unsigned int blkP = len*nk;
+  std::vector<unsigned int> colind(nblk+1,0), rowptr;
+  std::vector<double> aVal;
+  std::vector<int> aMark(nagg,-1);
+  std::vector<double> W, D(blkA);
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    const unsigned int icrs0 = (unsigned int)rowptr.size();
+    // W_c = sum_{j in aggregate c} A_ij Pt_j
+    auto add = [&](unsigned int jblk, const double* pa){
+      const int jagg = aAgg[jblk];
+      if( jagg < 0 ){ return; }
+      if( aMark[jagg] == -1 ){
+        aMark[jagg] = (int)(rowptr.size()-icrs0);
+        rowptr.push_back(jagg);
+        W.resize(W.size()+blkP,0.0);
+      }
+      MatMatAdd(W.data()+aMark[jagg]*blkP, pa, aPt.data()+jblk*blkP, len,len,nk);
+    };
+    W.clear();
+    add(iblk, A.valDia.data()+iblk*blkA);
+    for(unsigned int icrs=A.colInd[iblk];icrs<A.colInd[iblk+1];++icrs){
+      add(A.rowPtr[icrs], A.valCrs.data()+icrs*blkA);
+    }
+    const unsigned int ncrs = (unsigned int)rowptr.size()-icrs0;
+    for(unsigned int i=0;i<blkA;++i){ D[i] = -omega*aDiaInv[iblk*blkA+i]; }
+    aVal.resize(aVal.size()+ncrs*blkP,0.0);
+    for(unsigned int jcrs=0;jcrs<ncrs;++jcrs){
+      const unsigned int jagg = rowptr[icrs0+jcrs];
+      double* pp = aVal.data()+(icrs0+jcrs)*blkP;
+      if( (int)jagg == aAgg[iblk] ){
+        for(unsigned int i=0;i<blkP;++i){ pp[i] = aPt[iblk*blkP+i]; }
+      }
+      MatMatAdd(pp, D.data(), W.data()+jcrs*blkP, len,len,nk);
+      aMark[jagg] = -1;
+    }
+    colind[iblk+1] = (unsigned int)rowptr.size();
+  }
+  P.nblk_col = nblk;
+  P.nblk_row = nagg;
+  P.len_col = len;
+  P.len_row = nk;
+  P.colInd = colind;
+  P.rowPtr = rowptr;
+  P.valCrs = aVal;
+  P.valDia.clear();
+}
+
+// ----------------------------------------------------
+
+template <typename T>
+void delfem2::CPreconditionerAMG<T>::SetNearKernel_RigidBody
+ (const double* aXYZ,
+  unsigned int np,
+  unsigned int ndim)
+{
+  assert( ndim == 2 || ndim == 3 );
+  double cg[3] = {0,0,0}; // center for the rotation
+  for(unsigned int ip=0;ip<np;++ip){
+    for(unsigned int idim=0;idim<ndim;++idim){ cg[idim] += aXYZ[ip*ndim+idim]/np; }
+  }
+  if( ndim == 2 ){
+    m_nkernel = 3;
+    m_aKernel.assign(np*2*3,0.0);
+    for(unsigned int ip=0;ip<np;++ip){
+      const double x = aXYZ[ip*2+0]-cg[0];
+      const double y = aXYZ[ip*2+1]-cg[1];
+      T* pb = m_aKernel.data()+ip*2*3;
+      pb[0*3+0] = 1; pb[0*3+1] = 0; pb[0*3+2] = -y;
+      pb[1*3+0] = 0; pb[1*3+1] = 1; pb[1*3+2] = +x;
+    }
+    return;
+  }
+  m_nkernel = 6;
+  m_aKernel.assign(np*3*6,0.0);
+  for(unsigned int ip=0;ip<np;++ip){
+    const double x = aXYZ[ip*3+0]-cg[0];
+    const double y = aXYZ[ip*3+1]-cg[1];
+    const double z = aXYZ[ip*3+2]-cg[2];
+    T* pb = m_aKernel.data()+ip*3*6;
+    pb[0*6+0] = 1; pb[0*6+1] = 0; pb[0*6+2] = 0; pb[0*6+3] = 0;  pb[0*6+4] = +z; pb[0*6+5] = -y;
+    pb[1*6+0] = 0; pb[1*6+1] = 1; pb[1*6+2] = 0; pb[1*6+3] = -z; pb[1*6+4] = 0;  pb[1*6+5] = +x;
+    pb[2*6+0] = 0; pb[2*6+1] = 0; pb[2*6+2] = 1; pb[2*6+3] = +y; pb[2*6+4] = -x; pb[2*6+5] = 0;
+  }
+}
+template void dfm2::CPreconditionerAMG<double>::SetNearKernel_RigidBody(const double* aXYZ, unsigned int np, unsigned int ndim);
+
+
+template <typename T>
+void delfem2::CPreconditionerAMG<T>::Initialize
+ (const CMatrixSparse<T>& A)
+{
+  assert( A.nblk_col == A.nblk_row && A.len_col == A.len_row );
+  assert( !A.valDia.empty() );
+  m_aMatA.resize(1);
+  m_aMatA[0] = A;
+  m_aMatP.clear();
+  m_aDiaInv.clear();
+  std::vector<double> aB;
+  unsigned int nk;
+  if( m_nkernel > 0 && m_aKernel.size() == A.nblk_col*A.len_col*m_nkernel ){
+    aB = m_aKernel;
+    nk = m_nkernel;
+  }
+  else{ // translation for each dof in the block
+    nk = A.len_col;
+    aB.assign(A.nblk_col*nk*nk,0.0);
+    for(unsigned int idof=0;idof<A.nblk_col*nk;++idof){ aB[idof*nk+idof%nk] = 1.0; }
+  }
+  for(;;){
+    m_aDiaInv.resize(m_aDiaInv.size()+1);
+    const CMatrixSparse<T>& Af = m_aMatA.back();
+    DiaInv_Blk(m_aDiaInv.back(), Af);
+    if( Af.nblk_col*Af.len_col <= m_ncoarse_max ){ break; }
+    if( m_aMatA.size() >= m_nlevel_max ){ break; }
+    std::vector<int> aAgg;
+    const unsigned int nagg = Aggregation_Strength(aAgg, Af, m_theta);
+    if( nagg == 0 || nagg*nk >= Af.nblk_col*Af.len_col ){ break; } // not coarsened
+    std::vector<double> aPt, aBc;
+    std::vector<int> aFlgZero;
+    TentativeProlongation(aPt, aBc, aFlgZero,
+                          aAgg, nagg, aB, nk, Af.len_col);
+    const double rho = SpectralRadius_DiaInvA(Af, m_aDiaInv.back());
+    const double omega = (rho > 1.0e-30) ? (4.0/3.0)/rho : 0.0;
+    CMatrixSparse<T> P, Ac;
+    SmoothedProlongation(P,
+                         Af, m_aDiaInv.back(), omega, aPt, aAgg, nagg, nk);
+    { // Galerkin projection [Ac] = [P]^T[A][P]
+      Ac.SetNumThread(Af.nthread);
+      CTripleProductPlan<T> plan;
+      plan.Initialize(Ac, P, Af, P);
+      plan.SetValue(Ac, P, Af, P);
+    }
+    for(unsigned int idof=0;idof<nagg*nk;++idof){ // decouple the dofs of the rank deficient modes
+      if( aFlgZero[idof] == 0 ){ continue; }
+      Ac.valDia[(idof/nk)*nk*nk+(idof%nk)*nk+(idof%nk)] = 1.0;
+    }
+    if( Af.nthread > 1 ){ P.SetNumThread(Af.nthread); }
+    m_aMatP.push_back(P);
+    m_aMatA.push_back(Ac);
+    aB.swap(aBc);
+  }
+  m_iluCoarse.Initialize_ILUk(m_aMatA.back(),-1);
+  m_iluCoarse.SetValueILU(m_aMatA.back());
+  m_iluCoarse.DoILUDecomp();
+  // --------
+  const unsigned int nlev = (unsigned int)m_aMatA.size();
+  m_aVecB.resize(nlev);
+  m_aVecX.resize(nlev);
+  m_aVecR.resize(nlev);
+  unsigned int len_max = 0;
+  for(unsigned int ilev=0;ilev<nlev;++ilev){
+    const unsigned int ndof = m_aMatA[ilev].nblk_col*m_aMatA[ilev].len_col;
+    m_aVecB[ilev].assign(ndof,0.0);
+    m_aVecX[ilev].assign(ndof,0.0);
+    m_aVecR[ilev].assign(ndof,0.0);
+    if( m_aMatA[ilev].len_col > len_max ){ len_max = m_aMatA[ilev].len_col; }
+  }
+  m_aTmpBlk.assign(len_max,0.0);
+}
+template void dfm2::CPreconditionerAMG<double>::Initialize(const CMatrixSparse<double>& A);
+
+
+template <typename T>
+void delfem2::CPreconditionerAMG<T>::VCycle
+ (unsigned int ilev) const
+{
+  const std::vector<T>& b = m_aVecB[ilev];
+  std::vector<T>& x = m_aVecX[ilev];
+  if( ilev+1 == m_aMatA.size() ){ // coarsest
+    x = b;
+    m_iluCoarse.Solve(x.data());
+    return;
+  }
+  const CMatrixSparse<T>& A = m_aMatA[ilev];
+  const CMatrixSparse<T>& P = m_aMatP[ilev];
+  std::vector<T>& r = m_aVecR[ilev];
+  for(auto& v : x){ v = 0.0; }
+  for(unsigned int is=0;is<m_nsmooth;++is){
+    GaussSeidel_Blk(x.data(), b.data(), A, m_aDiaInv[ilev].data(), true, m_aTmpBlk.data());
+  }
+  r = b;
+  A.MatVec(r.data(), -1.0, x.data(), 1.0); // {r} = {b} - [A]{x}
+  P.MatTVec(m_aVecB[ilev+1].data(), 1.0, r.data(), 0.0);
+  this->VCycle(ilev+1);
+  P.MatVec(x.data(), 1.0, m_aVecX[ilev+1].data(), 1.0);
+  for(unsigned int is=0;is<m_nsmooth;++is){ // backward sweep for the symmetry
+    GaussSeidel_Blk(x.data(), b.data(), A, m_aDiaInv[ilev].data(), false, m_aTmpBlk.data());
+  }
+}
+template void dfm2::CPreconditionerAMG<double>::VCycle(unsigned int ilev) const;
+
+
+template <typename T>
+void delfem2::CPreconditionerAMG<T>::Solve
+ (T* vec) const
+{
+  if( m_aMatA.empty() ){ return; }
+  std::vector<T>& b = m_aVecB[0];
+  for(unsigned int i=0;i<b.size();++i){ b[i] = vec[i]; }
+  this->VCycle(0);
+  const std::vector<T>& x = m_aVecX[0];
+  for(unsigned int i=0;i<x.size();++i){ vec[i] = x[i]; }
+}
+template void dfm2::CPreconditionerAMG<double>::Solve(double* vec) const;
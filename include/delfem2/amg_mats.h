@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * @file amg_mats.h
+ * @brief smoothed aggregation algebraic multigrid preconditioner for CMatrixSparse
+ */
+
+#ifndef DFM2_AMG_MATS_H
+#define DFM2_AMG_MATS_H
+
+#include <vector>
+
+#include "delfem2/mats.h"
+#include "delfem2/ilu_mats.h"
+
+namespace delfem2 {
+
+/**
+ * @class smoothed aggregation AMG preconditioner for a symmetric positive definite block sparse matrix
+ * @tparam T double
+ * @details Solve() applies one V-cycle with the symmetric block Gauss-Seidel smoother and
+ * the exact LU factorization on the coarsest level. The V-cycle is symmetric, so it can be passed to Solve_PCG().
+ * The coarse spaces are built from the near-nullspace (the modes with small energy) of the matrix.
+ * The default near-nullspace is the translation in each dof of the block (e.g., the constant for the Poisson problem).
+ * For elasticity, set the rigid-body modes with SetNearKernel_RigidBody() before Initialize().
+ */
+template <typename T>
+class CPreconditionerAMG
+{
+public:
+  CPreconditionerAMG() : m_theta(0.08), m_nsmooth(1), m_ncoarse_max(300), m_nlevel_max(10), m_nkernel(0) {}
+  /**
+   * @brief set the near-nullspace
+   * @param aB (in) nkernel vectors stored as aB[idof*nkernel+ikernel]
+   */
+  void SetNearKernel(const std::vector<T>& aB, unsigned int nkernel){
+    m_aKernel = aB;
+    m_nkernel = nkernel;
+  }
+  /**
+   * @brief set the rigid-body modes as the near-nullspace for the elasticity
+   * @param aXYZ (in) coordinates of the points. the i-th point corresponds to the i-th block
+   * @param ndim (in) 2 or 3. The block size of the matrix needs to be ndim.
+   * @details 3 modes for 2D and 6 modes for 3D (translations and rotations)
+   */
+  void SetNearKernel_RigidBody(const double* aXYZ, unsigned int np, unsigned int ndim);
+  /**
+   * @brief build the multigrid hierarchy from the values of the matrix
+   * @details call this after the values of the matrix (and the boundary conditions) are set.
+   * The matrix is copied, so it can be modified afterwards.
+   */
+  void Initialize(const CMatrixSparse<T>& A);
+  /**
+   * @brief {vec} = [M]^-1{vec} where [M]^-1 is one V-cycle
+   * @details the work vectors are stored in this class, so do not call this concurrently for the same instance
+   */
+  void Solve(T* vec) const;
+  /**
+   * @brief number of levels including the finest one
+   */
+  unsigned int NumLevel() const { return (unsigned int)m_aMatA.size(); }
+private:
+  void VCycle(unsigned int ilev) const;
+public:
+  /**
+   * @param m_theta threshold of the strength of connection. the block (i,j) is strong if |Aij| > theta * sqrt(|Aii||Ajj|)
+   */
+  double m_theta;
+  /**
+   * @param m_nsmooth number of pre- and post- smoothing sweeps
+   */
+  unsigned int m_nsmooth;
+  /**
+   * @param m_ncoarse_max the coarsening stops when the number of the dofs is less than this
+   */
+  unsigned int m_ncoarse_max;
+  unsigned int m_nlevel_max;
+  /**
+   * @param m_aMatA matrix for each level. m_aMatA[0] is the copy of the input
+   * @param m_aMatP prolongation from the level ilev+1 to ilev. nblk_col is the number of fine blocks.
+   * @param m_aDiaInv inverse of the diagonal blocks for each level
+   */
+  std::vector< CMatrixSparse<T> > m_aMatA, m_aMatP;
+  std::vector< std::vector<T> > m_aDiaInv;
+  CPreconditionerILU<T> m_iluCoarse;
+private:
+  std::vector<T> m_aKernel;
+  unsigned int m_nkernel;
+  mutable std::vector< std::vector<T> > m_aVecB, m_aVecX, m_aVecR;
+  mutable std::vector<T> m_aTmpBlk; // residual of one block in the smoother
+};
+
+} // end namespace delfem2
+
+#endif
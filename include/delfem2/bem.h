@@ -11,6 +11,23 @@ const COMPLEX IMG = COMPLEX(0.0, 1.0);
 
 // -----------------------------------
 
+/**
+ * @brief dense square matrix (row-major n x n) as the linear operator for the solvers in "vecxitrsol.h"
+ * @details the matrix is referred (not copied)
+ */
+class CMatrixDenseOperator
+{
+public:
+  CMatrixDenseOperator(const std::vector<double>& A, unsigned int n) : A(A), n(n) {}
+  // {y} = alpha*[A]{x} + beta*{y}
+  void MatVec(double* y,
+              double alpha, const double* x,
+              double beta) const;
+public:
+  const std::vector<double>& A;
+  const unsigned int n;
+};
+
 bool Solve_BiCGSTAB(double& conv_ratio, int& iteration,
                     std::vector<double>& u_vec,
                     const std::vector<double>& A,
@@ -15,6 +15,10 @@
 #include <iostream>
 #include <sstream>
 
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
 namespace delfem2 {
 
 /**
@@ -46,6 +50,16 @@ public:
 	  bbmin[0] = +1;
 	  bbmax[0] = -1;
 	}
+  /**
+   * @brief area of the surface of the box used for the surface area heuristic (zero if inactive)
+   */
+  REAL SurfaceArea() const{
+    if( bbmin[0] > bbmax[0] ){ return 0; }
+    const REAL x0 = bbmax[0] - bbmin[0];
+    const REAL y0 = bbmax[1] - bbmin[1];
+    const REAL z0 = bbmax[2] - bbmin[2];
+    return 2*(x0*y0+y0*z0+z0*x0);
+  }
   REAL DiagonalLength() const{
     REAL x0 = bbmax[0] - bbmin[0];
     REAL y0 = bbmax[1] - bbmin[1];
@@ -143,6 +157,24 @@ public:
     if( bbmax[2] < bb.bbmin[2] ) return false;
     return true;
   }
+  /**
+   * @brief if the ray src+t*dir (t>=0) intersects the box (slab method)
+   */
+  bool IsIntersectRay(const double src[3], const double dir[3]) const
+  {
+    if( !IsActive() ) return false;
+    double tnear = 0.0, tfar = 1.0e+300;
+    for(int idim=0;idim<3;++idim){
+      const double invdir = ( fabs(dir[idim]) > 1.0e-300 ) ? 1.0/dir[idim] : 1.0e+300;
+      const double t0 = (bbmin[idim]-src[idim])*invdir;
+      const double t1 = (bbmax[idim]-src[idim])*invdir;
+      const double tmin = ( t0 < t1 ) ? t0 : t1;
+      const double tmax = ( t0 < t1 ) ? t1 : t0;
+      tnear = ( tnear > tmin ) ? tnear : tmin;
+      tfar = ( tfar < tmax ) ? tfar : tmax;
+    }
+    return tnear <= tfar;
+  }
   CBV3_AABB<REAL>& operator+=(const REAL v[3])
 	{
 		if( !IsActive() ){
@@ -302,6 +334,13 @@ public:
   bool IsActive() const {
     return r >= 0;
   }
+  /**
+   * @brief area of the surface of the sphere used for the surface area heuristic (zero if inactive)
+   */
+  REAL SurfaceArea() const {
+    if( r < 0 ){ return 0; }
+    return 4*M_PI*r*r;
+  }
   bool IsIntersectLine(const double src[3], const double dir[3]) const {
     double ratio = dir[0]*(c[0]-src[0]) + dir[1]*(c[1]-src[1]) + dir[2]*(c[2]-src[2]);
     ratio = ratio/(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
@@ -7,9 +7,13 @@
 
 #include <cstdio>
 #include <cmath>
+#include <cfloat>
 #include <algorithm>
+#include <atomic>
 
 #include "delfem2/bvh.h"
+#include "delfem2/bv.h"
+#include "delfem2/thread.h"
 
 namespace dfm2 = delfem2;
 
@@ -196,6 +200,255 @@ int dfm2::BVHTopology_TopDown_MeshElem
   return 0;
 }
 
+// -------------------------------------------
+// binned SAH
+
+/**
+ * box and number of the elements in a bin
+ */
+class CBinSAH{
+public:
+  void Clear(){
+    bb.Set_Inactive();
+    nelem = 0;
+  }
+  void Add(const CBinSAH& bin){
+    bb += bin.bb;
+    nelem += bin.nelem;
+  }
+public:
+  dfm2::CBV3d_AABB bb;
+  unsigned int nelem;
+};
+
+class CBuilderBVH_SAH{
+public:
+  CBuilderBVH_SAH(std::vector<dfm2::CNodeBVH2>& aNodeBVH) : aNodeBVH(aNodeBVH) {}
+  /**
+   * split the elements aInd[ib,ie) into aInd[ib,imid) and aInd[imid,ie) and return imid
+   */
+  unsigned int Partition(unsigned int ib, unsigned int ie, unsigned int nthread);
+  /**
+   * set the children of the node inode which has the elements aInd[ib,ie)
+   */
+  void SetChildren(unsigned int inode, unsigned int ib, unsigned int imid, unsigned int ie);
+  /**
+   * build the subtree of the node inode
+   */
+  void Build(unsigned int inode, unsigned int ib, unsigned int ie);
+public:
+  static const unsigned int NBIN = 16;
+  std::vector<dfm2::CNodeBVH2>& aNodeBVH;
+  std::vector<double> aBBElem; // bbmin and bbmax of the elements
+  std::vector<double> aCent; // center of the bounding box of the elements
+  std::vector<unsigned int> aInd; // element index
+};
+
+unsigned int CBuilderBVH_SAH::Partition(
+    unsigned int ib, unsigned int ie,
+    unsigned int nthread)
+{
+  assert( ie-ib >= 2 );
+  const unsigned int ngrain = 1u << 14; // don't use threads for small nodes
+  if( nthread > (ie-ib)/ngrain ){ nthread = (ie-ib)/ngrain; }
+  if( nthread == 0 ){ nthread = 1; }
+  std::vector<unsigned int> aSplit;
+  dfm2::SplitRange_Uniform(aSplit, nthread, ie-ib);
+  // bounding box of the centers
+  double cmin[3], cmax[3];
+  {
+    std::vector<CBinSAH> aBinCent(nthread);
+    dfm2::ParallelThread(nthread, [&](unsigned int ith){
+      CBinSAH& bin = aBinCent[ith];
+      bin.Clear();
+      for(unsigned int ii=ib+aSplit[ith];ii<ib+aSplit[ith+1];++ii){
+        const double* c = aCent.data()+aInd[ii]*3;
+        bin.bb.AddPoint(c,0.0);
+      }
+    });
+    for(unsigned int ith=1;ith<nthread;++ith){ aBinCent[0].Add(aBinCent[ith]); }
+    for(int idim=0;idim<3;++idim){
+      cmin[idim] = aBinCent[0].bb.bbmin[idim];
+      cmax[idim] = aBinCent[0].bb.bbmax[idim];
+    }
+  }
+  double scale[3];
+  for(int idim=0;idim<3;++idim){
+    scale[idim] = (cmax[idim] > cmin[idim]) ? NBIN/(cmax[idim]-cmin[idim]) : 0.0;
+  }
+  auto ibin_elem = [&](unsigned int ielem, int idim) -> unsigned int {
+    const unsigned int ibin = (unsigned int)((aCent[ielem*3+idim]-cmin[idim])*scale[idim]);
+    return (ibin < NBIN) ? ibin : NBIN-1;
+  };
+  // bin the elements along each axis
+  std::vector<CBinSAH> aBin(nthread*3*NBIN);
+  dfm2::ParallelThread(nthread, [&](unsigned int ith){
+    CBinSAH* pBin = aBin.data()+ith*3*NBIN;
+    for(unsigned int ibin=0;ibin<3*NBIN;++ibin){ pBin[ibin].Clear(); }
+    for(unsigned int ii=ib+aSplit[ith];ii<ib+aSplit[ith+1];++ii){
+      const unsigned int ielem = aInd[ii];
+      for(int idim=0;idim<3;++idim){
+        CBinSAH& bin = pBin[idim*NBIN+ibin_elem(ielem,idim)];
+        bin.bb += dfm2::CBV3d_AABB(aBBElem.data()+ielem*6, aBBElem.data()+ielem*6+3);
+        bin.nelem += 1;
+      }
+    }
+  });
+  for(unsigned int ith=1;ith<nthread;++ith){
+    for(unsigned int ibin=0;ibin<3*NBIN;++ibin){ aBin[ibin].Add(aBin[ith*3*NBIN+ibin]); }
+  }
+  // sweep the bins to find the plane with the minimum cost
+  int idim_best = -1;
+  unsigned int ibin_best = 0;
+  double cost_best = DBL_MAX;
+  for(int idim=0;idim<3;++idim){
+    if( scale[idim] == 0.0 ){ continue; }
+    const CBinSAH* pBin = aBin.data()+idim*NBIN;
+    double aCostR[NBIN]; // cost of the bins [ibin,NBIN)
+    {
+      CBinSAH binR; binR.Clear();
+      for(unsigned int ibin=NBIN-1;ibin>0;--ibin){
+        binR.Add(pBin[ibin]);
+        aCostR[ibin] = binR.bb.SurfaceArea()*binR.nelem;
+      }
+    }
+    CBinSAH binL; binL.Clear();
+    for(unsigned int ibin=0;ibin<NBIN-1;++ibin){ // split between ibin and ibin+1
+      binL.Add(pBin[ibin]);
+      if( binL.nelem == 0 || binL.nelem == ie-ib ){ continue; }
+      const double cost = binL.bb.SurfaceArea()*binL.nelem + aCostR[ibin+1];
+      if( cost < cost_best ){
+        cost_best = cost;
+        idim_best = idim;
+        ibin_best = ibin;
+      }
+    }
+  }
+  if( idim_best == -1 ){ // all the centers are the same
+    return (ib+ie)/2;
+  }
+  unsigned int* pMid = std::partition(aInd.data()+ib, aInd.data()+ie, [&](unsigned int ielem){
+    return ibin_elem(ielem,idim_best) <= ibin_best;
+  });
+  const unsigned int imid = pMid-aInd.data();
+  assert( imid > ib && imid < ie );
+  return imid;
+}
+
+void CBuilderBVH_SAH::SetChildren(
+    unsigned int inode,
+    unsigned int ib, unsigned int imid, unsigned int ie)
+{
+  const unsigned int inode0 = inode+1;
+  const unsigned int inode1 = inode+2*(imid-ib); // after the 2*(imid-ib)-1 nodes of child 0
+  aNodeBVH[inode].ichild[0] = inode0;
+  aNodeBVH[inode].ichild[1] = inode1;
+  aNodeBVH[inode0].iroot = inode;
+  aNodeBVH[inode1].iroot = inode;
+  if( imid-ib == 1 ){
+    aNodeBVH[inode0].ichild[0] = aInd[ib];
+    aNodeBVH[inode0].ichild[1] = -1;
+  }
+  if( ie-imid == 1 ){
+    aNodeBVH[inode1].ichild[0] = aInd[imid];
+    aNodeBVH[inode1].ichild[1] = -1;
+  }
+}
+
+void CBuilderBVH_SAH::Build(
+    unsigned int inode,
+    unsigned int ib, unsigned int ie)
+{
+  while( ie-ib >= 2 ){
+    const unsigned int imid = this->Partition(ib,ie,1);
+    this->SetChildren(inode,ib,imid,ie);
+    // recursion for the smaller child to limit the depth of the call stack
+    if( imid-ib < ie-imid ){
+      this->Build(inode+1,ib,imid);
+      inode = inode+2*(imid-ib);
+      ib = imid;
+    }
+    else{
+      this->Build(inode+2*(imid-ib),imid,ie);
+      inode = inode+1;
+      ie = imid;
+    }
+  }
+}
+
+int dfm2::BVHTopology_SAH_MeshElem(
+    std::vector<dfm2::CNodeBVH2>& aNodeBVH,
+    const double* aXYZ, unsigned int nXYZ,
+    const unsigned int* aElem, unsigned int nnoel, unsigned int nElem,
+    unsigned int nthread)
+{
+  assert( nElem > 0 );
+  (void)nXYZ; // only used in the assert
+  if( nthread == 0 ){ nthread = 1; }
+  aNodeBVH.resize(nElem*2-1);
+  aNodeBVH[0].iroot = -1;
+  CBuilderBVH_SAH builder(aNodeBVH);
+  builder.aBBElem.resize(nElem*6);
+  builder.aCent.resize(nElem*3);
+  builder.aInd.resize(nElem);
+  {
+    std::vector<unsigned int> aSplit;
+    dfm2::SplitRange_Uniform(aSplit, nthread, nElem);
+    dfm2::ParallelThread(nthread, [&](unsigned int ith){
+      for(unsigned int ielem=aSplit[ith];ielem<aSplit[ith+1];++ielem){
+        dfm2::CBV3d_AABB bb;
+        for(unsigned int inoel=0;inoel<nnoel;++inoel){
+          const unsigned int ino0 = aElem[ielem*nnoel+inoel];
+          assert( ino0 < nXYZ );
+          bb.AddPoint(aXYZ+ino0*3, 0.0);
+        }
+        for(int idim=0;idim<3;++idim){
+          builder.aBBElem[ielem*6+0+idim] = bb.bbmin[idim];
+          builder.aBBElem[ielem*6+3+idim] = bb.bbmax[idim];
+          builder.aCent[ielem*3+idim] = (bb.bbmin[idim]+bb.bbmax[idim])*0.5;
+        }
+        builder.aInd[ielem] = ielem;
+      }
+    });
+  }
+  if( nElem == 1 ){
+    aNodeBVH[0].ichild[0] = 0;
+    aNodeBVH[0].ichild[1] = -1;
+    return 0;
+  }
+  // split the large nodes near the root with threaded binning until there are enough subtrees
+  class CTask{
+  public:
+    unsigned int inode, ib, ie;
+  };
+  std::vector<CTask> aTask(1, CTask{0,0,nElem});
+  const unsigned int nelem_task = nElem/(nthread*4)+1;
+  for(;;){
+    unsigned int itask_max = 0;
+    for(unsigned int itask=1;itask<aTask.size();++itask){
+      if( aTask[itask].ie-aTask[itask].ib > aTask[itask_max].ie-aTask[itask_max].ib ){ itask_max = itask; }
+    }
+    const CTask task = aTask[itask_max];
+    if( nthread == 1 || task.ie-task.ib <= nelem_task ){ break; }
+    const unsigned int imid = builder.Partition(task.ib,task.ie,nthread);
+    builder.SetChildren(task.inode,task.ib,imid,task.ie);
+    aTask.erase(aTask.begin()+itask_max);
+    if( imid-task.ib >= 2 ){ aTask.push_back(CTask{task.inode+1,task.ib,imid}); }
+    if( task.ie-imid >= 2 ){ aTask.push_back(CTask{task.inode+2*(imid-task.ib),imid,task.ie}); }
+    if( aTask.empty() ){ return 0; }
+  }
+  std::sort(aTask.begin(), aTask.end(), [](const CTask& a, const CTask& b){ return a.ie-a.ib > b.ie-b.ib; });
+  std::atomic<unsigned int> itask_next(0);
+  dfm2::ParallelThread(nthread, [&](unsigned int){
+    for(;;){
+      const unsigned int itask = itask_next.fetch_add(1);
+      if( itask >= aTask.size() ){ break; }
+      builder.Build(aTask[itask].inode,aTask[itask].ib,aTask[itask].ie);
+    }
+  });
+  return 0;
+}
+
 
 
   // -------------------------------------------
@@ -212,6 +465,18 @@ std::uint32_t expandBits(std::uint32_t v)
   return v;
 }
 
+// Expands a 21-bit integer into 63 bits by puting two zeros before each bit
+static std::uint64_t expandBits64(std::uint64_t v)
+{
+  v &= 0x1fffffull;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v <<  8) & 0x100f00f00f00f00full;
+  v = (v | v <<  4) & 0x10c30c30c30c30c3ull;
+  v = (v | v <<  2) & 0x1249249249249249ull;
+  return v;
+}
+
 template <typename REAL>
 std::uint32_t delfem2::MortonCode(REAL x, REAL y, REAL z)
 {
@@ -229,6 +494,18 @@ std::uint32_t delfem2::MortonCode(REAL x, REAL y, REAL z)
 template std::uint32_t delfem2::MortonCode(float x, float y, float z);
 template std::uint32_t delfem2::MortonCode(double x, double y, double z);
 
+template <typename REAL>
+std::uint64_t delfem2::MortonCode64(REAL x, REAL y, REAL z)
+{
+  const double nres = 2097152.0; // 2^21
+  const auto ix = (std::uint64_t)fmin(fmax(x * nres, 0.0), nres-1.0);
+  const auto iy = (std::uint64_t)fmin(fmax(y * nres, 0.0), nres-1.0);
+  const auto iz = (std::uint64_t)fmin(fmax(z * nres, 0.0), nres-1.0);
+  return expandBits64(ix) * 4 + expandBits64(iy) * 2 + expandBits64(iz);
+}
+template std::uint64_t delfem2::MortonCode64(float x, float y, float z);
+template std::uint64_t delfem2::MortonCode64(double x, double y, double z);
+
 
 inline unsigned int clz(uint32_t x){
 #ifdef __GNUC__ // GCC compiler
@@ -246,33 +523,36 @@ inline unsigned int clz(uint32_t x){
 #endif
 }
 
-static int delta(int i, int j, const unsigned int* sorted_morton_code, int length)
+inline unsigned int clz(std::uint64_t x){
+  const auto xu = (std::uint32_t)(x >> 32);
+  if( xu != 0 ){ return clz(xu); }
+  return 32 + clz((std::uint32_t)x);
+}
+
+/**
+ * length of the common prefix of the i-th and the j-th codes.
+ * The index is appended to the code (Karras 2012), so the equal codes are split by their indices
+ * and the tree stays balanced for the duplicated codes.
+ */
+template <typename MC>
+static int delta(int i, int j, const MC* sorted_morton_code, int length)
 {
   if (j<0 || j >= length){
     return -1;
   }
-  else{
-    return clz(sorted_morton_code[i] ^ sorted_morton_code[j]);
-  }
+  const MC x = sorted_morton_code[i] ^ sorted_morton_code[j];
+  if( x != 0 ){ return clz(x); }
+  return sizeof(MC)*8 + clz((std::uint32_t)(i ^ j));
 }
 
-std::pair<int,int> delfem2::MortonCode_DeterminRange
-(const std::uint32_t* sortedMC,
+template <typename MC>
+static std::pair<int,int> MortonCode_DeterminRange_Impl
+(const MC* sortedMC,
  int nMC,
  int imc)
 {
   if( imc == 0 ){ return std::make_pair(0,nMC-1); }
   // ----------------------
-  const std::uint32_t mc0 = sortedMC[imc-1];
-  const std::uint32_t mc1 = sortedMC[imc+0];
-  const std::uint32_t mc2 = sortedMC[imc+1];
-  if( mc0 == mc1 && mc1 == mc2 ){ // for hash value collision
-    int jmc=imc+1;
-    for(;jmc<nMC;++jmc){
-      if( sortedMC[jmc] != mc1 ) break;
-    }
-    return std::make_pair(imc,jmc-1);
-  }
   int d = delta(imc, imc + 1, sortedMC, nMC) - delta(imc, imc - 1, sortedMC, nMC);
   d = d > 0 ? 1 : -1;
   
@@ -301,8 +581,25 @@ std::pair<int,int> delfem2::MortonCode_DeterminRange
   return range;
 }
 
-int delfem2::MortonCode_FindSplit
- (const std::uint32_t* sortedMC,
+std::pair<int,int> delfem2::MortonCode_DeterminRange
+(const std::uint32_t* sortedMC,
+ int nMC,
+ int imc)
+{
+  return MortonCode_DeterminRange_Impl(sortedMC,nMC,imc);
+}
+
+std::pair<int,int> delfem2::MortonCode_DeterminRange
+(const std::uint64_t* sortedMC,
+ int nMC,
+ int imc)
+{
+  return MortonCode_DeterminRange_Impl(sortedMC,nMC,imc);
+}
+
+template <typename MC>
+static int MortonCode_FindSplit_Impl
+ (const MC* sortedMC,
   unsigned int iMC_start,
   unsigned int iMC_last)
 {
@@ -311,15 +608,11 @@ int delfem2::MortonCode_FindSplit
   if (iMC_start == iMC_last) { return -1; }
   
   // ------------------------------
-  const int common_prefix = clz(sortedMC[iMC_start] ^ sortedMC[iMC_last]);
-  
-  //handle duplicated morton code
-  if (common_prefix == 32 ){ return iMC_start; } // sizeof(std::uint32_t)*8
+  const int common_prefix = delta(iMC_start, iMC_last, sortedMC, iMC_last+1);
   
   // Use binary search to find where the next bit differs.
   // Specifically, we are looking for the highest object that
   // shares more than commonPrefix bits with the first one.
-  const std::uint32_t mcStart = sortedMC[iMC_start];
   unsigned int iMC_split = iMC_start; // initial guess
   int step = iMC_last - iMC_start;
   do
@@ -328,8 +621,7 @@ int delfem2::MortonCode_FindSplit
     const unsigned int newSplit = iMC_split + step; // proposed new position
     if (newSplit < iMC_last)
     {
-      std::uint32_t splitCode = sortedMC[newSplit];
-      int splitPrefix = clz(mcStart ^ splitCode);
+      const int splitPrefix = delta(iMC_start, newSplit, sortedMC, iMC_last+1);
       if (splitPrefix > common_prefix){
         iMC_split = newSplit; // accept proposal
       }
@@ -339,28 +631,125 @@ int delfem2::MortonCode_FindSplit
   return iMC_split;
 }
 
+int delfem2::MortonCode_FindSplit
+ (const std::uint32_t* sortedMC,
+  unsigned int iMC_start,
+  unsigned int iMC_last)
+{
+  return MortonCode_FindSplit_Impl(sortedMC,iMC_start,iMC_last);
+}
 
+int delfem2::MortonCode_FindSplit
+ (const std::uint64_t* sortedMC,
+  unsigned int iMC_start,
+  unsigned int iMC_last)
+{
+  return MortonCode_FindSplit_Impl(sortedMC,iMC_start,iMC_last);
+}
+
+
+template <typename REAL>
+static std::uint32_t MortonCode_Bits(std::uint32_t, REAL x, REAL y, REAL z){
+  return dfm2::MortonCode(x,y,z);
+}
+
+template <typename REAL>
+static std::uint64_t MortonCode_Bits(std::uint64_t, REAL x, REAL y, REAL z){
+  return dfm2::MortonCode64(x,y,z);
+}
+
+template <typename MC>
 class CPairMtcInd{
 public:
-  std::uint32_t imtc;
+  MC imtc;
   unsigned int iobj;
 public:
-  bool operator < (const CPairMtcInd& rhs) const {
-    return (this->imtc < rhs.imtc);
+  bool operator < (const CPairMtcInd& rhs) const { // the same code is sorted by the index
+    if( this->imtc != rhs.imtc ){ return this->imtc < rhs.imtc; }
+    return this->iobj < rhs.iobj;
   }
 };
 
+/**
+ * stable LSD radix sort of the keys together with the values, 8 bits per pass.
+ * The pass is skipped if all the keys share the digit (e.g., the upper 2 bits of 30-bit Morton code).
+ * Each thread counts the digits in its range, then scatters its range to the offsets ordered by (digit,thread).
+ */
+template <typename KEY>
+static void RadixSort_KeyValue_Parallel(
+    std::vector<KEY>& aKey,
+    std::vector<unsigned int>& aVal,
+    unsigned int nthread)
+{
+  const unsigned int n = aKey.size();
+  assert( aVal.size() == n );
+  const unsigned int ngrain = 1u << 14; // don't use threads for small arrays
+  if( nthread > n/ngrain ){ nthread = n/ngrain; }
+  if( nthread == 0 ){ nthread = 1; }
+  std::vector<unsigned int> aSplit;
+  dfm2::SplitRange_Uniform(aSplit, nthread, n);
+  std::vector<KEY> aKeyTmp(n);
+  std::vector<unsigned int> aValTmp(n);
+  const unsigned int npass = sizeof(KEY);
+  std::vector<unsigned int> aOffset(nthread*256);
+  std::vector<int> aIsSkip(npass,0);
+  dfm2::CBarrier barrier(nthread);
+  dfm2::ParallelThread(nthread, [&](unsigned int ith){
+    KEY* pKey0 = aKey.data();
+    KEY* pKey1 = aKeyTmp.data();
+    unsigned int* pVal0 = aVal.data();
+    unsigned int* pVal1 = aValTmp.data();
+    unsigned int* pOff = aOffset.data()+ith*256;
+    const unsigned int is = aSplit[ith];
+    const unsigned int ie = aSplit[ith+1];
+    for(unsigned int ipass=0;ipass<npass;++ipass){
+      const unsigned int ishift = ipass*8;
+      for(unsigned int idigit=0;idigit<256;++idigit){ pOff[idigit] = 0; }
+      for(unsigned int i=is;i<ie;++i){ pOff[(pKey0[i]>>ishift)&0xff] += 1; }
+      barrier.Wait();
+      if( ith == 0 ){ // exclusive prefix sum in the order of (digit,thread)
+        unsigned int isum = 0;
+        for(unsigned int idigit=0;idigit<256;++idigit){
+          const unsigned int isum0 = isum;
+          for(unsigned int jth=0;jth<nthread;++jth){
+            const unsigned int icnt = aOffset[jth*256+idigit];
+            aOffset[jth*256+idigit] = isum;
+            isum += icnt;
+          }
+          if( isum - isum0 == n ){ aIsSkip[ipass] = 1; }
+        }
+      }
+      barrier.Wait();
+      if( aIsSkip[ipass] ){ continue; }
+      for(unsigned int i=is;i<ie;++i){
+        const unsigned int j = pOff[(pKey0[i]>>ishift)&0xff]++;
+        pKey1[j] = pKey0[i];
+        pVal1[j] = pVal0[i];
+      }
+      barrier.Wait();
+      std::swap(pKey0,pKey1);
+      std::swap(pVal0,pVal1);
+    }
+  });
+  unsigned int nscatter = 0;
+  for(unsigned int ipass=0;ipass<npass;++ipass){ if( !aIsSkip[ipass] ){ nscatter++; } }
+  if( nscatter % 2 == 1 ){
+    aKey.swap(aKeyTmp);
+    aVal.swap(aValTmp);
+  }
+}
+
 
 
-template <typename REAL>
-void dfm2::SortedMortenCode_Points3(
+template <typename MC, typename REAL>
+static void SortedMortenCode_Points3_Impl(
     std::vector<unsigned int> &aSortedId,
-    std::vector<std::uint32_t> &aSortedMc,
+    std::vector<MC> &aSortedMc,
     const std::vector<REAL> &aXYZ,
     const REAL min_xyz[3],
     const REAL max_xyz[3])
 {
-  std::vector<CPairMtcInd> aNodeBVH; // array of BVH node
+  std::vector< CPairMtcInd<MC> > aNodeBVH; // array of BVH node
   const std::size_t np = aXYZ.size()/3;
   aNodeBVH.resize(np);
   const REAL x_min = min_xyz[0];
@@ -373,7 +762,7 @@ void dfm2::SortedMortenCode_Points3(
     const REAL x = (aXYZ[ip*3+0]-x_min)/(x_max-x_min);
     const REAL y = (aXYZ[ip*3+1]-y_min)/(y_max-y_min);
     const REAL z = (aXYZ[ip*3+2]-z_min)/(z_max-z_min);
-    aNodeBVH[ip].imtc = dfm2::MortonCode(x,y,z);
+    aNodeBVH[ip].imtc = MortonCode_Bits(MC(0),x,y,z);
     aNodeBVH[ip].iobj = ip;
   }
   std::sort(aNodeBVH.begin(), aNodeBVH.end());
@@ -385,6 +774,17 @@ void dfm2::SortedMortenCode_Points3(
       //        std::cout << std::bitset<32>(aNodeBVH[ino].imtc) << "  " << clz(aNodeBVH[ino].imtc) << "   " << ino << std::endl;
   }
 }
+
+template <typename REAL>
+void dfm2::SortedMortenCode_Points3(
+    std::vector<unsigned int> &aSortedId,
+    std::vector<std::uint32_t> &aSortedMc,
+    const std::vector<REAL> &aXYZ,
+    const REAL min_xyz[3],
+    const REAL max_xyz[3])
+{
+  SortedMortenCode_Points3_Impl(aSortedId,aSortedMc,aXYZ,min_xyz,max_xyz);
+}
 template void dfm2::SortedMortenCode_Points3(
     std::vector<unsigned int>& aSortedId,
     std::vector<std::uint32_t>& aSortedMc,
@@ -398,62 +798,223 @@ template void dfm2::SortedMortenCode_Points3(
     const double min_xyz[3],
     const double max_xyz[3]);
 
+template <typename REAL>
+void dfm2::SortedMortenCode_Points3(
+    std::vector<unsigned int> &aSortedId,
+    std::vector<std::uint64_t> &aSortedMc,
+    const std::vector<REAL> &aXYZ,
+    const REAL min_xyz[3],
+    const REAL max_xyz[3])
+{
+  SortedMortenCode_Points3_Impl(aSortedId,aSortedMc,aXYZ,min_xyz,max_xyz);
+}
+template void dfm2::SortedMortenCode_Points3(
+    std::vector<unsigned int>& aSortedId,
+    std::vector<std::uint64_t>& aSortedMc,
+    const std::vector<float>& aXYZ,
+    const float min_xyz[3],
+    const float max_xyz[3]);
+template void dfm2::SortedMortenCode_Points3(
+    std::vector<unsigned int>& aSortedId,
+    std::vector<std::uint64_t>& aSortedMc,
+    const std::vector<double>& aXYZ,
+    const double min_xyz[3],
+    const double max_xyz[3]);
+
+template <typename MC, typename REAL>
+static void SortedMortenCode_Points3_Parallel_Impl(
+    std::vector<unsigned int> &aSortedId,
+    std::vector<MC> &aSortedMc,
+    const std::vector<REAL> &aXYZ,
+    const REAL min_xyz[3],
+    const REAL max_xyz[3],
+    unsigned int nthread)
+{
+  const unsigned int np = aXYZ.size()/3;
+  aSortedId.resize(np);
+  aSortedMc.resize(np);
+  std::vector<unsigned int> aSplit;
+  dfm2::SplitRange_Uniform(aSplit, nthread, np);
+  dfm2::ParallelThread(aSplit.size()-1, [&](unsigned int ith){
+    for(unsigned int ip=aSplit[ith];ip<aSplit[ith+1];++ip){
+      const REAL x = (aXYZ[ip*3+0]-min_xyz[0])/(max_xyz[0]-min_xyz[0]);
+      const REAL y = (aXYZ[ip*3+1]-min_xyz[1])/(max_xyz[1]-min_xyz[1]);
+      const REAL z = (aXYZ[ip*3+2]-min_xyz[2])/(max_xyz[2]-min_xyz[2]);
+      aSortedMc[ip] = MortonCode_Bits(MC(0),x,y,z);
+      aSortedId[ip] = ip;
+    }
+  });
+  RadixSort_KeyValue_Parallel(aSortedMc, aSortedId, nthread);
+}
+
+template <typename REAL>
+void dfm2::SortedMortenCode_Points3_Parallel(
+    std::vector<unsigned int> &aSortedId,
+    std::vector<std::uint32_t> &aSortedMc,
+    const std::vector<REAL> &aXYZ,
+    const REAL min_xyz[3],
+    const REAL max_xyz[3],
+    unsigned int nthread)
+{
+  SortedMortenCode_Points3_Parallel_Impl(aSortedId,aSortedMc,aXYZ,min_xyz,max_xyz,nthread);
+}
+template void dfm2::SortedMortenCode_Points3_Parallel(
+    std::vector<unsigned int>& aSortedId,
+    std::vector<std::uint32_t>& aSortedMc,
+    const std::vector<float>& aXYZ,
+    const float min_xyz[3],
+    const float max_xyz[3],
+    unsigned int nthread);
+template void dfm2::SortedMortenCode_Points3_Parallel(
+    std::vector<unsigned int>& aSortedId,
+    std::vector<std::uint32_t>& aSortedMc,
+    const std::vector<double>& aXYZ,
+    const double min_xyz[3],
+    const double max_xyz[3],
+    unsigned int nthread);
+
+template <typename REAL>
+void dfm2::SortedMortenCode_Points3_Parallel(
+    std::vector<unsigned int> &aSortedId,
+    std::vector<std::uint64_t> &aSortedMc,
+    const std::vector<REAL> &aXYZ,
+    const REAL min_xyz[3],
+    const REAL max_xyz[3],
+    unsigned int nthread)
+{
+  SortedMortenCode_Points3_Parallel_Impl(aSortedId,aSortedMc,aXYZ,min_xyz,max_xyz,nthread);
+}
+template void dfm2::SortedMortenCode_Points3_Parallel(
+    std::vector<unsigned int>& aSortedId,
+    std::vector<std::uint64_t>& aSortedMc,
+    const std::vector<float>& aXYZ,
+    const float min_xyz[3],
+    const float max_xyz[3],
+    unsigned int nthread);
+template void dfm2::SortedMortenCode_Points3_Parallel(
+    std::vector<unsigned int>& aSortedId,
+    std::vector<std::uint64_t>& aSortedMc,
+    const std::vector<double>& aXYZ,
+    const double min_xyz[3],
+    const double max_xyz[3],
+    unsigned int nthread);
+
 // ----------------------------------
 
-void dfm2::BVHTopology_Morton
-(std::vector<dfm2::CNodeBVH2>& aNodeBVH,
- const std::vector<unsigned int>& aSortedId,
- const std::vector<unsigned int>& aSortedMc)
+/**
+ * set the children of the internal node ini. Only ini and its children are written.
+ */
+template <typename MC>
+static void SetInternalNode_Morton(
+    std::vector<dfm2::CNodeBVH2>& aNodeBVH,
+    unsigned int ini,
+    const std::vector<unsigned int>& aSortedId,
+    const std::vector<MC>& aSortedMc)
+{
+  const unsigned int nni = aSortedMc.size()-1; // number of internal node
+  const std::pair<int,int> range = dfm2::MortonCode_DeterminRange(aSortedMc.data(), aSortedMc.size(), ini);
+  int isplit = dfm2::MortonCode_FindSplit(aSortedMc.data(), range.first, range.second);
+  assert( isplit != -1 );
+  if( range.first == isplit ){
+    const int inlA = nni+isplit;
+    aNodeBVH[ini].ichild[0] = inlA;
+    aNodeBVH[inlA].iroot = ini;
+    aNodeBVH[inlA].ichild[0] = aSortedId[isplit];
+    aNodeBVH[inlA].ichild[1] = -1;
+  }
+  else{
+    const int iniA = isplit;
+    aNodeBVH[ini].ichild[0] = iniA;
+    aNodeBVH[iniA].iroot = ini;
+  }
+  // ----
+  if( range.second == isplit+1 ){
+    const int inlB = nni+isplit+1;
+    aNodeBVH[ini].ichild[1] = inlB;
+    aNodeBVH[inlB].iroot = ini;
+    aNodeBVH[inlB].ichild[0] = aSortedId[isplit+1];
+    aNodeBVH[inlB].ichild[1] = -1;
+  }
+  else{
+    const int iniB = isplit+1;
+    aNodeBVH[ini].ichild[1] = iniB;
+    aNodeBVH[iniB].iroot = ini;
+  }
+}
+
+template <typename MC>
+static void BVHTopology_Morton_Impl(
+    std::vector<dfm2::CNodeBVH2>& aNodeBVH,
+    const std::vector<unsigned int>& aSortedId,
+    const std::vector<MC>& aSortedMc,
+    unsigned int nthread)
 {
+  assert( !aSortedMc.empty() && aSortedId.size() == aSortedMc.size() );
   aNodeBVH.resize(aSortedMc.size()*2-1);
   aNodeBVH[0].iroot = -1;
+  if( aSortedMc.size() == 1 ){ // the root is the leaf
+    aNodeBVH[0].ichild[0] = aSortedId[0];
+    aNodeBVH[0].ichild[1] = -1;
+    return;
+  }
   const unsigned int nni = aSortedMc.size()-1; // number of internal node
-  for(unsigned int ini=0;ini<nni;++ini){
-    const std::pair<int,int> range = dfm2::MortonCode_DeterminRange(aSortedMc.data(), aSortedMc.size(), ini);
-    int isplit = dfm2::MortonCode_FindSplit(aSortedMc.data(), range.first, range.second);
-    assert( isplit != -1 );
-    if( range.first == isplit ){
-      const int inlA = nni+isplit;
-      aNodeBVH[ini].ichild[0] = inlA;
-      aNodeBVH[inlA].iroot = ini;
-      aNodeBVH[inlA].ichild[0] = aSortedId[isplit];
-      aNodeBVH[inlA].ichild[1] = -1;
+  std::vector<unsigned int> aSplit;
+  dfm2::SplitRange_Uniform(aSplit, nthread, nni);
+  dfm2::ParallelThread(aSplit.size()-1, [&](unsigned int ith){
+    for(unsigned int ini=aSplit[ith];ini<aSplit[ith+1];++ini){
+      SetInternalNode_Morton(aNodeBVH, ini, aSortedId, aSortedMc);
     }
-    else{
-      const int iniA = isplit;
-      aNodeBVH[ini].ichild[0] = iniA;
-      aNodeBVH[iniA].iroot = ini;
-    }
-    // ----
-    if( range.second == isplit+1 ){
-      const int inlB = nni+isplit+1;
-      aNodeBVH[ini].ichild[1] = inlB;
-      aNodeBVH[inlB].iroot = ini;
-      aNodeBVH[inlB].ichild[0] = aSortedId[isplit+1];
-      aNodeBVH[inlB].ichild[1] = -1;
-    }
-    else{
-      const int iniB = isplit+1;
-      aNodeBVH[ini].ichild[1] = iniB;
-      aNodeBVH[iniB].iroot = ini;
-    }
-  }
+  });
 }
 
+void dfm2::BVHTopology_Morton
+(std::vector<dfm2::CNodeBVH2>& aNodeBVH,
+ const std::vector<unsigned int>& aSortedId,
+ const std::vector<std::uint32_t>& aSortedMc)
+{
+  BVHTopology_Morton_Impl(aNodeBVH, aSortedId, aSortedMc, 1);
+}
 
-void dfm2::Check_MortonCode_Sort
-(const std::vector<unsigned int>& aSortedId,
+void dfm2::BVHTopology_Morton
+(std::vector<dfm2::CNodeBVH2>& aNodeBVH,
+ const std::vector<unsigned int>& aSortedId,
+ const std::vector<std::uint64_t>& aSortedMc)
+{
+  BVHTopology_Morton_Impl(aNodeBVH, aSortedId, aSortedMc, 1);
+}
+
+void dfm2::BVHTopology_Morton_Parallel
+(std::vector<dfm2::CNodeBVH2>& aNodeBVH,
+ const std::vector<unsigned int>& aSortedId,
  const std::vector<std::uint32_t>& aSortedMc,
- const std::vector<double> aXYZ,
+ unsigned int nthread)
+{
+  BVHTopology_Morton_Impl(aNodeBVH, aSortedId, aSortedMc, nthread);
+}
+
+void dfm2::BVHTopology_Morton_Parallel
+(std::vector<dfm2::CNodeBVH2>& aNodeBVH,
+ const std::vector<unsigned int>& aSortedId,
+ const std::vector<std::uint64_t>& aSortedMc,
+ unsigned int nthread)
+{
+  BVHTopology_Morton_Impl(aNodeBVH, aSortedId, aSortedMc, nthread);
+}
+
+template <typename MC>
+static void Check_MortonCode_Sort_Impl
+(const std::vector<unsigned int>& aSortedId,
+ const std::vector<MC>& aSortedMc,
+ const std::vector<double>& aXYZ,
  const double bbmin[3], const double bbmax[3])
 {
   for(unsigned int imc=1;imc<aSortedMc.size();++imc){
-    std::uint32_t mc0 = aSortedMc[imc-1];
-    std::uint32_t mc1 = aSortedMc[imc+0];
+    MC mc0 = aSortedMc[imc-1];
+    MC mc1 = aSortedMc[imc+0];
     assert( mc0 <= mc1 );
   }
   for(unsigned int imc=0;imc<aSortedMc.size();++imc){
-    std::uint32_t mc0 = aSortedMc[imc];
+    MC mc0 = aSortedMc[imc];
     unsigned int ip = aSortedId[imc];
     double x0 = aXYZ[ip*3+0];
     double y0 = aXYZ[ip*3+1];
@@ -461,7 +1022,7 @@ void dfm2::Check_MortonCode_Sort
     double x1 = (x0-bbmin[0])/(bbmax[0]-bbmin[0]);
     double y1 = (y0-bbmin[1])/(bbmax[1]-bbmin[1]);
     double z1 = (z0-bbmin[2])/(bbmax[2]-bbmin[2]);
-    std::uint32_t mc1 = dfm2::MortonCode(x1,y1,z1);
+    MC mc1 = MortonCode_Bits(MC(0),x1,y1,z1);
     assert( mc0 == mc1 );
   }
   /*
@@ -472,8 +1033,27 @@ void dfm2::Check_MortonCode_Sort
    */
 }
 
-void dfm2::Check_MortonCode_RangeSplit
-(const std::vector<std::uint32_t>& aSortedMc)
+void dfm2::Check_MortonCode_Sort
+(const std::vector<unsigned int>& aSortedId,
+ const std::vector<std::uint32_t>& aSortedMc,
+ const std::vector<double> aXYZ,
+ const double bbmin[3], const double bbmax[3])
+{
+  Check_MortonCode_Sort_Impl(aSortedId,aSortedMc,aXYZ,bbmin,bbmax);
+}
+
+void dfm2::Check_MortonCode_Sort
+(const std::vector<unsigned int>& aSortedId,
+ const std::vector<std::uint64_t>& aSortedMc,
+ const std::vector<double> aXYZ,
+ const double bbmin[3], const double bbmax[3])
+{
+  Check_MortonCode_Sort_Impl(aSortedId,aSortedMc,aXYZ,bbmin,bbmax);
+}
+
+template <typename MC>
+static void Check_MortonCode_RangeSplit_Impl
+(const std::vector<MC>& aSortedMc)
 {
   assert(aSortedMc.size()>0);
   for(unsigned int ini=0;ini<aSortedMc.size()-1;++ini){
@@ -491,6 +1071,18 @@ void dfm2::Check_MortonCode_RangeSplit
   }
 }
 
+void dfm2::Check_MortonCode_RangeSplit
+(const std::vector<std::uint32_t>& aSortedMc)
+{
+  Check_MortonCode_RangeSplit_Impl(aSortedMc);
+}
+
+void dfm2::Check_MortonCode_RangeSplit
+(const std::vector<std::uint64_t>& aSortedMc)
+{
+  Check_MortonCode_RangeSplit_Impl(aSortedMc);
+}
+
 static void mark_child(std::vector<int>& aFlg,
                 unsigned int inode0,
                 const std::vector<dfm2::CNodeBVH2>& aNode)
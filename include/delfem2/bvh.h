@@ -11,8 +11,13 @@
 #include <stack>
 #include <vector>
 #include <set>
+#include <utility>
 #include <assert.h>
 #include <iostream>
+#include <atomic>
+#include <cstdint>
+
+#include "delfem2/thread.h"
 
 namespace delfem2 {
 
@@ -35,6 +40,22 @@ int BVHTopology_TopDown_MeshElem(
     const std::vector<int>& aElemSur,
     const std::vector<double>& aElemCenter);
 
+/**
+ * @brief make BVH topology in a top-down manner with the binned surface area heuristic (SAH)
+ * @details The elements are split where the sum of (surface area of the box) x (number of elements) of the children
+ * is minimum among the planes between the bins along the axes. Each leaf has one element as in the other topologies.
+ * The nodes are in the depth-first order (the subtree with n elements occupies 2n-1 consecutive nodes),
+ * so the output does not depend on nthread. The large nodes near the root are binned with multiple threads and
+ * the subtrees below them are built concurrently.
+ * Use this for the static geometries queried many times (e.g., ray casting).
+ * @return index of the root node (always 0)
+ */
+int BVHTopology_SAH_MeshElem(
+    std::vector<CNodeBVH2>& aNodeBVH,
+    const double* aXYZ, unsigned int nXYZ,
+    const unsigned int* aElem, unsigned int nnoel, unsigned int nElem,
+    unsigned int nthread);
+
 /**
  * @details check if the leaf is visited once
  */
@@ -48,21 +69,36 @@ void Check_BVH(
 
 /**
  * @returns return -1 if start == last
- * @details find split in BVH construction
+ * @details find split in BVH construction. The equal codes are distinguished by their indices (Karras 2012)
  * https://devblogs.nvidia.com/thinking-parallel-part-iii-tree-construction-gpu/
  */
 int MortonCode_FindSplit(const std::uint32_t* sortedMC,
               unsigned int start,
               unsigned int last);
+
+/**
+ * @details 64-bit version of the above
+ */
+int MortonCode_FindSplit(const std::uint64_t* sortedMC,
+              unsigned int start,
+              unsigned int last);
   
 /**
- * @details find range in parallel BVH construction
+ * @details find range in parallel BVH construction. The equal codes are distinguished by their indices (Karras 2012),
+ * so the tree is balanced for the points sharing the same code.
  * https://devblogs.nvidia.com/thinking-parallel-part-iii-tree-construction-gpu/
  */
 std::pair<int,int> MortonCode_DeterminRange(const std::uint32_t* sortedMC,
                                   int nMC,
                                   int i);
 
+/**
+ * @details 64-bit version of the above
+ */
+std::pair<int,int> MortonCode_DeterminRange(const std::uint64_t* sortedMC,
+                                  int nMC,
+                                  int i);
+
 /**
  * @brief compute morton code for 3d coordinates of a point. Each coordinate must be within the range of [0,1]
  * @details defined for "float" and "double"
@@ -71,6 +107,14 @@ std::pair<int,int> MortonCode_DeterminRange(const std::uint32_t* sortedMC,
 template <typename REAL>
 std::uint32_t MortonCode(REAL x, REAL y, REAL z);
 
+/**
+ * @brief 63-bit morton code (21 bits for each axis) for 3d coordinates of a point within the range of [0,1]
+ * @details use this for large or clustered point sets where the 30-bit code has many duplicates.
+ * defined for "float" and "double"
+ */
+template <typename REAL>
+std::uint64_t MortonCode64(REAL x, REAL y, REAL z);
+
 
 /**
  * @details defined for "float" and "double"
@@ -82,15 +126,78 @@ void SortedMortenCode_Points3(
     const std::vector<REAL> &aXYZ,
     const REAL min_xyz[3],
     const REAL max_xyz[3]);
+
+/**
+ * @details 64-bit version of the above. The codes are computed with MortonCode64
+ */
+template <typename REAL>
+void SortedMortenCode_Points3(
+    std::vector<unsigned int> &aSortedId,
+    std::vector<std::uint64_t> &aSortedMc,
+    const std::vector<REAL> &aXYZ,
+    const REAL min_xyz[3],
+    const REAL max_xyz[3]);
+
+/**
+ * @brief multi-threaded version of SortedMortenCode_Points3
+ * @details the codes are sorted with the stable LSD radix sort (8 bits per pass).
+ * The points with the same code are sorted by their indices, so the output is the same as SortedMortenCode_Points3.
+ * defined for "float" and "double"
+ */
+template <typename REAL>
+void SortedMortenCode_Points3_Parallel(
+    std::vector<unsigned int> &aSortedId,
+    std::vector<unsigned int> &aSortedMc,
+    const std::vector<REAL> &aXYZ,
+    const REAL min_xyz[3],
+    const REAL max_xyz[3],
+    unsigned int nthread);
+
+template <typename REAL>
+void SortedMortenCode_Points3_Parallel(
+    std::vector<unsigned int> &aSortedId,
+    std::vector<std::uint64_t> &aSortedMc,
+    const std::vector<REAL> &aXYZ,
+    const REAL min_xyz[3],
+    const REAL max_xyz[3],
+    unsigned int nthread);
   
+/**
+ * @details the leaves are the nodes [nMC-1,2*nMC-1) in the sorted order. The root (node 0) is the leaf if nMC==1
+ */
+void BVHTopology_Morton(
+    std::vector<CNodeBVH2>& aNodeBVH,
+    const std::vector<unsigned int>& aSortedId,
+    const std::vector<std::uint32_t>& aSortedMc);
+
 void BVHTopology_Morton(
     std::vector<CNodeBVH2>& aNodeBVH,
     const std::vector<unsigned int>& aSortedId,
-    const std::vector<unsigned int>& aSortedMc);
+    const std::vector<std::uint64_t>& aSortedMc);
+
+/**
+ * @brief multi-threaded version of BVHTopology_Morton
+ * @details the internal nodes are independent of each other (Karras 2012), so they are constructed concurrently.
+ * The output is the same as BVHTopology_Morton.
+ */
+void BVHTopology_Morton_Parallel(
+    std::vector<CNodeBVH2>& aNodeBVH,
+    const std::vector<unsigned int>& aSortedId,
+    const std::vector<std::uint32_t>& aSortedMc,
+    unsigned int nthread);
+
+void BVHTopology_Morton_Parallel(
+    std::vector<CNodeBVH2>& aNodeBVH,
+    const std::vector<unsigned int>& aSortedId,
+    const std::vector<std::uint64_t>& aSortedMc,
+    unsigned int nthread);
 
 void Check_MortonCode_RangeSplit(
     const std::vector<std::uint32_t>& aSortedMc);
 
+void Check_MortonCode_RangeSplit(
+    const std::vector<std::uint64_t>& aSortedMc);
+
 void Check_MortonCode_Sort(
     const std::vector<unsigned int>& aSortedId,
     const std::vector<std::uint32_t>& aSortedMc,
@@ -98,6 +205,13 @@ void Check_MortonCode_Sort(
     const double bbmin[3],
     const double bbmax[3]);
 
+void Check_MortonCode_Sort(
+    const std::vector<unsigned int>& aSortedId,
+    const std::vector<std::uint64_t>& aSortedMc,
+    const std::vector<double> aXYZ,
+    const double bbmin[3],
+    const double bbmax[3]);
+
 // above: code related to morton code
 // -------------------------------------------------------------------
 // below: template functions from here
@@ -114,6 +228,20 @@ void BVH_BuildBVHGeometry_Mesh(
     const REAL* aXYZ, unsigned int nXYZ,
     const unsigned int* aElem, unsigned int nnoel, unsigned int nElem);
 
+/**
+ * @brief multi-threaded version of BVH_BuildBVHGeometry_Mesh for the whole tree
+ * @details the bounding volumes are computed bottom-up. The leaves are processed concurrently and
+ * the thread reaching a branch node second (counted with an atomic counter) merges its children and goes up.
+ * The result is the same as BVH_BuildBVHGeometry_Mesh from the root node.
+ */
+template <typename BBOX, typename REAL>
+void BVH_BuildBVHGeometry_Mesh_Parallel(
+    std::vector<BBOX>& aBB,
+    const std::vector<CNodeBVH2>& aNodeBVH,
+    REAL margin,
+    const REAL* aXYZ, unsigned int nXYZ,
+    const unsigned int* aElem, unsigned int nnoel, unsigned int nElem,
+    unsigned int nthread);
 
 /**
  * @brief build geometry of BVH for point set
@@ -136,6 +264,20 @@ void BVH_BuildGeometryBranch(
     int ibvh_root,
     const std::vector<delfem2::CNodeBVH2>& aNodeBVH);
 
+/**
+ * @brief cost of the tree with the surface area heuristic (SAH) to compare the quality of the BVH builders
+ * @details sum of cost_node*SA(n)/SA(root) for the branch nodes and cost_elem*SA(n)/SA(root) for the leaves under ibvh_root,
+ * i.e., the expected number of the node tests and the element tests for a random ray hitting the root.
+ * The surface area is computed with BBOX::SurfaceArea().
+ */
+template <typename BBOX>
+double BVH_CostSAH(
+    int ibvh_root,
+    const std::vector<CNodeBVH2>& aNodeBVH,
+    const std::vector<BBOX>& aBB,
+    double cost_node = 1.0,
+    double cost_elem = 1.0);
+
 template <typename BBOX>
 void BuildBoundingBoxesBVH_Dynamic(
     int ibvh,
@@ -145,7 +287,44 @@ void BuildBoundingBoxesBVH_Dynamic(
     const std::vector<unsigned int>& aTri,
     const std::vector<CNodeBVH2>& aNodeBVH,
     std::vector<BBOX>& aBB);
-  
+
+/**
+ * @brief size of the fixed-size stack of the traversals below
+ * @details the stack holds at most (depth of the tree) nodes. A deeper subtree is traversed with a new stack.
+ */
+const unsigned int BVH_NSTACK = 128;
+
+/**
+ * @brief depth-first traversal of the BVH under ibvh_root without the recursion and the heap allocation
+ * @details the nodes are visited in the same order as the recursive queries (ichild[0] before ichild[1]).
+ * on_leaf is called right after is_enter returned true for the leaf, so the values computed in is_enter can be reused.
+ * @param is_enter is_enter(ibvh) returns true if the node ibvh (e.g., its bounding volume) hits the query
+ * @param on_leaf on_leaf(ielem) is called for the element of the entered leaf. Return false to stop (e.g., at the first hit)
+ * @return false if the traversal is stopped by on_leaf
+ */
+template <typename FUNC_ENTER, typename FUNC_LEAF>
+bool BVH_Traverse(
+    int ibvh_root,
+    const std::vector<CNodeBVH2>& aBVH,
+    FUNC_ENTER&& is_enter,
+    FUNC_LEAF&& on_leaf);
+
+/**
+ * @brief nearest-first traversal of the BVH under ibvh_root for the closest-hit queries (no recursion, no heap allocation)
+ * @details the nearer child is visited first and the nodes farther than dist_cur are skipped.
+ * @param dist_cur (in/out) distance to the current closest hit. Input a negative value if there is no hit yet
+ * @param dist_bv dist_bv(ibvh) returns the lower bound of the distance to the elements under ibvh. Negative value to skip the node
+ * @param on_leaf on_leaf(ielem, dist_leaf, dist_cur) is called for the element of the leaf not farther than dist_cur.
+ * dist_leaf is dist_bv of the leaf. Update dist_cur if the element is nearer.
+ */
+template <typename REAL, typename FUNC_DIST, typename FUNC_LEAF>
+void BVH_TraverseNearest(
+    REAL& dist_cur,
+    int ibvh_root,
+    const std::vector<CNodeBVH2>& aBVH,
+    FUNC_DIST&& dist_bv,
+    FUNC_LEAF&& on_leaf);
+
 template <typename BBOX>
 void BVH_GetIndElem_IncludePoint(
     std::vector<int>& aIndElem,
@@ -257,6 +436,55 @@ void delfem2::BVH_BuildBVHGeometry_Mesh(
   return;
 }
 
+template <typename BBOX, typename REAL>
+void delfem2::BVH_BuildBVHGeometry_Mesh_Parallel(
+    std::vector<BBOX>& aBB,
+    const std::vector<delfem2::CNodeBVH2>& aNodeBVH,
+    REAL margin,
+    const REAL* aXYZ, unsigned int nXYZ,
+    const unsigned int* aElem, unsigned int nnoel, unsigned int nElem,
+    unsigned int nthread)
+{
+  const unsigned int nnode = aNodeBVH.size();
+  aBB.resize(nnode);
+  // number of the children visited so far
+  std::vector< std::atomic<unsigned int> > aNVisit(nnode);
+  // the nodes are handed out in blocks because the leaves may be gathered (e.g., at the end for the Morton code)
+  const unsigned int nblk_node = 1024;
+  const unsigned int nblk = (nnode+nblk_node-1)/nblk_node;
+  std::atomic<unsigned int> iblk_next(0);
+  ParallelThread(nthread, [&](unsigned int){
+    for(;;){
+      const unsigned int iblk = iblk_next.fetch_add(1);
+      if( iblk >= nblk ){ break; }
+      const unsigned int inode_end = (iblk+1)*nblk_node < nnode ? (iblk+1)*nblk_node : nnode;
+      for(unsigned int inode=iblk*nblk_node;inode<inode_end;++inode){
+        if( aNodeBVH[inode].ichild[1] != -1 ){ continue; } // branch
+        const unsigned int ielem = aNodeBVH[inode].ichild[0];
+        assert( ielem < nElem );
+        BBOX& bb = aBB[inode];
+        bb.Set_Inactive();
+        for(unsigned int inoel=0;inoel<nnoel;++inoel){
+          const unsigned int ino0 = aElem[ielem*nnoel+inoel];
+          assert( ino0 < nXYZ );
+          bb.AddPoint(aXYZ+ino0*3, margin);
+        }
+        // go up while this thread is the second one visiting the branch
+        int ibvh = aNodeBVH[inode].iroot;
+        while( ibvh != -1 ){
+          if( aNVisit[ibvh].fetch_add(1,std::memory_order_acq_rel) == 0 ){ break; }
+          const int ichild0 = aNodeBVH[ibvh].ichild[0];
+          const int ichild1 = aNodeBVH[ibvh].ichild[1];
+          BBOX& bbp = aBB[ibvh];
+          bbp  = aBB[ichild0];
+          bbp += aBB[ichild1];
+          ibvh = aNodeBVH[ibvh].iroot;
+        }
+      }
+    }
+  });
+}
+
 template <typename BBOX, typename REAL>
 void delfem2::BVHGeometry_Points(
     std::vector<BBOX>& aBB,
@@ -311,6 +539,35 @@ void delfem2::BVH_BuildGeometryBranch(
   return;
 }
 
+template <typename BBOX>
+double delfem2::BVH_CostSAH(
+    int ibvh_root,
+    const std::vector<delfem2::CNodeBVH2>& aNodeBVH,
+    const std::vector<BBOX>& aBB,
+    double cost_node,
+    double cost_elem)
+{
+  assert( aBB.size() == aNodeBVH.size() );
+  const double area_root = aBB[ibvh_root].SurfaceArea();
+  if( area_root <= 0 ){ return 0.0; }
+  double cost = 0.0;
+  std::stack<int> stack;
+  stack.push(ibvh_root);
+  while( !stack.empty() ){
+    const int ibvh = stack.top();
+    stack.pop();
+    const double ratio = aBB[ibvh].SurfaceArea()/area_root;
+    if( aNodeBVH[ibvh].ichild[1] == -1 ){ // leaf
+      cost += cost_elem*ratio;
+      continue;
+    }
+    cost += cost_node*ratio;
+    stack.push(aNodeBVH[ibvh].ichild[0]);
+    stack.push(aNodeBVH[ibvh].ichild[1]);
+  }
+  return cost;
+}
+
 /*
 // build Bounding Box for AABB
 template <typename BBOX>
@@ -399,6 +656,86 @@ void delfem2::BuildBoundingBoxesBVH_Dynamic
 // -------------------------------------------------
 
 
+template <typename FUNC_ENTER, typename FUNC_LEAF>
+bool delfem2::BVH_Traverse(
+    int ibvh_root,
+    const std::vector<delfem2::CNodeBVH2>& aBVH,
+    FUNC_ENTER&& is_enter,
+    FUNC_LEAF&& on_leaf)
+{
+  assert( ibvh_root >= 0 && ibvh_root < (int)aBVH.size() );
+  int aStack[BVH_NSTACK];
+  unsigned int nstack = 0;
+  int ibvh = ibvh_root;
+  for(;;){
+    if( is_enter(ibvh) ){
+      const int ichild0 = aBVH[ibvh].ichild[0];
+      const int ichild1 = aBVH[ibvh].ichild[1];
+      if( ichild1 == -1 ){ // leaf
+        if( !on_leaf(ichild0) ){ return false; }
+      }
+      else if( nstack < BVH_NSTACK ){ // go down to ichild0 and visit ichild1 later
+        aStack[nstack++] = ichild1;
+        ibvh = ichild0;
+        continue;
+      }
+      else{ // the stack is full. visit the children with a new stack
+        if( !BVH_Traverse(ichild0, aBVH, is_enter, on_leaf) ){ return false; }
+        if( !BVH_Traverse(ichild1, aBVH, is_enter, on_leaf) ){ return false; }
+      }
+    }
+    if( nstack == 0 ){ break; }
+    ibvh = aStack[--nstack];
+  }
+  return true;
+}
+
+template <typename REAL, typename FUNC_DIST, typename FUNC_LEAF>
+void delfem2::BVH_TraverseNearest(
+    REAL& dist_cur,
+    int ibvh_root,
+    const std::vector<delfem2::CNodeBVH2>& aBVH,
+    FUNC_DIST&& dist_bv,
+    FUNC_LEAF&& on_leaf)
+{
+  assert( ibvh_root >= 0 && ibvh_root < (int)aBVH.size() );
+  int aStackNode[BVH_NSTACK];
+  REAL aStackDist[BVH_NSTACK];
+  unsigned int nstack = 0;
+  {
+    const REAL d0 = dist_bv(ibvh_root);
+    if( d0 < 0 ){ return; }
+    aStackNode[0] = ibvh_root;
+    aStackDist[0] = d0;
+    nstack = 1;
+  }
+  while( nstack > 0 ){
+    --nstack;
+    const int ibvh = aStackNode[nstack];
+    const REAL dist = aStackDist[nstack];
+    if( dist_cur >= 0 && dist > dist_cur ){ continue; } // farther than the current closest hit
+    int ichild0 = aBVH[ibvh].ichild[0];
+    int ichild1 = aBVH[ibvh].ichild[1];
+    if( ichild1 == -1 ){ // leaf
+      on_leaf(ichild0, dist, dist_cur);
+      continue;
+    }
+    REAL d0 = dist_bv(ichild0);
+    REAL d1 = dist_bv(ichild1);
+    if( d1 >= 0 && ( d0 < 0 || d1 < d0 ) ){ // ichild0 is the nearer child
+      std::swap(ichild0,ichild1);
+      std::swap(d0,d1);
+    }
+    if( nstack+2 > BVH_NSTACK ){ // the stack is full. visit the children with a new stack
+      if( d0 >= 0 ){ BVH_TraverseNearest(dist_cur, ichild0, aBVH, dist_bv, on_leaf); }
+      if( d1 >= 0 ){ BVH_TraverseNearest(dist_cur, ichild1, aBVH, dist_bv, on_leaf); }
+      continue;
+    }
+    if( d1 >= 0 ){ aStackNode[nstack] = ichild1; aStackDist[nstack] = d1; ++nstack; }
+    if( d0 >= 0 ){ aStackNode[nstack] = ichild0; aStackDist[nstack] = d0; ++nstack; }
+  }
+}
+
 template <typename BBOX>
 void delfem2::BVH_GetIndElem_IncludePoint
 (std::vector<int>& aIndElem,
@@ -408,15 +745,9 @@ void delfem2::BVH_GetIndElem_IncludePoint
  const std::vector<delfem2::CNodeBVH2>& aBVH,
  const std::vector<BBOX>& aBB)
 {
-  if( !aBB[ibvh].isInclude_Point(px,py,pz) ){ return; }
-  const int ichild0 = aBVH[ibvh].ichild[0];
-  const int ichild1 = aBVH[ibvh].ichild[1];
-  if( ichild1 == -1 ){ // leaf
-    aIndElem.push_back(ichild0);
-    return;
-  }
-  BVH_GetIndElem_IncludePoint(aIndElem, px,py,pz, ichild0,  aBVH,aBB);
-  BVH_GetIndElem_IncludePoint(aIndElem, px,py,pz, ichild1,  aBVH,aBB);
+  BVH_Traverse(ibvh, aBVH,
+               [&](int jbvh){ return aBB[jbvh].isInclude_Point(px,py,pz); },
+               [&](int ielem){ aIndElem.push_back(ielem); return true; });
 }
 
 /**
@@ -432,26 +763,25 @@ void delfem2::BVH_Range_DistToNearestPoint
  const std::vector<delfem2::CNodeBVH2>& aBVH,
  const std::vector<BBOX>& aBB)
 {
-  double min0=+1.0, max0=-1.0;
-  aBB[ibvh].Range_DistToPoint(min0,max0, p[0],p[1],p[2]);
-  if( max0 < min0 ){ return; } // ibvh is a inactive bvh the children should be inactive too
-  //
-  if( max>=min && min0>max ){ return; } // current range [min,max] is valid and nearer than [min0,min0].
-  const int ichild0 = aBVH[ibvh].ichild[0];
-  const int ichild1 = aBVH[ibvh].ichild[1];
-  if( ichild1 == -1 ){ // leaf
+  double min0=+1.0, max0=-1.0; // range of the node entered last
+  auto is_enter = [&](int jbvh){
+    min0=+1.0; max0=-1.0;
+    aBB[jbvh].Range_DistToPoint(min0,max0, p[0],p[1],p[2]);
+    if( max0 < min0 ){ return false; } // jbvh is a inactive bvh the children should be inactive too
+    if( max>=min && min0>max ){ return false; } // current range [min,max] is valid and nearer than [min0,min0].
+    return true;
+  };
+  auto on_leaf = [&](int){
     if( max<min ){ // current range is inactive
       max = max0;
       min = min0;
-      return;
+      return true;
     }
     if( max0 < max ){ max = max0; }
     if( min0 < min ){ min = min0; }
-    return;
-  }
-  //
-  BVH_Range_DistToNearestPoint(min,max, p, ichild0,aBVH,aBB);
-  BVH_Range_DistToNearestPoint(min,max, p, ichild1,aBVH,aBB);
+    return true;
+  };
+  BVH_Traverse(ibvh, aBVH, is_enter, on_leaf);
 }
 
 /**
@@ -469,23 +799,20 @@ void delfem2::BVH_IndPoint_NearestPoint
   const std::vector<BBOX>& aBB)
 {
   assert( aBVH.size() == aBB.size() );
-  REAL min0=+1.0, max0=-1.0;
-  aBB[ibvh].Range_DistToPoint(min0,max0, p[0],p[1],p[2]);
-  if( max0 < min0 ){ return; } // ibvh is a inactive bvh the children should be inactive too
-  if( cur_dist > 0 && min0>cur_dist ){ return; } // current range [min,max] is valid and nearer than [min0,min0].
-  const int ichild0 = aBVH[ibvh].ichild[0];
-  const int ichild1 = aBVH[ibvh].ichild[1];
-  if( ichild1 == -1 ){ // leaf
-    assert( min0 == max0 ); // because this is point
-    if( cur_dist < 0 || max0 < cur_dist ){ // current range is inactive
-      cur_dist = max0;
-      ip = ichild0;
+  auto dist_bv = [&](int jbvh){
+    REAL min0=+1.0, max0=-1.0;
+    aBB[jbvh].Range_DistToPoint(min0,max0, p[0],p[1],p[2]);
+    if( max0 < min0 ){ return (REAL)-1; } // jbvh is a inactive bvh the children should be inactive too
+    return min0;
+  };
+  auto on_leaf = [&](int ielem, REAL dist, REAL& dist_cur){
+    // the box of the leaf is the point
+    if( dist_cur < 0 || dist < dist_cur ){
+      dist_cur = dist;
+      ip = ielem;
     }
-    return;
-  }
-  //
-  BVH_IndPoint_NearestPoint(ip,cur_dist, p, ichild0,aBVH,aBB);
-  BVH_IndPoint_NearestPoint(ip,cur_dist, p, ichild1,aBVH,aBB);
+  };
+  BVH_TraverseNearest(cur_dist, ibvh, aBVH, dist_bv, on_leaf);
 }
 
 template <typename BBOX>
@@ -499,22 +826,14 @@ void delfem2::BVH_GetIndElem_InsideRange
  const std::vector<BBOX>& aBB)
 {
   assert( min < max );
-  {
-    double min0, max0;
-    aBB[ibvh].Range_DistToPoint(min0,max0, px,py,pz);
-    if( max0<min ){ return; }
-    if( min0>max ){ return; }
-  }
-  const int ichild0 = aBVH[ibvh].ichild[0];
-  const int ichild1 = aBVH[ibvh].ichild[1];
-  if( ichild1 == -1 ){ // leaf
-    assert( ichild0 >= 0 && ichild0 < aBB.size() );
-    aIndElem.push_back(ichild0);
-    return;
-  }
-  //
-  BVH_GetIndElem_InsideRange(aIndElem, min,max, px,py,pz, ichild0,aBVH,aBB);
-  BVH_GetIndElem_InsideRange(aIndElem, min,max, px,py,pz, ichild1,aBVH,aBB);
+  auto is_enter = [&](int jbvh){
+    double min0=+1.0, max0=-1.0;
+    aBB[jbvh].Range_DistToPoint(min0,max0, px,py,pz);
+    if( max0 < min0 ){ return false; } // inactive bvh. the children should be inactive too
+    return !( max0<min || min0>max );
+  };
+  BVH_Traverse(ibvh, aBVH, is_enter,
+               [&](int ielem){ aIndElem.push_back(ielem); return true; });
 }
 
 template <typename BBOX>
@@ -527,18 +846,9 @@ void delfem2::BVH_GetIndElem_IntersectRay
  const std::vector<BBOX>& aBB)
 {
   assert( ibvh >= 0 && ibvh < (int)aBVH.size() );
-  bool is_intersect = aBB[ibvh].IsIntersectRay(src,dir);
-  if( !is_intersect ) return;
-  //
-  const int ichild0 = aBVH[ibvh].ichild[0];
-  const int ichild1 = aBVH[ibvh].ichild[1];
-  if( ichild1 == -1 ){ // leaf
-    assert( ichild0 >= 0 && ichild0 < (int)aBB.size() );
-    aIndElem.push_back(ichild0);
-    return;
-  }
-  BVH_GetIndElem_IntersectRay(aIndElem, src,dir, ichild0,aBVH,aBB);
-  BVH_GetIndElem_IntersectRay(aIndElem, src,dir, ichild1,aBVH,aBB);
+  BVH_Traverse(ibvh, aBVH,
+               [&](int jbvh){ return aBB[jbvh].IsIntersectRay(src,dir); },
+               [&](int ielem){ aIndElem.push_back(ielem); return true; });
 }
 
 template <typename BBOX>
@@ -551,18 +861,9 @@ void delfem2::BVH_GetIndElem_IntersectLine
  const std::vector<BBOX>& aBB)
 {
   assert( ibvh >= 0 && ibvh < (int)aBVH.size() );
-  bool is_intersect = aBB[ibvh].IsIntersectLine(src,dir);
-  if( !is_intersect ) return;
-  //
-  const int ichild0 = aBVH[ibvh].ichild[0];
-  const int ichild1 = aBVH[ibvh].ichild[1];
-  if( ichild1 == -1 ){ // leaf
-    assert( ichild0 >= 0 && ichild0 < aBB.size() );
-    aIndElem.push_back(ichild0);
-    return;
-  }
-  BVH_GetIndElem_IntersectLine(aIndElem, src,dir, ichild0,aBVH,aBB);
-  BVH_GetIndElem_IntersectLine(aIndElem, src,dir, ichild1,aBVH,aBB);
+  BVH_Traverse(ibvh, aBVH,
+               [&](int jbvh){ return aBB[jbvh].IsIntersectLine(src,dir); },
+               [&](int ielem){ aIndElem.push_back(ielem); return true; });
 }
   
 
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <cfloat>
+
+#include "delfem2/bvh4.h"
+
+#if defined(__AVX__)
+#  include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define DFM2_BVH4_SSE2
+#endif
+
+namespace dfm2 = delfem2;
+
+// ------------------------------------
+
+template <typename REAL>
+static unsigned int CollapseNode_BVH4(
+    std::vector<dfm2::CNodeBVH4>& aNode4,
+    int ibvh,
+    const std::vector<dfm2::CNodeBVH2>& aNodeBVH,
+    const std::vector<dfm2::CBV3_AABB<REAL>>& aBB)
+{
+  int aCand[4];
+  unsigned int ncand = 0;
+  if( aNodeBVH[ibvh].ichild[1] == -1 ){ // the root is a leaf
+    aCand[ncand++] = ibvh;
+  }
+  else{
+    aCand[ncand++] = aNodeBVH[ibvh].ichild[0];
+    aCand[ncand++] = aNodeBVH[ibvh].ichild[1];
+  }
+  while( ncand < 4 ){ // open the branch with the largest surface area
+    int icand_max = -1;
+    double area_max = -1.0;
+    for(unsigned int icand=0;icand<ncand;++icand){
+      if( aNodeBVH[aCand[icand]].ichild[1] == -1 ){ continue; } // leaf
+      const double area = aBB[aCand[icand]].SurfaceArea();
+      if( area > area_max ){ area_max = area; icand_max = icand; }
+    }
+    if( icand_max == -1 ){ break; }
+    const int jbvh = aCand[icand_max];
+    aCand[icand_max] = aNodeBVH[jbvh].ichild[0];
+    aCand[ncand++] = aNodeBVH[jbvh].ichild[1];
+  }
+  const unsigned int inode4 = aNode4.size();
+  aNode4.resize(inode4+1);
+  for(unsigned int icand=0;icand<4;++icand){
+    dfm2::CNodeBVH4& node4 = aNode4[inode4];
+    if( icand >= ncand ){ // empty
+      for(int idim=0;idim<3;++idim){
+        node4.bbmin[idim][icand] = +DBL_MAX;
+        node4.bbmax[idim][icand] = -DBL_MAX;
+      }
+      node4.ichild[icand] = -1;
+      continue;
+    }
+    const dfm2::CBV3_AABB<REAL>& bb = aBB[aCand[icand]];
+    for(int idim=0;idim<3;++idim){
+      node4.bbmin[idim][icand] = bb.bbmin[idim];
+      node4.bbmax[idim][icand] = bb.bbmax[idim];
+    }
+  }
+  for(unsigned int icand=0;icand<ncand;++icand){
+    const dfm2::CNodeBVH2& node = aNodeBVH[aCand[icand]];
+    if( node.ichild[1] == -1 ){ // leaf
+      aNode4[inode4].ichild[icand] = -2-node.ichild[0];
+      continue;
+    }
+    const unsigned int jnode4 = CollapseNode_BVH4(aNode4, aCand[icand], aNodeBVH, aBB); // aNode4 may be reallocated
+    aNode4[inode4].ichild[icand] = jnode4;
+  }
+  return inode4;
+}
+
+template <typename REAL>
+void dfm2::BVH4_Collapse(
+    std::vector<CNodeBVH4>& aNode4,
+    int ibvh_root,
+    const std::vector<CNodeBVH2>& aNodeBVH,
+    const std::vector<CBV3_AABB<REAL>>& aBB)
+{
+  assert( aBB.size() == aNodeBVH.size() );
+  aNode4.clear();
+  aNode4.reserve(aNodeBVH.size()/3+1);
+  CollapseNode_BVH4(aNode4, ibvh_root, aNodeBVH, aBB);
+}
+template void dfm2::BVH4_Collapse(
+    std::vector<CNodeBVH4>& aNode4,
+    int ibvh_root,
+    const std::vector<CNodeBVH2>& aNodeBVH,
+    const std::vector<CBV3_AABB<float>>& aBB);
+template void dfm2::BVH4_Collapse(
+    std::vector<CNodeBVH4>& aNode4,
+    int ibvh_root,
+    const std::vector<CNodeBVH2>& aNodeBVH,
+    const std::vector<CBV3_AABB<double>>& aBB);
+
+// ------------------------------------
+// below: SIMD kernels testing the four children at once
+
+/**
+ * bit i is set if the box of the i-th child includes the point
+ */
+static unsigned int Mask_IncludePoint(
+    const dfm2::CNodeBVH4& node,
+    const double p[3])
+{
+#if defined(__AVX__)
+  __m256d flg = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  for(int idim=0;idim<3;++idim){
+    const __m256d x = _mm256_set1_pd(p[idim]);
+    flg = _mm256_and_pd(flg, _mm256_cmp_pd(_mm256_loadu_pd(node.bbmin[idim]), x, _CMP_LE_OQ));
+    flg = _mm256_and_pd(flg, _mm256_cmp_pd(x, _mm256_loadu_pd(node.bbmax[idim]), _CMP_LE_OQ));
+  }
+  return _mm256_movemask_pd(flg);
+#elif defined(DFM2_BVH4_SSE2)
+  __m128d flg0 = _mm_castsi128_pd(_mm_set1_epi32(-1));
+  __m128d flg1 = flg0;
+  for(int idim=0;idim<3;++idim){
+    const __m128d x = _mm_set1_pd(p[idim]);
+    flg0 = _mm_and_pd(flg0, _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(node.bbmin[idim]+0), x),
+                                       _mm_cmple_pd(x, _mm_loadu_pd(node.bbmax[idim]+0))));
+    flg1 = _mm_and_pd(flg1, _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(node.bbmin[idim]+2), x),
+                                       _mm_cmple_pd(x, _mm_loadu_pd(node.bbmax[idim]+2))));
+  }
+  return _mm_movemask_pd(flg0) | (_mm_movemask_pd(flg1) << 2);
+#else
+  unsigned int mask = 0;
+  for(int i=0;i<4;++i){
+    bool flg = true;
+    for(int idim=0;idim<3;++idim){
+      flg = flg && node.bbmin[idim][i] <= p[idim] && p[idim] <= node.bbmax[idim][i];
+    }
+    if( flg ){ mask |= (1u << i); }
+  }
+  return mask;
+#endif
+}
+
+/**
+ * bit i is set if the box of the i-th child intersects the ray (slab test)
+ * @param invdir inverse of the direction. Use a large number for the zero component to avoid 0*inf.
+ */
+static unsigned int Mask_IntersectRay(
+    const dfm2::CNodeBVH4& node,
+    const double src[3],
+    const double invdir[3])
+{
+#if defined(__AVX__)
+  __m256d tnear = _mm256_setzero_pd(); // ray starts at t=0
+  __m256d tfar = _mm256_set1_pd(DBL_MAX);
+  for(int idim=0;idim<3;++idim){
+    const __m256d s = _mm256_set1_pd(src[idim]);
+    const __m256d d = _mm256_set1_pd(invdir[idim]);
+    const __m256d t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(node.bbmin[idim]), s), d);
+    const __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(node.bbmax[idim]), s), d);
+    tnear = _mm256_max_pd(tnear, _mm256_min_pd(t0,t1));
+    tfar = _mm256_min_pd(tfar, _mm256_max_pd(t0,t1));
+  }
+  return _mm256_movemask_pd(_mm256_cmp_pd(tnear, tfar, _CMP_LE_OQ));
+#elif defined(DFM2_BVH4_SSE2)
+  unsigned int mask = 0;
+  for(int ihalf=0;ihalf<2;++ihalf){
+    __m128d tnear = _mm_setzero_pd();
+    __m128d tfar = _mm_set1_pd(DBL_MAX);
+    for(int idim=0;idim<3;++idim){
+      const __m128d s = _mm_set1_pd(src[idim]);
+      const __m128d d = _mm_set1_pd(invdir[idim]);
+      const __m128d t0 = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(node.bbmin[idim]+ihalf*2), s), d);
+      const __m128d t1 = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(node.bbmax[idim]+ihalf*2), s), d);
+      tnear = _mm_max_pd(tnear, _mm_min_pd(t0,t1));
+      tfar = _mm_min_pd(tfar, _mm_max_pd(t0,t1));
+    }
+    mask |= _mm_movemask_pd(_mm_cmple_pd(tnear, tfar)) << (ihalf*2);
+  }
+  return mask;
+#else
+  unsigned int mask = 0;
+  for(int i=0;i<4;++i){
+    double tnear = 0.0, tfar = DBL_MAX;
+    for(int idim=0;idim<3;++idim){
+      const double t0 = (node.bbmin[idim][i]-src[idim])*invdir[idim];
+      const double t1 = (node.bbmax[idim][i]-src[idim])*invdir[idim];
+      tnear = fmax(tnear, fmin(t0,t1));
+      tfar = fmin(tfar, fmax(t0,t1));
+    }
+    if( tnear <= tfar ){ mask |= (1u << i); }
+  }
+  return mask;
+#endif
+}
+
+/**
+ * squared distance from the point to the box of each child
+ */
+static void SquareDistance_Point(
+    double aDist2[4],
+    const dfm2::CNodeBVH4& node,
+    const double p[3])
+{
+#if defined(__AVX__)
+  __m256d dist2 = _mm256_setzero_pd();
+  for(int idim=0;idim<3;++idim){
+    const __m256d x = _mm256_set1_pd(p[idim]);
+    __m256d d = _mm256_max_pd(_mm256_sub_pd(_mm256_loadu_pd(node.bbmin[idim]), x),
+                              _mm256_sub_pd(x, _mm256_loadu_pd(node.bbmax[idim])));
+    d = _mm256_max_pd(d, _mm256_setzero_pd());
+    dist2 = _mm256_add_pd(dist2, _mm256_mul_pd(d,d));
+  }
+  _mm256_storeu_pd(aDist2, dist2);
+#elif defined(DFM2_BVH4_SSE2)
+  for(int ihalf=0;ihalf<2;++ihalf){
+    __m128d dist2 = _mm_setzero_pd();
+    for(int idim=0;idim<3;++idim){
+      const __m128d x = _mm_set1_pd(p[idim]);
+      __m128d d = _mm_max_pd(_mm_sub_pd(_mm_loadu_pd(node.bbmin[idim]+ihalf*2), x),
+                             _mm_sub_pd(x, _mm_loadu_pd(node.bbmax[idim]+ihalf*2)));
+      d = _mm_max_pd(d, _mm_setzero_pd());
+      dist2 = _mm_add_pd(dist2, _mm_mul_pd(d,d));
+    }
+    _mm_storeu_pd(aDist2+ihalf*2, dist2);
+  }
+#else
+  for(int i=0;i<4;++i){
+    aDist2[i] = 0.0;
+    for(int idim=0;idim<3;++idim){
+      double d = fmax(node.bbmin[idim][i]-p[idim], p[idim]-node.bbmax[idim][i]);
+      d = fmax(d, 0.0);
+      aDist2[i] += d*d;
+    }
+  }
+#endif
+}
+
+// above: SIMD kernels
+// ------------------------------------
+
+static void GetIndElem_IncludePoint_BVH4(
+    std::vector<int>& aIndElem,
+    const double p[3],
+    unsigned int inode4,
+    const std::vector<dfm2::CNodeBVH4>& aNode4)
+{
+  const dfm2::CNodeBVH4& node4 = aNode4[inode4];
+  const unsigned int mask = Mask_IncludePoint(node4, p);
+  for(int i=0;i<4;++i){
+    const int ichild = node4.ichild[i];
+    if( ichild == -1 ){ break; } // empty
+    if( !(mask & (1u << i)) ){ continue; }
+    if( ichild < 0 ){ aIndElem.push_back(-2-ichild); continue; } // leaf
+    GetIndElem_IncludePoint_BVH4(aIndElem, p, ichild, aNode4);
+  }
+}
+
+void dfm2::BVH4_GetIndElem_IncludePoint(
+    std::vector<int>& aIndElem,
+    //
+    double px, double py, double pz,
+    const std::vector<CNodeBVH4>& aNode4)
+{
+  if( aNode4.empty() ){ return; }
+  const double p[3] = {px,py,pz};
+  GetIndElem_IncludePoint_BVH4(aIndElem, p, 0, aNode4);
+}
+
+static void GetIndElem_IntersectRay_BVH4(
+    std::vector<int>& aIndElem,
+    const double src[3], const double invdir[3],
+    unsigned int inode4,
+    const std::vector<dfm2::CNodeBVH4>& aNode4)
+{
+  const dfm2::CNodeBVH4& node4 = aNode4[inode4];
+  const unsigned int mask = Mask_IntersectRay(node4, src, invdir);
+  for(int i=0;i<4;++i){
+    const int ichild = node4.ichild[i];
+    if( ichild == -1 ){ break; } // empty
+    if( !(mask & (1u << i)) ){ continue; }
+    if( ichild < 0 ){ aIndElem.push_back(-2-ichild); continue; } // leaf
+    GetIndElem_IntersectRay_BVH4(aIndElem, src, invdir, ichild, aNode4);
+  }
+}
+
+void dfm2::BVH4_GetIndElem_IntersectRay(
+    std::vector<int>& aIndElem,
+    //
+    const double src[3], const double dir[3],
+    const std::vector<CNodeBVH4>& aNode4)
+{
+  if( aNode4.empty() ){ return; }
+  double invdir[3];
+  for(int idim=0;idim<3;++idim){
+    invdir[idim] = ( fabs(dir[idim]) > 1.0e-300 ) ? 1.0/dir[idim] : 1.0e+300;
+  }
+  GetIndElem_IntersectRay_BVH4(aIndElem, src, invdir, 0, aNode4);
+}
+
+static void IndPoint_NearestPoint_BVH4(
+    unsigned int& ip,
+    double& cur_dist2,
+    const double p[3],
+    unsigned int inode4,
+    const std::vector<dfm2::CNodeBVH4>& aNode4)
+{
+  const dfm2::CNodeBVH4& node4 = aNode4[inode4];
+  double aDist2[4];
+  SquareDistance_Point(aDist2, node4, p);
+  int aOrder[4];
+  unsigned int nchild = 0;
+  for(int i=0;i<4;++i){ // insertion sort of the children by the distance
+    if( node4.ichild[i] == -1 ){ break; }
+    unsigned int j = nchild++;
+    for(;j>0 && aDist2[aOrder[j-1]] > aDist2[i];--j){ aOrder[j] = aOrder[j-1]; }
+    aOrder[j] = i;
+  }
+  for(unsigned int iorder=0;iorder<nchild;++iorder){
+    const int i = aOrder[iorder];
+    if( cur_dist2 >= 0 && aDist2[i] > cur_dist2 ){ return; } // the rest is farther
+    const int ichild = node4.ichild[i];
+    if( ichild < 0 ){ // leaf
+      if( cur_dist2 < 0 || aDist2[i] < cur_dist2 ){
+        cur_dist2 = aDist2[i];
+        ip = -2-ichild;
+      }
+      continue;
+    }
+    IndPoint_NearestPoint_BVH4(ip, cur_dist2, p, ichild, aNode4);
+  }
+}
+
+void dfm2::BVH4_IndPoint_NearestPoint(
+    unsigned int& ip,
+    double& cur_dist,
+    //
+    const double p[3],
+    const std::vector<CNodeBVH4>& aNode4)
+{
+  if( aNode4.empty() ){ return; }
+  double cur_dist2 = ( cur_dist < 0 ) ? -1.0 : cur_dist*cur_dist;
+  IndPoint_NearestPoint_BVH4(ip, cur_dist2, p, 0, aNode4);
+  if( cur_dist2 >= 0 ){ cur_dist = sqrt(cur_dist2); }
+}
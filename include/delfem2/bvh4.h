@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * @file bvh4.h
+ * @brief 4-wide BVH collapsed from the binary BVH. The boxes of the four children are tested at once with SIMD
+ * @details The bounding boxes of the children are stored in the SoA layout in double precision,
+ * so the results of the queries are the same as testing the axis-aligned bounding boxes one by one.
+ * With AVX (e.g., -mavx), the four children are tested with one 256-bit instruction sequence,
+ * with SSE2 (default on x86-64) with two 128-bit sequences. Otherwise the tests are scalar loops.
+ */
+
+#ifndef DFM2_BVH4_H
+#define DFM2_BVH4_H
+
+#include <vector>
+#include "delfem2/bvh.h"
+#include "delfem2/bv.h"
+
+namespace delfem2 {
+
+/**
+ * @class node of the 4-wide BVH
+ * @details ichild[i] is the index of the child node if ichild[i]>=0,
+ * -1 if the i-th slot is empty, and -2-ielem if the i-th child is the leaf with the element ielem.
+ * The empty slots are after the used slots.
+ */
+class CNodeBVH4
+{
+public:
+  double bbmin[3][4]; // bbmin[idim][ichild]
+  double bbmax[3][4]; // bbmax[idim][ichild]
+  int ichild[4];
+};
+
+/**
+ * @brief collapse the binary BVH into the 4-wide BVH
+ * @details The child with the largest surface area is opened until a node has four children,
+ * so that the large boxes are tested together.
+ * The root of aNode4 is aNode4[0]. If ibvh_root is a leaf, the root has only one child.
+ * @param aBB bounding boxes of the binary BVH (e.g., from BVH_BuildBVHGeometry_Mesh). Defined for "float" and "double"
+ */
+template <typename REAL>
+void BVH4_Collapse(
+    std::vector<CNodeBVH4>& aNode4,
+    int ibvh_root,
+    const std::vector<CNodeBVH2>& aNodeBVH,
+    const std::vector<CBV3_AABB<REAL>>& aBB);
+
+/**
+ * @brief elements whose box includes the point. 4-wide version of BVH_GetIndElem_IncludePoint
+ */
+void BVH4_GetIndElem_IncludePoint(
+    std::vector<int>& aIndElem,
+    //
+    double px, double py, double pz,
+    const std::vector<CNodeBVH4>& aNode4);
+
+/**
+ * @brief elements whose box intersects the ray src+t*dir (t>=0). 4-wide version of BVH_GetIndElem_IntersectRay
+ */
+void BVH4_GetIndElem_IntersectRay(
+    std::vector<int>& aIndElem,
+    //
+    const double src[3], const double dir[3],
+    const std::vector<CNodeBVH4>& aNode4);
+
+/**
+ * @brief index of the element whose box is the nearest to the point. 4-wide version of BVH_IndPoint_NearestPoint
+ * @details the children are visited in the order of the distance to their boxes.
+ * For a point set (the boxes of the leaves are the points), this is the nearest point.
+ * The cur_dist should be input as a negative value (e.g., cur_dist=-1)
+ */
+void BVH4_IndPoint_NearestPoint(
+    unsigned int& ip,
+    double& cur_dist,
+    //
+    const double p[3],
+    const std::vector<CNodeBVH4>& aNode4);
+
+} // end namespace delfem2
+
+#endif
@@ -16,6 +16,8 @@
 #include <complex>
 #include "delfem2/emat.h"
 #include "delfem2/mats.h"
+#include "delfem2/thread.h"
+#include "delfem2/instrument.h"
 //
 #include "delfem2/fem_emats.h"
 
@@ -130,9 +132,91 @@ static void MatMatTrans3
 }
 
 
+// call func(iel,tmp_buffer) for all the elements grouped by colors.
+// The colors are processed one by one. The elements in the same color do not share a point,
+// so they are split into nthread threads and merged concurrently with a merge buffer for each thread.
+template <typename FUNC>
+static void MergeElem_Colored(
+    const std::vector<unsigned int>& color_ind,
+    const std::vector<unsigned int>& color_elem,
+    unsigned int nthread,
+    unsigned int np,
+    const FUNC& func)
+{
+  if( nthread == 0 ){ nthread = 1; }
+  if( color_ind.size() < 2 ){ return; }
+  const unsigned int ncolor = color_ind.size()-1;
+  std::vector< std::vector<int> > aBuffer(nthread, std::vector<int>(np,-1));
+  dfm2::CBarrier barrier(nthread);
+  dfm2::ParallelThread(nthread, [&](unsigned int ith){
+    for(unsigned int icolor=0;icolor<ncolor;++icolor){
+      const unsigned long long n = color_ind[icolor+1]-color_ind[icolor];
+      const unsigned int ie0 = color_ind[icolor] + (unsigned int)(n*ith/nthread);
+      const unsigned int ie1 = color_ind[icolor] + (unsigned int)(n*(ith+1)/nthread);
+      for(unsigned int ie=ie0;ie<ie1;++ie){
+        func(color_elem[ie],aBuffer[ith]);
+      }
+      barrier.Wait();
+    }
+  });
+}
+
+// merge the element matrix of the iel-th element.
+// The destinations precomputed in the plan are used if the plan is given.
+static void MergeElemMat(
+    dfm2::CMatrixSparse<double>& mat_A,
+    unsigned int nno,
+    const unsigned int* aIP,
+    unsigned int blksize,
+    const double* emat,
+    const dfm2::CMergePlan* plan,
+    unsigned int iel,
+    std::vector<int>& tmp_buffer)
+{
+  if( plan != nullptr ){
+    assert( plan->nPoEl == nno );
+    mat_A.Mearge_Plan(nno, aIP, plan->ElemCrs(iel), emat);
+    return;
+  }
+  mat_A.Mearge(nno, aIP, nno, aIP, blksize, emat, tmp_buffer);
+}
+
 // -------------------------------------------------------
 // -------------------------------------------------------
 
+static void MergeElem_Poission_Tri2D(
+    dfm2::CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double alpha,
+    const double source,
+    const double* aXY1,
+    const unsigned int* aTri1,
+    const double* aVal,
+    const dfm2::CMergePlan* plan,
+    unsigned int iel,
+    std::vector<int>& tmp_buffer)
+{
+  const unsigned int i0 = aTri1[iel*3+0];
+  const unsigned int i1 = aTri1[iel*3+1];
+  const unsigned int i2 = aTri1[iel*3+2];
+  const unsigned int aIP[3] = {i0,i1,i2};
+  double coords[3][2]; FetchData(&coords[0][0],3,2,aIP, aXY1);
+  const double value[3] = { aVal[i0], aVal[i1], aVal[i2] };
+  ////
+  double eres[3];
+  double emat[3][3];
+  dfm2::EMat_Poisson_Tri2D
+  (eres,emat,
+   alpha, source,
+   coords, value);
+  for (int ino = 0; ino<3; ino++){
+    const unsigned int ip = aIP[ino];
+    vec_b[ip] += eres[ino];
+  }
+  MergeElemMat(mat_A, 3, aIP, 1, &emat[0][0],
+               plan, iel, tmp_buffer);
+}
+
 void dfm2::MergeLinSys_Poission_MeshTri2D(
     CMatrixSparse<double>& mat_A,
     double* vec_b,
@@ -142,33 +226,43 @@ void dfm2::MergeLinSys_Poission_MeshTri2D(
     int np,
     const unsigned int* aTri1,
     int nTri,
-    const double* aVal)
+    const double* aVal,
+    const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int nDoF = np;
   /////
   std::vector<int> tmp_buffer(nDoF, -1);
   for (int iel = 0; iel<nTri; ++iel){
-    const unsigned int i0 = aTri1[iel*3+0];
-    const unsigned int i1 = aTri1[iel*3+1];
-    const unsigned int i2 = aTri1[iel*3+2];
-    const unsigned int aIP[3] = {i0,i1,i2};
-    double coords[3][2]; FetchData(&coords[0][0],3,2,aIP, aXY1);
-    const double value[3] = { aVal[i0], aVal[i1], aVal[i2] };
-    ////
-    double eres[3];
-    double emat[3][3];
-    EMat_Poisson_Tri2D
-    (eres,emat,
-     alpha, source,
-     coords, value);
-    for (int ino = 0; ino<3; ino++){
-      const unsigned int ip = aIP[ino];
-      vec_b[ip] += eres[ino];
-    }
-    mat_A.Mearge(3, aIP, 3, aIP, 1, &emat[0][0], tmp_buffer);
+    MergeElem_Poission_Tri2D(mat_A,vec_b,
+                             alpha,source,aXY1,aTri1,aVal,
+                             plan,iel,tmp_buffer);
   }
 }
 
+void dfm2::MergeLinSys_Poission_MeshTri2D_Parallel(
+    CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double alpha,
+    const double source,
+    const double* aXY1,
+    int np,
+    const unsigned int* aTri1,
+    const std::vector<unsigned int>& color_ind,
+    const std::vector<unsigned int>& color_elem,
+    unsigned int nthread,
+    const double* aVal,
+    const CMergePlan* plan)
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
+  MergeElem_Colored(color_ind,color_elem,nthread,np,
+                    [&](unsigned int iel, std::vector<int>& tmp_buffer){
+    MergeElem_Poission_Tri2D(mat_A,vec_b,
+                             alpha,source,aXY1,aTri1,aVal,
+                             plan,iel,tmp_buffer);
+  });
+}
+
 void dfm2::MergeLinSys_Helmholtz_MeshTri2D(
     CMatrixSparse<COMPLEX>& mat_A,
     COMPLEX* vec_b,
@@ -179,6 +273,7 @@ void dfm2::MergeLinSys_Helmholtz_MeshTri2D(
     unsigned int nTri,
     const COMPLEX* aVal)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const unsigned int nDoF = np;
   std::vector<int> tmp_buffer(nDoF, -1);
   for (unsigned int iel = 0; iel<nTri; ++iel){
@@ -212,6 +307,7 @@ void dfm2::MergeLinSys_SommerfeltRadiationBC_Polyline2D(
     unsigned int nIPPolyline,
     const COMPLEX* aVal)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const unsigned int nDoF = np;
   std::vector<int> tmp_buffer(nDoF, -1);
   assert( nIPPolyline >= 2 );
@@ -233,6 +329,38 @@ void dfm2::MergeLinSys_SommerfeltRadiationBC_Polyline2D(
   }
 }
 
+static void MergeElem_Poission_Tet3D(
+    dfm2::CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double alpha,
+    const double source,
+    const double* aXYZ,
+    const unsigned int* aTet,
+    const double* aVal,
+    const dfm2::CMergePlan* plan,
+    unsigned int itet,
+    std::vector<int>& tmp_buffer)
+{
+  const unsigned int i0 = aTet[itet*4+0];
+  const unsigned int i1 = aTet[itet*4+1];
+  const unsigned int i2 = aTet[itet*4+2];
+  const unsigned int i3 = aTet[itet*4+3];
+  const unsigned int aIP[4] = {i0,i1,i2,i3};
+  double coords[4][3]; FetchData(&coords[0][0],4,3,aIP, aXYZ);
+  const double value[4] = { aVal[i0], aVal[i1], aVal[i2], aVal[i3] };
+  ////
+  double eres[4], emat[4][4];
+  dfm2::EMat_Poisson_Tet3D(eres,emat,
+                           alpha, source,
+                           coords, value);
+  for (int ino = 0; ino<4; ino++){
+    const unsigned int ip = aIP[ino];
+    vec_b[ip] += eres[ino];
+  }
+  MergeElemMat(mat_A, 4, aIP, 1, &emat[0][0],
+               plan, itet, tmp_buffer);
+}
+
 void dfm2::MergeLinSys_Poission_MeshTet3D(
     CMatrixSparse<double>& mat_A,
     double* vec_b,
@@ -240,31 +368,41 @@ void dfm2::MergeLinSys_Poission_MeshTet3D(
     const double source,
     const double* aXYZ, int nXYZ,
     const unsigned int* aTet, int nTet,
-    const double* aVal)
+    const double* aVal,
+    const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXYZ;
   std::vector<int> tmp_buffer(np, -1);
   for (int itet = 0; itet<nTet; ++itet){
-    const unsigned int i0 = aTet[itet*4+0];
-    const unsigned int i1 = aTet[itet*4+1];
-    const unsigned int i2 = aTet[itet*4+2];
-    const unsigned int i3 = aTet[itet*4+3];
-    const unsigned int aIP[4] = {i0,i1,i2,i3};
-    double coords[4][3]; FetchData(&coords[0][0],4,3,aIP, aXYZ);
-    const double value[4] = { aVal[i0], aVal[i1], aVal[i2], aVal[i3] };
-    ////
-    double eres[4], emat[4][4];
-    EMat_Poisson_Tet3D(eres,emat,
-                       alpha, source,
-                       coords, value);
-    for (int ino = 0; ino<4; ino++){
-      const unsigned int ip = aIP[ino];
-      vec_b[ip] += eres[ino];
-    }
-    mat_A.Mearge(4, aIP, 4, aIP, 1, &emat[0][0], tmp_buffer);
+    MergeElem_Poission_Tet3D(mat_A,vec_b,
+                             alpha,source,aXYZ,aTet,aVal,
+                             plan,itet,tmp_buffer);
   }
 }
 
+void dfm2::MergeLinSys_Poission_MeshTet3D_Parallel(
+    CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double alpha,
+    const double source,
+    const double* aXYZ, int nXYZ,
+    const unsigned int* aTet,
+    const std::vector<unsigned int>& color_ind,
+    const std::vector<unsigned int>& color_elem,
+    unsigned int nthread,
+    const double* aVal,
+    const CMergePlan* plan)
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
+  MergeElem_Colored(color_ind,color_elem,nthread,nXYZ,
+                    [&](unsigned int itet, std::vector<int>& tmp_buffer){
+    MergeElem_Poission_Tet3D(mat_A,vec_b,
+                             alpha,source,aXYZ,aTet,aVal,
+                             plan,itet,tmp_buffer);
+  });
+}
+
 void dfm2::MergeLinSys_Diffusion_MeshTri2D(
     CMatrixSparse<double>& mat_A,
     double* vec_b,
@@ -276,8 +414,10 @@ void dfm2::MergeLinSys_Diffusion_MeshTri2D(
     const double* aXY1, int nXY,
     const unsigned int* aTri1, int nTri,
     const double* aVal,
-    const double* aVelo)
+    const double* aVelo,
+    const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
 //  const int nDoF = nXY;
   ////
 //  mat_A.SetZero();
@@ -303,7 +443,8 @@ void dfm2::MergeLinSys_Diffusion_MeshTri2D(
       const unsigned int ip = aIP[ino];
       vec_b[ip] += eres[ino];
     }
-    mat_A.Mearge(3, aIP, 3, aIP, 1, &emat[0][0], tmp_buffer);
+    MergeElemMat(mat_A, 3, aIP, 1, &emat[0][0],
+                 plan, iel, tmp_buffer);
   }
 }
 
@@ -320,8 +461,10 @@ void dfm2::MergeLinSys_Diffusion_MeshTet3D(
     const unsigned int* aTet,
     int nTet,
     const double* aVal,
-    const double* aVelo)
+    const double* aVelo,
+    const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXYZ;
   std::vector<int> tmp_buffer(np, -1);
   for (int iel = 0; iel<nTet; ++iel){
@@ -344,8 +487,45 @@ void dfm2::MergeLinSys_Diffusion_MeshTet3D(
       const unsigned int ip = aIP[ino];
       vec_b[ip] += eres[ino];
     }
-    mat_A.Mearge(4, aIP, 4, aIP, 1, &emat[0][0], tmp_buffer);
+    MergeElemMat(mat_A, 4, aIP, 1, &emat[0][0],
+                 plan, iel, tmp_buffer);
+  }
+}
+
+static void MergeElem_SolidLinear_Static_Tri2D(
+    dfm2::CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double myu,
+    const double lambda,
+    const double rho,
+    const double g_x,
+    const double g_y,
+    const double* aXY1,
+    const unsigned int* aTri1,
+    const double* aVal,
+    const dfm2::CMergePlan* plan,
+    unsigned int iel,
+    std::vector<int>& tmp_buffer)
+{
+  const unsigned int i0 = aTri1[iel*3+0];
+  const unsigned int i1 = aTri1[iel*3+1];
+  const unsigned int i2 = aTri1[iel*3+2];
+  const unsigned int aIP[3] = {i0,i1,i2};
+  double coords[3][2]; FetchData(&coords[0][0],3,2,aIP, aXY1);
+  double disps[3][2]; FetchData(&disps[0][0],3,2,aIP, aVal);
+  ////
+  double eres[3][2];
+  double emat[3][3][2][2];
+  dfm2::EMat_SolidStaticLinear_Tri2D(eres,emat,
+                                     myu, lambda, rho, g_x, g_y,
+                                     disps, coords);
+  for (int ino = 0; ino<3; ino++){
+    const unsigned int ip = aIP[ino];
+    vec_b[ip*2+0] += eres[ino][0];
+    vec_b[ip*2+1] += eres[ino][1];
   }
+  MergeElemMat(mat_A, 3, aIP, 4, &emat[0][0][0][0],
+               plan, iel, tmp_buffer);
 }
 
 void dfm2::MergeLinSys_SolidLinear_Static_MeshTri2D
@@ -358,32 +538,44 @@ void dfm2::MergeLinSys_SolidLinear_Static_MeshTri2D
  const double g_y,
  const double* aXY1, int nXY,
  const unsigned int* aTri1, int nTri,
- const double* aVal)
+ const double* aVal,
+ const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXY;
   std::vector<int> tmp_buffer(np, -1);
   for(int iel=0; iel<nTri; ++iel){
-    const unsigned int i0 = aTri1[iel*3+0];
-    const unsigned int i1 = aTri1[iel*3+1];
-    const unsigned int i2 = aTri1[iel*3+2];
-    const unsigned int aIP[3] = {i0,i1,i2};
-    double coords[3][2]; FetchData(&coords[0][0],3,2,aIP, aXY1);
-    double disps[3][2]; FetchData(&disps[0][0],3,2,aIP, aVal);
-    ////
-    double eres[3][2];
-    double emat[3][3][2][2];
-    EMat_SolidStaticLinear_Tri2D(eres,emat,
-                                 myu, lambda, rho, g_x, g_y,
-                                 disps, coords);
-    for (int ino = 0; ino<3; ino++){
-      const unsigned int ip = aIP[ino];
-      vec_b[ip*2+0] += eres[ino][0];
-      vec_b[ip*2+1] += eres[ino][1];
-    }
-    mat_A.Mearge(3, aIP, 3, aIP, 4, &emat[0][0][0][0], tmp_buffer);
+    MergeElem_SolidLinear_Static_Tri2D(mat_A,vec_b,
+                                       myu,lambda,rho,g_x,g_y,aXY1,aTri1,aVal,
+                                       plan,iel,tmp_buffer);
   }
 }
 
+void dfm2::MergeLinSys_SolidLinear_Static_MeshTri2D_Parallel
+(CMatrixSparse<double>& mat_A,
+ double* vec_b,
+ const double myu,
+ const double lambda,
+ const double rho,
+ const double g_x,
+ const double g_y,
+ const double* aXY1, int nXY,
+ const unsigned int* aTri1,
+ const std::vector<unsigned int>& color_ind,
+ const std::vector<unsigned int>& color_elem,
+ unsigned int nthread,
+ const double* aVal,
+ const CMergePlan* plan)
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
+  MergeElem_Colored(color_ind,color_elem,nthread,nXY,
+                    [&](unsigned int iel, std::vector<int>& tmp_buffer){
+    MergeElem_SolidLinear_Static_Tri2D(mat_A,vec_b,
+                                       myu,lambda,rho,g_x,g_y,aXY1,aTri1,aVal,
+                                       plan,iel,tmp_buffer);
+  });
+}
+
 void dfm2::MergeLinSys_SolidLinear_NewmarkBeta_MeshTri2D(
     CMatrixSparse<double>& mat_A,
     double* vec_b,
@@ -399,8 +591,10 @@ void dfm2::MergeLinSys_SolidLinear_NewmarkBeta_MeshTri2D(
     const unsigned int* aTri1, int nTri,
     const double* aVal,
     const double* aVelo,
-    const double* aAcc)
+    const double* aAcc,
+    const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXY;
 //  const int nDoF = np*2;
   ////
@@ -432,7 +626,8 @@ void dfm2::MergeLinSys_SolidLinear_NewmarkBeta_MeshTri2D(
       vec_b[ip*2+1] += eres[ino][1];
     }
     // marge dde
-    mat_A.Mearge(3, aIP, 3, aIP, 4, &emat[0][0][0][0], tmp_buffer);
+    MergeElemMat(mat_A, 3, aIP, 4, &emat[0][0][0][0],
+                 plan, iel, tmp_buffer);
   }
 }
 
@@ -446,6 +641,7 @@ void dfm2::MergeLinSys_StokesStatic2D(
     const unsigned int* aTri1, int nTri,
     const double* aVal)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXY;
 //  const int nDoF = np*3;
   ////
@@ -489,6 +685,7 @@ void dfm2::MergeLinSys_StokesDynamic2D(
     const double* aVal,
     const double* aVelo)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXY;
 //  const int nDoF = np*3;
   ////
@@ -535,6 +732,7 @@ void dfm2::MergeLinSys_NavierStokes2D(
     const double* aVal, // vx,vy,press
     const double* aDtVal) // ax,ay,apress
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXY;
 //  const int nDoF = np*3;
   ////
@@ -566,6 +764,69 @@ void dfm2::MergeLinSys_NavierStokes2D(
 }
 
 
+// merge the in-plane strain energy of a triangle. return the energy
+static double MergeElem_Cloth_Tri(
+    dfm2::CMatrixSparse<double>& ddW,
+    double* dW,
+    double lambda,
+    double myu,
+    const double* aPosIni, int ndim,
+    const unsigned int* aTri,
+    const double* aXYZ,
+    unsigned int itri,
+    std::vector<int>& tmp_buffer)
+{
+  const unsigned int aIP[3] = { aTri[itri*3+0], aTri[itri*3+1], aTri[itri*3+2] };
+  double C[3][3] = {{0,0,0},{0,0,0},{0,0,0}};
+  double c[3][3];
+  for(int ino=0;ino<3;ino++){
+    const unsigned int ip = aIP[ino];
+    for(int i=0;i<ndim;i++){ C[ino][i] = aPosIni[ip*ndim+i]; }
+    for(int i=0;i<3;i++){ c[ino][i] = aXYZ[ip*3+i]; }
+  }
+  double e, de[3][3], dde[3][3][3][3];
+  dfm2::WdWddW_CST( e,de,dde, C,c, lambda,myu );
+  // marge de
+  for(int ino=0;ino<3;ino++){
+    const unsigned int ip = aIP[ino];
+    for(int i =0;i<3;i++){ dW[ip*3+i] += de[ino][i]; }
+  }
+  // marge dde
+  ddW.Mearge(3, aIP, 3, aIP, 9, &dde[0][0][0][0], tmp_buffer);
+  return e;
+}
+
+// merge the bending energy of a pair of triangles. return the energy
+static double MergeElem_Cloth_Bend(
+    dfm2::CMatrixSparse<double>& ddW,
+    double* dW,
+    double stiff_bend,
+    const double* aPosIni, int ndim,
+    const unsigned int* aQuad,
+    const double* aXYZ,
+    unsigned int iq,
+    std::vector<int>& tmp_buffer)
+{
+  const unsigned int aIP[4] = { aQuad[iq*4+0], aQuad[iq*4+1], aQuad[iq*4+2], aQuad[iq*4+3] };
+  double C[4][3] = {{0,0,0},{0,0,0},{0,0,0},{0,0,0}};
+  double c[4][3];
+  for(int ino=0;ino<4;ino++){
+    const unsigned int ip = aIP[ino];
+    for(int i=0;i<ndim;i++){ C[ino][i] = aPosIni[ip*ndim+i]; }
+    for(int i=0;i<3;i++){ c[ino][i] = aXYZ [ip*3+i]; }
+  }
+  double e, de[4][3], dde[4][4][3][3];
+  dfm2::WdWddW_Bend( e,de,dde, C,c, stiff_bend );
+  // marge de
+  for(int ino=0;ino<4;ino++){
+    const unsigned int ip = aIP[ino];
+    for(int i =0;i<3;i++){ dW[ip*3+i] += de[ino][i]; }
+  }
+  // marge dde
+  ddW.Mearge(4, aIP, 4, aIP, 9, &dde[0][0][0][0], tmp_buffer);
+  return e;
+}
+
 // compute total energy and its first and second derivatives
 double dfm2::MergeLinSys_Cloth
 (CMatrixSparse<double>& ddW, // (out) second derivative of energy
@@ -580,57 +841,64 @@ double dfm2::MergeLinSys_Cloth
  const double* aXYZ
  )
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   double W = 0;
   std::vector<int> tmp_buffer(np,-1);
   
   // marge element in-plane strain energy
   for(int itri=0;itri<nTri;itri++){
-    const unsigned int aIP[3] = { aTri[itri*3+0], aTri[itri*3+1], aTri[itri*3+2] };
-    double C[3][3] = {{0,0,0},{0,0,0},{0,0,0}};
-    double c[3][3];
-    for(int ino=0;ino<3;ino++){
-      const unsigned int ip = aIP[ino];
-      for(int i=0;i<ndim;i++){ C[ino][i] = aPosIni[ip*ndim+i]; }
-      for(int i=0;i<3;i++){ c[ino][i] = aXYZ[ip*3+i]; }
-    }
-    double e, de[3][3], dde[3][3][3][3];
-    WdWddW_CST( e,de,dde, C,c, lambda,myu );
-    W += e;  // marge energy
-    // marge de
-    for(int ino=0;ino<3;ino++){
-      const unsigned int ip = aIP[ino];
-      for(int i =0;i<3;i++){ dW[ip*3+i] += de[ino][i]; }
-    }
-    // marge dde
-    ddW.Mearge(3, aIP, 3, aIP, 9, &dde[0][0][0][0], tmp_buffer);
+    W += MergeElem_Cloth_Tri(ddW,dW,
+                             lambda,myu,aPosIni,ndim,aTri,aXYZ,
+                             itri,tmp_buffer);
   }
 //  std::cout << "cst:" << W << std::endl;
   // marge element bending energy
   for(int iq=0;iq<nQuad;iq++){
-    const unsigned int aIP[4] = { aQuad[iq*4+0], aQuad[iq*4+1], aQuad[iq*4+2], aQuad[iq*4+3] };
-    double C[4][3] = {{0,0,0},{0,0,0},{0,0,0},{0,0,0}};
-    double c[4][3];
-    for(int ino=0;ino<4;ino++){
-      const unsigned int ip = aIP[ino];
-      for(int i=0;i<ndim;i++){ C[ino][i] = aPosIni[ip*ndim+i]; }
-      for(int i=0;i<3;i++){ c[ino][i] = aXYZ [ip*3+i]; }
-    }
-    double e, de[4][3], dde[4][4][3][3];
-    WdWddW_Bend( e,de,dde, C,c, stiff_bend );
-    W += e;  // marge energy
-    // marge de
-    for(int ino=0;ino<4;ino++){
-      const unsigned int ip = aIP[ino];
-      for(int i =0;i<3;i++){ dW[ip*3+i] += de[ino][i]; }
-    }
-    // marge dde
-    ddW.Mearge(4, aIP, 4, aIP, 9, &dde[0][0][0][0], tmp_buffer);
+    W += MergeElem_Cloth_Bend(ddW,dW,
+                              stiff_bend,aPosIni,ndim,aQuad,aXYZ,
+                              iq,tmp_buffer);
   }
   return W;
 }
 
-
-
+double dfm2::MergeLinSys_Cloth_Parallel
+(CMatrixSparse<double>& ddW,
+ double* dW,
+ ////
+ double lambda,
+ double myu,
+ double stiff_bend,
+ const double* aPosIni, int np, int ndim,
+ const unsigned int* aTri,
+ const std::vector<unsigned int>& tri_color_ind,
+ const std::vector<unsigned int>& tri_color_elem,
+ const unsigned int* aQuad,
+ const std::vector<unsigned int>& quad_color_ind,
+ const std::vector<unsigned int>& quad_color_elem,
+ unsigned int nthread,
+ const double* aXYZ)
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
+  // the energy is summed up in the element order after the merge, so it does not depend on the number of threads
+  std::vector<double> aWTri(tri_color_elem.size(),0.0);
+  std::vector<double> aWQuad(quad_color_elem.size(),0.0);
+  MergeElem_Colored(tri_color_ind,tri_color_elem,nthread,np,
+                    [&](unsigned int itri, std::vector<int>& tmp_buffer){
+    aWTri[itri] = MergeElem_Cloth_Tri(ddW,dW,
+                                      lambda,myu,aPosIni,ndim,aTri,aXYZ,
+                                      itri,tmp_buffer);
+  });
+  MergeElem_Colored(quad_color_ind,quad_color_elem,nthread,np,
+                    [&](unsigned int iq, std::vector<int>& tmp_buffer){
+    aWQuad[iq] = MergeElem_Cloth_Bend(ddW,dW,
+                                      stiff_bend,aPosIni,ndim,aQuad,aXYZ,
+                                      iq,tmp_buffer);
+  });
+  double W = 0;
+  for(double w : aWTri){ W += w; }
+  for(double w : aWQuad){ W += w; }
+  return W;
+}
 
 double dfm2::MergeLinSys_Contact(
     CMatrixSparse<double>& ddW,
@@ -642,6 +910,7 @@ double dfm2::MergeLinSys_Contact(
     const double* aXYZ,
     int nXYZ)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const unsigned int np = nXYZ;
   std::vector<int> tmp_buffer(np,-1);
   double W = 0;
@@ -770,6 +1039,53 @@ double dfm2::MergeLinSys_Contact(
  */
 
 
+static void MergeElem_SolidLinear_Static_Tet3D(
+    dfm2::CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double myu,
+    const double lambda,
+    const double rho,
+    const double *g,
+    const double* aXYZ,
+    const unsigned int* aTet,
+    const double* aDisp,
+    const dfm2::CMergePlan* plan,
+    unsigned int iel,
+    std::vector<int>& tmp_buffer)
+{
+  const unsigned int i0 = aTet[iel*4+0];
+  const unsigned int i1 = aTet[iel*4+1];
+  const unsigned int i2 = aTet[iel*4+2];
+  const unsigned int i3 = aTet[iel*4+3];
+  const unsigned int aIP[4] = { i0, i1, i2, i3 };
+  double P[4][3]; FetchData(&P[0][0], 4, 3, aIP, aXYZ);
+  double disps[4][3]; FetchData(&disps[0][0], 4, 3, aIP, aDisp);
+  //
+  double emat[4][4][3][3];
+  for(int i=0;i<144;++i){ (&emat[0][0][0][0])[i] = 0.0; } // zero-clear
+  double eres[4][3];
+  {
+    const double vol = TetVolume3D(P[0],P[1],P[2],P[3]);
+    for(auto & ere : eres){
+      ere[0] = vol*rho*g[0]*0.25;
+      ere[1] = vol*rho*g[1]*0.25;
+      ere[2] = vol*rho*g[2]*0.25;
+    }
+  }
+  dfm2::EMat_SolidLinear_Static_Tet(emat,eres,
+                                    myu, lambda,
+                                    P, disps,
+                                    true); // additive
+  for (int ino = 0; ino<4; ino++){
+    const unsigned int ip = aIP[ino];
+    vec_b[ip*3+0] += eres[ino][0];
+    vec_b[ip*3+1] += eres[ino][1];
+    vec_b[ip*3+2] += eres[ino][2];
+  }
+  MergeElemMat(mat_A, 4, aIP, 9, &emat[0][0][0][0],
+               plan, iel, tmp_buffer);
+}
+
 void dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D(
     CMatrixSparse<double>& mat_A,
     double* vec_b,
@@ -779,44 +1095,43 @@ void dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D(
     const double *g,
     const double* aXYZ, unsigned int nXYZ,
     const unsigned int* aTet, unsigned int nTet,
-    const double* aDisp)
+    const double* aDisp,
+    const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const unsigned int np = nXYZ;
   std::vector<int> tmp_buffer(np, -1);
   for (unsigned int iel = 0; iel<nTet; ++iel){
-    const unsigned int i0 = aTet[iel*4+0];
-    const unsigned int i1 = aTet[iel*4+1];
-    const unsigned int i2 = aTet[iel*4+2];
-    const unsigned int i3 = aTet[iel*4+3];
-    const unsigned int aIP[4] = { i0, i1, i2, i3 };
-    double P[4][3]; FetchData(&P[0][0], 4, 3, aIP, aXYZ);
-    double disps[4][3]; FetchData(&disps[0][0], 4, 3, aIP, aDisp);
-    //
-    double emat[4][4][3][3];
-    for(int i=0;i<144;++i){ (&emat[0][0][0][0])[i] = 0.0; } // zero-clear
-    double eres[4][3];
-    {
-      const double vol = TetVolume3D(P[0],P[1],P[2],P[3]);
-      for(auto & ere : eres){
-        ere[0] = vol*rho*g[0]*0.25;
-        ere[1] = vol*rho*g[1]*0.25;
-        ere[2] = vol*rho*g[2]*0.25;
-      }
-    }
-    EMat_SolidLinear_Static_Tet(emat,eres,
-                                myu, lambda,
-                                P, disps,
-                                true); // additive
-    for (int ino = 0; ino<4; ino++){
-      const unsigned int ip = aIP[ino];
-      vec_b[ip*3+0] += eres[ino][0];
-      vec_b[ip*3+1] += eres[ino][1];
-      vec_b[ip*3+2] += eres[ino][2];
-    }
-    mat_A.Mearge(4, aIP, 4, aIP, 9, &emat[0][0][0][0], tmp_buffer);
+    MergeElem_SolidLinear_Static_Tet3D(mat_A,vec_b,
+                                       myu,lambda,rho,g,aXYZ,aTet,aDisp,
+                                       plan,iel,tmp_buffer);
   }
 }
 
+void dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D_Parallel(
+    CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double myu,
+    const double lambda,
+    const double rho,
+    const double *g,
+    const double* aXYZ, unsigned int nXYZ,
+    const unsigned int* aTet,
+    const std::vector<unsigned int>& color_ind,
+    const std::vector<unsigned int>& color_elem,
+    unsigned int nthread,
+    const double* aDisp,
+    const CMergePlan* plan)
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
+  MergeElem_Colored(color_ind,color_elem,nthread,nXYZ,
+                    [&](unsigned int iel, std::vector<int>& tmp_buffer){
+    MergeElem_SolidLinear_Static_Tet3D(mat_A,vec_b,
+                                       myu,lambda,rho,g,aXYZ,aTet,aDisp,
+                                       plan,iel,tmp_buffer);
+  });
+}
+
 void dfm2::MergeLinSys_LinearSolid3D_Static_Q1(
     CMatrixSparse<double>& mat_A,
     std::vector<double>& vec_b,
@@ -830,6 +1145,7 @@ void dfm2::MergeLinSys_LinearSolid3D_Static_Q1(
     const std::vector<int>& aHex,
     const std::vector<double>& aVal)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = (int)aXYZ.size()/3;
   const int nDoF = np*3;
   ////
@@ -880,8 +1196,10 @@ void dfm2::MergeLinSys_SolidLinear_NewmarkBeta_MeshTet3D(
     const unsigned int* aTet, int nTet,
     const double* aVal,
     const double* aVelo,
-    const double* aAcc)
+    const double* aAcc,
+    const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXYZ;
   std::vector<int> tmp_buffer(np, -1);
   for (int iel = 0; iel<nTet; ++iel){
@@ -908,7 +1226,8 @@ void dfm2::MergeLinSys_SolidLinear_NewmarkBeta_MeshTet3D(
       vec_b[ip*3+1] += eres[ino][1];
       vec_b[ip*3+2] += eres[ino][2];
     }
-    mat_A.Mearge(4, aIP, 4, aIP, 9, &emat[0][0][0][0], tmp_buffer);
+    MergeElemMat(mat_A, 4, aIP, 9, &emat[0][0][0][0],
+                 plan, iel, tmp_buffer);
   }
 }
 
@@ -925,8 +1244,10 @@ void dfm2::MergeLinSys_SolidLinear_BEuler_MeshTet3D(
     const unsigned int* aTet,
     unsigned int nTet,
     const double* aDisp,
-    const double* aVelo)
+    const double* aVelo,
+    const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const unsigned int np = nXYZ;
   std::vector<int> tmp_buffer(np, -1);
   for(unsigned int iel=0; iel<nTet; ++iel){
@@ -972,7 +1293,8 @@ void dfm2::MergeLinSys_SolidLinear_BEuler_MeshTet3D(
       vec_b[ip*3+1] += eres[ino][1]/dt;
       vec_b[ip*3+2] += eres[ino][2]/dt;
     }
-    mat_A.Mearge(4, aIP, 4, aIP, 9, &emat[0][0][0][0], tmp_buffer);
+    MergeElemMat(mat_A, 4, aIP, 9, &emat[0][0][0][0],
+                 plan, iel, tmp_buffer);
   }
 }
 
@@ -989,8 +1311,10 @@ void dfm2::MergeLinSys_SolidStiffwarp_BEuler_MeshTet3D
  const unsigned int* aTet, int nTet,
  const double* aDisp,
  const double* aVelo,
- const std::vector<double>& aR)
+ const std::vector<double>& aR,
+ const CMergePlan* plan)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXYZ;
   assert((int)aR.size()==np*9);
   // ----------------------------
@@ -1056,7 +1380,78 @@ void dfm2::MergeLinSys_SolidStiffwarp_BEuler_MeshTet3D
       vec_b[ip*3+1] += eres[ino][1]/dt;
       vec_b[ip*3+2] += eres[ino][2]/dt;
     }
-    mat_A.Mearge(4, aIP, 4, aIP, 9, &emat[0][0][0][0], tmp_buffer);
+    MergeElemMat(mat_A, 4, aIP, 9, &emat[0][0][0][0],
+                 plan, iel, tmp_buffer);
+  }
+}
+
+dfm2::CMatrixFree_SolidStiffwarp_BEuler_MeshTet3D::CMatrixFree_SolidStiffwarp_BEuler_MeshTet3D
+(double myu, double lambda, double rho, double dt,
+ const double* aXYZ, unsigned int nXYZ,
+ const unsigned int* aTet, unsigned int nTet,
+ const double* aR,
+ const int* aBCFlag)
+ : myu(myu), lambda(lambda), rho(rho), dt(dt),
+   np(nXYZ), nTet(nTet), aTet(aTet), aR(aR), aBCFlag(aBCFlag)
+{
+  aDlDxVol.resize(nTet*13);
+  for(unsigned int iel=0;iel<nTet;++iel){
+    const unsigned int* aIP = aTet+iel*4;
+    double P[4][3]; FetchData(&P[0][0], 4, 3, aIP, aXYZ);
+    double dldx[4][3], const_term[4];
+    TetDlDx(dldx, const_term, P[0], P[1], P[2], P[3]);
+    for(int i=0;i<12;++i){ aDlDxVol[iel*13+i] = (&dldx[0][0])[i]; }
+    aDlDxVol[iel*13+12] = TetVolume3D(P[0], P[1], P[2], P[3]);
+  }
+  aX.resize(np*3);
+  aY.resize(np*3);
+}
+
+void dfm2::CMatrixFree_SolidStiffwarp_BEuler_MeshTet3D::MatVec
+(double* y,
+ double alpha, const double* x,
+ double beta) const
+{
+  const unsigned int ndof = np*3;
+  for(unsigned int i=0;i<ndof;++i){
+    aX[i] = ( aBCFlag != nullptr && aBCFlag[i] != 0 ) ? 0.0 : x[i];
+    aY[i] = 0.0;
+  }
+  for(unsigned int iel=0;iel<nTet;++iel){
+    const unsigned int* aIP = aTet+iel*4;
+    double dldx[4][3];
+    for(int i=0;i<12;++i){ (&dldx[0][0])[i] = aDlDxVol[iel*13+i]; }
+    const double vol = aDlDxVol[iel*13+12];
+    double emat0[4][4][3][3];
+    ddW_SolidLinear_Tet3D(&emat0[0][0][0][0],
+                          lambda, myu, vol, dldx, false, 3);
+    const double mass = rho*vol*0.25/(dt*dt);
+    for(int ino=0;ino<4;++ino){
+      const double* Mi = aR+aIP[ino]*9;
+      // [Mi][K0_ij][Mi]^T{x_j} (the warped stiffness matrix uses the rotation of the row)
+      double s[3] = {0,0,0};
+      for(int jno=0;jno<4;++jno){
+        const double* xj = aX.data()+aIP[jno]*3;
+        const double xl[3] = {
+          Mi[0]*xj[0] + Mi[3]*xj[1] + Mi[6]*xj[2],
+          Mi[1]*xj[0] + Mi[4]*xj[1] + Mi[7]*xj[2],
+          Mi[2]*xj[0] + Mi[5]*xj[1] + Mi[8]*xj[2] };
+        double kx[3]; MatVec3(kx, &emat0[ino][jno][0][0], xl);
+        s[0] += kx[0];
+        s[1] += kx[1];
+        s[2] += kx[2];
+      }
+      double yi[3]; MatVec3(yi, Mi, s);
+      const double* xi = aX.data()+aIP[ino]*3;
+      double* pyi = aY.data()+aIP[ino]*3;
+      pyi[0] += yi[0] + mass*xi[0];
+      pyi[1] += yi[1] + mass*xi[1];
+      pyi[2] += yi[2] + mass*xi[2];
+    }
+  }
+  for(unsigned int i=0;i<ndof;++i){
+    const double v = ( aBCFlag != nullptr && aBCFlag[i] != 0 ) ? x[i] : aY[i];
+    y[i] = alpha*v + beta*y[i];
   }
 }
 
@@ -1073,6 +1468,7 @@ void dfm2::MergeLinSys_Stokes3D_Static
  const std::vector<double>& aVal,
  const std::vector<double>& aVelo)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = (int)aXYZ.size()/3;
   const int nDoF = np*4;
   ////
@@ -1121,6 +1517,7 @@ void dfm2::MergeLinSys_Stokes3D_Dynamic
  const std::vector<double>& aVal,
  const std::vector<double>& aVelo)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = (int)aXYZ.size()/3;
   const int nDoF = np*4;
   ////
@@ -1169,6 +1566,7 @@ void dfm2::MergeLinSys_NavierStokes3D_Dynamic
  const std::vector<double>& aVal,
  const std::vector<double>& aVelo)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = (int)aXYZ.size()/3;
   const int nDoF = np*4;
   ////
@@ -1510,6 +1908,7 @@ void dfm2::MergeLinSys_ShellStaticPlateBendingMITC3_MeshTri2D(
     unsigned int nTri,
     const double* aVal)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_ASSEMBLY);
   const int np = nXY;
   std::vector<int> tmp_buffer(np, -1);
   for(unsigned int iel=0; iel<nTri; ++iel){
@@ -27,6 +27,10 @@
 
 namespace delfem2 {
 
+// The optional argument "plan" of the MergeLinSys_* functions is the merge plan initialized with
+// CMergePlan::Initialize() for the same mesh and the matrix. The element matrices are merged without
+// searching the pattern if it is given (nullptr uses CMatrixSparse::Mearge()).
+
 void MergeLinSys_Poission_MeshTri2D(
     CMatrixSparse<double>& mat_A,
     double* vec_b,
@@ -34,7 +38,29 @@ void MergeLinSys_Poission_MeshTri2D(
     const double source,
     const double* aXY1, int np,
     const unsigned int* aTri1, int nTri,
-    const double* aVal);
+    const double* aVal,
+    const CMergePlan* plan = nullptr);
+
+/**
+ * @brief multi-threaded version of MergeLinSys_Poission_MeshTri2D
+ * @param color_ind jagged array index of the elements grouped by colors (see JArray_ElemColor_MeshElem in mshtopo.h)
+ * @param color_elem jagged array value of the elements grouped by colors
+ * @param nthread number of threads
+ * @details the colors are merged one by one. The elements in the same color do not share a point,
+ * so they are merged concurrently. The result does not depend on the number of threads.
+ */
+void MergeLinSys_Poission_MeshTri2D_Parallel(
+    CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double alpha,
+    const double source,
+    const double* aXY1, int np,
+    const unsigned int* aTri1,
+    const std::vector<unsigned int>& color_ind,
+    const std::vector<unsigned int>& color_elem,
+    unsigned int nthread,
+    const double* aVal,
+    const CMergePlan* plan = nullptr);
 
 void MergeLinSys_Poission_MeshTet3D(
     CMatrixSparse<double>& mat_A,
@@ -43,7 +69,25 @@ void MergeLinSys_Poission_MeshTet3D(
     const double source,
     const double* aXYZ, int nXYZ,
     const unsigned int* aTet, int nTet,
-    const double* aVal);
+    const double* aVal,
+    const CMergePlan* plan = nullptr);
+
+/**
+ * @brief multi-threaded version of MergeLinSys_Poission_MeshTet3D
+ * @details see MergeLinSys_Poission_MeshTri2D_Parallel for the arguments
+ */
+void MergeLinSys_Poission_MeshTet3D_Parallel(
+    CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double alpha,
+    const double source,
+    const double* aXYZ, int nXYZ,
+    const unsigned int* aTet,
+    const std::vector<unsigned int>& color_ind,
+    const std::vector<unsigned int>& color_elem,
+    unsigned int nthread,
+    const double* aVal,
+    const CMergePlan* plan = nullptr);
 
 void MergeLinSys_Helmholtz_MeshTri2D(
     CMatrixSparse<std::complex<double> >& mat_A,
@@ -76,7 +120,8 @@ void MergeLinSys_Diffusion_MeshTri2D(
     const double* aXY1, int nXY,
     const unsigned int* aTri1, int nTri,
     const double* aVal,
-    const double* aVelo);
+    const double* aVelo,
+    const CMergePlan* plan = nullptr);
 
 void MergeLinSys_Diffusion_MeshTet3D(
     CMatrixSparse<double>& mat_A,
@@ -91,7 +136,8 @@ void MergeLinSys_Diffusion_MeshTet3D(
     const unsigned int* aTet,
     int nTet,
     const double* aVal,
-    const double* aVelo);
+    const double* aVelo,
+    const CMergePlan* plan = nullptr);
 
 void MergeLinSys_SolidLinear_Static_MeshTri2D(
     CMatrixSparse<double>& mat_A,
@@ -103,7 +149,28 @@ void MergeLinSys_SolidLinear_Static_MeshTri2D(
     const double g_y,
     const double* aXY1, int nXY,
     const unsigned int* aTri1, int nTri,
-    const double* aVal);
+    const double* aVal,
+    const CMergePlan* plan = nullptr);
+
+/**
+ * @brief multi-threaded version of MergeLinSys_SolidLinear_Static_MeshTri2D
+ * @details see MergeLinSys_Poission_MeshTri2D_Parallel for the arguments
+ */
+void MergeLinSys_SolidLinear_Static_MeshTri2D_Parallel(
+    CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double myu,
+    const double lambda,
+    const double rho,
+    const double g_x,
+    const double g_y,
+    const double* aXY1, int nXY,
+    const unsigned int* aTri1,
+    const std::vector<unsigned int>& color_ind,
+    const std::vector<unsigned int>& color_elem,
+    unsigned int nthread,
+    const double* aVal,
+    const CMergePlan* plan = nullptr);
 
 void MergeLinSys_SolidLinear_NewmarkBeta_MeshTri2D(
     CMatrixSparse<double>& mat_A,
@@ -120,7 +187,8 @@ void MergeLinSys_SolidLinear_NewmarkBeta_MeshTri2D(
     const unsigned int* aTri1, int nTri,
     const double* aVal,
     const double* aVelo,
-    const double* aAcc);
+    const double* aAcc,
+    const CMergePlan* plan = nullptr);
 
 void MergeLinSys_StokesStatic2D(
     CMatrixSparse<double>& mat_A,
@@ -172,6 +240,29 @@ double MergeLinSys_Cloth(
     const unsigned int* aQuad, int nQuad, // (in) index of 4 vertices required for bending
     const double* aXYZ);
 
+/**
+ * @brief multi-threaded version of MergeLinSys_Cloth
+ * @param tri_color_ind, tri_color_elem triangles grouped by colors (see JArray_ElemColor_MeshElem in mshtopo.h)
+ * @param quad_color_ind, quad_color_elem quads for bending grouped by colors
+ * @return total energy. it is summed up in the element order, so it does not depend on the number of threads
+ */
+double MergeLinSys_Cloth_Parallel(
+    CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    //
+    double lambda,
+    double myu,
+    double stiff_bend,
+    const double* aPosIni, int np, int ndim,
+    const unsigned int* aTri,
+    const std::vector<unsigned int>& tri_color_ind,
+    const std::vector<unsigned int>& tri_color_elem,
+    const unsigned int* aQuad,
+    const std::vector<unsigned int>& quad_color_ind,
+    const std::vector<unsigned int>& quad_color_elem,
+    unsigned int nthread,
+    const double* aXYZ);
+
 double MergeLinSys_Contact(
     CMatrixSparse<double>& ddW,
     double* dW, // (out) first derivative of energy
@@ -190,7 +281,27 @@ void MergeLinSys_SolidLinear_Static_MeshTet3D(
     const double *g,
     const double* aXYZ, unsigned int nXYZ,
     const unsigned int* aTet, unsigned int nTet,
-    const double* aDisp);
+    const double* aDisp,
+    const CMergePlan* plan = nullptr);
+
+/**
+ * @brief multi-threaded version of MergeLinSys_SolidLinear_Static_MeshTet3D
+ * @details see MergeLinSys_Poission_MeshTri2D_Parallel for the arguments
+ */
+void MergeLinSys_SolidLinear_Static_MeshTet3D_Parallel(
+    CMatrixSparse<double>& mat_A,
+    double* vec_b,
+    const double myu,
+    const double lambda,
+    const double rho,
+    const double *g,
+    const double* aXYZ, unsigned int nXYZ,
+    const unsigned int* aTet,
+    const std::vector<unsigned int>& color_ind,
+    const std::vector<unsigned int>& color_elem,
+    unsigned int nthread,
+    const double* aDisp,
+    const CMergePlan* plan = nullptr);
 
 void MergeLinSys_LinearSolid3D_Static_Q1(
     CMatrixSparse<double>& mat_A,
@@ -219,7 +330,8 @@ void MergeLinSys_SolidLinear_NewmarkBeta_MeshTet3D(
     const unsigned int* aTet, int nTet,
     const double* aVal,
     const double* aVelo,
-    const double* aAcc);
+    const double* aAcc,
+    const CMergePlan* plan = nullptr);
 
 void MergeLinSys_SolidLinear_BEuler_MeshTet3D(
     CMatrixSparse<double>& mat_A,
@@ -232,7 +344,8 @@ void MergeLinSys_SolidLinear_BEuler_MeshTet3D(
     const double* aXYZ, unsigned int nXYZ,
     const unsigned int* aTet, unsigned int nTet,
     const double* aDisp,
-    const double* aVelo);
+    const double* aVelo,
+    const CMergePlan* plan = nullptr);
 
 void MergeLinSys_SolidStiffwarp_BEuler_MeshTet3D(
     CMatrixSparse<double>& mat_A,
@@ -246,7 +359,49 @@ void MergeLinSys_SolidStiffwarp_BEuler_MeshTet3D(
     const unsigned int* aTet, int nTet,
     const double* aDisp,
     const double* aVelo,
-    const std::vector<double>& aR);
+    const std::vector<double>& aR,
+    const CMergePlan* plan = nullptr);
+
+/**
+ * @brief matrix-free operator of the linear system made by MergeLinSys_SolidStiffwarp_BEuler_MeshTet3D()
+ * @details MatVec() computes the product element-by-element, so the sparse matrix is not stored.
+ * Only the gradients of the shape functions and the volume of each tet are precomputed.
+ * This can be passed to the solvers in vecxitrsol.h (e.g., Solve_PBiCGStab()) as the matrix.
+ * The arrays given to the constructor are referred (not copied) in MatVec().
+ */
+class CMatrixFree_SolidStiffwarp_BEuler_MeshTet3D
+{
+public:
+  /**
+   * @param aR (in) rotation matrix (row-major 3x3) at each point
+   * @param aBCFlag (in) fixed dofs are the ones with non-zero flag. same as CMatrixSparse::SetFixedBC(). can be nullptr
+   */
+  CMatrixFree_SolidStiffwarp_BEuler_MeshTet3D(
+      double myu, double lambda, double rho, double dt,
+      const double* aXYZ, unsigned int nXYZ,
+      const unsigned int* aTet, unsigned int nTet,
+      const double* aR,
+      const int* aBCFlag);
+  /**
+   * @brief {y} = alpha*[A]{x} + beta*{y}
+   * @details the work vectors are stored in this class, so do not call this concurrently for the same instance
+   */
+  void MatVec(double* y,
+              double alpha, const double* x,
+              double beta) const;
+public:
+  double myu, lambda, rho, dt;
+  unsigned int np, nTet;
+  const unsigned int* aTet;
+  const double* aR;
+  const int* aBCFlag;
+  /**
+   * @param aDlDxVol gradients of the shape functions dldx[4][3] and the volume for each tet (13 values per tet)
+   */
+  std::vector<double> aDlDxVol;
+private:
+  mutable std::vector<double> aX, aY;
+};
 
 void MergeLinSys_Stokes3D_Static(
     CMatrixSparse<double>& mat_A,
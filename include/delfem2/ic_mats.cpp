@@ -0,0 +1,565 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+#include "delfem2/ic_mats.h"
+#include "delfem2/mshtopo.h"
+#include "delfem2/matn.hpp"
+#include "delfem2/mats_internal.h"
+#include "delfem2/thread.h"
+
+namespace dfm2 = delfem2;
+
+// -----------------------------------------------------
+
+template <typename T>
+void dfm2::CPreconditionerIC<T>::Initialize_ICk
+(const CMatrixSparse<T>& m,
+ int lev_fill,
+ bool is_multicolor)
+{
+  assert( m.nblk_col == m.nblk_row );
+  assert( m.len_col == m.len_row );
+  this->Initialize_Pattern(m.colInd.data(), m.rowPtr.data(),
+                           m.nblk_col, m.len_col,
+                           lev_fill, is_multicolor);
+}
+template void dfm2::CPreconditionerIC<float>::Initialize_ICk(const CMatrixSparse<float>& m, int lev_fill, bool is_multicolor);
+template void dfm2::CPreconditionerIC<double>::Initialize_ICk(const CMatrixSparse<double>& m, int lev_fill, bool is_multicolor);
+
+template <typename T>
+void dfm2::CPreconditionerIC<T>::Initialize_ICk
+(const CMatrixSparseSym<T>& m,
+ int lev_fill,
+ bool is_multicolor)
+{
+  this->Initialize_Pattern(m.colInd.data(), m.rowPtr.data(),
+                           m.nblk, m.len,
+                           lev_fill, is_multicolor);
+}
+template void dfm2::CPreconditionerIC<float>::Initialize_ICk(const CMatrixSparseSym<float>& m, int lev_fill, bool is_multicolor);
+template void dfm2::CPreconditionerIC<double>::Initialize_ICk(const CMatrixSparseSym<double>& m, int lev_fill, bool is_multicolor);
+
+// only the blocks in the upper triangle (jblk>iblk) of the input pattern are referred,
+// so the full pattern and the pattern of the upper triangle give the same result.
+// if(lev_fill < 0){ take all the fills }
+template <typename T>
+void dfm2::CPreconditionerIC<T>::Initialize_Pattern
+(const unsigned int* colind,
+ const unsigned int* rowptr,
+ unsigned int nblk,
+ unsigned int len,
+ int lev_fill,
+ bool is_multicolor)
+{
+  m_nblk = nblk;
+  m_len = len;
+  std::vector<unsigned int> psup_ind(nblk+1,0), psup;
+  { // symmetric adjacency of the blocks
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      for(unsigned int icrs=colind[iblk];icrs<colind[iblk+1];++icrs){
+        const unsigned int jblk = rowptr[icrs];
+        if( jblk <= iblk ){ continue; }
+        psup_ind[iblk+1] += 1;
+        psup_ind[jblk+1] += 1;
+      }
+    }
+    for(unsigned int iblk=0;iblk<nblk;++iblk){ psup_ind[iblk+1] += psup_ind[iblk]; }
+    psup.resize(psup_ind[nblk]);
+    std::vector<unsigned int> aCnt(psup_ind.begin(),psup_ind.end()-1);
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      for(unsigned int icrs=colind[iblk];icrs<colind[iblk+1];++icrs){
+        const unsigned int jblk = rowptr[icrs];
+        if( jblk <= iblk ){ continue; }
+        psup[aCnt[iblk]++] = jblk;
+        psup[aCnt[jblk]++] = iblk;
+      }
+    }
+  }
+  m_aNew2Old.clear();
+  m_aOld2New.clear();
+  m_vecTmp.clear();
+  if( is_multicolor ){
+    std::vector<unsigned int> color_ind;
+    Permutation_MultiColor(m_aNew2Old, color_ind,
+                           psup_ind, psup);
+    InversePermutation(m_aOld2New, m_aNew2Old);
+    JArray_Permute(psup_ind, psup, m_aNew2Old);
+    m_vecTmp.resize(nblk*len);
+  }
+  // symbolic factorization. the fill of the level lev(k,j)+lev(k,l)+1 is added to (j,l) eliminating the row k
+  std::vector< std::vector< std::pair<unsigned int,int> > > aRow(nblk); // (column,level) in the upper triangle
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    for(unsigned int ipsup=psup_ind[iblk];ipsup<psup_ind[iblk+1];++ipsup){
+      const unsigned int jblk = psup[ipsup];
+      if( jblk > iblk ){ aRow[iblk].emplace_back(jblk,0); }
+    }
+  }
+  if( lev_fill != 0 ){
+    for(unsigned int kblk=0;kblk<nblk;++kblk){
+      std::sort(aRow[kblk].begin(),aRow[kblk].end());
+      const std::vector< std::pair<unsigned int,int> >& rowk = aRow[kblk];
+      for(unsigned int ij=0;ij<rowk.size();++ij){
+        const unsigned int jblk = rowk[ij].first;
+        for(unsigned int il=ij+1;il<rowk.size();++il){
+          const unsigned int lblk = rowk[il].first;
+          const int lev = rowk[ij].second + rowk[il].second + 1;
+          if( lev_fill > 0 && lev > lev_fill ){ continue; }
+          std::vector< std::pair<unsigned int,int> >& rowj = aRow[jblk];
+          bool is_found = false;
+          for(auto& cl : rowj){
+            if( cl.first != lblk ){ continue; }
+            if( lev < cl.second ){ cl.second = lev; }
+            is_found = true;
+            break;
+          }
+          if( !is_found ){ rowj.emplace_back(lblk,lev); }
+        }
+      }
+    }
+  }
+  {
+    std::vector<unsigned int> colind_u(nblk+1,0), rowptr_u;
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      std::sort(aRow[iblk].begin(),aRow[iblk].end());
+      colind_u[iblk+1] = colind_u[iblk] + aRow[iblk].size();
+      for(const auto& cl : aRow[iblk]){ rowptr_u.push_back(cl.first); }
+    }
+    m_matU.Initialize(nblk, len);
+    m_matU.SetPattern(colind_u.data(), colind_u.size(),
+                      rowptr_u.data(), rowptr_u.size());
+  }
+  m_valD.assign(nblk*len*len, 0.0);
+  { // transposed pattern
+    const std::vector<unsigned int>& colindu = m_matU.colInd;
+    const std::vector<unsigned int>& rowptru = m_matU.rowPtr;
+    m_colIndT.assign(nblk+1,0);
+    for(unsigned int ijcrs=0;ijcrs<rowptru.size();++ijcrs){ m_colIndT[rowptru[ijcrs]+1] += 1; }
+    for(unsigned int iblk=0;iblk<nblk;++iblk){ m_colIndT[iblk+1] += m_colIndT[iblk]; }
+    m_rowPtrT.resize(rowptru.size());
+    m_crsT.resize(rowptru.size());
+    std::vector<unsigned int> aCnt(m_colIndT.begin(),m_colIndT.end()-1);
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      for(unsigned int ijcrs=colindu[iblk];ijcrs<colindu[iblk+1];++ijcrs){
+        const unsigned int jblk = rowptru[ijcrs];
+        m_rowPtrT[aCnt[jblk]] = iblk;
+        m_crsT[aCnt[jblk]] = ijcrs;
+        aCnt[jblk]++;
+      }
+    }
+  }
+  { // level schedule. the level of a row is one plus the maximum level of the rows it depends on
+    std::vector<unsigned int> aLev(nblk,0);
+    unsigned int nlev = 0;
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      unsigned int ilev = 0;
+      for(unsigned int it=m_colIndT[iblk];it<m_colIndT[iblk+1];++it){
+        const unsigned int kblk = m_rowPtrT[it];
+        if( aLev[kblk]+1 > ilev ){ ilev = aLev[kblk]+1; }
+      }
+      aLev[iblk] = ilev;
+      if( ilev+1 > nlev ){ nlev = ilev+1; }
+    }
+    dfm2::JArray_Level(m_levFwdInd, m_levFwdBlk, aLev, nlev);
+    nlev = 0;
+    for(unsigned int iblk=nblk;iblk-->0;){
+      unsigned int ilev = 0;
+      for(unsigned int ijcrs=m_matU.colInd[iblk];ijcrs<m_matU.colInd[iblk+1];++ijcrs){
+        const unsigned int jblk = m_matU.rowPtr[ijcrs];
+        if( aLev[jblk]+1 > ilev ){ ilev = aLev[jblk]+1; }
+      }
+      aLev[iblk] = ilev;
+      if( ilev+1 > nlev ){ nlev = ilev+1; }
+    }
+    dfm2::JArray_Level(m_levBwdInd, m_levBwdBlk, aLev, nlev);
+  }
+  this->Resize_Work();
+}
+template void dfm2::CPreconditionerIC<float>::Initialize_Pattern(const unsigned int* colind, const unsigned int* rowptr,
+                                                                 unsigned int nblk, unsigned int len,
+                                                                 int lev_fill, bool is_multicolor);
+template void dfm2::CPreconditionerIC<double>::Initialize_Pattern(const unsigned int* colind, const unsigned int* rowptr,
+                                                                  unsigned int nblk, unsigned int len,
+                                                                  int lev_fill, bool is_multicolor);
+
+template <typename T>
+void dfm2::CPreconditionerIC<T>::Resize_Work()
+{
+  m_aBuff.assign(m_nthread*m_nblk,-1);
+  m_aTmp.resize(m_nthread*2*m_len*m_len);
+}
+template void dfm2::CPreconditionerIC<float>::Resize_Work();
+template void dfm2::CPreconditionerIC<double>::Resize_Work();
+
+template <typename T>
+void dfm2::CPreconditionerIC<T>::SetNumThread(unsigned int nthread)
+{
+  m_nthread = (nthread==0) ? 1 : nthread;
+  if( m_nthread == 1 ){ m_pool.reset(); }
+  else if( !m_pool || m_pool->NumThread() != m_nthread ){
+    m_pool = std::make_shared<dfm2::CThreadPool>(m_nthread);
+  }
+  this->Resize_Work();
+}
+template void dfm2::CPreconditionerIC<float>::SetNumThread(unsigned int nthread);
+template void dfm2::CPreconditionerIC<double>::SetNumThread(unsigned int nthread);
+
+// -----------------------------------------------------
+
+// the block (i,j) of the upper triangle in the original order goes to (i',j') in the new order.
+// if i'>j', the transposed block is stored at (j',i').
+template <typename T>
+void dfm2::CPreconditionerIC<T>::SetValue_Upper
+(const unsigned int* colind,
+ const unsigned int* rowptr,
+ const T* valcrs,
+ const T* valdia)
+{
+  const unsigned int nblk = m_nblk;
+  const unsigned int len = m_len;
+  const unsigned int blksize = len*len;
+  const bool is_perm = !m_aOld2New.empty();
+  m_matU.SetZero();
+  for(unsigned int iblk0=0;iblk0<nblk;++iblk0){
+    const unsigned int iblk1 = is_perm ? m_aOld2New[iblk0] : iblk0;
+    for(unsigned int i=0;i<blksize;++i){ m_matU.valDia[iblk1*blksize+i] = valdia[iblk0*blksize+i]; }
+    for(unsigned int icrs=colind[iblk0];icrs<colind[iblk0+1];++icrs){
+      const unsigned int jblk0 = rowptr[icrs];
+      if( jblk0 <= iblk0 ){ continue; }
+      const unsigned int jblk1 = is_perm ? m_aOld2New[jblk0] : jblk0;
+      const bool is_trans = (iblk1 > jblk1);
+      const unsigned int ib = is_trans ? jblk1 : iblk1;
+      const unsigned int jb = is_trans ? iblk1 : jblk1;
+      const auto itr0 = m_matU.rowPtr.begin()+m_matU.colInd[ib];
+      const auto itr1 = m_matU.rowPtr.begin()+m_matU.colInd[ib+1];
+      const auto itr = std::lower_bound(itr0,itr1,jb);
+      assert( itr != itr1 && *itr == jb );
+      T* pout = m_matU.valCrs.data() + (itr-m_matU.rowPtr.begin())*blksize;
+      const T* pin = valcrs + icrs*blksize;
+      if( !is_trans ){
+        for(unsigned int i=0;i<blksize;++i){ pout[i] = pin[i]; }
+      }
+      else{
+        for(unsigned int i=0;i<len;++i){
+          for(unsigned int j=0;j<len;++j){ pout[i*len+j] = pin[j*len+i]; }
+        }
+      }
+    }
+  }
+}
+template void dfm2::CPreconditionerIC<float>::SetValue_Upper(const unsigned int* colind, const unsigned int* rowptr,
+                                                             const float* valcrs, const float* valdia);
+template void dfm2::CPreconditionerIC<double>::SetValue_Upper(const unsigned int* colind, const unsigned int* rowptr,
+                                                              const double* valcrs, const double* valdia);
+
+template <typename T>
+void dfm2::CPreconditionerIC<T>::SetValueIC
+(const CMatrixSparse<T>& m)
+{
+  assert( m.nblk_col == m_nblk && m.len_col == m_len );
+  assert( !m.valDia.empty() );
+  this->SetValue_Upper(m.colInd.data(), m.rowPtr.data(),
+                       m.valCrs.data(), m.valDia.data());
+}
+template void dfm2::CPreconditionerIC<float>::SetValueIC(const CMatrixSparse<float>& m);
+template void dfm2::CPreconditionerIC<double>::SetValueIC(const CMatrixSparse<double>& m);
+
+template <typename T>
+void dfm2::CPreconditionerIC<T>::SetValueIC
+(const CMatrixSparseSym<T>& m)
+{
+  assert( m.nblk == m_nblk && m.len == m_len );
+  this->SetValue_Upper(m.colInd.data(), m.rowPtr.data(),
+                       m.valCrs.data(), m.valDia.data());
+}
+template void dfm2::CPreconditionerIC<float>::SetValueIC(const CMatrixSparseSym<float>& m);
+template void dfm2::CPreconditionerIC<double>::SetValueIC(const CMatrixSparseSym<double>& m);
+
+// -----------------------------------------------------
+
+// factorize the block row iblk (left-looking). The rows kblk<iblk with the block (kblk,iblk) need to be factorized.
+// [D_i] = [A_ii] - sum_k [U_ki]^T[D_k][U_ki]
+// [U_ij] = [D_i]^-1 ([A_ij] - sum_k [U_ki]^T[D_k][U_kj])
+// buff: size of nblk filled with -1, tmp: size of 2*len*len
+template <typename T, unsigned int N>
+static bool DoICDecomp_Row
+(unsigned int iblk,
+ int* buff,
+ T* tmp,
+ dfm2::CMatrixSparseSym<T>& matU,
+ T* valD,
+ const std::vector<unsigned int>& colIndT,
+ const std::vector<unsigned int>& rowPtrT,
+ const std::vector<unsigned int>& crsT)
+{
+  const unsigned int len = (N==0) ? matU.len : N;
+  const unsigned int blksize = len*len;
+  const unsigned int* colind = matU.colInd.data();
+  const unsigned int* rowptr = matU.rowPtr.data();
+  T* vcrs = matU.valCrs.data();
+  T* vdia = matU.valDia.data();
+  for(unsigned int ijcrs=colind[iblk];ijcrs<colind[iblk+1];++ijcrs){ buff[rowptr[ijcrs]] = ijcrs; }
+  T* di = vdia+iblk*blksize;
+  for(unsigned int it=colIndT[iblk];it<colIndT[iblk+1];++it){
+    const unsigned int kblk = rowPtrT[it];
+    const T* uki = vcrs+crsT[it]*blksize;
+    const T* dk = valD+kblk*blksize;
+    for(unsigned int a=0;a<len;++a){ // tmp = [U_ki]^T[D_k]
+      for(unsigned int b=0;b<len;++b){
+        T s = uki[a]*dk[b];
+        for(unsigned int c=1;c<len;++c){ s += uki[c*len+a]*dk[c*len+b]; }
+        tmp[a*len+b] = s;
+      }
+    }
+    if( N != 0 ){ dfm2::MatMatSub<T,N>(di,tmp,uki); }
+    else{
+      for(unsigned int a=0;a<len;++a){
+        for(unsigned int b=0;b<len;++b){
+          T s = tmp[a*len]*uki[b];
+          for(unsigned int c=1;c<len;++c){ s += tmp[a*len+c]*uki[c*len+b]; }
+          di[a*len+b] -= s;
+        }
+      }
+    }
+    for(unsigned int kjcrs=colind[kblk];kjcrs<colind[kblk+1];++kjcrs){
+      const unsigned int jblk = rowptr[kjcrs];
+      if( buff[jblk] < 0 ){ continue; } // jblk is not in the row iblk (dropped)
+      const T* ukj = vcrs+kjcrs*blksize;
+      T* wij = vcrs+buff[jblk]*blksize;
+      if( N != 0 ){ dfm2::MatMatSub<T,N>(wij,tmp,ukj); continue; }
+      for(unsigned int a=0;a<len;++a){
+        for(unsigned int b=0;b<len;++b){
+          T s = tmp[a*len]*ukj[b];
+          for(unsigned int c=1;c<len;++c){ s += tmp[a*len+c]*ukj[c*len+b]; }
+          wij[a*len+b] -= s;
+        }
+      }
+    }
+  }
+  for(unsigned int ijcrs=colind[iblk];ijcrs<colind[iblk+1];++ijcrs){ buff[rowptr[ijcrs]] = -1; }
+  for(unsigned int i=0;i<blksize;++i){ valD[iblk*blksize+i] = di[i]; }
+  const int info = dfm2::InverseMat_Blk<T,N>(di,len);
+  if( info != 0 ){ return false; }
+  for(unsigned int ijcrs=colind[iblk];ijcrs<colind[iblk+1];++ijcrs){ // [U_ij] = [D_i]^-1[W_ij]
+    T* uij = vcrs+ijcrs*blksize;
+    for(unsigned int i=0;i<blksize;++i){ tmp[i] = uij[i]; }
+    for(unsigned int a=0;a<len;++a){
+      for(unsigned int b=0;b<len;++b){
+        T s = di[a*len]*tmp[b];
+        for(unsigned int c=1;c<len;++c){ s += di[a*len+c]*tmp[c*len+b]; }
+        uij[a*len+b] = s;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename T, unsigned int N>
+static void DoICDecomp_Blk
+(bool& is_success,
+ int* aBuff,
+ T* aTmp,
+ dfm2::CMatrixSparseSym<T>& matU,
+ std::vector<T>& valD,
+ const std::vector<unsigned int>& colIndT,
+ const std::vector<unsigned int>& rowPtrT,
+ const std::vector<unsigned int>& crsT,
+ const std::vector<unsigned int>& levInd,
+ const std::vector<unsigned int>& levBlk,
+ dfm2::CThreadPool* pool)
+{
+  const unsigned int nblk = matU.nblk;
+  const unsigned int blksize = matU.len*matU.len;
+  if( pool == nullptr ){
+    is_success = true;
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      const bool res = DoICDecomp_Row<T,N>(iblk,aBuff,aTmp,
+                                           matU,valD.data(),colIndT,rowPtrT,crsT);
+      if( !res ){ is_success = false; }
+    }
+    return;
+  }
+  const unsigned int nthread = pool->NumThread();
+  std::atomic<bool> is_fail(false);
+  dfm2::CBarrier barrier(nthread);
+  pool->Run([&](unsigned int ith){
+    int* buff = aBuff+ith*nblk; // filled with -1
+    T* tmp = aTmp+ith*blksize*2;
+    for(unsigned int ilev=0;ilev+1<levInd.size();++ilev){
+      const unsigned long long n = levInd[ilev+1]-levInd[ilev];
+      const unsigned int ib0 = levInd[ilev] + (unsigned int)(n*ith/nthread);
+      const unsigned int ib1 = levInd[ilev] + (unsigned int)(n*(ith+1)/nthread);
+      for(unsigned int ib=ib0;ib<ib1;++ib){
+        const bool res = DoICDecomp_Row<T,N>(levBlk[ib],buff,tmp,
+                                             matU,valD.data(),colIndT,rowPtrT,crsT);
+        if( !res ){ is_fail = true; }
+      }
+      barrier.Wait();
+    }
+  });
+  is_success = !is_fail;
+}
+
+template <typename T>
+bool dfm2::CPreconditionerIC<T>::DoICDecomp()
+{
+  bool is_success = false;
+  assert( m_aBuff.size() >= m_nthread*m_nblk && m_aTmp.size() >= m_nthread*2*m_len*m_len );
+  dfm2::CThreadPool* pool = (m_nthread > 1) ? m_pool.get() : nullptr;
+  DFM2_DISPATCH_BLK(DoICDecomp_Blk, m_len,
+                    is_success, m_aBuff.data(), m_aTmp.data(),
+                    m_matU, m_valD, m_colIndT, m_rowPtrT, m_crsT,
+                    m_levFwdInd, m_levFwdBlk, pool)
+  return is_success;
+}
+template bool dfm2::CPreconditionerIC<float>::DoICDecomp();
+template bool dfm2::CPreconditionerIC<double>::DoICDecomp();
+
+// -----------------------------------------------------
+
+// forward substitution for the block row iblk: {z_i} = {b_i} - sum_k [U_ki]^T{z_k}
+template <typename T, unsigned int N>
+static inline void ForwardSubstitution_Row
+(T* vec,
+ unsigned int iblk,
+ const dfm2::CMatrixSparseSym<T>& matU,
+ const std::vector<unsigned int>& colIndT,
+ const std::vector<unsigned int>& rowPtrT,
+ const std::vector<unsigned int>& crsT)
+{
+  const unsigned int len = (N==0) ? matU.len : N;
+  const unsigned int blksize = len*len;
+  const T* vcrs = matU.valCrs.data();
+  T* vi = vec+iblk*len;
+  for(unsigned int it=colIndT[iblk];it<colIndT[iblk+1];++it){
+    const T* uki = vcrs+crsT[it]*blksize;
+    const T* vk = vec+rowPtrT[it]*len;
+    for(unsigned int j=0;j<len;++j){
+      T s = uki[j]*vk[0];
+      for(unsigned int i=1;i<len;++i){ s += uki[i*len+j]*vk[i]; }
+      vi[j] -= s;
+    }
+  }
+}
+
+// backward substitution for the block row iblk: {x_i} = [D_i]^-1{z_i} - sum_j [U_ij]{x_j}
+template <typename T, unsigned int N>
+static inline void BackwardSubstitution_Row
+(T* vec,
+ unsigned int iblk,
+ T* tmp,
+ const dfm2::CMatrixSparseSym<T>& matU)
+{
+  const unsigned int len = (N==0) ? matU.len : N;
+  const unsigned int blksize = len*len;
+  const unsigned int* colind = matU.colInd.data();
+  const unsigned int* rowptr = matU.rowPtr.data();
+  const T* vcrs = matU.valCrs.data();
+  const T* dinv = matU.valDia.data()+iblk*blksize;
+  T* vi = vec+iblk*len;
+  for(unsigned int i=0;i<len;++i){
+    T s = dinv[i*len]*vi[0];
+    for(unsigned int j=1;j<len;++j){ s += dinv[i*len+j]*vi[j]; }
+    tmp[i] = s;
+  }
+  for(unsigned int ijcrs=colind[iblk];ijcrs<colind[iblk+1];++ijcrs){
+    const T* uij = vcrs+ijcrs*blksize;
+    const T* vj = vec+rowptr[ijcrs]*len;
+    if( N != 0 ){ dfm2::MatVecSub<T,N>(tmp,uij,vj); continue; }
+    for(unsigned int i=0;i<len;++i){
+      T s = uij[i*len]*vj[0];
+      for(unsigned int j=1;j<len;++j){ s += uij[i*len+j]*vj[j]; }
+      tmp[i] -= s;
+    }
+  }
+  for(unsigned int i=0;i<len;++i){ vi[i] = tmp[i]; }
+}
+
+template <typename T, unsigned int N>
+static void Solve_Blk
+(T* vec,
+ T* aTmp,
+ const dfm2::CMatrixSparseSym<T>& matU,
+ const std::vector<unsigned int>& colIndT,
+ const std::vector<unsigned int>& rowPtrT,
+ const std::vector<unsigned int>& crsT,
+ const std::vector<unsigned int>& levfwd_ind,
+ const std::vector<unsigned int>& levfwd_blk,
+ const std::vector<unsigned int>& levbwd_ind,
+ const std::vector<unsigned int>& levbwd_blk,
+ dfm2::CThreadPool* pool)
+{
+  const unsigned int nblk = matU.nblk;
+  if( pool == nullptr ){
+    T tmp0[(N==0) ? 1 : N]; // on the stack for the fixed block size
+    T* tmp = (N==0) ? aTmp : tmp0;
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      ForwardSubstitution_Row<T,N>(vec,iblk,matU,colIndT,rowPtrT,crsT);
+    }
+    for(unsigned int iblk=nblk;iblk-->0;){
+      BackwardSubstitution_Row<T,N>(vec,iblk,tmp,matU);
+    }
+    return;
+  }
+  const unsigned int nthread = pool->NumThread();
+  dfm2::CBarrier barrier(nthread);
+  pool->Run([&](unsigned int ith){
+    T tmp0[(N==0) ? 1 : N];
+    T* tmp = (N==0) ? aTmp+ith*matU.len : tmp0;
+    for(unsigned int ilev=0;ilev+1<levfwd_ind.size();++ilev){
+      const unsigned long long n = levfwd_ind[ilev+1]-levfwd_ind[ilev];
+      const unsigned int ib0 = levfwd_ind[ilev] + (unsigned int)(n*ith/nthread);
+      const unsigned int ib1 = levfwd_ind[ilev] + (unsigned int)(n*(ith+1)/nthread);
+      for(unsigned int ib=ib0;ib<ib1;++ib){
+        ForwardSubstitution_Row<T,N>(vec,levfwd_blk[ib],matU,colIndT,rowPtrT,crsT);
+      }
+      barrier.Wait();
+    }
+    for(unsigned int ilev=0;ilev+1<levbwd_ind.size();++ilev){
+      const unsigned long long n = levbwd_ind[ilev+1]-levbwd_ind[ilev];
+      const unsigned int ib0 = levbwd_ind[ilev] + (unsigned int)(n*ith/nthread);
+      const unsigned int ib1 = levbwd_ind[ilev] + (unsigned int)(n*(ith+1)/nthread);
+      for(unsigned int ib=ib0;ib<ib1;++ib){
+        BackwardSubstitution_Row<T,N>(vec,levbwd_blk[ib],tmp,matU);
+      }
+      barrier.Wait();
+    }
+  });
+}
+
+template <typename T>
+void dfm2::CPreconditionerIC<T>::Solve
+(T* vec) const
+{
+  const unsigned int len = m_len;
+  T* v = vec;
+  if( !m_aNew2Old.empty() ){ // to the new order
+    assert( m_vecTmp.size() == m_nblk*len );
+    for(unsigned int iblk1=0;iblk1<m_nblk;++iblk1){
+      const unsigned int iblk0 = m_aNew2Old[iblk1];
+      for(unsigned int i=0;i<len;++i){ m_vecTmp[iblk1*len+i] = vec[iblk0*len+i]; }
+    }
+    v = m_vecTmp.data();
+  }
+  assert( m_aTmp.size() >= m_nthread*len );
+  dfm2::CThreadPool* pool = (m_nthread > 1) ? m_pool.get() : nullptr;
+  DFM2_DISPATCH_BLK(Solve_Blk, len,
+                    v, m_aTmp.data(), m_matU, m_colIndT, m_rowPtrT, m_crsT,
+                    m_levFwdInd, m_levFwdBlk, m_levBwdInd, m_levBwdBlk, pool)
+  if( !m_aNew2Old.empty() ){ // back to the original order
+    for(unsigned int iblk1=0;iblk1<m_nblk;++iblk1){
+      const unsigned int iblk0 = m_aNew2Old[iblk1];
+      for(unsigned int i=0;i<len;++i){ vec[iblk0*len+i] = m_vecTmp[iblk1*len+i]; }
+    }
+  }
+}
+template void dfm2::CPreconditionerIC<float>::Solve(float* vec) const;
+template void dfm2::CPreconditionerIC<double>::Solve(double* vec) const;
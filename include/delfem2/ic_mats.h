@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * @file ic_mats.h
+ * @brief incomplete Cholesky preconditioner for the symmetric positive definite CMatrixSparse
+ */
+
+#ifndef DFM2_IC_MATS_H
+#define DFM2_IC_MATS_H
+
+#include <vector>
+
+#include "delfem2/mats.h"
+
+namespace delfem2 {
+
+/**
+ * @class block incomplete Cholesky (IC(0) and IC(k)) preconditioner
+ * @tparam T float or double
+ * @details The matrix is factorized as [A] ~ [U]^T[D][U] where [U] is the unit upper block triangular matrix.
+ * Only [U] and [D]^-1 are stored, so the memory and the work are about the half of CPreconditionerILU.
+ * The lifecycle is the same as CPreconditionerILU: Initialize_IC0() or Initialize_ICk() computes the pattern,
+ * SetValueIC() copies the values of the matrix, DoICDecomp() factorizes and Solve() applies the preconditioner.
+ * With the multicolor ordering, the blocks are renumbered color by color inside this class (the input and output
+ * of Solve() are in the original order). The rows in the same color are independent for IC(0), so the
+ * factorization and the substitutions are parallelized over the rows in each color with SetNumThread().
+ */
+template <typename T>
+class CPreconditionerIC
+{
+public:
+  CPreconditionerIC() : m_nthread(1), m_nblk(0), m_len(0) {}
+  /**
+   * @brief IC(0). The pattern of the factor is the upper triangle of the matrix
+   * @param is_multicolor reorder the blocks with the multicolor ordering
+   */
+  void Initialize_IC0(const CMatrixSparse<T>& m, bool is_multicolor=false){
+    this->Initialize_ICk(m, 0, is_multicolor);
+  }
+  void Initialize_IC0(const CMatrixSparseSym<T>& m, bool is_multicolor=false){
+    this->Initialize_ICk(m, 0, is_multicolor);
+  }
+  /**
+   * @brief IC(k) with the fill-in up to the level lev_fill
+   */
+  void Initialize_ICk(const CMatrixSparse<T>& m, int lev_fill, bool is_multicolor=false);
+  void Initialize_ICk(const CMatrixSparseSym<T>& m, int lev_fill, bool is_multicolor=false);
+  /**
+   * @brief copy the values of the matrix. The matrix needs to have the same pattern as the one passed to Initialize_*()
+   * @details only the upper triangle of CMatrixSparse is referred
+   */
+  void SetValueIC(const CMatrixSparse<T>& m);
+  void SetValueIC(const CMatrixSparseSym<T>& m);
+  /**
+   * @return false if a pivot block is singular
+   */
+  bool DoICDecomp();
+  /**
+   * @brief {vec} = [M]^-1{vec}
+   * @details the work vector is stored in this class, so do not call this concurrently for the same instance
+   */
+  void Solve(T* vec) const;
+  /**
+   * @brief use nthread threads in DoICDecomp() and Solve(). nthread=1 (default) is serial.
+   * @details the worker threads are created here once and reused in every DoICDecomp() and Solve() (see CThreadPool)
+   */
+  void SetNumThread(unsigned int nthread);
+  /**
+   * @brief number of levels in the forward substitution (the number of colors for IC(0) with the multicolor ordering)
+   */
+  unsigned int NumLevel() const {
+    return m_levFwdInd.empty() ? 0 : (unsigned int)m_levFwdInd.size()-1;
+  }
+private:
+  void Initialize_Pattern(const unsigned int* colind, const unsigned int* rowptr,
+                          unsigned int nblk, unsigned int len,
+                          int lev_fill, bool is_multicolor);
+  void SetValue_Upper(const unsigned int* colind, const unsigned int* rowptr,
+                      const T* valcrs, const T* valdia);
+  void Resize_Work();
+public:
+  /**
+   * @param m_nthread number of threads used in DoICDecomp() and Solve()
+   */
+  unsigned int m_nthread;
+  /**
+   * @param m_pool worker threads used in DoICDecomp() and Solve() (null if m_nthread==1)
+   */
+  std::shared_ptr<CThreadPool> m_pool;
+  unsigned int m_nblk, m_len;
+  /**
+   * @param m_aNew2Old, m_aOld2New the permutation of the blocks (empty if the blocks are not reordered)
+   */
+  std::vector<unsigned int> m_aNew2Old, m_aOld2New;
+  /**
+   * @param m_matU the pattern and the values of [U] in the new order. valDia stores [D]^-1
+   * @param m_valD the pivot blocks [D]
+   */
+  CMatrixSparseSym<T> m_matU;
+  std::vector<T> m_valD;
+  /**
+   * @param m_colIndT, m_rowPtrT, m_crsT transposed pattern of [U] (the blocks in each block column and their index in valCrs)
+   */
+  std::vector<unsigned int> m_colIndT, m_rowPtrT, m_crsT;
+  /**
+   * @param m_levFwdInd, m_levFwdBlk jagged array of the block rows for each level of the forward substitution
+   * @param m_levBwdInd, m_levBwdBlk jagged array of the block rows for each level of the backward substitution
+   */
+  std::vector<unsigned int> m_levFwdInd, m_levFwdBlk;
+  std::vector<unsigned int> m_levBwdInd, m_levBwdBlk;
+private:
+  mutable std::vector<T> m_vecTmp;
+  /**
+   * @param m_aBuff, m_aTmp work buffers of each thread (size: m_nthread*m_nblk filled with -1, m_nthread*2*m_len*m_len)
+   */
+  std::vector<int> m_aBuff;
+  mutable std::vector<T> m_aTmp;
+};
+
+} // end namespace delfem2
+
+#endif
@@ -10,15 +10,21 @@
 #include <cmath>
 #include <vector>
 #include <complex>
+#include <algorithm>
 
 #include "delfem2/ilu_mats.h"
+#include "delfem2/matn.hpp"
+#include "delfem2/mats_internal.h"
+#include "delfem2/thread.h"
+#include "delfem2/instrument.h"
 
 typedef std::complex<double> COMPLEX;
 namespace dfm2 = delfem2;
 
 // ----------------------------------------------------
 
-static void CalcMatPr(double* out, const double* d, double* tmp,
+template <typename REAL>
+static void CalcMatPr(REAL* out, const REAL* d, REAL* tmp,
                       const unsigned int ni, const unsigned int nj )
 {
 	unsigned int i,j,k;
@@ -35,7 +41,8 @@ static void CalcMatPr(double* out, const double* d, double* tmp,
 	}
 }
 
-static void CalcSubMatPr(double* out, const double* a, const double* b,
+template <typename REAL>
+static void CalcSubMatPr(REAL* out, const REAL* a, const REAL* b,
                          const int ni, const int nk, const int nj )
 {
 	int i,j,k;
@@ -49,40 +56,6 @@ static void CalcSubMatPr(double* out, const double* a, const double* b,
 }
 
 
-static void CalcInvMat(
-    double* a,
-    const unsigned int n,
-    int& info )
-{
-	double tmp1;
-  
-	info = 0;
-	unsigned int i,j,k;
-	for(i=0;i<n;i++){
-		if( fabs(a[i*n+i]) < 1.0e-30 ){
-			info = 1;
-			return;
-		}
-		if( a[i*n+i] < 0.0 ){
-			info--;
-		}
-		tmp1 = 1.0 / a[i*n+i];
-		a[i*n+i] = 1.0;
-		for(k=0;k<n;k++){
-			a[i*n+k] *= tmp1;
-		}
-		for(j=0;j<n;j++){
-			if( j!=i ){
-				tmp1 = a[j*n+i];
-				a[j*n+i] = 0.0;
-				for(k=0;k<n;k++){
-					a[j*n+k] -= tmp1*a[i*n+k];
-				}
-			}
-		}
-	}
-}
-
 // t is a tmporary buffer size of 9
 static inline void CalcInvMat3(double a[], double t[] )
 {
@@ -119,6 +92,83 @@ delfem2::CPreconditionerILU<T>::CPreconditionerILU(const CPreconditionerILU<T>&
   for(int iblk=0;iblk<nblk;++iblk){
     this->m_diaInd[iblk] = p.m_diaInd[iblk];
   }
+  this->m_nthread = p.m_nthread;
+  this->m_pool = p.m_pool;
+  this->m_aTmp = p.m_aTmp;
+  this->m_levFwdInd = p.m_levFwdInd;
+  this->m_levFwdBlk = p.m_levFwdBlk;
+  this->m_levBwdInd = p.m_levBwdInd;
+  this->m_levBwdBlk = p.m_levBwdBlk;
+}
+
+// -------------------------------------------------------------------
+
+// ILU factorization with the block size N fixed at compile time
+// N=0 means the size is given at runtime
+template <typename T, unsigned int N>
+static bool DoILUDecomp_Blk
+(dfm2::CMatrixSparse<T>& mat,
+ const unsigned int* diaind)
+{
+  const int nmax_sing = 10;
+  int icnt_sing = 0;
+  const unsigned int len = (N==0) ? mat.len_col : N;
+  const unsigned int blksize = len*len;
+  const unsigned int nblk = mat.nblk_col;
+  const unsigned int* colind = mat.colInd.data();
+  const unsigned int* rowptr = mat.rowPtr.data();
+  T* vcrs = mat.valCrs.data();
+  T* vdia = mat.valDia.data();
+  std::vector<int> row2crs(nblk,-1);
+  std::vector<T> aTmpBlk(blksize);
+  T* tmpBlk = aTmpBlk.data();
+  for(unsigned int iblk=0;iblk<nblk;iblk++){
+    for(unsigned int ijcrs=colind[iblk];ijcrs<colind[iblk+1];ijcrs++){
+      const unsigned int jblk0 = rowptr[ijcrs]; assert( jblk0<nblk );
+      row2crs[jblk0] = ijcrs;
+    }
+    // [L] * [D^-1*U]
+    for(unsigned int ikcrs=colind[iblk];ikcrs<diaind[iblk];ikcrs++){
+      const unsigned int kblk = rowptr[ikcrs]; assert( kblk<nblk );
+      const T* vik = vcrs+ikcrs*blksize;
+      for(unsigned int kjcrs=diaind[kblk];kjcrs<colind[kblk+1];kjcrs++){
+        const unsigned int jblk0 = rowptr[kjcrs]; assert( jblk0<nblk );
+        const T* vkj = vcrs+kjcrs*blksize;
+        T* vij = nullptr;
+        if( jblk0 != iblk ){
+          const int ijcrs0 = row2crs[jblk0];
+          if( ijcrs0 == -1 ){ continue; }
+          vij = vcrs+ijcrs0*blksize;
+        }
+        else{
+          vij = vdia+iblk*blksize;
+        }
+        if( N != 0 ){ dfm2::MatMatSub<T,N>(vij,vik,vkj); }
+        else{ CalcSubMatPr(vij,vik,vkj, len,len,len); }
+      }
+    }
+    const int info = dfm2::InverseMat_Blk<T,N>(vdia+iblk*blksize,len);
+    if( info == 1 ){
+      std::cout << "frac false" << iblk << std::endl;
+      icnt_sing++;
+      if( icnt_sing > nmax_sing ){ return false; }
+    }
+    // [U] = [1/D][U]
+    const T* vii = vdia+iblk*blksize;
+    for(unsigned int ijcrs=diaind[iblk];ijcrs<colind[iblk+1];ijcrs++){
+      T* vij = vcrs+ijcrs*blksize;
+      if( N != 0 ){
+        for(unsigned int i=0;i<blksize;i++){ tmpBlk[i] = vij[i]; }
+        dfm2::MatMat<T,N>(vij,vii,tmpBlk);
+      }
+      else{ CalcMatPr(vij,vii,tmpBlk, len,len); }
+    }
+    for(unsigned int ijcrs=colind[iblk];ijcrs<colind[iblk+1];ijcrs++){
+      const unsigned int jblk0 = rowptr[ijcrs]; assert( jblk0<nblk );
+      row2crs[jblk0] = -1;
+    }
+  }
+  return true;
 }
 
 // -------------------------------------------------------------------
@@ -129,6 +179,7 @@ namespace delfem2{
 template <>
 bool CPreconditionerILU<double>::DoILUDecomp()
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_FACTORIZE);
   const int nmax_sing = 10;
 	int icnt_sing = 0;
   
@@ -329,7 +380,14 @@ bool CPreconditionerILU<double>::DoILUDecomp()
 		}	// end iblk
 	}
   // ------------------------------------------------------------------------
-	else{	// lenBlk >= 4
+  else if( len == 4 ){
+    return DoILUDecomp_Blk<double,4>(mat,m_diaInd.data());
+  }
+  else if( len == 6 ){
+    return DoILUDecomp_Blk<double,6>(mat,m_diaInd.data());
+  }
+  // ------------------------------------------------------------------------
+	else{	// other block sizes
     const unsigned int blksize = len*len;
 		auto* pTmpBlk = new double [blksize];
 		for(unsigned int iblk=0;iblk<nblk;iblk++){
@@ -360,8 +418,7 @@ bool CPreconditionerILU<double>::DoILUDecomp()
 			}
 			{
 				double* vii = &vdia[iblk*blksize];
-				int info = 0;
-				CalcInvMat(vii,len,info);
+				const int info = dfm2::InverseMat_Blk<double,0>(vii,len);
 				if( info==1 ){
 					std::cout << "frac false" << iblk << std::endl;
 					icnt_sing++;
@@ -389,10 +446,26 @@ bool CPreconditionerILU<double>::DoILUDecomp()
 	return true;
 }
 
+// numerical factorization
+template <>
+bool CPreconditionerILU<float>::DoILUDecomp()
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_FACTORIZE);
+  switch( mat.len_col ){
+    case 1: return DoILUDecomp_Blk<float,1>(mat,m_diaInd.data());
+    case 2: return DoILUDecomp_Blk<float,2>(mat,m_diaInd.data());
+    case 3: return DoILUDecomp_Blk<float,3>(mat,m_diaInd.data());
+    case 4: return DoILUDecomp_Blk<float,4>(mat,m_diaInd.data());
+    case 6: return DoILUDecomp_Blk<float,6>(mat,m_diaInd.data());
+    default: return DoILUDecomp_Blk<float,0>(mat,m_diaInd.data());
+  }
+}
+
 // numerical factorization
 template <>
 bool CPreconditionerILU<COMPLEX>::DoILUDecomp()
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_FACTORIZE);
 //  const int nmax_sing = 10;
 //  int icnt_sing = 0;
   
@@ -468,296 +541,376 @@ bool CPreconditionerILU<COMPLEX>::DoILUDecomp()
 
 // -----------------------------------------------------
 
+// forward substitution for the iblk-th block row
+// N is the block size fixed at compile time. N=0 means the size is given at runtime.
+// tmp is a buffer with size of the block size
+template <typename T, unsigned int N>
+static inline void ForwardSubstitution_Row
+(T* vec,
+ unsigned int iblk,
+ T* tmp,
+ const dfm2::CMatrixSparse<T>& mat,
+ const unsigned int* diaind)
+{
+  const unsigned int len = (N==0) ? mat.len_col : N;
+  const unsigned int blksize = len*len;
+  const unsigned int* colind = mat.colInd.data();
+  const unsigned int* rowptr = mat.rowPtr.data();
+  const T* vcrs = mat.valCrs.data();
+  const T* vdia = mat.valDia.data();
+  for(unsigned int idof=0;idof<len;idof++){ tmp[idof] = vec[iblk*len+idof]; }
+  for(unsigned int ijcrs=colind[iblk];ijcrs<diaind[iblk];ijcrs++){
+    assert( ijcrs<mat.rowPtr.size() );
+    const unsigned int jblk0 = rowptr[ijcrs];
+    assert( jblk0<iblk );
+    const T* vij = vcrs+ijcrs*blksize;
+    const T* vj = vec+jblk0*len;
+    if( N != 0 ){ dfm2::MatVecSub<T,N>(tmp,vij,vj); continue; }
+    for(unsigned int idof=0;idof<len;idof++){
+      T s = vij[idof*len]*vj[0];
+      for(unsigned int jdof=1;jdof<len;jdof++){ s += vij[idof*len+jdof]*vj[jdof]; }
+      tmp[idof] -= s;
+    }
+  }
+  const T* vii = vdia+iblk*blksize;
+  for(unsigned int idof=0;idof<len;idof++){
+    T s = vii[idof*len]*tmp[0];
+    for(unsigned int jdof=1;jdof<len;jdof++){ s += vii[idof*len+jdof]*tmp[jdof]; }
+    vec[iblk*len+idof] = s;
+  }
+}
+
+// backward substitution for the iblk-th block row
+template <typename T, unsigned int N>
+static inline void BackwardSubstitution_Row
+(T* vec,
+ unsigned int iblk,
+ T* tmp,
+ const dfm2::CMatrixSparse<T>& mat,
+ const unsigned int* diaind)
+{
+  const unsigned int len = (N==0) ? mat.len_col : N;
+  const unsigned int blksize = len*len;
+  const unsigned int* colind = mat.colInd.data();
+  const unsigned int* rowptr = mat.rowPtr.data();
+  const T* vcrs = mat.valCrs.data();
+  for(unsigned int idof=0;idof<len;idof++){ tmp[idof] = vec[iblk*len+idof]; }
+  for(unsigned int ijcrs=diaind[iblk];ijcrs<colind[iblk+1];ijcrs++){
+    assert( ijcrs<mat.rowPtr.size() );
+    const unsigned int jblk0 = rowptr[ijcrs];
+    assert( jblk0>iblk && jblk0<mat.nblk_col );
+    const T* vij = vcrs+ijcrs*blksize;
+    const T* vj = vec+jblk0*len;
+    if( N != 0 ){ dfm2::MatVecSub<T,N>(tmp,vij,vj); continue; }
+    for(unsigned int idof=0;idof<len;idof++){
+      T s = vij[idof*len]*vj[0];
+      for(unsigned int jdof=1;jdof<len;jdof++){ s += vij[idof*len+jdof]*vj[jdof]; }
+      tmp[idof] -= s;
+    }
+  }
+  for(unsigned int idof=0;idof<len;idof++){ vec[iblk*len+idof] = tmp[idof]; }
+}
+
+template <typename T, unsigned int N>
+static void ForwardSubstitution_Blk
+(T* vec,
+ T* aTmp,
+ const dfm2::CMatrixSparse<T>& mat,
+ const unsigned int* diaind)
+{
+  T tmp0[(N==0) ? 1 : N]; // on the stack for the fixed block size
+  T* tmp = (N==0) ? aTmp : tmp0;
+  const unsigned int nblk = mat.nblk_col;
+  for(unsigned int iblk=0;iblk<nblk;iblk++){
+    ForwardSubstitution_Row<T,N>(vec,iblk,tmp,mat,diaind);
+  }
+}
+
+template <typename T, unsigned int N>
+static void BackwardSubstitution_Blk
+(T* vec,
+ T* aTmp,
+ const dfm2::CMatrixSparse<T>& mat,
+ const unsigned int* diaind)
+{
+  T tmp0[(N==0) ? 1 : N]; // on the stack for the fixed block size
+  T* tmp = (N==0) ? aTmp : tmp0;
+  const unsigned int nblk = mat.nblk_col;
+  for(unsigned int iblk=nblk;iblk-->0;){
+    BackwardSubstitution_Row<T,N>(vec,iblk,tmp,mat,diaind);
+  }
+}
+
 template <typename T>
 void delfem2::CPreconditionerILU<T>::ForwardSubstitution
 ( T* vec ) const
 {
-  const unsigned int len = mat.len_col;
+  assert( m_aTmp.size() >= mat.len_col );
+  DFM2_DISPATCH_BLK(ForwardSubstitution_Blk, mat.len_col, vec, m_aTmp.data(), mat, m_diaInd.data())
+}
+template void dfm2::CPreconditionerILU<double>::ForwardSubstitution( double* vec ) const;
+template void dfm2::CPreconditionerILU<float>::ForwardSubstitution( float* vec ) const;
+template void dfm2::CPreconditionerILU<COMPLEX>::ForwardSubstitution( COMPLEX* vec ) const;
+
+template <typename T>
+void delfem2::CPreconditionerILU<T>::BackwardSubstitution
+( T* vec ) const
+{
+  assert( m_aTmp.size() >= mat.len_col );
+  DFM2_DISPATCH_BLK(BackwardSubstitution_Blk, mat.len_col, vec, m_aTmp.data(), mat, m_diaInd.data())
+}
+template void dfm2::CPreconditionerILU<double>::BackwardSubstitution(  double* vec ) const;
+template void dfm2::CPreconditionerILU<float>::BackwardSubstitution(  float* vec ) const;
+template void dfm2::CPreconditionerILU<COMPLEX>::BackwardSubstitution( COMPLEX* vec ) const;
+
+// -----------------------------------------------------
+
+// level of a block row is one plus the maximum level of the rows it depends on.
+// the rows in the same level can be substituted concurrently
+template <typename T>
+void delfem2::CPreconditionerILU<T>::MakeLevelSchedule()
+{
   const unsigned int nblk = mat.nblk_col;
-  
-  if( len == 1 ){
-    const unsigned int* colind = mat.colInd.data();
-    const unsigned int* rowptr = mat.rowPtr.data();
-    const T* vcrs = mat.valCrs.data();
-    const T* vdia = mat.valDia.data();
-    // -------------------------
-    for(unsigned int iblk=0;iblk<nblk;iblk++){
-      T lvec_i = vec[iblk];
-      for(unsigned int ijcrs=colind[iblk];ijcrs<m_diaInd[iblk];ijcrs++){
-        assert( ijcrs<mat.rowPtr.size() );
-        const int jblk0 = rowptr[ijcrs];
-        assert( jblk0<(int)iblk );
-        lvec_i -= vcrs[ijcrs]*vec[jblk0];
-      }
-      vec[iblk] = vdia[iblk]*lvec_i;
+  std::vector<unsigned int> aLev(nblk,0);
+  unsigned int nlev = 0;
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    unsigned int ilev = 0;
+    for(unsigned int ijcrs=mat.colInd[iblk];ijcrs<m_diaInd[iblk];++ijcrs){
+      const unsigned int jblk0 = mat.rowPtr[ijcrs];
+      assert( jblk0 < iblk );
+      if( aLev[jblk0]+1 > ilev ){ ilev = aLev[jblk0]+1; }
     }
+    aLev[iblk] = ilev;
+    if( ilev+1 > nlev ){ nlev = ilev+1; }
   }
-  else if( len == 2 ){
-    const unsigned int* colind = mat.colInd.data();
-    const unsigned int* rowptr = mat.rowPtr.data();
-    const T* vcrs = mat.valCrs.data();
-    const T* vdia = mat.valDia.data();
-    // ------------------------
-    T pTmpVec[2];
-    for(unsigned int iblk=0;iblk<nblk;iblk++){
-      pTmpVec[0] = vec[iblk*2+0];
-      pTmpVec[1] = vec[iblk*2+1];
-      const unsigned int icrs0 = colind[iblk];
-      const unsigned int icrs1 = m_diaInd[iblk];
-      for(unsigned int ijcrs=icrs0;ijcrs<icrs1;ijcrs++){
-        assert( ijcrs<mat.rowPtr.size() );
-        const int jblk0 = rowptr[ijcrs];
-        assert( jblk0<(int)iblk );
-        const T* vij = &vcrs[ijcrs*4];
-        const T valj0 = vec[jblk0*2+0];
-        const T valj1 = vec[jblk0*2+1];
-        pTmpVec[0] -= vij[0]*valj0+vij[1]*valj1;
-        pTmpVec[1] -= vij[2]*valj0+vij[3]*valj1;
-      }
-      const T* vii = &vdia[iblk*4];
-      vec[iblk*2+0] = vii[0]*pTmpVec[0]+vii[1]*pTmpVec[1];
-      vec[iblk*2+1] = vii[2]*pTmpVec[0]+vii[3]*pTmpVec[1];
+  dfm2::JArray_Level(m_levFwdInd, m_levFwdBlk, aLev, nlev);
+  // ------
+  nlev = 0;
+  for(unsigned int iblk=nblk;iblk-->0;){
+    unsigned int ilev = 0;
+    for(unsigned int ijcrs=m_diaInd[iblk];ijcrs<mat.colInd[iblk+1];++ijcrs){
+      const unsigned int jblk0 = mat.rowPtr[ijcrs];
+      assert( jblk0 > iblk && jblk0 < nblk );
+      if( aLev[jblk0]+1 > ilev ){ ilev = aLev[jblk0]+1; }
     }
+    aLev[iblk] = ilev;
+    if( ilev+1 > nlev ){ nlev = ilev+1; }
   }
-  else if( len == 3 ){
-    const unsigned int* colind = mat.colInd.data();
-    const unsigned int* rowptr = mat.rowPtr.data();
-    const T* vcrs = mat.valCrs.data();
-    const T* vdia = mat.valDia.data();
-    // -------------------------
-    T pTmpVec[3];
-    for(unsigned int iblk=0;iblk<nblk;iblk++){
-      pTmpVec[0] = vec[iblk*3+0];
-      pTmpVec[1] = vec[iblk*3+1];
-      pTmpVec[2] = vec[iblk*3+2];
-      const unsigned int icrs0 = colind[iblk];
-      const unsigned int icrs1 = m_diaInd[iblk];
-      for(unsigned int ijcrs=icrs0;ijcrs<icrs1;ijcrs++){
-        assert( ijcrs<mat.rowPtr.size() );
-        const int jblk0 = rowptr[ijcrs];
-        assert( jblk0<(int)iblk );
-        const T* vij = &vcrs[ijcrs*9];
-        const T valj0 = vec[jblk0*3+0];
-        const T valj1 = vec[jblk0*3+1];
-        const T valj2 = vec[jblk0*3+2];
-        pTmpVec[0] -= vij[0]*valj0+vij[1]*valj1+vij[2]*valj2;
-        pTmpVec[1] -= vij[3]*valj0+vij[4]*valj1+vij[5]*valj2;
-        pTmpVec[2] -= vij[6]*valj0+vij[7]*valj1+vij[8]*valj2;
-      }
-      const T* vii = &vdia[iblk*9];
-      vec[iblk*3+0] = vii[0]*pTmpVec[0]+vii[1]*pTmpVec[1]+vii[2]*pTmpVec[2];
-      vec[iblk*3+1] = vii[3]*pTmpVec[0]+vii[4]*pTmpVec[1]+vii[5]*pTmpVec[2];
-      vec[iblk*3+2] = vii[6]*pTmpVec[0]+vii[7]*pTmpVec[1]+vii[8]*pTmpVec[2];
-    }
+  dfm2::JArray_Level(m_levBwdInd, m_levBwdBlk, aLev, nlev);
+  m_aTmp.resize(m_nthread*mat.len_col);
+}
+template void dfm2::CPreconditionerILU<double>::MakeLevelSchedule();
+template void dfm2::CPreconditionerILU<float>::MakeLevelSchedule();
+template void dfm2::CPreconditionerILU<COMPLEX>::MakeLevelSchedule();
+
+template <typename T>
+void delfem2::CPreconditionerILU<T>::SetNumThread(unsigned int nthread)
+{
+  m_nthread = (nthread==0) ? 1 : nthread;
+  if( m_nthread == 1 ){ m_pool.reset(); }
+  else if( !m_pool || m_pool->NumThread() != m_nthread ){
+    m_pool = std::make_shared<dfm2::CThreadPool>(m_nthread);
   }
-  else if (len==4){
-    const unsigned int* colind = mat.colInd.data();
-    const unsigned int* rowptr = mat.rowPtr.data();
-    const T* vcrs = mat.valCrs.data();
-    const T* vdia = mat.valDia.data();
-    // ------------
-    T pTmpVec[4];
-    for (unsigned int iblk = 0; iblk<nblk; iblk++){
-      pTmpVec[0] = vec[iblk*4+0];
-      pTmpVec[1] = vec[iblk*4+1];
-      pTmpVec[2] = vec[iblk*4+2];
-      pTmpVec[3] = vec[iblk*4+3];
-      const unsigned int icrs0 = colind[iblk];
-      const unsigned int icrs1 = m_diaInd[iblk];
-      for (unsigned int ijcrs = icrs0; ijcrs<icrs1; ijcrs++){
-        assert(ijcrs<mat.rowPtr.size());
-        const int jblk0 = rowptr[ijcrs];
-        assert(jblk0<(int)iblk);
-        const T* vij = &vcrs[ijcrs*16];
-        const T valj0 = vec[jblk0*4+0];
-        const T valj1 = vec[jblk0*4+1];
-        const T valj2 = vec[jblk0*4+2];
-        const T valj3 = vec[jblk0*4+3];
-        pTmpVec[0] -= vij[ 0]*valj0+vij[ 1]*valj1+vij[ 2]*valj2+vij[ 3]*valj3;
-        pTmpVec[1] -= vij[ 4]*valj0+vij[ 5]*valj1+vij[ 6]*valj2+vij[ 7]*valj3;
-        pTmpVec[2] -= vij[ 8]*valj0+vij[ 9]*valj1+vij[10]*valj2+vij[11]*valj3;
-        pTmpVec[3] -= vij[12]*valj0+vij[13]*valj1+vij[14]*valj2+vij[15]*valj3;
+  m_aTmp.resize(m_nthread*mat.len_col);
+}
+template void dfm2::CPreconditionerILU<double>::SetNumThread(unsigned int nthread);
+template void dfm2::CPreconditionerILU<float>::SetNumThread(unsigned int nthread);
+template void dfm2::CPreconditionerILU<COMPLEX>::SetNumThread(unsigned int nthread);
+
+template <typename T, unsigned int N>
+static void Solve_LevelSchedule_Blk
+(T* vec,
+ T* aTmp,
+ const dfm2::CMatrixSparse<T>& mat,
+ const unsigned int* diaind,
+ const std::vector<unsigned int>& levfwd_ind,
+ const std::vector<unsigned int>& levfwd_blk,
+ const std::vector<unsigned int>& levbwd_ind,
+ const std::vector<unsigned int>& levbwd_blk,
+ dfm2::CThreadPool& pool)
+{
+  const unsigned int nthread = pool.NumThread();
+  dfm2::CBarrier barrier(nthread);
+  pool.Run([&](unsigned int ith){
+    T tmp0[(N==0) ? 1 : N]; // on the stack for the fixed block size
+    T* tmp = (N==0) ? aTmp+ith*mat.len_col : tmp0;
+    for(unsigned int ilev=0;ilev+1<levfwd_ind.size();++ilev){
+      const unsigned long long n = levfwd_ind[ilev+1]-levfwd_ind[ilev];
+      const unsigned int ib0 = levfwd_ind[ilev] + (unsigned int)(n*ith/nthread);
+      const unsigned int ib1 = levfwd_ind[ilev] + (unsigned int)(n*(ith+1)/nthread);
+      for(unsigned int ib=ib0;ib<ib1;++ib){
+        ForwardSubstitution_Row<T,N>(vec,levfwd_blk[ib],tmp,mat,diaind);
       }
-      const T* vii = &vdia[iblk*16];
-      vec[iblk*4+0] = vii[ 0]*pTmpVec[0]+vii[ 1]*pTmpVec[1]+vii[ 2]*pTmpVec[2]+vii[ 3]*pTmpVec[3];
-      vec[iblk*4+1] = vii[ 4]*pTmpVec[0]+vii[ 5]*pTmpVec[1]+vii[ 6]*pTmpVec[2]+vii[ 7]*pTmpVec[3];
-      vec[iblk*4+2] = vii[ 8]*pTmpVec[0]+vii[ 9]*pTmpVec[1]+vii[10]*pTmpVec[2]+vii[11]*pTmpVec[3];
-      vec[iblk*4+3] = vii[12]*pTmpVec[0]+vii[13]*pTmpVec[1]+vii[14]*pTmpVec[2]+vii[15]*pTmpVec[3];
+      barrier.Wait();
     }
-  }
-  else{
-    const int blksize = len*len;
-    std::vector<T> pTmpVec(len);
-    for(unsigned int iblk=0;iblk<nblk;iblk++){
-      for(unsigned int idof=0;idof<len;idof++){
-        pTmpVec[idof] = vec[iblk*len+idof];
-      }
-      for(unsigned int ijcrs=mat.colInd[iblk];ijcrs<m_diaInd[iblk];ijcrs++){
-        assert( ijcrs<mat.rowPtr.size() );
-        const int jblk0 = mat.rowPtr[ijcrs];
-        assert( jblk0<(int)iblk );
-        const T* vij = &mat.valCrs[ijcrs*blksize];
-        for(unsigned int idof=0;idof<len;idof++){
-          for(unsigned int jdof=0;jdof<len;jdof++){
-            pTmpVec[idof] -= vij[idof*len+jdof]*vec[jblk0*len+jdof];
-          }
-        }
-      }
-      const T* vii = &mat.valDia[iblk*blksize];
-      for(unsigned int idof=0;idof<len;idof++){
-        T dtmp1 = 0.0;
-        for(unsigned int jdof=0;jdof<len;jdof++){
-          dtmp1 += vii[idof*len+jdof]*pTmpVec[jdof];
-        }
-        vec[iblk*len+idof] = dtmp1;
+    for(unsigned int ilev=0;ilev+1<levbwd_ind.size();++ilev){
+      const unsigned long long n = levbwd_ind[ilev+1]-levbwd_ind[ilev];
+      const unsigned int ib0 = levbwd_ind[ilev] + (unsigned int)(n*ith/nthread);
+      const unsigned int ib1 = levbwd_ind[ilev] + (unsigned int)(n*(ith+1)/nthread);
+      for(unsigned int ib=ib0;ib<ib1;++ib){
+        BackwardSubstitution_Row<T,N>(vec,levbwd_blk[ib],tmp,mat,diaind);
       }
+      barrier.Wait();
     }
-  }
+  });
 }
-template void dfm2::CPreconditionerILU<double>::ForwardSubstitution( double* vec ) const;
-template void dfm2::CPreconditionerILU<COMPLEX>::ForwardSubstitution( COMPLEX* vec ) const;
 
 template <typename T>
-void delfem2::CPreconditionerILU<T>::BackwardSubstitution
+void delfem2::CPreconditionerILU<T>::Solve_LevelSchedule
 ( T* vec ) const
 {
-  const unsigned int len = mat.len_col;
-  const int nblk = mat.nblk_col;
-  
-  if( len == 1 ){
-    const unsigned int* colind = mat.colInd.data();
-    const unsigned int* rowptr = mat.rowPtr.data();
-    const T* vcrs = mat.valCrs.data();
-    // -------------------------------
-    for(int iblk=nblk-1;iblk>=0;iblk--){
-      assert( (int)iblk < nblk );
-      T lvec_i = vec[iblk];
-      for(unsigned int ijcrs=m_diaInd[iblk];ijcrs<colind[iblk+1];ijcrs++){
-        assert( ijcrs<mat.rowPtr.size() );
-        const int jblk0 = rowptr[ijcrs];
-        assert( jblk0>(int)iblk && jblk0<nblk );
-        lvec_i -= vcrs[ijcrs]*vec[jblk0];
+  assert( m_levFwdInd.size() >= 1 && m_levBwdInd.size() >= 1 );
+  assert( m_pool && m_pool->NumThread() == m_nthread );
+  assert( m_aTmp.size() >= m_nthread*mat.len_col );
+  DFM2_DISPATCH_BLK(Solve_LevelSchedule_Blk, mat.len_col,
+                    vec, m_aTmp.data(), mat, m_diaInd.data(),
+                    m_levFwdInd, m_levFwdBlk, m_levBwdInd, m_levBwdBlk, *m_pool)
+}
+template void dfm2::CPreconditionerILU<double>::Solve_LevelSchedule( double* vec ) const;
+template void dfm2::CPreconditionerILU<float>::Solve_LevelSchedule( float* vec ) const;
+template void dfm2::CPreconditionerILU<COMPLEX>::Solve_LevelSchedule( COMPLEX* vec ) const;
+
+// forward substitution for the iblk-th block row of the nvec interleaved vectors
+// tmp is a buffer with size of len*nvec
+template <typename T, unsigned int N>
+static inline void ForwardSubstitutionMulti_Row
+(T* vec,
+ unsigned int nvec,
+ unsigned int iblk,
+ T* tmp,
+ const dfm2::CMatrixSparse<T>& mat,
+ const unsigned int* diaind)
+{
+  const unsigned int len = (N==0) ? mat.len_col : N;
+  const unsigned int blksize = len*len;
+  const unsigned int* colind = mat.colInd.data();
+  const unsigned int* rowptr = mat.rowPtr.data();
+  const T* vcrs = mat.valCrs.data();
+  T* vi = vec+iblk*len*nvec;
+  for(unsigned int i=0;i<len*nvec;i++){ tmp[i] = vi[i]; }
+  for(unsigned int ijcrs=colind[iblk];ijcrs<diaind[iblk];ijcrs++){
+    assert( rowptr[ijcrs]<iblk );
+    const T* vij = vcrs+ijcrs*blksize;
+    const T* vj = vec+rowptr[ijcrs]*len*nvec;
+    for(unsigned int idof=0;idof<len;idof++){
+      T* ti = tmp+idof*nvec;
+      for(unsigned int jdof=0;jdof<len;jdof++){
+        const T a = vij[idof*len+jdof];
+        const T* vjj = vj+jdof*nvec;
+        for(unsigned int ivec=0;ivec<nvec;ivec++){ ti[ivec] -= a*vjj[ivec]; } // contiguous in ivec for the vectorization
       }
-      vec[iblk] = lvec_i;
     }
   }
-  else if( len == 2 ){
-    const unsigned int* colind = mat.colInd.data();
-    const unsigned int* rowptr = mat.rowPtr.data();
-    const T* vcrs = mat.valCrs.data();
-    // ----------------------------
-    T pTmpVec[2];
-    for(int iblk=nblk-1;iblk>=0;iblk--){
-      assert( (int)iblk < nblk );
-      pTmpVec[0] = vec[iblk*2+0];
-      pTmpVec[1] = vec[iblk*2+1];
-      const unsigned int icrs0 = m_diaInd[iblk];
-      const unsigned int icrs1 = colind[iblk+1];
-      for(unsigned int ijcrs=icrs0;ijcrs<icrs1;ijcrs++){
-        assert( ijcrs<mat.rowPtr.size() );
-        const int jblk0 = rowptr[ijcrs];
-        assert( jblk0>(int)iblk && jblk0<nblk );
-        const T* vij = &vcrs[ijcrs*4];
-        const T valj0 = vec[jblk0*2+0];
-        const T valj1 = vec[jblk0*2+1];
-        pTmpVec[0] -= vij[0]*valj0+vij[1]*valj1;
-        pTmpVec[1] -= vij[2]*valj0+vij[3]*valj1;
-      }
-      vec[iblk*2+0] = pTmpVec[0];
-      vec[iblk*2+1] = pTmpVec[1];
+  const T* vii = mat.valDia.data()+iblk*blksize;
+  for(unsigned int idof=0;idof<len;idof++){
+    T* vid = vi+idof*nvec;
+    for(unsigned int ivec=0;ivec<nvec;ivec++){ vid[ivec] = vii[idof*len]*tmp[ivec]; }
+    for(unsigned int jdof=1;jdof<len;jdof++){
+      const T a = vii[idof*len+jdof];
+      const T* tj = tmp+jdof*nvec;
+      for(unsigned int ivec=0;ivec<nvec;ivec++){ vid[ivec] += a*tj[ivec]; }
     }
   }
-  else if( len == 3 ){
-    const unsigned int* colind = mat.colInd.data();
-    const unsigned int* rowptr = mat.rowPtr.data();
-    const T* vcrs = mat.valCrs.data();
-    // --------------------
-    T pTmpVec[3];
-    for(int iblk=nblk-1;iblk>=0;iblk--){
-      assert( (int)iblk < nblk );
-      pTmpVec[0] = vec[iblk*3+0];
-      pTmpVec[1] = vec[iblk*3+1];
-      pTmpVec[2] = vec[iblk*3+2];
-      const int icrs0 = m_diaInd[iblk];
-      const unsigned int icrs1 = colind[iblk+1];
-      for(unsigned int ijcrs=icrs0;ijcrs<icrs1;ijcrs++){
-        assert( ijcrs<mat.rowPtr.size() );
-        const int jblk0 = rowptr[ijcrs];
-        assert( jblk0>(int)iblk && jblk0<nblk );
-        const T* vij = &vcrs[ijcrs*9];
-        const T valj0 = vec[jblk0*3+0];
-        const T valj1 = vec[jblk0*3+1];
-        const T valj2 = vec[jblk0*3+2];
-        pTmpVec[0] -= vij[0]*valj0+vij[1]*valj1+vij[2]*valj2;
-        pTmpVec[1] -= vij[3]*valj0+vij[4]*valj1+vij[5]*valj2;
-        pTmpVec[2] -= vij[6]*valj0+vij[7]*valj1+vij[8]*valj2;
+}
+
+// backward substitution for the iblk-th block row of the nvec interleaved vectors
+template <typename T, unsigned int N>
+static inline void BackwardSubstitutionMulti_Row
+(T* vec,
+ unsigned int nvec,
+ unsigned int iblk,
+ const dfm2::CMatrixSparse<T>& mat,
+ const unsigned int* diaind)
+{
+  const unsigned int len = (N==0) ? mat.len_col : N;
+  const unsigned int blksize = len*len;
+  const unsigned int* colind = mat.colInd.data();
+  const unsigned int* rowptr = mat.rowPtr.data();
+  const T* vcrs = mat.valCrs.data();
+  T* vi = vec+iblk*len*nvec;
+  for(unsigned int ijcrs=diaind[iblk];ijcrs<colind[iblk+1];ijcrs++){
+    assert( rowptr[ijcrs]>iblk && rowptr[ijcrs]<mat.nblk_col );
+    const T* vij = vcrs+ijcrs*blksize;
+    const T* vj = vec+rowptr[ijcrs]*len*nvec;
+    for(unsigned int idof=0;idof<len;idof++){
+      T* vid = vi+idof*nvec;
+      for(unsigned int jdof=0;jdof<len;jdof++){
+        const T a = vij[idof*len+jdof];
+        const T* vjj = vj+jdof*nvec;
+        for(unsigned int ivec=0;ivec<nvec;ivec++){ vid[ivec] -= a*vjj[ivec]; }
       }
-      vec[iblk*3+0] = pTmpVec[0];
-      vec[iblk*3+1] = pTmpVec[1];
-      vec[iblk*3+2] = pTmpVec[2];
     }
   }
-  else if (len==4){
-    const unsigned int* colind = mat.colInd.data();
-    const unsigned int* rowptr = mat.rowPtr.data();
-    const T* vcrs = mat.valCrs.data();
-    // -----------------------------
-    T pTmpVec[4];
-    for (int iblk = nblk-1; iblk>=0; iblk--){
-      assert((int)iblk < nblk);
-      pTmpVec[0] = vec[iblk*4+0];
-      pTmpVec[1] = vec[iblk*4+1];
-      pTmpVec[2] = vec[iblk*4+2];
-      pTmpVec[3] = vec[iblk*4+3];
-      const int icrs0 = m_diaInd[iblk];
-      const unsigned int icrs1 = colind[iblk+1];
-      for (unsigned int ijcrs = icrs0; ijcrs<icrs1; ijcrs++){
-        assert(ijcrs<mat.rowPtr.size());
-        const int jblk0 = rowptr[ijcrs];
-        assert(jblk0>(int)iblk && jblk0<nblk);
-        const T* vij = &vcrs[ijcrs*16];
-        const T valj0 = vec[jblk0*4+0];
-        const T valj1 = vec[jblk0*4+1];
-        const T valj2 = vec[jblk0*4+2];
-        const T valj3 = vec[jblk0*4+3];
-        pTmpVec[0] -= vij[ 0]*valj0+vij[ 1]*valj1+vij[ 2]*valj2+vij[ 3]*valj3;
-        pTmpVec[1] -= vij[ 4]*valj0+vij[ 5]*valj1+vij[ 6]*valj2+vij[ 7]*valj3;
-        pTmpVec[2] -= vij[ 8]*valj0+vij[ 9]*valj1+vij[10]*valj2+vij[11]*valj3;
-        pTmpVec[3] -= vij[12]*valj0+vij[13]*valj1+vij[14]*valj2+vij[15]*valj3;
-      }
-      vec[iblk*4+0] = pTmpVec[0];
-      vec[iblk*4+1] = pTmpVec[1];
-      vec[iblk*4+2] = pTmpVec[2];
-      vec[iblk*4+3] = pTmpVec[3];
+}
+
+template <typename T, unsigned int N>
+static void SolveMulti_Blk
+(T* vec,
+ unsigned int nvec,
+ T* aTmp,
+ const dfm2::CMatrixSparse<T>& mat,
+ const unsigned int* diaind,
+ const std::vector<unsigned int>& levfwd_ind,
+ const std::vector<unsigned int>& levfwd_blk,
+ const std::vector<unsigned int>& levbwd_ind,
+ const std::vector<unsigned int>& levbwd_blk,
+ dfm2::CThreadPool* pool)
+{
+  if( pool == nullptr ){
+    const unsigned int nblk = mat.nblk_col;
+    for(unsigned int iblk=0;iblk<nblk;iblk++){
+      ForwardSubstitutionMulti_Row<T,N>(vec,nvec,iblk,aTmp,mat,diaind);
     }
+    for(unsigned int iblk=nblk;iblk-->0;){
+      BackwardSubstitutionMulti_Row<T,N>(vec,nvec,iblk,mat,diaind);
+    }
+    return;
   }
-  else{
-    const int blksize = len*len;
-    std::vector<T> pTmpVec(len);
-    for(int iblk=nblk-1;iblk>=0;iblk--){
-      assert( (int)iblk < nblk );
-      for(unsigned int idof=0;idof<len;idof++){
-        pTmpVec[idof] = vec[iblk*len+idof];
-      }
-      for(unsigned int ijcrs=m_diaInd[iblk];ijcrs<mat.colInd[iblk+1];ijcrs++){
-        assert( ijcrs<mat.rowPtr.size() );
-        const int jblk0 = mat.rowPtr[ijcrs];
-        assert( jblk0>(int)iblk && jblk0<nblk );
-        const T* vij = &mat.valCrs[ijcrs*blksize];
-        for(unsigned int idof=0;idof<len;idof++){
-          for(unsigned int jdof=0;jdof<len;jdof++){
-            pTmpVec[idof] -= vij[idof*len+jdof]*vec[jblk0*len+jdof];
-          }
-        }
+  const unsigned int nthread = pool->NumThread();
+  dfm2::CBarrier barrier(nthread);
+  pool->Run([&](unsigned int ith){
+    T* tmp = aTmp+ith*mat.len_col*nvec;
+    for(unsigned int ilev=0;ilev+1<levfwd_ind.size();++ilev){
+      const unsigned long long n = levfwd_ind[ilev+1]-levfwd_ind[ilev];
+      const unsigned int ib0 = levfwd_ind[ilev] + (unsigned int)(n*ith/nthread);
+      const unsigned int ib1 = levfwd_ind[ilev] + (unsigned int)(n*(ith+1)/nthread);
+      for(unsigned int ib=ib0;ib<ib1;++ib){
+        ForwardSubstitutionMulti_Row<T,N>(vec,nvec,levfwd_blk[ib],tmp,mat,diaind);
       }
-      for(unsigned int idof=0;idof<len;idof++){
-        vec[iblk*len+idof] = pTmpVec[idof];
+      barrier.Wait();
+    }
+    for(unsigned int ilev=0;ilev+1<levbwd_ind.size();++ilev){
+      const unsigned long long n = levbwd_ind[ilev+1]-levbwd_ind[ilev];
+      const unsigned int ib0 = levbwd_ind[ilev] + (unsigned int)(n*ith/nthread);
+      const unsigned int ib1 = levbwd_ind[ilev] + (unsigned int)(n*(ith+1)/nthread);
+      for(unsigned int ib=ib0;ib<ib1;++ib){
+        BackwardSubstitutionMulti_Row<T,N>(vec,nvec,levbwd_blk[ib],mat,diaind);
       }
+      barrier.Wait();
     }
-  }
+  });
 }
-template void dfm2::CPreconditionerILU<double>::BackwardSubstitution(  double* vec ) const;
-template void dfm2::CPreconditionerILU<COMPLEX>::BackwardSubstitution( COMPLEX* vec ) const;
+
+template <typename T>
+void delfem2::CPreconditionerILU<T>::SolveMulti
+(T* vec,
+ unsigned int nvec) const
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_PRECOND);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_PRECOND,
+                        2.0*nvec*(mat.valCrs.size()+mat.valDia.size()),
+                        (mat.valCrs.size()+mat.valDia.size())*sizeof(T) + mat.rowPtr.size()*sizeof(unsigned int)
+                        + 4.0*nvec*mat.nblk_col*mat.len_col*sizeof(T));
+  dfm2::CThreadPool* pool = (m_nthread > 1) ? m_pool.get() : nullptr;
+  const size_t ntmp = (pool ? m_nthread : 1)*mat.len_col*nvec;
+  if( m_aTmp.size() < ntmp ){ m_aTmp.resize(ntmp); } // grows only when nvec grows
+  DFM2_DISPATCH_BLK(SolveMulti_Blk, mat.len_col,
+                    vec, nvec, m_aTmp.data(), mat, m_diaInd.data(),
+                    m_levFwdInd, m_levFwdBlk, m_levBwdInd, m_levBwdBlk, pool)
+}
+template void dfm2::CPreconditionerILU<double>::SolveMulti( double* vec, unsigned int nvec ) const;
+template void dfm2::CPreconditionerILU<float>::SolveMulti( float* vec, unsigned int nvec ) const;
+template void dfm2::CPreconditionerILU<COMPLEX>::SolveMulti( COMPLEX* vec, unsigned int nvec ) const;
 
 class CRowLev{
 public:
@@ -918,9 +1071,11 @@ void delfem2::CPreconditionerILU<T>::Initialize_ILUk
     mat.valDia = m.valDia;
     //    std::cout<<"ncrs: "<<ncrs<<" "<<m.rowPtr.size()<<std::endl;
   }
+  this->MakeLevelSchedule();
 }
 
 template void dfm2::CPreconditionerILU<double>::Initialize_ILUk(const CMatrixSparse<double>& m, int lev_fill);
+template void dfm2::CPreconditionerILU<float>::Initialize_ILUk(const CMatrixSparse<float>& m, int lev_fill);
 template void dfm2::CPreconditionerILU<COMPLEX>::Initialize_ILUk(const CMatrixSparse<COMPLEX>& m, int lev_fill);
 
 
@@ -967,6 +1122,7 @@ void delfem2::CPreconditionerILU<T>::SetValueILU
   for(unsigned int i=0;i<nblk*blksize;i++){ mat.valDia[i] = rhs.valDia[i]; }
 }
 template void dfm2::CPreconditionerILU<double>::SetValueILU(const CMatrixSparse<double>& rhs);
+template void dfm2::CPreconditionerILU<float>::SetValueILU(const CMatrixSparse<float>& rhs);
 template void dfm2::CPreconditionerILU<COMPLEX>::SetValueILU(const CMatrixSparse<COMPLEX>& rhs);
 
 
@@ -989,7 +1145,80 @@ void delfem2::CPreconditionerILU<T>::Initialize_ILU0
       }
     }
   }
+  this->MakeLevelSchedule();
 }
 template void dfm2::CPreconditionerILU<double>::Initialize_ILU0(const CMatrixSparse<double>& m);
+template void dfm2::CPreconditionerILU<float>::Initialize_ILU0(const CMatrixSparse<float>& m);
 template void dfm2::CPreconditionerILU<COMPLEX>::Initialize_ILU0(const CMatrixSparse<COMPLEX>& m);
 
+template <typename T>
+void delfem2::CPreconditionerILU<T>::Initialize_ILU0
+ (const CMatrixSparseSym<T>& m)
+{
+  CMatrixSparse<T> mf;
+  m.GetFull(mf);
+  this->Initialize_ILU0(mf);
+}
+template void dfm2::CPreconditionerILU<double>::Initialize_ILU0(const CMatrixSparseSym<double>& m);
+template void dfm2::CPreconditionerILU<float>::Initialize_ILU0(const CMatrixSparseSym<float>& m);
+template void dfm2::CPreconditionerILU<COMPLEX>::Initialize_ILU0(const CMatrixSparseSym<COMPLEX>& m);
+
+template <typename T>
+void delfem2::CPreconditionerILU<T>::Initialize_ILUk
+ (const CMatrixSparseSym<T>& m,
+  int lev_fill)
+{
+  CMatrixSparse<T> mf;
+  m.GetFull(mf);
+  this->Initialize_ILUk(mf, lev_fill);
+}
+template void dfm2::CPreconditionerILU<double>::Initialize_ILUk(const CMatrixSparseSym<double>& m, int lev_fill);
+template void dfm2::CPreconditionerILU<float>::Initialize_ILUk(const CMatrixSparseSym<float>& m, int lev_fill);
+template void dfm2::CPreconditionerILU<COMPLEX>::Initialize_ILUk(const CMatrixSparseSym<COMPLEX>& m, int lev_fill);
+
+// the block (i,j) of the upper triangle is copied to (i,j) and its transpose to (j,i).
+// the rows of the pattern of the factors are sorted, so the blocks are searched with the bisection.
+template <typename T>
+void delfem2::CPreconditionerILU<T>::SetValueILU
+ (const CMatrixSparseSym<T>& rhs)
+{
+  const unsigned int nblk = mat.nblk_col;
+  const unsigned int len = mat.len_col;
+  assert( rhs.nblk == nblk );
+  assert( rhs.len == len );
+  const unsigned int blksize = len*len;
+  {
+    const unsigned int n = mat.rowPtr.size()*len*len;
+    for(unsigned int i=0;i<n;++i){ mat.valCrs[i] = 0.0; }
+  }
+  auto find_crs = [this](unsigned int iblk, unsigned int jblk) -> int {
+    const auto itr0 = mat.rowPtr.begin()+mat.colInd[iblk];
+    const auto itr1 = mat.rowPtr.begin()+mat.colInd[iblk+1];
+    const auto itr = std::lower_bound(itr0, itr1, jblk);
+    if( itr == itr1 || *itr != jblk ){ return -1; }
+    return itr - mat.rowPtr.begin();
+  };
+  for(unsigned int iblk=0;iblk<nblk;iblk++){
+    for(unsigned int ijcrs=rhs.colInd[iblk];ijcrs<rhs.colInd[iblk+1];ijcrs++){
+      const unsigned int jblk0 = rhs.rowPtr[ijcrs];
+      const T* pval_in = &rhs.valCrs[ijcrs*blksize];
+      const int ijcrs0 = find_crs(iblk,jblk0);
+      if( ijcrs0 != -1 ){
+        T* pval_out = &mat.valCrs[ijcrs0*blksize];
+        for(unsigned int i=0;i<blksize;i++){ pval_out[i] = pval_in[i]; }
+      }
+      const int jicrs0 = find_crs(jblk0,iblk);
+      if( jicrs0 != -1 ){
+        T* pval_out = &mat.valCrs[jicrs0*blksize];
+        for(unsigned int i=0;i<len;i++){
+          for(unsigned int j=0;j<len;j++){ pval_out[i*len+j] = pval_in[j*len+i]; }
+        }
+      }
+    }
+  }
+  for(unsigned int i=0;i<nblk*blksize;i++){ mat.valDia[i] = rhs.valDia[i]; }
+}
+template void dfm2::CPreconditionerILU<double>::SetValueILU(const CMatrixSparseSym<double>& rhs);
+template void dfm2::CPreconditionerILU<float>::SetValueILU(const CMatrixSparseSym<float>& rhs);
+template void dfm2::CPreconditionerILU<COMPLEX>::SetValueILU(const CMatrixSparseSym<COMPLEX>& rhs);
+
@@ -11,6 +11,7 @@
 #include <iostream>
 
 #include "mats.h"
+#include "instrument.h"
 
 namespace delfem2 {
 
@@ -18,23 +19,88 @@ template <typename T>
 class CPreconditionerILU
 {
 public:
-  CPreconditionerILU(){}
+  CPreconditionerILU() : m_nthread(1) {}
   CPreconditionerILU(const CPreconditionerILU&); // copy
   ~CPreconditionerILU(){ m_diaInd.clear(); }
   void Initialize_ILU0(const CMatrixSparse<T>& m);
   void Initialize_ILUk(const CMatrixSparse<T>& m, int fill_level);
   void SetValueILU(const CMatrixSparse<T>& m);
+  /**
+   * @brief initialize with the symmetric matrix storing the upper triangle. The factors are stored in the full pattern.
+   */
+  void Initialize_ILU0(const CMatrixSparseSym<T>& m);
+  void Initialize_ILUk(const CMatrixSparseSym<T>& m, int fill_level);
+  void SetValueILU(const CMatrixSparseSym<T>& m);
   void Solve(T* vec) const{
+    DFM2_INSTRUMENT_SCOPE(INSTRUMENT_PRECOND);
+    DFM2_INSTRUMENT_COUNT(INSTRUMENT_PRECOND,
+                          2.0*(mat.valCrs.size()+mat.valDia.size()),
+                          (mat.valCrs.size()+mat.valDia.size())*sizeof(T) + mat.rowPtr.size()*sizeof(unsigned int)
+                          + 4.0*mat.nblk_col*mat.len_col*sizeof(T));
+    if( m_nthread > 1 && m_pool ){
+      this->Solve_LevelSchedule(vec);
+      return;
+    }
 		this->ForwardSubstitution(vec);
 		this->BackwardSubstitution(vec);
   }
+  /**
+   * @brief solve for nvec vectors at once. The vectors are interleaved as vec[idof*nvec+ivec]
+   * @details the factors are read once for all the vectors (see CMatrixSparse::MatVecMulti()).
+   * The threads are used in the same way as Solve().
+   */
+  void SolveMulti(T* vec, unsigned int nvec) const;
   bool DoILUDecomp();
+  /**
+   * @brief use nthread threads in Solve()
+   * @details The block rows in the same level of the level schedule (computed in Initialize_ILU0() or Initialize_ILUk())
+   * are independent of each other, so they are solved concurrently. The levels are processed one by one.
+   * The result is the same as the serial solve. nthread=1 (default) is serial.
+   * The worker threads are created here once and reused in every Solve() (see CThreadPool).
+   */
+  void SetNumThread(unsigned int nthread);
+  /**
+   * @brief number of levels in the forward substitution
+   * @details nblk/NumLevelForward() is the average number of block rows that can be solved concurrently
+   */
+  unsigned int NumLevelForward() const {
+    return m_levFwdInd.empty() ? 0 : (unsigned int)m_levFwdInd.size()-1;
+  }
+  /**
+   * @brief number of levels in the backward substitution
+   */
+  unsigned int NumLevelBackward() const {
+    return m_levBwdInd.empty() ? 0 : (unsigned int)m_levBwdInd.size()-1;
+  }
 private:
   void ForwardSubstitution(  T* vec ) const;
   void BackwardSubstitution( T* vec ) const;
+  void Solve_LevelSchedule( T* vec ) const;
+  void MakeLevelSchedule();
 public:
   CMatrixSparse<T> mat;
   std::vector<unsigned int> m_diaInd;
+  /**
+   * @param m_nthread number of threads used in Solve()
+   */
+  unsigned int m_nthread;
+  /**
+   * @param m_pool worker threads used in Solve() and SolveMulti() (null if m_nthread==1)
+   */
+  std::shared_ptr<CThreadPool> m_pool;
+  /**
+   * @param m_aTmp work buffer of the substitutions (size: m_nthread*len, or m_nthread*len*nvec in SolveMulti()).
+   * Solve() does not allocate, but do not call Solve() concurrently for the same instance
+   */
+  mutable std::vector<T> m_aTmp;
+  /**
+   * @param m_levFwdInd, m_levFwdBlk jagged array of the block rows for each level of the forward substitution
+   */
+  std::vector<unsigned int> m_levFwdInd, m_levFwdBlk;
+  /**
+   * @param m_levBwdInd, m_levBwdBlk jagged array of the block rows for each level of the backward substitution
+   */
+  std::vector<unsigned int> m_levBwdInd, m_levBwdBlk;
 };
  
   
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * @file instrument.h
+ * @brief timers, flop/byte counters and the per-iteration callback of the solvers and the assembly (header only)
+ * @details The solvers, the preconditioners and the MergeLinSys_* functions are instrumented with the macros
+ * DFM2_INSTRUMENT_*, and the Krylov solvers call the operators through Instrument_MatVec() and Instrument_Precond().
+ * The macros are expanded only if DFM2_INSTRUMENT is defined at the compilation of the library
+ * and the code using it. Otherwise they are empty and nothing is compiled into the solvers.
+ * Even with DFM2_INSTRUMENT, nothing is recorded unless a CInstrument is bound to the thread with CInstrumentBind.
+ *
+ * usage:
+ *   delfem2::CInstrument inst;
+ *   inst.callback_iteration = [](unsigned int iitr, double conv_ratio){ return iitr < 100; }; // optional
+ *   {
+ *     delfem2::CInstrumentBind bind(inst);
+ *     Solve_PCG(...);
+ *   }
+ *   inst.aTime[delfem2::INSTRUMENT_MATVEC]; // seconds spent in the matrix-vector products
+ */
+
+#ifndef DFM2_INSTRUMENT_H
+#define DFM2_INSTRUMENT_H
+
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+namespace delfem2 {
+
+enum INSTRUMENT_PHASE {
+  INSTRUMENT_MATVEC = 0, // matrix-vector product
+  INSTRUMENT_PRECOND,    // application of the preconditioner
+  INSTRUMENT_VECTOR,     // dot products and vector updates
+  INSTRUMENT_ASSEMBLY,   // merge of the element matrices (MergeLinSys_*)
+  INSTRUMENT_FACTORIZE,  // numerical factorization of the preconditioner
+  INSTRUMENT_NPHASE
+};
+
+/**
+ * @class counters of each phase of the linear solve
+ * @details The phases do not overlap: a phase started inside another phase (e.g., the dot products inside
+ * the preconditioner) is not timed and its flops and bytes are added to the outer phase.
+ * So the sum of aTime is the time spent in the instrumented code and aFlop/aTime is the throughput of each phase.
+ * The flops and the bytes are counted only by the code knowing the storage (e.g., CMatrixSparse::MatVec()).
+ * The bytes are the estimate of the memory traffic reading the matrix and the vectors once.
+ */
+class CInstrument
+{
+public:
+  CInstrument(){ this->Clear(); }
+  void Clear(){
+    for(unsigned int i=0;i<INSTRUMENT_NPHASE;++i){
+      aTime[i] = 0.0;
+      aCall[i] = 0;
+      aFlop[i] = 0.0;
+      aByte[i] = 0.0;
+    }
+    nitr = 0;
+    m_depth = 0;
+    m_phase = INSTRUMENT_NPHASE;
+  }
+  double TimeTotal() const {
+    double t = 0.0;
+    for(unsigned int i=0;i<INSTRUMENT_NPHASE;++i){ t += aTime[i]; }
+    return t;
+  }
+public:
+  /**
+   * @param aTime elapsed time of each phase in seconds
+   * @param aCall number of the calls of each phase
+   */
+  double aTime[INSTRUMENT_NPHASE];
+  std::uint64_t aCall[INSTRUMENT_NPHASE];
+  double aFlop[INSTRUMENT_NPHASE];
+  double aByte[INSTRUMENT_NPHASE];
+  /**
+   * @param nitr total number of the iterations of the Krylov solvers
+   */
+  std::uint64_t nitr;
+  /**
+   * @param callback_iteration called after each iteration of the Krylov solvers with the iteration count and the
+   * relative residual norm (the largest one of the systems not converged for Solve_PCG_Multi()).
+   * The solver stops (as if converged) if this returns false.
+   */
+  std::function<bool(unsigned int, double)> callback_iteration;
+  // the phase and the depth of the running scopes
+  unsigned int m_depth;
+  INSTRUMENT_PHASE m_phase;
+};
+
+/**
+ * @brief the instrument bound to the calling thread (nullptr if not bound)
+ */
+inline CInstrument*& Instrument_Current(){
+  static thread_local CInstrument* pInstrument = nullptr;
+  return pInstrument;
+}
+
+/**
+ * @class bind the instrument to the calling thread while this object lives
+ * @details the threads created inside the solvers (e.g., in CMatrixSparse::MatVec()) are not recorded separately.
+ * They are included in the time of the phase on the calling thread.
+ */
+class CInstrumentBind
+{
+public:
+  explicit CInstrumentBind(CInstrument& inst) : m_prev(Instrument_Current()) { Instrument_Current() = &inst; }
+  ~CInstrumentBind(){ Instrument_Current() = m_prev; }
+  CInstrumentBind(const CInstrumentBind&) = delete;
+  CInstrumentBind& operator=(const CInstrumentBind&) = delete;
+private:
+  CInstrument* m_prev;
+};
+
+/**
+ * @class scoped timer of a phase. Use it with the macro DFM2_INSTRUMENT_SCOPE
+ */
+class CInstrumentScope
+{
+public:
+  explicit CInstrumentScope(INSTRUMENT_PHASE iphase) : m_p(Instrument_Current()), m_phase(iphase) {
+    if( m_p == nullptr ){ return; }
+    m_p->m_depth += 1;
+    if( m_p->m_depth != 1 ){ return; } // inside another phase
+    m_p->m_phase = iphase;
+    m_p->aCall[iphase] += 1;
+    m_t0 = std::chrono::steady_clock::now();
+  }
+  ~CInstrumentScope(){
+    if( m_p == nullptr ){ return; }
+    m_p->m_depth -= 1;
+    if( m_p->m_depth != 0 ){ return; }
+    const std::chrono::duration<double> dt = std::chrono::steady_clock::now() - m_t0;
+    m_p->aTime[m_phase] += dt.count();
+    m_p->m_phase = INSTRUMENT_NPHASE;
+  }
+  CInstrumentScope(const CInstrumentScope&) = delete;
+  CInstrumentScope& operator=(const CInstrumentScope&) = delete;
+private:
+  CInstrument* m_p;
+  INSTRUMENT_PHASE m_phase;
+  std::chrono::steady_clock::time_point m_t0;
+};
+
+/**
+ * @brief add the flops and the bytes to the running phase (or to iphase if no phase is running)
+ */
+inline void Instrument_Count(INSTRUMENT_PHASE iphase, double flop, double byte){
+  CInstrument* p = Instrument_Current();
+  if( p == nullptr ){ return; }
+  if( p->m_phase != INSTRUMENT_NPHASE ){ iphase = p->m_phase; }
+  p->aFlop[iphase] += flop;
+  p->aByte[iphase] += byte;
+}
+
+/**
+ * @brief count the iteration and call the callback
+ * @return false if the callback requests to stop the solver
+ */
+inline bool Instrument_Iteration(unsigned int iitr, double conv_ratio){
+  CInstrument* p = Instrument_Current();
+  if( p == nullptr ){ return true; }
+  p->nitr += 1;
+  if( !p->callback_iteration ){ return true; }
+  return p->callback_iteration(iitr, conv_ratio);
+}
+
+} // end namespace delfem2
+
+#define DFM2_INSTRUMENT_CONCAT0(a,b) a##b
+#define DFM2_INSTRUMENT_CONCAT(a,b) DFM2_INSTRUMENT_CONCAT0(a,b)
+
+#if defined(DFM2_INSTRUMENT)
+#  define DFM2_INSTRUMENT_SCOPE(phase) \
+     delfem2::CInstrumentScope DFM2_INSTRUMENT_CONCAT(dfm2_instrument_scope_,__LINE__)(phase)
+#  define DFM2_INSTRUMENT_COUNT(phase, flop, byte) delfem2::Instrument_Count(phase, flop, byte)
+#  define DFM2_INSTRUMENT_IS_STOP(iitr, conv_ratio) (!delfem2::Instrument_Iteration(iitr, conv_ratio))
+#else
+#  define DFM2_INSTRUMENT_SCOPE(phase)
+#  define DFM2_INSTRUMENT_COUNT(phase, flop, byte)
+#  define DFM2_INSTRUMENT_IS_STOP(iitr, conv_ratio) false
+#endif
+
+namespace delfem2 {
+
+/**
+ * @brief mat.MatVec(args...) timed as the phase INSTRUMENT_MATVEC (a plain call without DFM2_INSTRUMENT)
+ */
+template <typename MAT, typename... ARGS>
+inline void Instrument_MatVec(const MAT& mat, ARGS... args){
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_MATVEC);
+  mat.MatVec(args...);
+}
+
+/**
+ * @brief prec.Solve(args...) timed as the phase INSTRUMENT_PRECOND (a plain call without DFM2_INSTRUMENT)
+ */
+template <typename PREC, typename... ARGS>
+inline void Instrument_Precond(const PREC& prec, ARGS... args){
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_PRECOND);
+  prec.Solve(args...);
+}
+
+} // end namespace delfem2
+
+#endif
@@ -0,0 +1,507 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+#include "delfem2/ldl_mats.h"
+#include "delfem2/thread.h"
+
+namespace dfm2 = delfem2;
+
+// ----------------------------------------------------
+
+// symmetric adjacency of the blocks (without the diagonal)
+static void JArray_AdjacencySymmetric(
+    std::vector<unsigned int>& adj_ind,
+    std::vector<unsigned int>& adj,
+    const std::vector<unsigned int>& colind,
+    const std::vector<unsigned int>& rowptr,
+    unsigned int nblk)
+{
+  adj_ind.assign(nblk+1,0);
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    for(unsigned int icrs=colind[iblk];icrs<colind[iblk+1];++icrs){
+      const unsigned int jblk = rowptr[icrs];
+      if( jblk == iblk ){ continue; }
+      adj_ind[iblk+1]++;
+      adj_ind[jblk+1]++;
+    }
+  }
+  for(unsigned int iblk=0;iblk<nblk;++iblk){ adj_ind[iblk+1] += adj_ind[iblk]; }
+  std::vector<unsigned int> tmp(adj_ind[nblk]);
+  {
+    std::vector<unsigned int> aPos(adj_ind.begin(),adj_ind.end()-1);
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      for(unsigned int icrs=colind[iblk];icrs<colind[iblk+1];++icrs){
+        const unsigned int jblk = rowptr[icrs];
+        if( jblk == iblk ){ continue; }
+        tmp[aPos[iblk]++] = jblk;
+        tmp[aPos[jblk]++] = iblk;
+      }
+    }
+  }
+  // remove the duplicates
+  std::vector<int> aFlg(nblk,-1);
+  std::vector<unsigned int> adj_ind1(nblk+1,0);
+  adj.clear();
+  adj.reserve(tmp.size());
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    for(unsigned int it=adj_ind[iblk];it<adj_ind[iblk+1];++it){
+      const unsigned int jblk = tmp[it];
+      if( aFlg[jblk] == (int)iblk ){ continue; }
+      aFlg[jblk] = (int)iblk;
+      adj.push_back(jblk);
+    }
+    adj_ind1[iblk+1] = (unsigned int)adj.size();
+  }
+  adj_ind = adj_ind1;
+}
+
+// breadth first search from iroot visiting the nodes with aTag[i]==itag.
+// aLev needs to be -1 for such nodes. return the visited nodes in the order of the level
+static void BFS_Level(
+    std::vector<unsigned int>& aOrd,
+    std::vector<int>& aLev,
+    unsigned int iroot,
+    int itag,
+    const std::vector<int>& aTag,
+    const std::vector<unsigned int>& adj_ind,
+    const std::vector<unsigned int>& adj)
+{
+  aOrd.clear();
+  aOrd.push_back(iroot);
+  aLev[iroot] = 0;
+  for(unsigned int io=0;io<aOrd.size();++io){
+    const unsigned int i0 = aOrd[io];
+    for(unsigned int ia=adj_ind[i0];ia<adj_ind[i0+1];++ia){
+      const unsigned int j0 = adj[ia];
+      if( aTag[j0] != itag || aLev[j0] != -1 ){ continue; }
+      aLev[j0] = aLev[i0]+1;
+      aOrd.push_back(j0);
+    }
+  }
+}
+
+// nested dissection ordering with the separators from the level structure of the breadth first search.
+// aPerm[inew] = iold
+static void Ordering_NestedDissection(
+    std::vector<unsigned int>& aPerm,
+    const std::vector<unsigned int>& adj_ind,
+    const std::vector<unsigned int>& adj)
+{
+  const unsigned int nleaf = 16;
+  const unsigned int n = (unsigned int)adj_ind.size()-1;
+  aPerm.resize(n);
+  std::vector<int> aTag(n,0), aLev(n,-1);
+  int itag = 0;
+  std::vector< std::pair<std::vector<unsigned int>,unsigned int> > aStack; // (nodes, offset of the new index)
+  {
+    std::vector<unsigned int> aNode(n);
+    for(unsigned int i=0;i<n;++i){ aNode[i] = i; }
+    aStack.emplace_back(aNode,0);
+  }
+  std::vector<unsigned int> aOrd;
+  while( !aStack.empty() ){
+    const std::vector<unsigned int> aNode = aStack.back().first;
+    const unsigned int ibeg = aStack.back().second;
+    aStack.pop_back();
+    const unsigned int nnode = (unsigned int)aNode.size();
+    if( nnode <= nleaf ){
+      for(unsigned int i=0;i<nnode;++i){ aPerm[ibeg+i] = aNode[i]; }
+      continue;
+    }
+    itag++;
+    for(unsigned int i0 : aNode){ aTag[i0] = itag; aLev[i0] = -1; }
+    BFS_Level(aOrd,aLev, aNode[0],itag,aTag,adj_ind,adj);
+    if( aOrd.size() < nnode ){ // disconnected
+      std::vector<unsigned int> aNode1;
+      for(unsigned int i0 : aNode){ if( aLev[i0] == -1 ){ aNode1.push_back(i0); } }
+      aStack.emplace_back(aOrd,ibeg);
+      aStack.emplace_back(aNode1,ibeg+(unsigned int)aOrd.size());
+      continue;
+    }
+    // pseudo-peripheral node
+    for(int itr=0;itr<5;++itr){
+      const int nlev0 = aLev[aOrd.back()];
+      unsigned int iroot = aOrd.back();
+      for(int io=(int)aOrd.size()-1;io>=0 && aLev[aOrd[io]]==nlev0;--io){ // minimum degree in the last level
+        const unsigned int i0 = aOrd[io];
+        if( adj_ind[i0+1]-adj_ind[i0] < adj_ind[iroot+1]-adj_ind[iroot] ){ iroot = i0; }
+      }
+      for(unsigned int i0 : aNode){ aLev[i0] = -1; }
+      BFS_Level(aOrd,aLev, iroot,itag,aTag,adj_ind,adj);
+      if( aLev[aOrd.back()] <= nlev0 ){ break; }
+    }
+    const int nlev = aLev[aOrd.back()]+1;
+    if( nlev <= 2 ){ // too dense to be separated
+      for(unsigned int i=0;i<nnode;++i){ aPerm[ibeg+i] = aNode[i]; }
+      continue;
+    }
+    int ilev_sep = aLev[aOrd[nnode/2]];
+    if( ilev_sep < 1 ){ ilev_sep = 1; }
+    if( ilev_sep > nlev-2 ){ ilev_sep = nlev-2; }
+    std::vector<unsigned int> aNodeA, aNodeB, aNodeS;
+    for(unsigned int i0 : aOrd){
+      if( aLev[i0] < ilev_sep ){ aNodeA.push_back(i0); continue; }
+      if( aLev[i0] > ilev_sep ){ aNodeB.push_back(i0); continue; }
+      bool is_sep = false; // the separator only needs the nodes adjacent to the other side
+      for(unsigned int ia=adj_ind[i0];ia<adj_ind[i0+1];++ia){
+        const unsigned int j0 = adj[ia];
+        if( aTag[j0] == itag && aLev[j0] == ilev_sep+1 ){ is_sep = true; break; }
+      }
+      if( is_sep ){ aNodeS.push_back(i0); }
+      else{ aNodeA.push_back(i0); }
+    }
+    const unsigned int nA = (unsigned int)aNodeA.size();
+    const unsigned int nB = (unsigned int)aNodeB.size();
+    for(unsigned int is=0;is<aNodeS.size();++is){ aPerm[ibeg+nA+nB+is] = aNodeS[is]; }
+    aStack.emplace_back(aNodeA,ibeg);
+    aStack.emplace_back(aNodeB,ibeg+nA);
+  }
+}
+
+// dot product of the contiguous arrays. four partial sums to hide the latency of the addition
+template <typename T>
+static inline T DotBuffer(
+    const T* a,
+    const T* b,
+    unsigned int n)
+{
+  T s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  unsigned int i = 0;
+  for(;i+3<n;i+=4){
+    s0 += a[i+0]*b[i+0];
+    s1 += a[i+1]*b[i+1];
+    s2 += a[i+2]*b[i+2];
+    s3 += a[i+3]*b[i+3];
+  }
+  for(;i<n;++i){ s0 += a[i]*b[i]; }
+  return (s0+s1)+(s2+s3);
+}
+
+// ----------------------------------------------------
+
+template <typename T>
+void delfem2::CSparseLDL<T>::Initialize
+ (const CMatrixSparse<T>& A)
+{
+  assert( A.nblk_col == A.nblk_row && A.len_col == A.len_row );
+  const unsigned int nblk = A.nblk_col;
+  m_nblk = nblk;
+  m_len = A.len_col;
+  std::vector<unsigned int> adj_ind, adj;
+  JArray_AdjacencySymmetric(adj_ind,adj,
+                            A.colInd,A.rowPtr,nblk);
+  Ordering_NestedDissection(m_aPerm,
+                            adj_ind,adj);
+  m_aPermInv.resize(nblk);
+  for(unsigned int inew=0;inew<nblk;++inew){ m_aPermInv[m_aPerm[inew]] = inew; }
+  // elimination tree (Liu 1986)
+  std::vector<int> aParent(nblk,-1);
+  {
+    std::vector<int> aAnc(nblk,-1);
+    for(unsigned int i=0;i<nblk;++i){
+      const unsigned int iold = m_aPerm[i];
+      for(unsigned int ia=adj_ind[iold];ia<adj_ind[iold+1];++ia){
+        int r = (int)m_aPermInv[adj[ia]];
+        if( r >= (int)i ){ continue; }
+        while( aAnc[r] != -1 && aAnc[r] != (int)i ){
+          const int t = aAnc[r];
+          aAnc[r] = (int)i;
+          r = t;
+        }
+        if( aAnc[r] == -1 ){ aAnc[r] = (int)i; aParent[r] = (int)i; }
+      }
+    }
+  }
+  std::vector<unsigned int> chd_ind(nblk+1,0), chd;
+  for(unsigned int i=0;i<nblk;++i){ if( aParent[i] != -1 ){ chd_ind[aParent[i]+1]++; } }
+  for(unsigned int i=0;i<nblk;++i){ chd_ind[i+1] += chd_ind[i]; }
+  chd.resize(chd_ind[nblk]);
+  {
+    std::vector<unsigned int> aPos(chd_ind.begin(),chd_ind.end()-1);
+    for(unsigned int i=0;i<nblk;++i){ if( aParent[i] != -1 ){ chd[aPos[aParent[i]]++] = i; } }
+  }
+  // structure of each block column of L (below the diagonal)
+  std::vector<unsigned int> str_ind(nblk+1,0), str;
+  {
+    std::vector<int> aFlg(nblk,-1);
+    for(unsigned int j=0;j<nblk;++j){
+      const unsigned int i0 = (unsigned int)str.size();
+      aFlg[j] = (int)j;
+      const unsigned int jold = m_aPerm[j];
+      for(unsigned int ia=adj_ind[jold];ia<adj_ind[jold+1];++ia){
+        const unsigned int i = m_aPermInv[adj[ia]];
+        if( i < j || aFlg[i] == (int)j ){ continue; }
+        aFlg[i] = (int)j;
+        str.push_back(i);
+      }
+      for(unsigned int ic=chd_ind[j];ic<chd_ind[j+1];++ic){
+        const unsigned int c = chd[ic];
+        for(unsigned int is=str_ind[c];is<str_ind[c+1];++is){
+          const unsigned int i = str[is];
+          if( aFlg[i] == (int)j ){ continue; }
+          aFlg[i] = (int)j;
+          str.push_back(i);
+        }
+      }
+      std::sort(str.begin()+i0,str.end());
+      str_ind[j+1] = (unsigned int)str.size();
+    }
+  }
+  // supernodes: a chain of the columns in the elimination tree is merged as a dense panel
+  // if the ratio of the explicit zeros is small (relaxed supernode)
+  m_snColInd.assign(1,0);
+  {
+    size_t nnz_true = 1+str_ind[1]-str_ind[0]; // non-zero blocks in the current supernode
+    for(unsigned int j=1;j<nblk;++j){
+      const size_t ncol = j-m_snColInd.back()+1;
+      const size_t nstr = str_ind[j+1]-str_ind[j];
+      const size_t nnz_merge = ncol*(ncol+1)/2 + ncol*nstr;
+      const size_t nnz_true1 = nnz_true + 1 + nstr;
+      const double ratio_zero = (double)(nnz_merge-nnz_true1)/nnz_merge;
+      const size_t ncoldof = ncol*m_len;
+      const bool is_merge = aParent[j-1] == (int)j
+          && ( ncoldof <= 4
+              || (ncoldof <= 16 && ratio_zero < 0.8)
+              || (ncoldof <= 48 && ratio_zero < 0.1)
+              || ratio_zero < 0.05 );
+      if( is_merge ){ nnz_true = nnz_true1; continue; }
+      m_snColInd.push_back(j);
+      nnz_true = 1 + nstr;
+    }
+  }
+  m_snColInd.push_back(nblk);
+  const unsigned int nsn = (unsigned int)m_snColInd.size()-1;
+  std::vector<unsigned int> aSnBlk(nblk);
+  for(unsigned int isn=0;isn<nsn;++isn){
+    for(unsigned int j=m_snColInd[isn];j<m_snColInd[isn+1];++j){ aSnBlk[j] = isn; }
+  }
+  m_snRowInd.assign(nsn+1,0);
+  m_snRow.clear();
+  m_snParent.assign(nsn,-1);
+  m_snValInd.assign(nsn+1,0);
+  for(unsigned int isn=0;isn<nsn;++isn){
+    const unsigned int jlast = m_snColInd[isn+1]-1;
+    for(unsigned int j=m_snColInd[isn];j<=jlast;++j){ m_snRow.push_back(j); }
+    for(unsigned int is=str_ind[jlast];is<str_ind[jlast+1];++is){ m_snRow.push_back(str[is]); }
+    m_snRowInd[isn+1] = (unsigned int)m_snRow.size();
+    if( aParent[jlast] != -1 ){ m_snParent[isn] = (int)aSnBlk[aParent[jlast]]; }
+    const size_t nrow = (m_snRowInd[isn+1]-m_snRowInd[isn])*m_len;
+    const size_t ncol = (m_snColInd[isn+1]-m_snColInd[isn])*m_len;
+    m_snValInd[isn+1] = m_snValInd[isn] + nrow*ncol;
+  }
+  m_snChildInd.assign(nsn+1,0);
+  for(unsigned int isn=0;isn<nsn;++isn){ if( m_snParent[isn] != -1 ){ m_snChildInd[m_snParent[isn]+1]++; } }
+  for(unsigned int isn=0;isn<nsn;++isn){ m_snChildInd[isn+1] += m_snChildInd[isn]; }
+  m_snChild.resize(m_snChildInd[nsn]);
+  {
+    std::vector<unsigned int> aPos(m_snChildInd.begin(),m_snChildInd.end()-1);
+    for(unsigned int isn=0;isn<nsn;++isn){
+      if( m_snParent[isn] != -1 ){ m_snChild[aPos[m_snParent[isn]]++] = isn; }
+    }
+  }
+  // levels of the supernodal tree. children have smaller index than the parent
+  std::vector<unsigned int> aLev(nsn,0);
+  unsigned int nlev = 0;
+  for(unsigned int isn=0;isn<nsn;++isn){
+    for(unsigned int ic=m_snChildInd[isn];ic<m_snChildInd[isn+1];++ic){
+      aLev[isn] = std::max(aLev[isn],aLev[m_snChild[ic]]+1);
+    }
+    nlev = std::max(nlev,aLev[isn]+1);
+  }
+  m_levInd.assign(nlev+1,0);
+  for(unsigned int isn=0;isn<nsn;++isn){ m_levInd[aLev[isn]+1]++; }
+  for(unsigned int ilev=0;ilev<nlev;++ilev){ m_levInd[ilev+1] += m_levInd[ilev]; }
+  m_levSn.resize(nsn);
+  {
+    std::vector<unsigned int> aPos(m_levInd.begin(),m_levInd.end()-1);
+    for(unsigned int isn=0;isn<nsn;++isn){ m_levSn[aPos[aLev[isn]]++] = isn; }
+  }
+  m_valL.assign(m_snValInd[nsn],0.0);
+  m_valD.assign(nblk*m_len,0.0);
+}
+template void dfm2::CSparseLDL<double>::Initialize(const CMatrixSparse<double>& A);
+
+
+template <typename T>
+bool delfem2::CSparseLDL<T>::Factorize
+ (const CMatrixSparse<T>& A)
+{
+  assert( A.nblk_col == m_nblk && A.len_col == m_len );
+  const unsigned int len = m_len;
+  const unsigned int blksize = len*len;
+  const unsigned int nsn = this->NumSuperNode();
+  const unsigned int nlev = (unsigned int)m_levInd.size()-1;
+  const unsigned int nthread = m_nthread;
+  std::vector< std::vector<T> > aUpdate(nsn); // update matrix passed to the parent
+  std::atomic<bool> is_success(true);
+  CBarrier barrier(nthread);
+  dfm2::ParallelThread(nthread, [&](unsigned int ith){
+    std::vector<int> aRelMap(m_nblk,-1);
+    std::vector<T> F, W;
+    std::vector<unsigned int> aMap;
+    for(unsigned int ilev=0;ilev<nlev;++ilev){
+      for(unsigned int il=m_levInd[ilev]+ith;il<m_levInd[ilev+1];il+=nthread){
+        const unsigned int isn = m_levSn[il];
+        const unsigned int jblk0 = m_snColInd[isn];
+        const unsigned int nbc = m_snColInd[isn+1]-jblk0;
+        const unsigned int nbr = m_snRowInd[isn+1]-m_snRowInd[isn];
+        const unsigned int* psnrow = m_snRow.data()+m_snRowInd[isn];
+        const unsigned int nc = nbc*len;
+        const unsigned int nr = nbr*len;
+        for(unsigned int ir=0;ir<nbr;++ir){ aRelMap[psnrow[ir]] = (int)ir; }
+        F.assign((size_t)nr*nr,0.0);
+        // assemble the lower triangle of the matrix
+        for(unsigned int jb=0;jb<nbc;++jb){
+          const unsigned int jold = m_aPerm[jblk0+jb];
+          for(unsigned int idim=0;idim<len;++idim){
+            for(unsigned int jdim=0;jdim<len;++jdim){
+              F[(size_t)(jb*len+idim)*nr+jb*len+jdim] += A.valDia[jold*blksize+idim*len+jdim];
+            }
+          }
+          for(unsigned int icrs=A.colInd[jold];icrs<A.colInd[jold+1];++icrs){
+            const unsigned int i = m_aPermInv[A.rowPtr[icrs]];
+            if( i <= jblk0+jb ){ continue; }
+            assert( aRelMap[i] >= 0 );
+            const unsigned int ib = aRelMap[i];
+            const T* pa = A.valCrs.data()+icrs*blksize;
+            for(unsigned int idim=0;idim<len;++idim){
+              for(unsigned int jdim=0;jdim<len;++jdim){
+                F[(size_t)(ib*len+jdim)*nr+jb*len+idim] += pa[idim*len+jdim];
+              }
+            }
+          }
+        }
+        // extend-add the update matrices of the children
+        for(unsigned int ic=m_snChildInd[isn];ic<m_snChildInd[isn+1];++ic){
+          const unsigned int isn0 = m_snChild[ic];
+          const unsigned int nbc0 = m_snColInd[isn0+1]-m_snColInd[isn0];
+          const unsigned int nbu0 = m_snRowInd[isn0+1]-m_snRowInd[isn0]-nbc0;
+          const unsigned int* prow0 = m_snRow.data()+m_snRowInd[isn0]+nbc0;
+          const unsigned int nu0 = nbu0*len;
+          aMap.resize(nu0);
+          for(unsigned int iu=0;iu<nu0;++iu){ aMap[iu] = aRelMap[prow0[iu/len]]*len+iu%len; }
+          const std::vector<T>& U = aUpdate[isn0];
+          for(unsigned int iu=0;iu<nu0;++iu){
+            T* pf = F.data()+(size_t)aMap[iu]*nr;
+            const T* pu = U.data()+(size_t)iu*nu0;
+            for(unsigned int ju=0;ju<=iu;++ju){ pf[aMap[ju]] += pu[ju]; }
+          }
+          std::vector<T>().swap(aUpdate[isn0]);
+        }
+        // dense LDL^T of the panel (the first nc columns) row by row
+        T* pL = m_valL.data()+m_snValInd[isn];
+        T* pD = m_valD.data()+jblk0*len;
+        W.resize((size_t)nr*nc); // [L][D]
+        for(unsigned int i=0;i<nr;++i){
+          T* pl = pL+(size_t)i*nc;
+          T* pw = W.data()+(size_t)i*nc;
+          const T* pf = F.data()+(size_t)i*nr;
+          const unsigned int kend = (i<nc) ? i : nc;
+          for(unsigned int k=0;k<kend;++k){
+            pw[k] = pf[k] - DotBuffer(pw, pL+(size_t)k*nc, k);
+            pl[k] = pw[k]/pD[k];
+          }
+          if( i >= nc ){ continue; }
+          T d = pf[i] - DotBuffer(pw, pl, i);
+          if( fabs(d) < 1.0e-30 ){ is_success = false; d = 1.0; }
+          pD[i] = d;
+        }
+        if( m_snParent[isn] != -1 ){ // update matrix [U] = [F22] - [L21][D][L21]^T
+          const unsigned int nu = nr-nc;
+          std::vector<T>& U = aUpdate[isn];
+          U.resize((size_t)nu*nu);
+          for(unsigned int iu=0;iu<nu;++iu){
+            const T* pw = W.data()+(size_t)(nc+iu)*nc;
+            const T* pf = F.data()+(size_t)(nc+iu)*nr+nc;
+            T* pu = U.data()+(size_t)iu*nu;
+            for(unsigned int ju=0;ju<=iu;++ju){
+              pu[ju] = pf[ju] - DotBuffer(pw, pL+(size_t)(nc+ju)*nc, nc);
+            }
+          }
+        }
+      }
+      barrier.Wait();
+    }
+  });
+  return is_success;
+}
+template bool dfm2::CSparseLDL<double>::Factorize(const CMatrixSparse<double>& A);
+
+
+template <typename T>
+void delfem2::CSparseLDL<T>::Solve
+ (T* vec) const
+{
+  const unsigned int len = m_len;
+  const unsigned int nsn = this->NumSuperNode();
+  std::vector<T> y(m_nblk*len);
+  for(unsigned int inew=0;inew<m_nblk;++inew){
+    const unsigned int iold = m_aPerm[inew];
+    for(unsigned int idim=0;idim<len;++idim){ y[inew*len+idim] = vec[iold*len+idim]; }
+  }
+  // forward substitution
+  for(unsigned int isn=0;isn<nsn;++isn){
+    const unsigned int nc = (m_snColInd[isn+1]-m_snColInd[isn])*len;
+    const unsigned int nr = (m_snRowInd[isn+1]-m_snRowInd[isn])*len;
+    const unsigned int* psnrow = m_snRow.data()+m_snRowInd[isn];
+    const T* pL = m_valL.data()+m_snValInd[isn];
+    T* pyc = y.data()+m_snColInd[isn]*len;
+    for(unsigned int k=0;k<nc;++k){
+      const T yk = pyc[k];
+      for(unsigned int i=k+1;i<nc;++i){ pyc[i] -= pL[i*nc+k]*yk; }
+    }
+    for(unsigned int i=nc;i<nr;++i){
+      T s = 0.0;
+      for(unsigned int k=0;k<nc;++k){ s += pL[i*nc+k]*pyc[k]; }
+      y[psnrow[i/len]*len+i%len] -= s;
+    }
+  }
+  for(unsigned int i=0;i<m_nblk*len;++i){ y[i] /= m_valD[i]; }
+  // backward substitution
+  for(int isn=(int)nsn-1;isn>=0;--isn){
+    const unsigned int nc = (m_snColInd[isn+1]-m_snColInd[isn])*len;
+    const unsigned int nr = (m_snRowInd[isn+1]-m_snRowInd[isn])*len;
+    const unsigned int* psnrow = m_snRow.data()+m_snRowInd[isn];
+    const T* pL = m_valL.data()+m_snValInd[isn];
+    T* pyc = y.data()+m_snColInd[isn]*len;
+    for(unsigned int i=nc;i<nr;++i){
+      const T yi = y[psnrow[i/len]*len+i%len];
+      for(unsigned int k=0;k<nc;++k){ pyc[k] -= pL[i*nc+k]*yi; }
+    }
+    for(int k=(int)nc-1;k>=0;--k){
+      T s = 0.0;
+      for(unsigned int i=k+1;i<nc;++i){ s += pL[i*nc+k]*pyc[i]; }
+      pyc[k] -= s;
+    }
+  }
+  for(unsigned int inew=0;inew<m_nblk;++inew){
+    const unsigned int iold = m_aPerm[inew];
+    for(unsigned int idim=0;idim<len;++idim){ vec[iold*len+idim] = y[inew*len+idim]; }
+  }
+}
+template void dfm2::CSparseLDL<double>::Solve(double* vec) const;
+
+
+template <typename T>
+size_t delfem2::CSparseLDL<T>::NumNonZero() const
+{
+  const unsigned int nsn = this->NumSuperNode();
+  size_t nnz = 0;
+  for(unsigned int isn=0;isn<nsn;++isn){
+    const size_t nc = (m_snColInd[isn+1]-m_snColInd[isn])*m_len;
+    const size_t nr = (m_snRowInd[isn+1]-m_snRowInd[isn])*m_len;
+    nnz += nc*(nc+1)/2 + (nr-nc)*nc;
+  }
+  return nnz;
+}
+template size_t dfm2::CSparseLDL<double>::NumNonZero() const;
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * @file ldl_mats.h
+ * @brief supernodal sparse LDL^T direct solver for the symmetric CMatrixSparse
+ */
+
+#ifndef DFM2_LDL_MATS_H
+#define DFM2_LDL_MATS_H
+
+#include <vector>
+
+#include "delfem2/mats.h"
+
+namespace delfem2 {
+
+/**
+ * @class sparse LDL^T factorization (without pivoting) of a symmetric block sparse matrix
+ * @tparam T double
+ * @details The blocks are reordered with the nested dissection to reduce the fill-in.
+ * Initialize() computes the ordering, the elimination tree and the supernodes from the pattern.
+ * Factorize() computes the values with the multifrontal method and can be called many times for the same pattern.
+ * The supernodes in the same level of the tree are factorized concurrently with SetNumThread().
+ * The matrix needs to be positive definite (or at least has non-zero leading minors).
+ */
+template <typename T>
+class CSparseLDL
+{
+public:
+  CSparseLDL() : m_nthread(1), m_nblk(0), m_len(0) {}
+  /**
+   * @brief symbolic factorization. only the pattern of the matrix is used
+   * @details the pattern needs to be symmetric
+   */
+  void Initialize(const CMatrixSparse<T>& A);
+  /**
+   * @brief numeric factorization
+   * @details the pattern of A needs to be the same as the one passed to Initialize()
+   * @return false if a pivot is zero
+   */
+  bool Factorize(const CMatrixSparse<T>& A);
+  /**
+   * @brief {vec} = [A]^-1{vec}
+   */
+  void Solve(T* vec) const;
+  void SetNumThread(unsigned int nthread){ m_nthread = (nthread==0) ? 1 : nthread; }
+  unsigned int NumSuperNode() const {
+    return m_snColInd.empty() ? 0 : (unsigned int)m_snColInd.size()-1;
+  }
+  /**
+   * @brief number of non-zero entries in the lower triangle of the factor (including the diagonal)
+   */
+  size_t NumNonZero() const;
+public:
+  /**
+   * @param m_nthread number of threads used in Factorize()
+   */
+  unsigned int m_nthread;
+  unsigned int m_nblk, m_len;
+  /**
+   * @param m_aPerm block permutation. m_aPerm[iblk_new] = iblk_old
+   * @param m_aPermInv inverse of the permutation. m_aPermInv[iblk_old] = iblk_new
+   */
+  std::vector<unsigned int> m_aPerm, m_aPermInv;
+  /**
+   * @param m_snColInd the supernode isn has the block columns [m_snColInd[isn], m_snColInd[isn+1]) in the new order
+   * @param m_snRowInd, m_snRow jagged array of the block rows of each supernode (sorted, starting with its columns)
+   * @param m_snParent parent supernode in the elimination tree (-1 for the root)
+   * @param m_snChildInd, m_snChild jagged array of the children supernodes
+   * @param m_levInd, m_levSn jagged array of the supernodes for each level of the tree (leaves are in the level 0)
+   */
+  std::vector<unsigned int> m_snColInd, m_snRowInd, m_snRow;
+  std::vector<int> m_snParent;
+  std::vector<unsigned int> m_snChildInd, m_snChild;
+  std::vector<unsigned int> m_levInd, m_levSn;
+  /**
+   * @param m_snValInd the dense panel of the supernode isn is stored at m_valL[m_snValInd[isn]]
+   * @param m_valL row-major (nrow x ncol) panel of L for each supernode. The unit diagonal is not referred.
+   * @param m_valD diagonal D in the new order
+   */
+  std::vector<size_t> m_snValInd;
+  std::vector<T> m_valL, m_valD;
+};
+
+} // end namespace delfem2
+
+#endif
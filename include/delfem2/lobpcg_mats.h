@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * @file lobpcg_mats.h
+ * @brief sparse generalized eigensolver (LOBPCG) for the lowest modes of [K]{x} = lambda [M]{x}
+ */
+
+#ifndef DFM2_LOBPCG_MATS_H
+#define DFM2_LOBPCG_MATS_H
+
+#include <vector>
+#include <cmath>
+#include <cassert>
+
+#include "delfem2/vecxitrsol.h"
+
+namespace delfem2 {
+
+/**
+ * @class lumped (diagonal) mass matrix with the interface of the matrix of the solvers (see vecxitrsol.h)
+ * @details the mass of the i-th block is applied to all the len dofs of the block
+ */
+class CMatrixLumpedMass
+{
+public:
+  CMatrixLumpedMass(const double* aMass, unsigned int nblk, unsigned int len)
+  : aMass(aMass), nblk(nblk), len(len) {}
+  void MatVec(double* y, double alpha, const double* x, double beta) const {
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      const double m = alpha*aMass[iblk];
+      for(unsigned int i=iblk*len;i<(iblk+1)*len;++i){ y[i] = beta*y[i] + m*x[i]; }
+    }
+  }
+private:
+  const double* aMass;
+  const unsigned int nblk, len;
+};
+
+/**
+ * @brief lowest nmode eigenpairs of the generalized problem [K]{x} = lambda [M]{x} with the LOBPCG method
+ * @details Locally optimal block preconditioned conjugate gradient method (Knyazev 2001).
+ * Each iteration finds the Ritz pairs in the span of the current vectors {X}, the preconditioned residuals {W} and
+ * the previous search directions {P}. A pair whose relative residual norm |[K]{x}-lambda[M]{x}|/|lambda [M]{x}| is
+ * below conv_ratio_tol is locked: its {W} and {P} are not added to the subspace anymore (soft locking).
+ * The known modes aKer (e.g., the rigid-body modes of a free body) are removed from the subspace in the [M]-inner
+ * product, so the solver finds the lowest modes orthogonal to them.
+ * MAT_K and MAT_M need "void MatVec(double* y, double alpha, const double* x, double beta) const"
+ * (e.g., CMatrixSparse<double> and CMatrixLumpedMass) and PREC needs "void Solve(double* vec) const" that
+ * approximates [K]^-1 (e.g., CPreconditionerILU<double> or CPreconditionerAMG<double>. For a singular [K],
+ * factorize [K]+sigma[M] with small sigma).
+ * For the fixed dofs, set the rows and columns of [K] to the identity (CMatrixSparse::SetFixedBC()), set the mass
+ * to zero and give the initial vectors with zero at the fixed dofs.
+ * @param aEigVal (out) eigenvalues in ascending order (size: nmode)
+ * @param aEigVec (in/out) initial vectors as input (e.g., random) and the [M]-orthonormal eigenvectors as output.
+ * the i-th vector is aEigVec[i*ndof+idof]
+ * @param aKer (in) nker known modes stored as aKer[iker*ndof+idof]. They need not be orthonormal.
+ * @return history of the maximum relative residual norm among the pairs for each iteration
+ */
+template <typename MAT_K, typename MAT_M, typename PREC>
+std::vector<double> Solve_LOBPCG(
+    double* aEigVal,
+    double* aEigVec,
+    unsigned int nmode,
+    unsigned int ndof,
+    double conv_ratio_tol,
+    unsigned int max_nitr,
+    const MAT_K& matK,
+    const MAT_M& matM,
+    const PREC& prec,
+    const double* aKer = nullptr,
+    unsigned int nker = 0)
+{
+  const unsigned int n = ndof;
+  const unsigned int m = nmode;
+  std::vector<double> aHistory;
+  // [M]-orthonormal known modes {Y} and [M]{Y}
+  std::vector<double> Y(aKer, aKer+nker*n), MY(nker*n);
+  for(unsigned int iker=0;iker<nker;++iker){
+    double* y = Y.data()+iker*n;
+    for(unsigned int jker=0;jker<iker;++jker){
+      const double d = DotX(MY.data()+jker*n, y, n);
+      AXPY(-d, Y.data()+jker*n, y, n);
+    }
+    double* my = MY.data()+iker*n;
+    matM.MatVec(my, 1.0, y, 0.0);
+    const double s = 1.0/sqrt(DotX(y, my, n));
+    ScaleX(y, s, n);
+    ScaleX(my, s, n);
+  }
+  auto RemoveKernel = [&](double* x){
+    for(unsigned int iker=0;iker<nker;++iker){
+      const double d = DotX(MY.data()+iker*n, x, n);
+      AXPY(-d, Y.data()+iker*n, x, n);
+    }
+  };
+  // the vectors {S} = [{X},{W},{P}] of the subspace and their product with [K] and [M]
+  std::vector<double> S(3*m*n), KS(3*m*n), MS(3*m*n);
+  std::vector<double> P(m*n), KP(m*n), MP(m*n), aTmp(m*n);
+  for(unsigned int i=0;i<m;++i){
+    RemoveKernel(aEigVec+i*n);
+    for(unsigned int idof=0;idof<n;++idof){ S[i*n+idof] = aEigVec[i*n+idof]; }
+  }
+  std::vector<double> G(9*m*m), H(9*m*m), C(3*m*m), aLam(m);
+  std::vector<unsigned int> aActive;
+  bool is_p = false;
+  for(unsigned int iitr=0;iitr<=max_nitr;++iitr){
+    // build the subspace. the columns are [{X}, {W}_active, {P}_active]
+    const unsigned int na = (iitr==0) ? 0 : (unsigned int)aActive.size();
+    for(unsigned int ia=0;ia<na;++ia){
+      const unsigned int i = aActive[ia];
+      double* w = S.data()+(m+ia)*n;
+      for(unsigned int idof=0;idof<n;++idof){ w[idof] = KS[i*n+idof] - aLam[i]*MS[i*n+idof]; }
+      prec.Solve(w);
+      RemoveKernel(w);
+      const double s = 1.0/sqrt(DotX(w, w, n));
+      ScaleX(w, s, n);
+      if( !is_p ){ continue; }
+      for(unsigned int idof=0;idof<n;++idof){
+        S[(m+na+ia)*n+idof] = P[i*n+idof];
+        KS[(m+na+ia)*n+idof] = KP[i*n+idof];
+        MS[(m+na+ia)*n+idof] = MP[i*n+idof];
+      }
+    }
+    const unsigned int i0 = (iitr==0) ? 0 : m; // the columns whose products are not computed yet
+    for(unsigned int i=i0;i<m+na;++i){
+      matK.MatVec(KS.data()+i*n, 1.0, S.data()+i*n, 0.0);
+      matM.MatVec(MS.data()+i*n, 1.0, S.data()+i*n, 0.0);
+    }
+    // Rayleigh-Ritz
+    unsigned int ns = (is_p) ? m+2*na : m+na;
+    InnerProducts_Vectors(G.data(), S.data(), KS.data(), ns, n);
+    InnerProducts_Vectors(H.data(), S.data(), MS.data(), ns, n);
+    bool res_rr = GeneralizedEigenSym_Lowest(aLam.data(), C.data(), m,
+                                             G.data(), H.data(), ns);
+    if( !res_rr && ns != m+na ){ // the subspace is nearly degenerated. restart without {P}
+      const unsigned int ns1 = m+na;
+      for(unsigned int i=0;i<ns1;++i){
+        for(unsigned int j=0;j<ns1;++j){
+          G[i*ns1+j] = G[i*ns+j];
+          H[i*ns1+j] = H[i*ns+j];
+        }
+      }
+      ns = ns1;
+      res_rr = GeneralizedEigenSym_Lowest(aLam.data(), C.data(), m,
+                                          G.data(), H.data(), ns);
+    }
+    if( !res_rr ){ break; }
+    // {P} = {W}C_W + {P}C_P, {X} = {X}C_X + {P}
+    for(unsigned int k=0;k<3;++k){
+      std::vector<double>& sk = (k==0) ? S : ((k==1) ? KS : MS);
+      std::vector<double>& pk = (k==0) ? P : ((k==1) ? KP : MP);
+      LinearCombination_Vectors(pk.data(),
+                                sk.data()+m*n, C.data()+m*m, ns-m, m, n);
+      LinearCombination_Vectors(aTmp.data(),
+                                sk.data(), C.data(), m, m, n);
+      for(unsigned int i=0;i<m*n;++i){ sk[i] = aTmp[i] + pk[i]; }
+    }
+    is_p = (iitr > 0); // {P} is {W}C_W even if the previous {P} is dropped in the Rayleigh-Ritz
+    // convergence and locking
+    double res_max = 0.0;
+    aActive.clear();
+    for(unsigned int i=0;i<m;++i){
+      const double* kx = KS.data()+i*n;
+      const double* mx = MS.data()+i*n;
+      double rr = 0.0;
+      for(unsigned int idof=0;idof<n;++idof){
+        const double r = kx[idof] - aLam[i]*mx[idof];
+        rr += r*r;
+      }
+      const double den = fabs(aLam[i])*sqrt(DotX(mx, mx, n));
+      const double res = (den > 1.0e-30) ? sqrt(rr)/den : sqrt(rr);
+      if( res > res_max ){ res_max = res; }
+      if( res >= conv_ratio_tol ){ aActive.push_back(i); }
+    }
+    aHistory.push_back(res_max);
+    if( aActive.empty() ){ break; }
+  }
+  for(unsigned int i=0;i<m;++i){
+    aEigVal[i] = aLam[i];
+    for(unsigned int idof=0;idof<n;++idof){ aEigVec[i*n+idof] = S[i*n+idof]; }
+  }
+  return aHistory;
+}
+
+} // end namespace delfem2
+
+#endif
@@ -44,6 +44,102 @@ void MatVec
   }
 }
 
+/**
+ * @brief {y} += alpha*[A]{x} where [A] is NCOL x NROW matrix
+ */
+template <typename REAL, unsigned int NCOL, unsigned int NROW>
+void MatVecAdd
+(REAL* y,
+ REAL alpha, const REAL* A, const REAL* x)
+{
+  for(unsigned int i=0;i<NCOL;++i){
+    REAL s = A[i*NROW]*x[0];
+    for(unsigned int j=1;j<NROW;++j){ s += A[i*NROW+j]*x[j]; }
+    y[i] += alpha*s;
+  }
+}
+
+/**
+ * @brief {y} += alpha*[A]^T{x} where [A] is NCOL x NROW matrix
+ */
+template <typename REAL, unsigned int NCOL, unsigned int NROW>
+void MatTVecAdd
+(REAL* y,
+ REAL alpha, const REAL* A, const REAL* x)
+{
+  for(unsigned int j=0;j<NROW;++j){
+    REAL s = A[j]*x[0];
+    for(unsigned int i=1;i<NCOL;++i){ s += A[i*NROW+j]*x[i]; }
+    y[j] += alpha*s;
+  }
+}
+
+/**
+ * @brief {y} -= [A]{x} where [A] is NxN matrix
+ */
+template <typename REAL, unsigned int N>
+void MatVecSub
+(REAL* y,
+ const REAL* A, const REAL* x)
+{
+  for(unsigned int i=0;i<N;++i){
+    REAL s = A[i*N]*x[0];
+    for(unsigned int j=1;j<N;++j){ s += A[i*N+j]*x[j]; }
+    y[i] -= s;
+  }
+}
+
+/**
+ * @brief [C] -= [A][B] where all the matrices are NxN
+ */
+template <typename REAL, unsigned int N>
+void MatMatSub
+(REAL* C,
+ const REAL* A, const REAL* B)
+{
+  for(unsigned int i=0;i<N;++i){
+    for(unsigned int j=0;j<N;++j){
+      REAL s = A[i*N]*B[j];
+      for(unsigned int k=1;k<N;++k){ s += A[i*N+k]*B[k*N+j]; }
+      C[i*N+j] -= s;
+    }
+  }
+}
+
+/**
+ * @brief {y} += {x} where the vectors have N entries
+ */
+template <typename REAL, unsigned int N>
+void VecAdd
+(REAL* y,
+ const REAL* x)
+{
+  for(unsigned int i=0;i<N;++i){ y[i] += x[i]; }
+}
+
+/**
+ * @brief invert NxN matrix in place with Gauss-Jordan elimination without pivoting
+ * @return 0 if success, 1 if the pivot is too small
+ */
+template <typename REAL, unsigned int N>
+int InverseMat
+(REAL* a)
+{
+  for(unsigned int i=0;i<N;++i){
+    const REAL aii = a[i*N+i];
+    if( aii < 1.0e-30 && aii > -1.0e-30 ){ return 1; }
+    const REAL tmp0 = 1 / aii;
+    a[i*N+i] = 1;
+    for(unsigned int k=0;k<N;++k){ a[i*N+k] *= tmp0; }
+    for(unsigned int j=0;j<N;++j){
+      if( j == i ){ continue; }
+      const REAL tmp1 = a[j*N+i];
+      a[j*N+i] = 0;
+      for(unsigned int k=0;k<N;++k){ a[j*N+k] -= tmp1*a[i*N+k]; }
+    }
+  }
+  return 0;
+}
 
 }
 
@@ -9,7 +9,12 @@
 #include <cmath>
 #include <vector>
 #include <complex>
+#include <algorithm>
 #include "delfem2/mats.h"
+#include "delfem2/thread.h"
+#include "delfem2/instrument.h"
+#include "delfem2/matn.hpp"
+#include "delfem2/mats_internal.h"
 
 typedef std::complex<double> COMPLEX;
 namespace dfm2 = delfem2;
@@ -65,6 +70,84 @@ static double MatNorm_Assym(
 
 // -------------------------------------------------------
 
+// block operations for the matrix-vector products.
+// N is the block size fixed at compile time. N=0 means the size (ncol x nrow) is given at runtime.
+
+template <typename T, unsigned int N>
+static inline void BlkMatVecAdd
+(T* y,
+ T alpha, const T* A, const T* x,
+ unsigned int ncol, unsigned int nrow)
+{
+  if( N != 0 ){ dfm2::MatVecAdd<T,N,N>(y,alpha,A,x); return; }
+  for(unsigned int i=0;i<ncol;++i){
+    T s = A[i*nrow]*x[0];
+    for(unsigned int j=1;j<nrow;++j){ s += A[i*nrow+j]*x[j]; }
+    y[i] += alpha*s;
+  }
+}
+
+template <typename T, unsigned int N>
+static inline void BlkMatTVecAdd
+(T* y,
+ T alpha, const T* A, const T* x,
+ unsigned int ncol, unsigned int nrow)
+{
+  if( N != 0 ){ dfm2::MatTVecAdd<T,N,N>(y,alpha,A,x); return; }
+  for(unsigned int j=0;j<nrow;++j){
+    T s = A[j]*x[0];
+    for(unsigned int i=1;i<ncol;++i){ s += A[i*nrow+j]*x[i]; }
+    y[j] += alpha*s;
+  }
+}
+
+// Calc Matrix Vector Product for the block rows in [iblk_beg,iblk_end)
+// {y} = alpha*[A]{x} + beta*{y}
+template <typename T, unsigned int N>
+static void MatVec_BlkRange
+(T* y,
+ T alpha,
+ const T* x,
+ T beta,
+ unsigned int iblk_beg,
+ unsigned int iblk_end,
+ const dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int len_col = (N==0) ? mat.len_col : N;
+  const unsigned int len_row = (N==0) ? mat.len_row : N;
+  const unsigned int blksize = len_col*len_row;
+  const T* vcrs  = mat.valCrs.data();
+  const T* vdia = mat.valDia.empty() ? nullptr : mat.valDia.data();
+  const unsigned int* colind = mat.colInd.data();
+  const unsigned int* rowptr = mat.rowPtr.data();
+  for(unsigned int i=iblk_beg*len_col;i<iblk_end*len_col;++i){ y[i] *= beta; }
+  for(unsigned int iblk=iblk_beg;iblk<iblk_end;iblk++){
+    T* py = y+iblk*len_col;
+    for(unsigned int icrs=colind[iblk];icrs<colind[iblk+1];icrs++){
+      assert( icrs < mat.rowPtr.size() );
+      const unsigned int jblk0 = rowptr[icrs];
+      assert( jblk0 < mat.nblk_row );
+      BlkMatVecAdd<T,N>(py, alpha, vcrs+icrs*blksize, x+jblk0*len_row, len_col, len_row);
+    }
+    if( vdia == nullptr ){ continue; }
+    BlkMatVecAdd<T,N>(py, alpha, vdia+iblk*blksize, x+iblk*len_row, len_col, len_row);
+  }
+}
+
+template <typename T>
+static void MatVec_Range
+(T* y,
+ T alpha,
+ const T* x,
+ T beta,
+ unsigned int iblk_beg,
+ unsigned int iblk_end,
+ const dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int N = (mat.len_col == mat.len_row) ? mat.len_col : 0;
+  DFM2_DISPATCH_BLK(MatVec_BlkRange, N, y,alpha,x,beta,iblk_beg,iblk_end,mat)
+}
+
 // Calc Matrix Vector Product
 // {y} = alpha*[A]{x} + beta*{y}
 template <typename T>
@@ -74,142 +157,187 @@ void dfm2::CMatrixSparse<T>::MatVec
  const T* x,
  T beta) const
 {
-  const unsigned int ndofcol = len_col*nblk_col;
-  for(unsigned int i=0;i<ndofcol;++i){ y[i] *= beta; }
-  const unsigned int blksize = len_col*len_row;
-  // --------
-	if( len_col == 1 && len_row == 1 ){
-		const T* vcrs  = valCrs.data();
-		const T* vdia = valDia.data();
-		const unsigned int* colind = colInd.data();
-		const unsigned int* rowptr = rowPtr.data();
-		//
-		for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-			T& vy = y[iblk];
-			const unsigned int colind0 = colind[iblk];
-			const unsigned int colind1 = colind[iblk+1];
-			for(unsigned int icrs=colind0;icrs<colind1;icrs++){
-				assert( icrs < rowPtr.size() );
-				const unsigned int jblk0 = rowptr[icrs];
-				assert( jblk0 < nblk_row );
-				vy += alpha * vcrs[icrs] * x[jblk0];
-			}
-			vy += alpha * vdia[iblk] * x[iblk];
-		}
-	}
-	else if( len_col == 2 && len_row == 2 ){
-		const T* vcrs  = valCrs.data();
-		const T* vdia = valDia.data();
-		const unsigned int* colind = colInd.data();
-		const unsigned int* rowptr = rowPtr.data();
-		//
-		for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-			const unsigned int icrs0 = colind[iblk];
-			const unsigned int icrs1 = colind[iblk+1];
-			for(unsigned int icrs=icrs0;icrs<icrs1;icrs++){
-				assert( icrs < rowPtr.size() );
-				const unsigned int jblk0 = rowptr[icrs];
-				assert( jblk0 < nblk_row );
-				y[iblk*2+0] += alpha * ( vcrs[icrs*4  ]*x[jblk0*2+0] + vcrs[icrs*4+1]*x[jblk0*2+1] );
-				y[iblk*2+1] += alpha * ( vcrs[icrs*4+2]*x[jblk0*2+0] + vcrs[icrs*4+3]*x[jblk0*2+1] );
-			}
-			y[iblk*2+0] += alpha * ( vdia[iblk*4+0]*x[iblk*2+0] + vdia[iblk*4+1]*x[iblk*2+1] );
-			y[iblk*2+1] += alpha * ( vdia[iblk*4+2]*x[iblk*2+0] + vdia[iblk*4+3]*x[iblk*2+1] );
-		}
-	}
-	else if( len_col == 3 && len_row == 3 ){
-		const T* vcrs  = valCrs.data();
-		const T* vdia = valDia.data();
-		const unsigned int* colind = colInd.data();
-		const unsigned int* rowptr = rowPtr.data();
-		//
-		for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-			const unsigned int icrs0 = colind[iblk];
-			const unsigned int icrs1 = colind[iblk+1];
-			for(unsigned int icrs=icrs0;icrs<icrs1;icrs++){
-				assert( icrs < rowPtr.size() );
-				const unsigned int jblk0 = rowptr[icrs];
-				assert( jblk0 < nblk_row );
-        const unsigned int i0 = iblk*3;
-        const unsigned int j0 = jblk0*3;
-        const unsigned int k0 = icrs*9;
-				y[i0+0] += alpha*(vcrs[k0+0]*x[j0+0]+vcrs[k0+1]*x[j0+1]+vcrs[k0+2]*x[j0+2]);
-				y[i0+1] += alpha*(vcrs[k0+3]*x[j0+0]+vcrs[k0+4]*x[j0+1]+vcrs[k0+5]*x[j0+2]);
-				y[i0+2] += alpha*(vcrs[k0+6]*x[j0+0]+vcrs[k0+7]*x[j0+1]+vcrs[k0+8]*x[j0+2]);
-			}
-      {
-        const unsigned int i0 = iblk*3;
-        const unsigned int k0 = iblk*9;
-        y[i0+0] += alpha*(vdia[k0+0]*x[i0+0]+vdia[k0+1]*x[i0+1]+vdia[k0+2]*x[i0+2]);
-        y[i0+1] += alpha*(vdia[k0+3]*x[i0+0]+vdia[k0+4]*x[i0+1]+vdia[k0+5]*x[i0+2]);
-        y[i0+2] += alpha*(vdia[k0+6]*x[i0+0]+vdia[k0+7]*x[i0+1]+vdia[k0+8]*x[i0+2]);
-      }
-		}
-  }
-	else if( len_col == 4 && len_row == 4 ){
-    const T* vcrs  = valCrs.data();
-    const T* vdia = valDia.data();
-    const unsigned int* colind = colInd.data();
-    const unsigned int* rowptr = rowPtr.data();
-    //
-    for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-      const unsigned int icrs0 = colind[iblk];
-      const unsigned int icrs1 = colind[iblk+1];
-      for(unsigned int icrs=icrs0;icrs<icrs1;icrs++){
-        assert( icrs < rowPtr.size() );
-        const unsigned int jblk0 = rowptr[icrs];
-        assert( jblk0 < nblk_row );
-        const unsigned int i0 = iblk*4;
-        const unsigned int j0 = jblk0*4;
-        const unsigned int k0 = icrs*16;
-        y[i0+0] += alpha*(vcrs[k0+ 0]*x[j0+0]+vcrs[k0+ 1]*x[j0+1]+vcrs[k0+ 2]*x[j0+2]+vcrs[k0+ 3]*x[j0+3]);
-        y[i0+1] += alpha*(vcrs[k0+ 4]*x[j0+0]+vcrs[k0+ 5]*x[j0+1]+vcrs[k0+ 6]*x[j0+2]+vcrs[k0+ 7]*x[j0+3]);
-        y[i0+2] += alpha*(vcrs[k0+ 8]*x[j0+0]+vcrs[k0+ 9]*x[j0+1]+vcrs[k0+10]*x[j0+2]+vcrs[k0+11]*x[j0+3]);
-        y[i0+3] += alpha*(vcrs[k0+12]*x[j0+0]+vcrs[k0+13]*x[j0+1]+vcrs[k0+14]*x[j0+2]+vcrs[k0+15]*x[j0+3]);
-      }
-      {
-        const unsigned int i0 = iblk*4;
-        const unsigned int k0 = iblk*16;
-        y[i0+0] += alpha*(vdia[k0+ 0]*x[i0+0]+vdia[k0+ 1]*x[i0+1]+vdia[k0+ 2]*x[i0+2]+vdia[k0+ 3]*x[i0+3]);
-        y[i0+1] += alpha*(vdia[k0+ 4]*x[i0+0]+vdia[k0+ 5]*x[i0+1]+vdia[k0+ 6]*x[i0+2]+vdia[k0+ 7]*x[i0+3]);
-        y[i0+2] += alpha*(vdia[k0+ 8]*x[i0+0]+vdia[k0+ 9]*x[i0+1]+vdia[k0+10]*x[i0+2]+vdia[k0+11]*x[i0+3]);
-        y[i0+3] += alpha*(vdia[k0+12]*x[i0+0]+vdia[k0+13]*x[i0+1]+vdia[k0+14]*x[i0+2]+vdia[k0+15]*x[i0+3]);
-      }
-    }
-  }
-	else{
-		const T* vcrs  = valCrs.data();
-		const T* vdia = valDia.data();
-		const unsigned int* colind = colInd.data();
-		const unsigned int* rowptr = rowPtr.data();
-		//
-		for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-			const unsigned int colind0 = colind[iblk];
-			const unsigned int colind1 = colind[iblk+1];
-			for(unsigned int icrs=colind0;icrs<colind1;icrs++){
-				assert( icrs < rowPtr.size() );
-				const unsigned int jblk0 = rowptr[icrs];
-				assert( jblk0 < nblk_row );
-				for(unsigned int idof=0;idof<len_col;idof++){
-          for(unsigned int jdof=0;jdof<len_row;jdof++){
-            y[iblk*len_col+idof] += alpha * vcrs[icrs*blksize+idof*len_row+jdof] * x[jblk0*len_row+jdof];
-          }
-				}
-			}
-			for(unsigned int idof=0;idof<len_col;idof++){
-        for(unsigned int jdof=0;jdof<len_row;jdof++){
-          y[iblk*len_col+idof] += alpha * vdia[iblk*blksize+idof*len_row+jdof] * x[iblk*len_row+jdof];
-        }
-			}
-		}
-	}
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_MATVEC);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_MATVEC,
+                        2.0*(valCrs.size()+valDia.size()),
+                        (valCrs.size()+valDia.size())*sizeof(T) + rowPtr.size()*sizeof(unsigned int)
+                        + (nblk_row*len_row + 2.0*nblk_col*len_col)*sizeof(T));
+  if( nthread <= 1 || splitRow.size() != nthread+1 || !pool ){
+    MatVec_Range(y,alpha,x,beta,0,nblk_col,*this);
+    return;
+  }
+  pool->Run([&](unsigned int ith){
+    MatVec_Range(y,alpha,x,beta,splitRow[ith],splitRow[ith+1],*this);
+  });
 }
 template void delfem2::CMatrixSparse<float>::MatVec(float *y, float alpha, const float *x, float beta) const;
 template void delfem2::CMatrixSparse<double>::MatVec(double *y, double alpha, const double *x, double beta) const;
 template void delfem2::CMatrixSparse<COMPLEX>::MatVec(COMPLEX *y, COMPLEX alpha, const COMPLEX *x, COMPLEX beta) const;
 
+// Calc Matrix Product with nvec interleaved vectors for the block rows in [iblk_beg,iblk_end)
+// {Y} = alpha*[A]{X} + beta*{Y}
+template <typename T, unsigned int N>
+static void MatVecMulti_BlkRange
+(T* Y,
+ T alpha,
+ const T* X,
+ T beta,
+ unsigned int nvec,
+ unsigned int iblk_beg,
+ unsigned int iblk_end,
+ const dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int len_col = (N==0) ? mat.len_col : N;
+  const unsigned int len_row = (N==0) ? mat.len_row : N;
+  const unsigned int blksize = len_col*len_row;
+  const T* vcrs  = mat.valCrs.data();
+  const T* vdia = mat.valDia.empty() ? nullptr : mat.valDia.data();
+  const unsigned int* colind = mat.colInd.data();
+  const unsigned int* rowptr = mat.rowPtr.data();
+  for(unsigned int i=iblk_beg*len_col*nvec;i<iblk_end*len_col*nvec;++i){ Y[i] *= beta; }
+  for(unsigned int iblk=iblk_beg;iblk<iblk_end;iblk++){
+    T* py = Y+iblk*len_col*nvec;
+    const unsigned int icrs0 = colind[iblk];
+    const unsigned int icrs1 = colind[iblk+1];
+    for(unsigned int icrs=icrs0;icrs<icrs1+1;icrs++){ // the last one is the diagonal block
+      const T* pa;
+      const T* px;
+      if( icrs < icrs1 ){
+        assert( rowptr[icrs] < mat.nblk_row );
+        pa = vcrs+icrs*blksize;
+        px = X+rowptr[icrs]*len_row*nvec;
+      }
+      else{
+        if( vdia == nullptr ){ continue; }
+        pa = vdia+iblk*blksize;
+        px = X+iblk*len_row*nvec;
+      }
+      for(unsigned int i=0;i<len_col;++i){
+        for(unsigned int j=0;j<len_row;++j){
+          const T a = alpha*pa[i*len_row+j];
+          const T* pxj = px+j*nvec;
+          T* pyi = py+i*nvec;
+          for(unsigned int ivec=0;ivec<nvec;++ivec){ pyi[ivec] += a*pxj[ivec]; } // contiguous in ivec for the vectorization
+        }
+      }
+    }
+  }
+}
+
+template <typename T>
+static void MatVecMulti_Range
+(T* Y,
+ T alpha,
+ const T* X,
+ T beta,
+ unsigned int nvec,
+ unsigned int iblk_beg,
+ unsigned int iblk_end,
+ const dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int N = (mat.len_col == mat.len_row) ? mat.len_col : 0;
+  DFM2_DISPATCH_BLK(MatVecMulti_BlkRange, N, Y,alpha,X,beta,nvec,iblk_beg,iblk_end,mat)
+}
+
+template <typename T>
+void dfm2::CMatrixSparse<T>::MatVecMulti
+(T* Y,
+ T alpha,
+ const T* X,
+ T beta,
+ unsigned int nvec) const
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_MATVEC);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_MATVEC,
+                        2.0*nvec*(valCrs.size()+valDia.size()),
+                        (valCrs.size()+valDia.size())*sizeof(T) + rowPtr.size()*sizeof(unsigned int)
+                        + nvec*(nblk_row*len_row + 2.0*nblk_col*len_col)*sizeof(T));
+  if( nthread <= 1 || splitRow.size() != nthread+1 || !pool ){
+    MatVecMulti_Range(Y,alpha,X,beta,nvec,0,nblk_col,*this);
+    return;
+  }
+  pool->Run([&](unsigned int ith){
+    MatVecMulti_Range(Y,alpha,X,beta,nvec,splitRow[ith],splitRow[ith+1],*this);
+  });
+}
+template void delfem2::CMatrixSparse<float>::MatVecMulti(float *Y, float alpha, const float *X, float beta,
+                                                         unsigned int nvec) const;
+template void delfem2::CMatrixSparse<double>::MatVecMulti(double *Y, double alpha, const double *X, double beta,
+                                                          unsigned int nvec) const;
+template void delfem2::CMatrixSparse<COMPLEX>::MatVecMulti(COMPLEX *Y, COMPLEX alpha, const COMPLEX *X, COMPLEX beta,
+                                                           unsigned int nvec) const;
+
 // -------------------------------------------------------
 
+// Calc Matrix Vector Product (serial)
+// {y} = alpha*[A]^T{x} + beta*{y}
+template <typename T, unsigned int N>
+static void MatTVec_Serial
+(T* y,
+ T alpha,
+ const T* x,
+ T beta,
+ const dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int len_col = (N==0) ? mat.len_col : N;
+  const unsigned int len_row = (N==0) ? mat.len_row : N;
+  const unsigned int blksize = len_col*len_row;
+  const T* vcrs  = mat.valCrs.data();
+  const T* vdia = mat.valDia.empty() ? nullptr : mat.valDia.data();
+  const unsigned int* colind = mat.colInd.data();
+  const unsigned int* rowptr = mat.rowPtr.data();
+  const unsigned int ndofrow = len_row*mat.nblk_row;
+  for(unsigned int i=0;i<ndofrow;++i){ y[i] *= beta; }
+  for(unsigned int iblk=0;iblk<mat.nblk_col;iblk++){
+    const T* px = x+iblk*len_col;
+    for(unsigned int icrs=colind[iblk];icrs<colind[iblk+1];icrs++){
+      assert( icrs < mat.rowPtr.size() );
+      const unsigned int jblk0 = rowptr[icrs];
+      assert( jblk0 < mat.nblk_row );
+      BlkMatTVecAdd<T,N>(y+jblk0*len_row, alpha, vcrs+icrs*blksize, px, len_col, len_row);
+    }
+    if( vdia == nullptr ){ continue; }
+    BlkMatTVecAdd<T,N>(y+iblk*len_row, alpha, vdia+iblk*blksize, px, len_col, len_row);
+  }
+}
+
+// Calc Matrix Vector Product for the block columns in [jblk_beg,jblk_end) using the transposed pattern
+// {y} = alpha*[A]^T{x} + beta*{y}
+// The entries of y are accumulated in the same order as MatTVec_Serial.
+template <typename T, unsigned int N>
+static void MatTVec_BlkColRange
+(T* y,
+ T alpha,
+ const T* x,
+ T beta,
+ unsigned int jblk_beg,
+ unsigned int jblk_end,
+ const dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int len_col = (N==0) ? mat.len_col : N;
+  const unsigned int len_row = (N==0) ? mat.len_row : N;
+  const unsigned int blksize = len_col*len_row;
+  const T* vcrs  = mat.valCrs.data();
+  const T* vdia = mat.valDia.empty() ? nullptr : mat.valDia.data();
+  for(unsigned int jblk=jblk_beg;jblk<jblk_end;++jblk){
+    T* py = y+jblk*len_row;
+    for(unsigned int jdof=0;jdof<len_row;jdof++){ py[jdof] *= beta; }
+    bool is_dia_added = (vdia == nullptr);
+    for(unsigned int it=mat.colIndT[jblk];it<mat.colIndT[jblk+1];++it){
+      const unsigned int iblk = mat.rowPtrT[it];
+      const unsigned int icrs = mat.crsT[it];
+      if( !is_dia_added && iblk > jblk ){
+        BlkMatTVecAdd<T,N>(py, alpha, vdia+jblk*blksize, x+jblk*len_col, len_col, len_row);
+        is_dia_added = true;
+      }
+      BlkMatTVecAdd<T,N>(py, alpha, vcrs+icrs*blksize, x+iblk*len_col, len_col, len_row);
+    }
+    if( !is_dia_added ){
+      BlkMatTVecAdd<T,N>(py, alpha, vdia+jblk*blksize, x+jblk*len_col, len_col, len_row);
+    }
+  }
+}
+
 // Calc Matrix Vector Product
 // {y} = alpha*[A]^T{x} + beta*{y}
 template <typename T>
@@ -219,202 +347,125 @@ void dfm2::CMatrixSparse<T>::MatTVec
   const T* x,
   T beta) const
 {
-  const unsigned int ndofrow = len_row*nblk_row;
-  for(unsigned int i=0;i<ndofrow;++i){ y[i] *= beta; }
-  const unsigned int blksize = len_col*len_row;
-  // ---------
-  /*
-  if( len_col == 1 && len_row == 1 ){
-    const T* vcrs  = valCrs.data();
-    const T* vdia = valDia.data();
-    const unsigned int* colind = colInd.data();
-    const unsigned int* rowptr = rowPtr.data();
-    //
-    for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-      T& vy = y[iblk];
-      vy *= beta;
-      const unsigned int colind0 = colind[iblk];
-      const unsigned int colind1 = colind[iblk+1];
-      for(unsigned int icrs=colind0;icrs<colind1;icrs++){
-        assert( icrs < rowPtr.size() );
-        const unsigned int jblk0 = rowptr[icrs];
-        assert( jblk0 < nblk_row );
-        vy += alpha * vcrs[icrs] * x[jblk0];
-      }
-      vy += alpha * vdia[iblk] * x[iblk];
-    }
-  }
-  else if( len_col == 2 && len_row == 2 ){
-    const T* vcrs  = valCrs.data();
-    const T* vdia = valDia.data();
-    const unsigned int* colind = colInd.data();
-    const unsigned int* rowptr = rowPtr.data();
-    //
-    for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-      y[iblk*2+0] *= beta;
-      y[iblk*2+1] *= beta;
-      const unsigned int icrs0 = colind[iblk];
-      const unsigned int icrs1 = colind[iblk+1];
-      for(unsigned int icrs=icrs0;icrs<icrs1;icrs++){
-        assert( icrs < rowPtr.size() );
-        const unsigned int jblk0 = rowptr[icrs];
-        assert( jblk0 < nblk_row );
-        y[iblk*2+0] += alpha * ( vcrs[icrs*4  ]*x[jblk0*2+0] + vcrs[icrs*4+1]*x[jblk0*2+1] );
-        y[iblk*2+1] += alpha * ( vcrs[icrs*4+2]*x[jblk0*2+0] + vcrs[icrs*4+3]*x[jblk0*2+1] );
-      }
-      y[iblk*2+0] += alpha * ( vdia[iblk*4+0]*x[iblk*2+0] + vdia[iblk*4+1]*x[iblk*2+1] );
-      y[iblk*2+1] += alpha * ( vdia[iblk*4+2]*x[iblk*2+0] + vdia[iblk*4+3]*x[iblk*2+1] );
-    }
-  }
-  else if( len_col == 3 && len_row == 3 ){
-    const T* vcrs  = valCrs.data();
-    const T* vdia = valDia.data();
-    const unsigned int* colind = colInd.data();
-    const unsigned int* rowptr = rowPtr.data();
-    //
-    for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-      y[iblk*3+0] *= beta;
-      y[iblk*3+1] *= beta;
-      y[iblk*3+2] *= beta;
-      const unsigned int icrs0 = colind[iblk];
-      const unsigned int icrs1 = colind[iblk+1];
-      for(unsigned int icrs=icrs0;icrs<icrs1;icrs++){
-        assert( icrs < rowPtr.size() );
-        const unsigned int jblk0 = rowptr[icrs];
-        assert( jblk0 < nblk_row );
-        const unsigned int i0 = iblk*3;
-        const unsigned int j0 = jblk0*3;
-        const unsigned int k0 = icrs*9;
-        y[i0+0] += alpha*(vcrs[k0+0]*x[j0+0]+vcrs[k0+1]*x[j0+1]+vcrs[k0+2]*x[j0+2]);
-        y[i0+1] += alpha*(vcrs[k0+3]*x[j0+0]+vcrs[k0+4]*x[j0+1]+vcrs[k0+5]*x[j0+2]);
-        y[i0+2] += alpha*(vcrs[k0+6]*x[j0+0]+vcrs[k0+7]*x[j0+1]+vcrs[k0+8]*x[j0+2]);
-      }
-      {
-        const unsigned int i0 = iblk*3;
-        const unsigned int k0 = iblk*9;
-        y[i0+0] += alpha*(vdia[k0+0]*x[i0+0]+vdia[k0+1]*x[i0+1]+vdia[k0+2]*x[i0+2]);
-        y[i0+1] += alpha*(vdia[k0+3]*x[i0+0]+vdia[k0+4]*x[i0+1]+vdia[k0+5]*x[i0+2]);
-        y[i0+2] += alpha*(vdia[k0+6]*x[i0+0]+vdia[k0+7]*x[i0+1]+vdia[k0+8]*x[i0+2]);
-      }
-    }
-  }
-  else if( len_col == 4 && len_row == 4 ){
-    const T* vcrs  = valCrs.data();
-    const T* vdia = valDia.data();
-    const unsigned int* colind = colInd.data();
-    const unsigned int* rowptr = rowPtr.data();
-    //
-    for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-      y[iblk*4+0] *= beta;
-      y[iblk*4+1] *= beta;
-      y[iblk*4+2] *= beta;
-      y[iblk*4+3] *= beta;
-      const unsigned int icrs0 = colind[iblk];
-      const unsigned int icrs1 = colind[iblk+1];
-      for(unsigned int icrs=icrs0;icrs<icrs1;icrs++){
-        assert( icrs < rowPtr.size() );
-        const unsigned int jblk0 = rowptr[icrs];
-        assert( jblk0 < nblk_row );
-        const unsigned int i0 = iblk*4;
-        const unsigned int j0 = jblk0*4;
-        const unsigned int k0 = icrs*16;
-        y[i0+0] += alpha*(vcrs[k0+ 0]*x[j0+0]+vcrs[k0+ 1]*x[j0+1]+vcrs[k0+ 2]*x[j0+2]+vcrs[k0+ 3]*x[j0+3]);
-        y[i0+1] += alpha*(vcrs[k0+ 4]*x[j0+0]+vcrs[k0+ 5]*x[j0+1]+vcrs[k0+ 6]*x[j0+2]+vcrs[k0+ 7]*x[j0+3]);
-        y[i0+2] += alpha*(vcrs[k0+ 8]*x[j0+0]+vcrs[k0+ 9]*x[j0+1]+vcrs[k0+10]*x[j0+2]+vcrs[k0+11]*x[j0+3]);
-        y[i0+3] += alpha*(vcrs[k0+12]*x[j0+0]+vcrs[k0+13]*x[j0+1]+vcrs[k0+14]*x[j0+2]+vcrs[k0+15]*x[j0+3]);
-      }
-      {
-        const unsigned int i0 = iblk*4;
-        const unsigned int k0 = iblk*16;
-        y[i0+0] += alpha*(vdia[k0+ 0]*x[i0+0]+vdia[k0+ 1]*x[i0+1]+vdia[k0+ 2]*x[i0+2]+vdia[k0+ 3]*x[i0+3]);
-        y[i0+1] += alpha*(vdia[k0+ 4]*x[i0+0]+vdia[k0+ 5]*x[i0+1]+vdia[k0+ 6]*x[i0+2]+vdia[k0+ 7]*x[i0+3]);
-        y[i0+2] += alpha*(vdia[k0+ 8]*x[i0+0]+vdia[k0+ 9]*x[i0+1]+vdia[k0+10]*x[i0+2]+vdia[k0+11]*x[i0+3]);
-        y[i0+3] += alpha*(vdia[k0+12]*x[i0+0]+vdia[k0+13]*x[i0+1]+vdia[k0+14]*x[i0+2]+vdia[k0+15]*x[i0+3]);
-      }
-    }
-  }
-  else{
-   */
-  {
-    const T* vcrs  = valCrs.data();
-    const T* vdia = valDia.data();
-    const unsigned int* colind = colInd.data();
-    const unsigned int* rowptr = rowPtr.data();
-    //
-    for(unsigned int iblk=0;iblk<nblk_col;iblk++){
-      const unsigned int colind0 = colind[iblk];
-      const unsigned int colind1 = colind[iblk+1];
-      for(unsigned int icrs=colind0;icrs<colind1;icrs++){
-        assert( icrs < rowPtr.size() );
-        const unsigned int jblk0 = rowptr[icrs];
-        assert( jblk0 < nblk_row );
-        for(unsigned int idof=0;idof<len_col;idof++){
-          for(unsigned int jdof=0;jdof<len_row;jdof++){
-            y[jblk0*len_row+jdof] += alpha * vcrs[icrs*blksize+idof*len_row+jdof] * x[iblk*len_col+idof];
-          }
-        }
-      }
-      for(unsigned int jdof=0;jdof<len_row;jdof++){
-        for(unsigned int idof=0;idof<len_col;idof++){
-          y[iblk*len_row+jdof] += alpha * vdia[iblk*blksize+idof*len_row+jdof] * x[iblk*len_col+idof];
-        }
-      }
-    }
+  const unsigned int N = (len_col == len_row) ? len_col : 0;
+  if( nthread <= 1 || splitCol.size() != nthread+1 || !pool ){
+    DFM2_DISPATCH_BLK(MatTVec_Serial, N, y,alpha,x,beta,*this)
+    return;
   }
+  pool->Run([&](unsigned int ith){
+    DFM2_DISPATCH_BLK(MatTVec_BlkColRange, N, y,alpha,x,beta,splitCol[ith],splitCol[ith+1],*this)
+  });
 }
 template void delfem2::CMatrixSparse<float>::MatTVec(float *y, float alpha, const float *x, float beta) const;
 template void delfem2::CMatrixSparse<double>::MatTVec(double *y, double alpha, const double *x, double beta) const;
 template void delfem2::CMatrixSparse<COMPLEX>::MatTVec(COMPLEX *y, COMPLEX alpha, const COMPLEX *x, COMPLEX beta) const;
 
+// -------------------------------------------------------
+
+template <typename T>
+void dfm2::CMatrixSparse<T>::SetNumThread(unsigned int nthread0)
+{
+  this->nthread = (nthread0==0) ? 1 : nthread0;
+  splitRow.clear();
+  splitCol.clear();
+  colIndT.clear();
+  rowPtrT.clear();
+  crsT.clear();
+  if( nthread <= 1 ){ pool.reset(); return; }
+  if( !pool || pool->NumThread() != nthread ){ pool = std::make_shared<dfm2::CThreadPool>(nthread); }
+  if( colInd.size() != nblk_col+1 ){ return; } // pattern is not set yet
+  const unsigned int ncrs = colInd[nblk_col];
+  if( rowPtr.size() != ncrs ){ return; }
+  dfm2::SplitRange_Weight(splitRow, nthread, colInd.data(), nblk_col);
+  // make transposed pattern. rows are sorted in ascending order for each column
+  colIndT.assign(nblk_row+1,0);
+  for(unsigned int icrs=0;icrs<ncrs;++icrs){
+    assert( rowPtr[icrs] < nblk_row );
+    colIndT[rowPtr[icrs]+1] += 1;
+  }
+  for(unsigned int jblk=0;jblk<nblk_row;++jblk){ colIndT[jblk+1] += colIndT[jblk]; }
+  rowPtrT.resize(ncrs);
+  crsT.resize(ncrs);
+  for(unsigned int iblk=0;iblk<nblk_col;++iblk){
+    for(unsigned int icrs=colInd[iblk];icrs<colInd[iblk+1];++icrs){
+      const unsigned int jblk = rowPtr[icrs];
+      const unsigned int it = colIndT[jblk];
+      rowPtrT[it] = iblk;
+      crsT[it] = icrs;
+      colIndT[jblk] += 1;
+    }
+  }
+  for(unsigned int jblk=nblk_row;jblk>0;--jblk){ colIndT[jblk] = colIndT[jblk-1]; }
+  colIndT[0] = 0;
+  dfm2::SplitRange_Weight(splitCol, nthread, colIndT.data(), nblk_row);
+}
+template void delfem2::CMatrixSparse<float>::SetNumThread(unsigned int nthread0);
+template void delfem2::CMatrixSparse<double>::SetNumThread(unsigned int nthread0);
+template void delfem2::CMatrixSparse<COMPLEX>::SetNumThread(unsigned int nthread0);
+
 
 // ----------------------------------
 
-template<typename T>
-bool delfem2::CMatrixSparse<T>::Mearge
+// N is the block size fixed at compile time. N=0 means the size is given at runtime.
+template<typename T, unsigned int N>
+static void Mearge_Blk
 (unsigned int nblkel_col, const unsigned int *blkel_col,
  unsigned int nblkel_row, const unsigned int *blkel_row,
- unsigned int blksize, const T *emat,
- std::vector<int> &marge_buffer)
+ const T *emat,
+ std::vector<int> &marge_buffer,
+ dfm2::CMatrixSparse<T>& mat)
 {
-  assert(!valCrs.empty());
-  assert(!valDia.empty());
-  assert(blksize == len_col * len_row);
-  marge_buffer.resize(nblk_row);
-  const unsigned int *colind = colInd.data();
-  const unsigned int *rowptr = rowPtr.data();
-  T *vcrs = valCrs.data();
-  T *vdia = valDia.data();
+  const unsigned int blksize = (N==0) ? mat.len_col*mat.len_row : N*N;
+  const unsigned int *colind = mat.colInd.data();
+  const unsigned int *rowptr = mat.rowPtr.data();
+  T *vcrs = mat.valCrs.data();
+  T *vdia = mat.valDia.data();
   for (unsigned int iblkel = 0; iblkel < nblkel_col; iblkel++) {
     const unsigned int iblk1 = blkel_col[iblkel];
-    assert(iblk1 < nblk_col);
+    assert(iblk1 < mat.nblk_col);
     for (unsigned int jpsup = colind[iblk1]; jpsup < colind[iblk1 + 1]; jpsup++) {
-      assert(jpsup < rowPtr.size());
+      assert(jpsup < mat.rowPtr.size());
       const int jblk1 = rowptr[jpsup];
       marge_buffer[jblk1] = jpsup;
     }
     for (unsigned int jblkel = 0; jblkel < nblkel_row; jblkel++) {
       const unsigned int jblk1 = blkel_row[jblkel];
-      assert(jblk1 < nblk_row);
+      assert(jblk1 < mat.nblk_row);
+      const T *pval_in = &emat[(iblkel * nblkel_row + jblkel) * blksize];
+      T* pval_out = nullptr;
       if (iblk1 == jblk1) {  // Marge Diagonal
-        const T *pval_in = &emat[(iblkel * nblkel_row + iblkel) * blksize];
-        T *pval_out = &vdia[iblk1 * blksize];
-        for (unsigned int i = 0; i < blksize; i++) { pval_out[i] += pval_in[i]; }
+        pval_out = &vdia[iblk1 * blksize];
       } else {  // Marge Non-Diagonal
         if (marge_buffer[jblk1] == -1) continue;
-        assert(marge_buffer[jblk1] >= 0 && marge_buffer[jblk1] < (int) rowPtr.size());
+        assert(marge_buffer[jblk1] >= 0 && marge_buffer[jblk1] < (int) mat.rowPtr.size());
         const int jpsup1 = marge_buffer[jblk1];
-        assert(rowPtr[jpsup1] == jblk1);
-        const T *pval_in = &emat[(iblkel * nblkel_row + jblkel) * blksize];
-        T *pval_out = &vcrs[jpsup1 * blksize];
-        for (unsigned int i = 0; i < blksize; i++) { pval_out[i] += pval_in[i]; }
+        assert(mat.rowPtr[jpsup1] == jblk1);
+        pval_out = &vcrs[jpsup1 * blksize];
       }
+      for (unsigned int i = 0; i < blksize; i++) { pval_out[i] += pval_in[i]; }
     }
     for (unsigned int jpsup = colind[iblk1]; jpsup < colind[iblk1 + 1]; jpsup++) {
-      assert(jpsup < rowPtr.size());
+      assert(jpsup < mat.rowPtr.size());
       const int jblk1 = rowptr[jpsup];
       marge_buffer[jblk1] = -1;
     }
   }
+}
+
+template<typename T>
+bool delfem2::CMatrixSparse<T>::Mearge
+(unsigned int nblkel_col, const unsigned int *blkel_col,
+ unsigned int nblkel_row, const unsigned int *blkel_row,
+ unsigned int blksize, const T *emat,
+ std::vector<int> &marge_buffer)
+{
+  assert(!valCrs.empty());
+  assert(!valDia.empty());
+  assert(blksize == len_col * len_row);
+  (void)blksize; // only used in the assert
+  marge_buffer.resize(nblk_row,-1);
+  const unsigned int N = (len_col == len_row) ? len_col : 0;
+  DFM2_DISPATCH_BLK(Mearge_Blk, N, nblkel_col,blkel_col,nblkel_row,blkel_row,emat,marge_buffer,*this)
   return true;
 }
 template bool delfem2::CMatrixSparse<float>::Mearge(unsigned int nblkel_col, const unsigned int *blkel_col,
@@ -430,8 +481,418 @@ template bool delfem2::CMatrixSparse<COMPLEX>::Mearge(unsigned int nblkel_col, c
                                                       unsigned int blksize, const COMPLEX *emat,
                                                       std::vector<int> &marge_buffer);
 
+template<typename T, unsigned int N>
+static void Mearge_Plan_Blk
+(unsigned int nblkel, const unsigned int *blkel,
+ const int *crs,
+ const T *emat,
+ dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int blksize = (N==0) ? mat.len_col*mat.len_row : N*N;
+  T *vcrs = mat.valCrs.data();
+  T *vdia = mat.valDia.data();
+  for (unsigned int iblkel = 0; iblkel < nblkel; iblkel++) {
+    const unsigned int iblk1 = blkel[iblkel];
+    for (unsigned int jblkel = 0; jblkel < nblkel; jblkel++) {
+      const T *pval_in = emat + (iblkel * nblkel + jblkel) * blksize;
+      const int ijcrs = crs[iblkel * nblkel + jblkel];
+      T* pval_out = nullptr;
+      if (ijcrs >= 0) {
+        assert( ijcrs < (int)mat.rowPtr.size() && mat.rowPtr[ijcrs] == blkel[jblkel] );
+        pval_out = vcrs + ijcrs * blksize;
+      }
+      else if (iblk1 == blkel[jblkel]) { pval_out = vdia + iblk1 * blksize; }
+      else { continue; }
+      for (unsigned int i = 0; i < blksize; i++) { pval_out[i] += pval_in[i]; }
+    }
+  }
+}
+
+template<typename T>
+void delfem2::CMatrixSparse<T>::Mearge_Plan
+(unsigned int nblkel, const unsigned int *blkel,
+ const int *crs,
+ const T *emat)
+{
+  assert(!valDia.empty());
+  const unsigned int N = (len_col == len_row) ? len_col : 0;
+  DFM2_DISPATCH_BLK(Mearge_Plan_Blk, N, nblkel,blkel,crs,emat,*this)
+}
+template void delfem2::CMatrixSparse<float>::Mearge_Plan(unsigned int nblkel, const unsigned int *blkel,
+                                                         const int *crs, const float *emat);
+template void delfem2::CMatrixSparse<double>::Mearge_Plan(unsigned int nblkel, const unsigned int *blkel,
+                                                          const int *crs, const double *emat);
+template void delfem2::CMatrixSparse<COMPLEX>::Mearge_Plan(unsigned int nblkel, const unsigned int *blkel,
+                                                           const int *crs, const COMPLEX *emat);
+
+template<typename T>
+void delfem2::CMergePlan::Initialize
+(const CMatrixSparse<T>& mat,
+ const unsigned int* aElem, unsigned int nElem0, unsigned int nPoEl0)
+{
+  this->nElem = nElem0;
+  this->nPoEl = nPoEl0;
+  aCrs.assign(nElem*nPoEl*nPoEl, -1);
+  std::vector<int> marge_buffer(mat.nblk_row, -1);
+  for(unsigned int iel=0;iel<nElem;++iel){
+    const unsigned int* aIP = aElem+iel*nPoEl;
+    int* crs = aCrs.data()+iel*nPoEl*nPoEl;
+    for(unsigned int ino=0;ino<nPoEl;++ino){
+      const unsigned int ip = aIP[ino];
+      assert( ip < mat.nblk_col );
+      for(unsigned int ijcrs=mat.colInd[ip];ijcrs<mat.colInd[ip+1];++ijcrs){
+        marge_buffer[mat.rowPtr[ijcrs]] = ijcrs;
+      }
+      for(unsigned int jno=0;jno<nPoEl;++jno){
+        const unsigned int jp = aIP[jno];
+        assert( jp < mat.nblk_row );
+        if( ip == jp ){ continue; }
+        crs[ino*nPoEl+jno] = marge_buffer[jp];
+      }
+      for(unsigned int ijcrs=mat.colInd[ip];ijcrs<mat.colInd[ip+1];++ijcrs){
+        marge_buffer[mat.rowPtr[ijcrs]] = -1;
+      }
+    }
+  }
+}
+template void delfem2::CMergePlan::Initialize(const CMatrixSparse<float>& mat,
+                                              const unsigned int* aElem, unsigned int nElem, unsigned int nPoEl);
+template void delfem2::CMergePlan::Initialize(const CMatrixSparse<double>& mat,
+                                              const unsigned int* aElem, unsigned int nElem, unsigned int nPoEl);
+template void delfem2::CMergePlan::Initialize(const CMatrixSparse<COMPLEX>& mat,
+                                              const unsigned int* aElem, unsigned int nElem, unsigned int nPoEl);
+
+// -----------------------------------------------------------------
+// sparse matrix-matrix product
+
+// [C] += [A][B] where [A] is (ni x nk) and [B] is (nk x nj)
+template <typename T>
+static inline void BlkMatMatAdd
+(T* C,
+ const T* A, const T* B,
+ unsigned int ni, unsigned int nk, unsigned int nj)
+{
+  for(unsigned int i=0;i<ni;++i){
+    for(unsigned int k=0;k<nk;++k){
+      const T aik = A[i*nk+k];
+      for(unsigned int j=0;j<nj;++j){ C[i*nj+j] += aik*B[k*nj+j]; }
+    }
+  }
+}
+
+// [C] += [A]^T[B] where [A] is (nk x ni) and [B] is (nk x nj)
+template <typename T>
+static inline void BlkMatTMatAdd
+(T* C,
+ const T* A, const T* B,
+ unsigned int ni, unsigned int nk, unsigned int nj)
+{
+  for(unsigned int k=0;k<nk;++k){
+    for(unsigned int i=0;i<ni;++i){
+      const T aki = A[k*ni+i];
+      for(unsigned int j=0;j<nj;++j){ C[i*nj+j] += aki*B[k*nj+j]; }
+    }
+  }
+}
+
+// call func(jblk, pa) for the blocks in the block row iblk of [A]. The diagonal block comes first.
+template <typename T, typename FUNC>
+static inline void ForEachBlk_Row
+(const dfm2::CMatrixSparse<T>& A,
+ unsigned int iblk,
+ FUNC func)
+{
+  const unsigned int blksize = A.len_col*A.len_row;
+  if( !A.valDia.empty() ){ func(iblk, A.valDia.data()+iblk*blksize); }
+  for(unsigned int icrs=A.colInd[iblk];icrs<A.colInd[iblk+1];++icrs){
+    func(A.rowPtr[icrs], A.valCrs.data()+icrs*blksize);
+  }
+}
+
+// set the pattern of the block rows. The values are set to zero.
+template <typename T>
+static void SetPattern_MatProduct
+(dfm2::CMatrixSparse<T>& C,
+ unsigned int nblk_col, unsigned int nblk_row,
+ unsigned int len_col, unsigned int len_row,
+ bool is_dia,
+ std::vector<unsigned int>& colind,
+ std::vector<unsigned int>& rowptr)
+{
+  C.nblk_col = nblk_col;
+  C.nblk_row = nblk_row;
+  C.len_col = len_col;
+  C.len_row = len_row;
+  C.colInd.swap(colind);
+  C.rowPtr.swap(rowptr);
+  C.valCrs.assign(C.rowPtr.size()*len_col*len_row, 0);
+  if( is_dia ){ C.valDia.assign(nblk_col*len_col*len_row, 0); }
+  else{ C.valDia.clear(); }
+  C.SetNumThread(C.nthread); // update the cache for the threads
+}
+
+// call func(iblk_beg, iblk_end, aMark) for the ranges of the block rows of [C] with the threads of [C].
+// aMark is the work array of each thread with size of C.nblk_row initialized with -1
+template <typename T, typename FUNC>
+static void ParallelRange_MatProduct
+(const dfm2::CMatrixSparse<T>& C,
+ FUNC func)
+{
+  if( C.nthread <= 1 || C.splitRow.size() != C.nthread+1 ){
+    std::vector<int> aMark(C.nblk_row,-1);
+    func(0, C.nblk_col, aMark);
+    return;
+  }
+  dfm2::ParallelThread(C.nthread, [&](unsigned int ith){
+    std::vector<int> aMark(C.nblk_row,-1);
+    func(C.splitRow[ith], C.splitRow[ith+1], aMark);
+  });
+}
+
+template <typename T>
+void dfm2::MatSparse_MatMat_Symbolic
+(CMatrixSparse<T>& C,
+ const CMatrixSparse<T>& A,
+ const CMatrixSparse<T>& B)
+{
+  assert( A.nblk_row == B.nblk_col && A.len_row == B.len_col );
+  const unsigned int nblk = A.nblk_col;
+  const bool is_dia = (A.nblk_col == B.nblk_row && A.len_col == B.len_row);
+  std::vector<unsigned int> colind(nblk+1,0), rowptr;
+  std::vector<int> aMark(B.nblk_row,-1);
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    const unsigned int icrs0 = (unsigned int)rowptr.size();
+    ForEachBlk_Row(A, iblk, [&](unsigned int kblk, const T*){
+      ForEachBlk_Row(B, kblk, [&](unsigned int jblk, const T*){
+        if( is_dia && jblk == iblk ){ return; }
+        if( aMark[jblk] == (int)iblk ){ return; }
+        aMark[jblk] = (int)iblk;
+        rowptr.push_back(jblk);
+      });
+    });
+    std::sort(rowptr.begin()+icrs0, rowptr.end());
+    colind[iblk+1] = (unsigned int)rowptr.size();
+  }
+  SetPattern_MatProduct(C,
+                        nblk, B.nblk_row, A.len_col, B.len_row, is_dia,
+                        colind, rowptr);
+}
+template void dfm2::MatSparse_MatMat_Symbolic(CMatrixSparse<float>& C,
+    const CMatrixSparse<float>& A, const CMatrixSparse<float>& B);
+template void dfm2::MatSparse_MatMat_Symbolic(CMatrixSparse<double>& C,
+    const CMatrixSparse<double>& A, const CMatrixSparse<double>& B);
+template void dfm2::MatSparse_MatMat_Symbolic(CMatrixSparse<COMPLEX>& C,
+    const CMatrixSparse<COMPLEX>& A, const CMatrixSparse<COMPLEX>& B);
+
+template <typename T>
+void dfm2::MatSparse_MatMat_Numeric
+(CMatrixSparse<T>& C,
+ const CMatrixSparse<T>& A,
+ const CMatrixSparse<T>& B)
+{
+  assert( A.nblk_row == B.nblk_col && A.len_row == B.len_col );
+  assert( C.nblk_col == A.nblk_col && C.nblk_row == B.nblk_row );
+  assert( C.len_col == A.len_col && C.len_row == B.len_row );
+  const unsigned int blkC = C.len_col*C.len_row;
+  const bool is_dia = !C.valDia.empty();
+  ParallelRange_MatProduct(C, [&](unsigned int iblk_beg, unsigned int iblk_end, std::vector<int>& aMark){
+    for(unsigned int iblk=iblk_beg;iblk<iblk_end;++iblk){
+      for(unsigned int icrs=C.colInd[iblk];icrs<C.colInd[iblk+1];++icrs){ aMark[C.rowPtr[icrs]] = icrs; }
+      for(unsigned int i=C.colInd[iblk]*blkC;i<C.colInd[iblk+1]*blkC;++i){ C.valCrs[i] = 0; }
+      if( is_dia ){ for(unsigned int i=iblk*blkC;i<(iblk+1)*blkC;++i){ C.valDia[i] = 0; } }
+      ForEachBlk_Row(A, iblk, [&](unsigned int kblk, const T* pa){
+        ForEachBlk_Row(B, kblk, [&](unsigned int jblk, const T* pb){
+          T* pc = nullptr;
+          if( is_dia && jblk == iblk ){ pc = C.valDia.data()+iblk*blkC; }
+          else{
+            assert( aMark[jblk] != -1 );
+            pc = C.valCrs.data()+aMark[jblk]*blkC;
+          }
+          BlkMatMatAdd(pc, pa, pb, A.len_col, A.len_row, B.len_row);
+        });
+      });
+      for(unsigned int icrs=C.colInd[iblk];icrs<C.colInd[iblk+1];++icrs){ aMark[C.rowPtr[icrs]] = -1; }
+    }
+  });
+}
+template void dfm2::MatSparse_MatMat_Numeric(CMatrixSparse<float>& C,
+    const CMatrixSparse<float>& A, const CMatrixSparse<float>& B);
+template void dfm2::MatSparse_MatMat_Numeric(CMatrixSparse<double>& C,
+    const CMatrixSparse<double>& A, const CMatrixSparse<double>& B);
+template void dfm2::MatSparse_MatMat_Numeric(CMatrixSparse<COMPLEX>& C,
+    const CMatrixSparse<COMPLEX>& A, const CMatrixSparse<COMPLEX>& B);
+
+template <typename T>
+void dfm2::CTripleProductPlan<T>::Initialize
+(CMatrixSparse<T>& Ac,
+ const CMatrixSparse<T>& R,
+ const CMatrixSparse<T>& A,
+ const CMatrixSparse<T>& P)
+{
+  assert( R.nblk_col == A.nblk_col && R.len_col == A.len_col );
+  matAP.nthread = Ac.nthread;
+  MatSparse_MatMat_Symbolic(matAP, A, P);
+  // transposed pattern of [R]. The block rows are ascending for each block column
+  const unsigned int nblk = R.nblk_col;
+  const unsigned int nblkc = R.nblk_row;
+  const unsigned int ncrsR = (unsigned int)R.rowPtr.size();
+  colIndRt.assign(nblkc+1,0);
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    ForEachBlk_Row(R, iblk, [&](unsigned int iblkc, const T*){ colIndRt[iblkc+1] += 1; });
+  }
+  for(unsigned int iblkc=0;iblkc<nblkc;++iblkc){ colIndRt[iblkc+1] += colIndRt[iblkc]; }
+  rowPtrRt.resize(colIndRt[nblkc]);
+  crsRt.resize(colIndRt[nblkc]);
+  {
+    std::vector<unsigned int> aPos(colIndRt.begin(), colIndRt.end()-1);
+    for(unsigned int iblk=0;iblk<nblk;++iblk){
+      if( !R.valDia.empty() ){
+        const unsigned int ipos = aPos[iblk]++;
+        rowPtrRt[ipos] = iblk;
+        crsRt[ipos] = ncrsR+iblk;
+      }
+      for(unsigned int icrs=R.colInd[iblk];icrs<R.colInd[iblk+1];++icrs){
+        const unsigned int ipos = aPos[R.rowPtr[icrs]]++;
+        rowPtrRt[ipos] = iblk;
+        crsRt[ipos] = icrs;
+      }
+    }
+  }
+  // pattern of [Ac] = [R]^T[AP]
+  const bool is_dia = (nblkc == P.nblk_row && R.len_row == P.len_row);
+  std::vector<unsigned int> colind(nblkc+1,0), rowptr;
+  std::vector<int> aMark(P.nblk_row,-1);
+  for(unsigned int iblkc=0;iblkc<nblkc;++iblkc){
+    const unsigned int icrs0 = (unsigned int)rowptr.size();
+    for(unsigned int it=colIndRt[iblkc];it<colIndRt[iblkc+1];++it){
+      ForEachBlk_Row(matAP, rowPtrRt[it], [&](unsigned int jblkc, const T*){
+        if( is_dia && jblkc == iblkc ){ return; }
+        if( aMark[jblkc] == (int)iblkc ){ return; }
+        aMark[jblkc] = (int)iblkc;
+        rowptr.push_back(jblkc);
+      });
+    }
+    std::sort(rowptr.begin()+icrs0, rowptr.end());
+    colind[iblkc+1] = (unsigned int)rowptr.size();
+  }
+  SetPattern_MatProduct(Ac,
+                        nblkc, P.nblk_row, R.len_row, P.len_row, is_dia,
+                        colind, rowptr);
+}
+template void dfm2::CTripleProductPlan<float>::Initialize(CMatrixSparse<float>& Ac,
+    const CMatrixSparse<float>& R, const CMatrixSparse<float>& A, const CMatrixSparse<float>& P);
+template void dfm2::CTripleProductPlan<double>::Initialize(CMatrixSparse<double>& Ac,
+    const CMatrixSparse<double>& R, const CMatrixSparse<double>& A, const CMatrixSparse<double>& P);
+template void dfm2::CTripleProductPlan<COMPLEX>::Initialize(CMatrixSparse<COMPLEX>& Ac,
+    const CMatrixSparse<COMPLEX>& R, const CMatrixSparse<COMPLEX>& A, const CMatrixSparse<COMPLEX>& P);
+
+template <typename T>
+void dfm2::CTripleProductPlan<T>::SetValue
+(CMatrixSparse<T>& Ac,
+ const CMatrixSparse<T>& R,
+ const CMatrixSparse<T>& A,
+ const CMatrixSparse<T>& P)
+{
+  assert( colIndRt.size() == R.nblk_row+1 );
+  assert( Ac.nblk_col == R.nblk_row && Ac.nblk_row == P.nblk_row );
+  if( matAP.nthread != Ac.nthread ){ matAP.SetNumThread(Ac.nthread); }
+  MatSparse_MatMat_Numeric(matAP, A, P);
+  const unsigned int blkR = R.len_col*R.len_row;
+  const unsigned int blkC = Ac.len_col*Ac.len_row;
+  const unsigned int ncrsR = (unsigned int)R.rowPtr.size();
+  const bool is_dia = !Ac.valDia.empty();
+  ParallelRange_MatProduct(Ac, [&](unsigned int iblk_beg, unsigned int iblk_end, std::vector<int>& aMark){
+    for(unsigned int iblkc=iblk_beg;iblkc<iblk_end;++iblkc){
+      for(unsigned int icrs=Ac.colInd[iblkc];icrs<Ac.colInd[iblkc+1];++icrs){ aMark[Ac.rowPtr[icrs]] = icrs; }
+      for(unsigned int i=Ac.colInd[iblkc]*blkC;i<Ac.colInd[iblkc+1]*blkC;++i){ Ac.valCrs[i] = 0; }
+      if( is_dia ){ for(unsigned int i=iblkc*blkC;i<(iblkc+1)*blkC;++i){ Ac.valDia[i] = 0; } }
+      for(unsigned int it=colIndRt[iblkc];it<colIndRt[iblkc+1];++it){
+        const unsigned int icrs = crsRt[it];
+        const T* pr = (icrs < ncrsR) ? R.valCrs.data()+icrs*blkR : R.valDia.data()+(icrs-ncrsR)*blkR;
+        ForEachBlk_Row(matAP, rowPtrRt[it], [&](unsigned int jblkc, const T* pap){
+          T* pc = nullptr;
+          if( is_dia && jblkc == iblkc ){ pc = Ac.valDia.data()+iblkc*blkC; }
+          else{
+            assert( aMark[jblkc] != -1 );
+            pc = Ac.valCrs.data()+aMark[jblkc]*blkC;
+          }
+          BlkMatTMatAdd(pc, pr, pap, R.len_row, R.len_col, matAP.len_row);
+        });
+      }
+      for(unsigned int icrs=Ac.colInd[iblkc];icrs<Ac.colInd[iblkc+1];++icrs){ aMark[Ac.rowPtr[icrs]] = -1; }
+    }
+  });
+}
+template void dfm2::CTripleProductPlan<float>::SetValue(CMatrixSparse<float>& Ac,
+    const CMatrixSparse<float>& R, const CMatrixSparse<float>& A, const CMatrixSparse<float>& P);
+template void dfm2::CTripleProductPlan<double>::SetValue(CMatrixSparse<double>& Ac,
+    const CMatrixSparse<double>& R, const CMatrixSparse<double>& A, const CMatrixSparse<double>& P);
+template void dfm2::CTripleProductPlan<COMPLEX>::SetValue(CMatrixSparse<COMPLEX>& Ac,
+    const CMatrixSparse<COMPLEX>& R, const CMatrixSparse<COMPLEX>& A, const CMatrixSparse<COMPLEX>& P);
+
 // -----------------------------------------------------------------
 
+template<typename T, unsigned int N>
+static void SetFixedBC_Dia_Blk(
+    const int *bc_flag,
+    T val_dia,
+    dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int len = (N==0) ? mat.len_col : N;
+  const unsigned int blksize = len * len;
+  T* vdia = mat.valDia.data();
+  for (unsigned int iblk = 0; iblk < mat.nblk_col; iblk++) { // set diagonal
+    for (unsigned int ilen = 0; ilen < len; ilen++) {
+      if (bc_flag[iblk * len + ilen] == 0) continue;
+      for (unsigned int jlen = 0; jlen < len; jlen++) {
+        vdia[iblk * blksize + ilen * len + jlen] = 0.0;
+        vdia[iblk * blksize + jlen * len + ilen] = 0.0;
+      }
+      vdia[iblk * blksize + ilen * len + ilen] = val_dia;
+    }
+  }
+}
+
+template<typename T, unsigned int N>
+static void SetFixedBC_Row_Blk(
+    const int *bc_flag,
+    dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int len = (N==0) ? mat.len_col : N;
+  const unsigned int blksize = len * len;
+  T* vcrs = mat.valCrs.data();
+  for (unsigned int iblk = 0; iblk < mat.nblk_col; iblk++) { // set row
+    for (unsigned int ilen = 0; ilen < len; ilen++) {
+      if (bc_flag[iblk * len + ilen] == 0) continue;
+      for (unsigned int icrs = mat.colInd[iblk]; icrs < mat.colInd[iblk + 1]; icrs++) {
+        for (unsigned int jlen = 0; jlen < len; jlen++) {
+          vcrs[icrs * blksize + ilen * len + jlen] = 0.0;
+        }
+      }
+    }
+  }
+}
+
+template<typename T, unsigned int N>
+static void SetFixedBC_Col_Blk(
+    const int *bc_flag,
+    dfm2::CMatrixSparse<T>& mat)
+{
+  const unsigned int len = (N==0) ? mat.len_col : N;
+  const unsigned int blksize = len * len;
+  T* vcrs = mat.valCrs.data();
+  const unsigned int ncrs = mat.rowPtr.size();
+  for (unsigned int icrs = 0; icrs < ncrs; icrs++) { // set column
+    const unsigned int jblk1 = mat.rowPtr[icrs];
+    for (unsigned int jlen = 0; jlen < len; jlen++) {
+      if (bc_flag[jblk1 * len + jlen] == 0) continue;
+      for (unsigned int ilen = 0; ilen < len; ilen++) {
+        vcrs[icrs * blksize + ilen * len + jlen] = 0.0;
+      }
+    }
+  }
+}
+
 template<typename T>
 void delfem2::CMatrixSparse<T>::SetFixedBC_Dia(
     const int *bc_flag,
@@ -440,17 +901,7 @@ void delfem2::CMatrixSparse<T>::SetFixedBC_Dia(
   assert(!this->valDia.empty());
   assert(this->nblk_row == this->nblk_col);
   assert(this->len_row == this->len_col);
-  const int blksize = len_col * len_row;
-  for (unsigned int iblk = 0; iblk < nblk_col; iblk++) { // set diagonal
-    for (unsigned int ilen = 0; ilen < len_col; ilen++) {
-      if (bc_flag[iblk * len_col + ilen] == 0) continue;
-      for (unsigned int jlen = 0; jlen < len_row; jlen++) {
-        valDia[iblk * blksize + ilen * len_col + jlen] = 0.0;
-        valDia[iblk * blksize + jlen * len_col + ilen] = 0.0;
-      }
-      valDia[iblk * blksize + ilen * len_col + ilen] = val_dia;
-    }
-  }
+  DFM2_DISPATCH_BLK(SetFixedBC_Dia_Blk, len_col, bc_flag, val_dia, *this)
 }
 template void delfem2::CMatrixSparse<float>::SetFixedBC_Dia(const int *bc_flag, float val_dia);
 template void delfem2::CMatrixSparse<double>::SetFixedBC_Dia(const int *bc_flag, double val_dia);
@@ -463,17 +914,7 @@ void delfem2::CMatrixSparse<T>::SetFixedBC_Row(const int *bc_flag)
   assert(!this->valDia.empty());
   assert(this->nblk_row == this->nblk_col);
   assert(this->len_row == this->len_col);
-  const int blksize = len_col * len_row;
-  for (unsigned int iblk = 0; iblk < nblk_col; iblk++) { // set row
-    for (unsigned int icrs = colInd[iblk]; icrs < colInd[iblk + 1]; icrs++) {
-      for (unsigned int ilen = 0; ilen < len_col; ilen++) {
-        if (bc_flag[iblk * len_col + ilen] == 0) continue;
-        for (unsigned int jlen = 0; jlen < len_row; jlen++) {
-          valCrs[icrs * blksize + ilen * len_col + jlen] = 0.0;
-        }
-      }
-    }
-  }
+  DFM2_DISPATCH_BLK(SetFixedBC_Row_Blk, len_col, bc_flag, *this)
 }
 template void delfem2::CMatrixSparse<float>::SetFixedBC_Row(const int *bc_flag);
 template void delfem2::CMatrixSparse<double>::SetFixedBC_Row(const int *bc_flag);
@@ -485,21 +926,269 @@ void delfem2::CMatrixSparse<T>::SetFixedBC_Col(const int *bc_flag)
   assert(!this->valDia.empty());
   assert(this->nblk_row == this->nblk_col);
   assert(this->len_row == this->len_col);
-  const int blksize = len_col * len_row;
-  for (unsigned int icrs = 0; icrs < rowPtr.size(); icrs++) { // set column
-    const int jblk1 = rowPtr[icrs];
-    for (unsigned int jlen = 0; jlen < len_row; jlen++) {
-      if (bc_flag[jblk1 * len_row + jlen] == 0) continue;
-      for (unsigned int ilen = 0; ilen < len_col; ilen++) {
-        valCrs[icrs * blksize + ilen * len_col + jlen] = 0.0;
-      }
-    }
-  }
+  DFM2_DISPATCH_BLK(SetFixedBC_Col_Blk, len_col, bc_flag, *this)
 }
 template void delfem2::CMatrixSparse<float>::SetFixedBC_Col(const int *bc_flag);
 template void delfem2::CMatrixSparse<double>::SetFixedBC_Col(const int *bc_flag);
 template void delfem2::CMatrixSparse<COMPLEX>::SetFixedBC_Col(const int *bc_flag);
 
+// -----------------------------------------------------------------
+// symmetric matrix storing the upper triangle
+
+template<typename T>
+void dfm2::CMatrixSparseSym<T>::SetPattern(
+    const unsigned int *colind, unsigned int ncolind,
+    const unsigned int *rowptr, unsigned int nrowptr)
+{
+  assert(rowPtr.empty());
+  assert(ncolind == nblk + 1);
+  (void)ncolind; (void)nrowptr; // only used in the asserts
+  colInd.assign(nblk + 1, 0);
+  for (unsigned int iblk = 0; iblk < nblk; ++iblk) {
+    for (unsigned int icrs = colind[iblk]; icrs < colind[iblk + 1]; ++icrs) {
+      assert(icrs < nrowptr);
+      if (rowptr[icrs] > iblk) { colInd[iblk + 1] += 1; }
+    }
+  }
+  for (unsigned int iblk = 0; iblk < nblk; ++iblk) { colInd[iblk + 1] += colInd[iblk]; }
+  rowPtr.resize(colInd[nblk]);
+  for (unsigned int iblk = 0; iblk < nblk; ++iblk) {
+    unsigned int jcrs = colInd[iblk];
+    for (unsigned int icrs = colind[iblk]; icrs < colind[iblk + 1]; ++icrs) {
+      if (rowptr[icrs] > iblk) { rowPtr[jcrs++] = rowptr[icrs]; }
+    }
+    std::sort(rowPtr.begin() + colInd[iblk], rowPtr.begin() + colInd[iblk + 1]);
+  }
+  valCrs.assign(rowPtr.size() * len * len, 0.0);
+}
+template void delfem2::CMatrixSparseSym<float>::SetPattern(const unsigned int *colind, unsigned int ncolind,
+                                                           const unsigned int *rowptr, unsigned int nrowptr);
+template void delfem2::CMatrixSparseSym<double>::SetPattern(const unsigned int *colind, unsigned int ncolind,
+                                                            const unsigned int *rowptr, unsigned int nrowptr);
+template void delfem2::CMatrixSparseSym<COMPLEX>::SetPattern(const unsigned int *colind, unsigned int ncolind,
+                                                             const unsigned int *rowptr, unsigned int nrowptr);
+
+template<typename T>
+void dfm2::CMatrixSparseSym<T>::SetUpper(const CMatrixSparse<T>& m)
+{
+  assert(m.nblk_col == m.nblk_row);
+  assert(m.len_col == m.len_row);
+  this->Initialize(m.nblk_col, m.len_col);
+  this->SetPattern(m.colInd.data(), m.colInd.size(),
+                   m.rowPtr.data(), m.rowPtr.size());
+  const unsigned int blksize = len * len;
+  for (unsigned int iblk = 0; iblk < nblk; ++iblk) {
+    for (unsigned int icrs = m.colInd[iblk]; icrs < m.colInd[iblk + 1]; ++icrs) {
+      const unsigned int jblk = m.rowPtr[icrs];
+      if (jblk <= iblk) { continue; }
+      const auto itr = std::lower_bound(rowPtr.begin() + colInd[iblk], rowPtr.begin() + colInd[iblk + 1], jblk);
+      const unsigned int jcrs = itr - rowPtr.begin();
+      for (unsigned int i = 0; i < blksize; ++i) { valCrs[jcrs * blksize + i] = m.valCrs[icrs * blksize + i]; }
+    }
+  }
+  if (!m.valDia.empty()) { valDia = m.valDia; }
+}
+template void delfem2::CMatrixSparseSym<float>::SetUpper(const CMatrixSparse<float>& m);
+template void delfem2::CMatrixSparseSym<double>::SetUpper(const CMatrixSparse<double>& m);
+template void delfem2::CMatrixSparseSym<COMPLEX>::SetUpper(const CMatrixSparse<COMPLEX>& m);
+
+template<typename T>
+void dfm2::CMatrixSparseSym<T>::GetFull(CMatrixSparse<T>& m) const
+{
+  const unsigned int blksize = len * len;
+  std::vector<unsigned int> colind(nblk + 1, 0);
+  for (unsigned int iblk = 0; iblk < nblk; ++iblk) {
+    colind[iblk + 1] += colInd[iblk + 1] - colInd[iblk]; // upper
+    for (unsigned int icrs = colInd[iblk]; icrs < colInd[iblk + 1]; ++icrs) {
+      colind[rowPtr[icrs] + 1] += 1; // lower
+    }
+  }
+  for (unsigned int iblk = 0; iblk < nblk; ++iblk) { colind[iblk + 1] += colind[iblk]; }
+  const unsigned int ncrs = colind[nblk];
+  std::vector<unsigned int> rowptr(ncrs);
+  std::vector<T> valcrs(ncrs * blksize);
+  // the lower blocks in the row i come from the rows j<i, so the rows are filled in ascending order
+  std::vector<unsigned int> aPos(colind.begin(), colind.end() - 1);
+  for (unsigned int iblk = 0; iblk < nblk; ++iblk) {
+    for (unsigned int icrs = colInd[iblk]; icrs < colInd[iblk + 1]; ++icrs) {
+      const unsigned int jblk = rowPtr[icrs];
+      const T *pval = valCrs.data() + icrs * blksize;
+      { // upper block (iblk,jblk)
+        const unsigned int kcrs = aPos[iblk]++;
+        rowptr[kcrs] = jblk;
+        for (unsigned int i = 0; i < blksize; ++i) { valcrs[kcrs * blksize + i] = pval[i]; }
+      }
+      { // lower block (jblk,iblk) is the transpose
+        const unsigned int kcrs = aPos[jblk]++;
+        rowptr[kcrs] = iblk;
+        for (unsigned int i = 0; i < len; ++i) {
+          for (unsigned int j = 0; j < len; ++j) {
+            valcrs[kcrs * blksize + i * len + j] = pval[j * len + i];
+          }
+        }
+      }
+    }
+  }
+  m.Initialize(nblk, len, true);
+  m.SetPattern(colind.data(), colind.size(),
+               rowptr.data(), rowptr.size());
+  m.valCrs = valcrs;
+  m.valDia = valDia;
+}
+template void delfem2::CMatrixSparseSym<float>::GetFull(CMatrixSparse<float>& m) const;
+template void delfem2::CMatrixSparseSym<double>::GetFull(CMatrixSparse<double>& m) const;
+template void delfem2::CMatrixSparseSym<COMPLEX>::GetFull(CMatrixSparse<COMPLEX>& m) const;
+
+template<typename T, unsigned int N>
+static void Mearge_Sym_Blk
+(unsigned int nblkel, const unsigned int *blkel,
+ const T *emat,
+ std::vector<int> &marge_buffer,
+ dfm2::CMatrixSparseSym<T>& mat)
+{
+  const unsigned int blksize = (N==0) ? mat.len*mat.len : N*N;
+  const unsigned int *colind = mat.colInd.data();
+  const unsigned int *rowptr = mat.rowPtr.data();
+  T *vcrs = mat.valCrs.data();
+  T *vdia = mat.valDia.data();
+  for (unsigned int iblkel = 0; iblkel < nblkel; iblkel++) {
+    const unsigned int iblk1 = blkel[iblkel];
+    assert(iblk1 < mat.nblk);
+    for (unsigned int jpsup = colind[iblk1]; jpsup < colind[iblk1 + 1]; jpsup++) {
+      marge_buffer[rowptr[jpsup]] = jpsup;
+    }
+    for (unsigned int jblkel = 0; jblkel < nblkel; jblkel++) {
+      const unsigned int jblk1 = blkel[jblkel];
+      assert(jblk1 < mat.nblk);
+      if (jblk1 < iblk1) { continue; } // the transpose is merged with (jblkel,iblkel)
+      const T *pval_in = &emat[(iblkel * nblkel + jblkel) * blksize];
+      T* pval_out = nullptr;
+      if (iblk1 == jblk1) {
+        pval_out = &vdia[iblk1 * blksize];
+      } else {
+        if (marge_buffer[jblk1] == -1) continue;
+        pval_out = &vcrs[marge_buffer[jblk1] * blksize];
+      }
+      for (unsigned int i = 0; i < blksize; i++) { pval_out[i] += pval_in[i]; }
+    }
+    for (unsigned int jpsup = colind[iblk1]; jpsup < colind[iblk1 + 1]; jpsup++) {
+      marge_buffer[rowptr[jpsup]] = -1;
+    }
+  }
+}
+
+template<typename T>
+bool delfem2::CMatrixSparseSym<T>::Mearge
+(unsigned int nblkel, const unsigned int *blkel,
+ unsigned int blksize, const T *emat,
+ std::vector<int> &marge_buffer)
+{
+  assert(!valDia.empty());
+  assert(blksize == len * len);
+  (void)blksize; // only used in the assert
+  marge_buffer.resize(nblk,-1);
+  DFM2_DISPATCH_BLK(Mearge_Sym_Blk, len, nblkel,blkel,emat,marge_buffer,*this)
+  return true;
+}
+template bool delfem2::CMatrixSparseSym<float>::Mearge(unsigned int nblkel, const unsigned int *blkel,
+                                                       unsigned int blksize, const float *emat,
+                                                       std::vector<int> &marge_buffer);
+template bool delfem2::CMatrixSparseSym<double>::Mearge(unsigned int nblkel, const unsigned int *blkel,
+                                                        unsigned int blksize, const double *emat,
+                                                        std::vector<int> &marge_buffer);
+template bool delfem2::CMatrixSparseSym<COMPLEX>::Mearge(unsigned int nblkel, const unsigned int *blkel,
+                                                         unsigned int blksize, const COMPLEX *emat,
+                                                         std::vector<int> &marge_buffer);
+
+// {y} = alpha*[A]{x} + beta*{y}. each stored block is read once and used for both (i,j) and (j,i)
+template <typename T, unsigned int N>
+static void MatVec_Sym_Blk
+(T* y,
+ T alpha,
+ const T* x,
+ T beta,
+ const dfm2::CMatrixSparseSym<T>& mat)
+{
+  const unsigned int len = (N==0) ? mat.len : N;
+  const unsigned int blksize = len*len;
+  const T* vcrs  = mat.valCrs.data();
+  const T* vdia = mat.valDia.data();
+  const unsigned int* colind = mat.colInd.data();
+  const unsigned int* rowptr = mat.rowPtr.data();
+  for(unsigned int i=0;i<mat.nblk*len;++i){ y[i] *= beta; }
+  for(unsigned int iblk=0;iblk<mat.nblk;iblk++){
+    T* py = y+iblk*len;
+    const T* px = x+iblk*len;
+    for(unsigned int icrs=colind[iblk];icrs<colind[iblk+1];icrs++){
+      const unsigned int jblk0 = rowptr[icrs];
+      assert( jblk0 > iblk && jblk0 < mat.nblk );
+      BlkMatVecAdd<T,N>(py, alpha, vcrs+icrs*blksize, x+jblk0*len, len, len);
+      BlkMatTVecAdd<T,N>(y+jblk0*len, alpha, vcrs+icrs*blksize, px, len, len);
+    }
+    BlkMatVecAdd<T,N>(py, alpha, vdia+iblk*blksize, px, len, len);
+  }
+}
+
+template <typename T>
+void dfm2::CMatrixSparseSym<T>::MatVec
+(T* y,
+ T alpha,
+ const T* x,
+ T beta) const
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_MATVEC);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_MATVEC,
+                        2.0*(2*valCrs.size()+valDia.size()),
+                        (valCrs.size()+valDia.size())*sizeof(T) + rowPtr.size()*sizeof(unsigned int)
+                        + 3.0*nblk*len*sizeof(T));
+  DFM2_DISPATCH_BLK(MatVec_Sym_Blk, len, y,alpha,x,beta,*this)
+}
+template void dfm2::CMatrixSparseSym<float>::MatVec(float *y, float alpha, const float *x, float beta) const;
+template void dfm2::CMatrixSparseSym<double>::MatVec(double *y, double alpha, const double *x, double beta) const;
+template void dfm2::CMatrixSparseSym<COMPLEX>::MatVec(COMPLEX *y, COMPLEX alpha, const COMPLEX *x, COMPLEX beta) const;
+
+template<typename T, unsigned int N>
+static void SetFixedBC_Sym_Blk(
+    const int *bc_flag,
+    dfm2::CMatrixSparseSym<T>& mat)
+{
+  const unsigned int len = (N==0) ? mat.len : N;
+  const unsigned int blksize = len * len;
+  T* vdia = mat.valDia.data();
+  T* vcrs = mat.valCrs.data();
+  for (unsigned int iblk = 0; iblk < mat.nblk; iblk++) {
+    for (unsigned int ilen = 0; ilen < len; ilen++) { // set diagonal
+      if (bc_flag[iblk * len + ilen] == 0) continue;
+      for (unsigned int jlen = 0; jlen < len; jlen++) {
+        vdia[iblk * blksize + ilen * len + jlen] = 0.0;
+        vdia[iblk * blksize + jlen * len + ilen] = 0.0;
+      }
+      vdia[iblk * blksize + ilen * len + ilen] = 1.0;
+    }
+    for (unsigned int icrs = mat.colInd[iblk]; icrs < mat.colInd[iblk + 1]; icrs++) {
+      const unsigned int jblk = mat.rowPtr[icrs];
+      for (unsigned int ilen = 0; ilen < len; ilen++) { // row of iblk
+        if (bc_flag[iblk * len + ilen] == 0) continue;
+        for (unsigned int jlen = 0; jlen < len; jlen++) { vcrs[icrs * blksize + ilen * len + jlen] = 0.0; }
+      }
+      for (unsigned int jlen = 0; jlen < len; jlen++) { // column of jblk (the row of jblk in the lower triangle)
+        if (bc_flag[jblk * len + jlen] == 0) continue;
+        for (unsigned int ilen = 0; ilen < len; ilen++) { vcrs[icrs * blksize + ilen * len + jlen] = 0.0; }
+      }
+    }
+  }
+}
+
+template<typename T>
+void delfem2::CMatrixSparseSym<T>::SetFixedBC(const int *bc_flag)
+{
+  assert(!this->valDia.empty());
+  DFM2_DISPATCH_BLK(SetFixedBC_Sym_Blk, len, bc_flag, *this)
+}
+template void delfem2::CMatrixSparseSym<float>::SetFixedBC(const int *bc_flag);
+template void delfem2::CMatrixSparseSym<double>::SetFixedBC(const int *bc_flag);
+template void delfem2::CMatrixSparseSym<COMPLEX>::SetFixedBC(const int *bc_flag);
+
 // -----------------------------------------------------------------
 
 void dfm2::SetMasterSlave
@@ -11,9 +11,12 @@
 #include <vector>
 #include <cassert>
 #include <complex>
+#include <memory>
 
 namespace delfem2 {
 
+class CThreadPool;
+
 /**
  * @class sparse matrix class
  * @tparam T float, double and std::complex<double>
@@ -21,7 +24,7 @@ namespace delfem2 {
 template<typename T>
 class CMatrixSparse {
 public:
-  CMatrixSparse() : nblk_col(0), nblk_row(0), len_col(0), len_row(0) {}
+  CMatrixSparse() : nblk_col(0), nblk_row(0), len_col(0), len_row(0), nthread(1) {}
 
   virtual ~CMatrixSparse() {
     colInd.clear();
@@ -40,9 +43,17 @@ public:
     valCrs.clear();
     if (is_dia) { valDia.assign(nblk * len * len, 0.0); }
     else { valDia.clear(); }
+    splitRow.clear();
+    splitCol.clear();
+    colIndT.clear();
+    rowPtrT.clear();
+    crsT.clear();
   }
 
-  void operator=(const CMatrixSparse &m) {
+  // same copy as operator=. the implicit one is deprecated because operator= is user-declared
+  CMatrixSparse(const CMatrixSparse &m) : CMatrixSparse() { *this = m; }
+
+  CMatrixSparse& operator=(const CMatrixSparse &m) {
     this->nblk_col = m.nblk_col;
     this->len_col = m.len_col;
     this->nblk_row = m.nblk_row;
@@ -51,6 +62,37 @@ public:
     rowPtr = m.rowPtr;
     valCrs = m.valCrs;
     valDia = m.valDia; // copy value
+    nthread = m.nthread;
+    pool = m.pool;
+    splitRow = m.splitRow;
+    splitCol = m.splitCol;
+    colIndT = m.colIndT;
+    rowPtrT = m.rowPtrT;
+    crsT = m.crsT;
+    return *this;
+  }
+
+  /**
+   * @brief copy the pattern and the values of the matrix with the different value type (e.g., double to float)
+   * @details the cache for the multi-threading is not copied. call SetNumThread() to use the threads.
+   */
+  template <typename S>
+  void SetCopy(const CMatrixSparse<S> &m) {
+    this->nblk_col = m.nblk_col;
+    this->len_col = m.len_col;
+    this->nblk_row = m.nblk_row;
+    this->len_row = m.len_row;
+    colInd = m.colInd;
+    rowPtr = m.rowPtr;
+    valCrs.assign(m.valCrs.begin(), m.valCrs.end());
+    valDia.assign(m.valDia.begin(), m.valDia.end());
+    nthread = 1;
+    pool.reset();
+    splitRow.clear();
+    splitCol.clear();
+    colIndT.clear();
+    rowPtrT.clear();
+    crsT.clear();
   }
 
   void SetPattern(const unsigned int *colind, unsigned int ncolind,
@@ -63,8 +105,19 @@ public:
     rowPtr.resize(ncrs);
     for (unsigned int icrs = 0; icrs < ncrs; icrs++) { rowPtr[icrs] = rowptr[icrs]; }
     valCrs.resize(ncrs * len_col * len_row);
+    if( nthread > 1 ){ this->SetNumThread(nthread); }
   }
 
+  /**
+   * @func set the number of threads used in MatVec() and MatTVec()
+   * @details Block rows are split such that each thread has similar number of non-zero blocks.
+   * MatTVec() uses the transposed pattern cached here, so no two threads write to the same entry.
+   * The accumulation order is the same as the serial code, so the results are bit-identical to nthread=1.
+   * The worker threads are created here once and reused in every MatVec() (see CThreadPool).
+   * Call this after SetPattern() (SetPattern() updates the cache when nthread>1). nthread=1 (default) is serial.
+   */
+  void SetNumThread(unsigned int nthread0);
+
   bool SetZero() {
     if (valDia.size() != 0) {
       assert(len_col == len_row);
@@ -86,6 +139,15 @@ public:
               unsigned int blksize, const T *emat,
               std::vector<int> &m_marge_tmp_buffer);
 
+  /**
+   * @brief merge the element matrix to the blocks precomputed by CMergePlan (see CMergePlan)
+   * @param nblkel number of the blocks of the element (same for the column and the row)
+   * @param crs (in) CMergePlan::ElemCrs() of the element
+   */
+  void Mearge_Plan(unsigned int nblkel, const unsigned int *blkel,
+                   const int *crs,
+                   const T *emat);
+
   /**
    * @func Matrix vector product as: {y} = alpha * [A]{x} + beta * {y}
    */
@@ -98,6 +160,16 @@ public:
   void MatTVec(T *y,
                T alpha, const T *x,
                T beta) const;
+  /**
+   * @func Matrix product for nvec vectors at once as: {Y} = alpha * [A]{X} + beta * {Y}
+   * @details the vectors are interleaved: the ivec-th component of the idof-th dof is X[idof*nvec+ivec].
+   * Each block of the matrix is read once for all the vectors, so this is faster than nvec calls of MatVec().
+   * Threads are used in the same way as MatVec() (see SetNumThread())
+   */
+  void MatVecMulti(T *Y,
+                   T alpha, const T *X,
+                   T beta,
+                   unsigned int nvec) const;
   
   /**
    * @func set fixed bc for diagonal block matrix where( pBCFlag[i] != 0).
@@ -166,6 +238,199 @@ public:
   std::vector<unsigned int> rowPtr;
   std::vector<T> valCrs;
   std::vector<T> valDia;
+  /**
+   * @param nthread number of threads for MatVec() and MatTVec()
+   */
+  unsigned int nthread;
+  /**
+   * @param pool worker threads for MatVec() and MatTVec() created in SetNumThread(). The copies share it
+   */
+  std::shared_ptr<CThreadPool> pool;
+  /**
+   * @param splitRow block-row ranges for each thread in MatVec() (size: nthread+1)
+   */
+  std::vector<unsigned int> splitRow;
+  /**
+   * @param splitCol block-column ranges for each thread in MatTVec() (size: nthread+1)
+   */
+  std::vector<unsigned int> splitCol;
+  /**
+   * @param colIndT indeces where the column starts in the transposed pattern (size: nblk_row+1)
+   */
+  std::vector<unsigned int> colIndT;
+  /**
+   * @param rowPtrT block-row index of the transposed pattern sorted in ascending order for each column
+   */
+  std::vector<unsigned int> rowPtrT;
+  /**
+   * @param crsT index in rowPtr (and valCrs) of each entry of the transposed pattern
+   */
+  std::vector<unsigned int> crsT;
+};
+
+/**
+ * @class destinations of the element matrices in the values of CMatrixSparse precomputed for a mesh
+ * @details CMatrixSparse::Mearge() searches the pattern of the block rows for each element in each merge.
+ * This class keeps the result of the search for all the elements, so the merge with CMatrixSparse::Mearge_Plan()
+ * becomes a simple scatter-add without the search and the buffer.
+ * The plan is valid while the mesh and the pattern of the matrix are not changed.
+ */
+class CMergePlan
+{
+public:
+  CMergePlan() : nElem(0), nPoEl(0) {}
+  template <typename T>
+  void Initialize(const CMatrixSparse<T>& mat,
+                  const unsigned int* aElem, unsigned int nElem, unsigned int nPoEl);
+  const int* ElemCrs(unsigned int iel) const {
+    assert( iel < nElem );
+    return aCrs.data()+iel*nPoEl*nPoEl;
+  }
+public:
+  unsigned int nElem, nPoEl;
+  /**
+   * @param aCrs index of the block in CMatrixSparse::valCrs for each element and each pair of its points
+   * (size: nElem*nPoEl*nPoEl). -1 for the diagonal block or the pair not in the pattern.
+   */
+  std::vector<int> aCrs;
+};
+
+/**
+ * @class symmetric block sparse matrix storing only the upper block triangle and the diagonal blocks
+ * @tparam T float, double and std::complex<double> (complex symmetric, not hermitian)
+ * @details The block (i,j) with i<j is stored in the row i. The block (j,i) is its transpose and not stored,
+ * so the memory and the memory traffic in MatVec() are about the half of CMatrixSparse.
+ * The rows of the pattern are sorted. The class can be passed to the Krylov solvers (e.g., Solve_PCG())
+ * and to CPreconditionerILU as the matrix.
+ */
+template<typename T>
+class CMatrixSparseSym {
+public:
+  CMatrixSparseSym() : nblk(0), len(0) {}
+  void Initialize(unsigned int nblk0, unsigned int len0) {
+    this->nblk = nblk0;
+    this->len = len0;
+    colInd.assign(nblk0 + 1, 0);
+    rowPtr.clear();
+    valCrs.clear();
+    valDia.assign(nblk0 * len0 * len0, 0.0);
+  }
+  /**
+   * @brief set the pattern from the pattern of the full matrix (e.g., points surrounding point)
+   * @details the blocks in the lower triangle are discarded
+   */
+  void SetPattern(const unsigned int *colind, unsigned int ncolind,
+                  const unsigned int *rowptr, unsigned int nrowptr);
+  /**
+   * @brief copy the upper triangle of the full symmetric matrix (pattern and values)
+   */
+  void SetUpper(const CMatrixSparse<T>& m);
+  /**
+   * @brief make the full matrix with the sorted rows (pattern and values)
+   */
+  void GetFull(CMatrixSparse<T>& m) const;
+  void SetZero() {
+    for (unsigned int i = 0; i < valDia.size(); ++i) { valDia[i] = 0; }
+    for (unsigned int i = 0; i < valCrs.size(); ++i) { valCrs[i] = 0; }
+  }
+  /**
+   * @brief merge the symmetric element matrix.
+   * @details only the blocks in the upper triangle and the diagonal of emat are referred
+   * @param nblkel number of the blocks of the element (same for the column and the row)
+   */
+  bool Mearge(unsigned int nblkel, const unsigned int *blkel,
+              unsigned int blksize, const T *emat,
+              std::vector<int> &m_marge_tmp_buffer);
+  /**
+   * @func Matrix vector product as: {y} = alpha * [A]{x} + beta * {y}
+   */
+  void MatVec(T *y,
+              T alpha, const T *x,
+              T beta) const;
+  /**
+   * @func if pBCFlag is *not* 0 for a dof, set the off-diagonal components in its row and column to zero and set diagonal to one.
+   */
+  void SetFixedBC(const int *pBCFlag);
+  void AddDia(T eps) {
+    for (unsigned int iblk = 0; iblk < nblk; ++iblk) {
+      for (unsigned int ilen = 0; ilen < len; ++ilen) {
+        valDia[iblk * len * len + ilen * len + ilen] += eps;
+      }
+    }
+  }
+public:
+  unsigned int nblk;
+  unsigned int len;
+  /**
+   * @param colInd indeces where the row starts in CRS data structure
+   * @param rowPtr column index of the block in the upper triangle (ascending in each row)
+   */
+  std::vector<unsigned int> colInd;
+  std::vector<unsigned int> rowPtr;
+  std::vector<T> valCrs;
+  std::vector<T> valDia;
+};
+
+/**
+ * @brief symbolic phase of the sparse matrix-matrix product [C] = [A][B]. make the pattern of [C]
+ * @details The rows of [C] are sorted. The block of [C] is (A.len_col x B.len_row).
+ * If [C] is square (the number and the size of the blocks), the diagonal blocks are stored in valDia.
+ * The values are set to zero. The pattern can be reused with MatSparse_MatMat_Numeric() while the patterns of
+ * [A] and [B] are not changed. The number of threads of [C] is kept.
+ */
+template <typename T>
+void MatSparse_MatMat_Symbolic(CMatrixSparse<T>& C,
+                               const CMatrixSparse<T>& A,
+                               const CMatrixSparse<T>& B);
+
+/**
+ * @brief numeric phase of the sparse matrix-matrix product [C] = [A][B]
+ * @details [C] needs the pattern made by MatSparse_MatMat_Symbolic() for [A] and [B].
+ * The block rows of [C] are computed independently, so they are computed in parallel with the threads of [C]
+ * (see CMatrixSparse::SetNumThread()). The results are the same as the serial computation.
+ */
+template <typename T>
+void MatSparse_MatMat_Numeric(CMatrixSparse<T>& C,
+                              const CMatrixSparse<T>& A,
+                              const CMatrixSparse<T>& B);
+
+/**
+ * @class triple product [Ac] = [R]^T[A][P] split into the symbolic and the numeric phases
+ * @details e.g., the Galerkin coarse operator of the multigrid with [R]=[P], or the Schur complement and the projection
+ * of the constraints. Initialize() makes the patterns of [A][P] and [Ac] and SetValue() computes the values.
+ * The plan is valid while the patterns of [R], [A] and [P] are not changed.
+ * SetValue() is computed in parallel over the block rows with the threads of [Ac] (see CMatrixSparse::SetNumThread())
+ */
+template <typename T>
+class CTripleProductPlan
+{
+public:
+  /**
+   * @brief symbolic phase. make the pattern of [Ac] (values are set to zero)
+   * @details [R] and [P] have the same block rows as [A]. The block of [Ac] is (R.len_row x P.len_row).
+   * If [Ac] is square, the diagonal blocks are stored in valDia.
+   */
+  void Initialize(CMatrixSparse<T>& Ac,
+                  const CMatrixSparse<T>& R,
+                  const CMatrixSparse<T>& A,
+                  const CMatrixSparse<T>& P);
+  /**
+   * @brief numeric phase. compute the values of [Ac] in the pattern made by Initialize()
+   */
+  void SetValue(CMatrixSparse<T>& Ac,
+                const CMatrixSparse<T>& R,
+                const CMatrixSparse<T>& A,
+                const CMatrixSparse<T>& P);
+public:
+  /**
+   * @param matAP the intermediate product [A][P]
+   */
+  CMatrixSparse<T> matAP;
+  /**
+   * @param colIndRt, rowPtrRt transposed pattern of [R] (the block rows of [R] for each block column)
+   * @param crsRt index of the block in R.valCrs, or R.rowPtr.size()+iblk for the diagonal block of the block row iblk
+   */
+  std::vector<unsigned int> colIndRt, rowPtrRt, crsRt;
 };
 
 double CheckSymmetry(const delfem2::CMatrixSparse<double> &mat);
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * @file mats_internal.h
+ * @brief helpers shared by the implementations of the sparse matrices and the preconditioners (mats.cpp, ilu_mats.cpp, ...)
+ * @details include this only from the .cpp files. This is not a part of the interface.
+ */
+
+#ifndef DFM2_MATS_INTERNAL_H
+#define DFM2_MATS_INTERNAL_H
+
+#include <vector>
+#include "delfem2/matn.hpp"
+
+/**
+ * @brief dispatch to the fixed block-size kernel F<T,N> for the block sizes frequently used
+ * (1:scalar, 2:2D solid, 3:3D solid, 4:3D solid with pressure or 2D shell, 6:shell).
+ * F<T,0> is the kernel for the runtime block size. T needs to be defined at the expansion.
+ */
+#define DFM2_DISPATCH_BLK(F, len, ...) \
+  switch( len ){ \
+    case 1: F<T,1>(__VA_ARGS__); break; \
+    case 2: F<T,2>(__VA_ARGS__); break; \
+    case 3: F<T,3>(__VA_ARGS__); break; \
+    case 4: F<T,4>(__VA_ARGS__); break; \
+    case 6: F<T,6>(__VA_ARGS__); break; \
+    default: F<T,0>(__VA_ARGS__); break; \
+  }
+
+namespace delfem2 {
+
+/**
+ * @brief invert the len x len block in place with Gauss-Jordan elimination without pivoting
+ * @tparam N block size fixed at compile time (InverseMat<T,N> in matn.hpp). N=0 means the size is len
+ * @return 0 if success, 1 if the pivot is too small
+ */
+template <typename T, unsigned int N>
+int InverseMat_Blk(T* a, unsigned int len)
+{
+  if( N != 0 ){ return InverseMat<T,(N==0)?1:N>(a); }
+  for(unsigned int i=0;i<len;++i){
+    const T aii = a[i*len+i];
+    if( aii < 1.0e-30 && aii > -1.0e-30 ){ return 1; }
+    const T tmp0 = 1 / aii;
+    a[i*len+i] = 1;
+    for(unsigned int k=0;k<len;++k){ a[i*len+k] *= tmp0; }
+    for(unsigned int j=0;j<len;++j){
+      if( j == i ){ continue; }
+      const T tmp1 = a[j*len+i];
+      a[j*len+i] = 0;
+      for(unsigned int k=0;k<len;++k){ a[j*len+k] -= tmp1*a[i*len+k]; }
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief jagged array of the block rows in each level from the level of each block row (level scheduling)
+ * @param aLev (in) level of each block row. The levels are less than nlev
+ */
+inline void JArray_Level(
+    std::vector<unsigned int>& lev_ind,
+    std::vector<unsigned int>& lev_blk,
+    const std::vector<unsigned int>& aLev,
+    unsigned int nlev)
+{
+  const unsigned int nblk = aLev.size();
+  lev_ind.assign(nlev+1,0);
+  for(unsigned int iblk=0;iblk<nblk;++iblk){ lev_ind[aLev[iblk]+1] += 1; }
+  for(unsigned int ilev=0;ilev<nlev;++ilev){ lev_ind[ilev+1] += lev_ind[ilev]; }
+  lev_blk.resize(nblk);
+  std::vector<unsigned int> aCnt(lev_ind.begin(),lev_ind.end()-1);
+  for(unsigned int iblk=0;iblk<nblk;++iblk){ lev_blk[aCnt[aLev[iblk]]++] = iblk; }
+}
+
+} // namespace delfem2
+
+#endif
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <complex>
+#if !defined(_WIN32)
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#include "delfem2/matsio.h"
+
+typedef std::complex<double> COMPLEX;
+namespace dfm2 = delfem2;
+
+// -------------------------------------------------------
+// format
+
+namespace delfem2 {
+namespace matsio {
+
+const char MAGIC[8] = {'D','F','M','2','M','A','T','S'};
+const uint32_t VERSION = 1;
+const uint32_t TAG_BYTE_ORDER = 0x01020304;
+
+enum KIND {
+  KIND_MATSPARSE = 1,
+  KIND_ILU = 2,
+};
+
+template <typename T> uint32_t ValueType();
+template <> uint32_t ValueType<float>(){ return 1; }
+template <> uint32_t ValueType<double>(){ return 2; }
+template <> uint32_t ValueType<COMPLEX>(){ return 3; }
+
+struct CHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t kind;
+  uint32_t value_type;
+  uint32_t size_value;
+  uint32_t narray;
+};
+
+template <typename T>
+CHeader MakeHeader(uint32_t kind, uint32_t narray)
+{
+  CHeader h;
+  std::memcpy(h.magic, MAGIC, 8);
+  h.version = VERSION;
+  h.byte_order = TAG_BYTE_ORDER;
+  h.kind = kind;
+  h.value_type = ValueType<T>();
+  h.size_value = sizeof(T);
+  h.narray = narray;
+  return h;
+}
+
+template <typename T>
+bool IsValidHeader(const CHeader& h, uint32_t kind, uint32_t narray)
+{
+  return std::memcmp(h.magic, MAGIC, 8) == 0
+      && h.version == VERSION
+      && h.byte_order == TAG_BYTE_ORDER
+      && h.kind == kind
+      && h.value_type == ValueType<T>()
+      && h.size_value == sizeof(T)
+      && h.narray == narray;
+}
+
+// the arrays are stored as [size in bytes (uint64)][data][padding to 8 bytes]
+class CWriter
+{
+public:
+  explicit CWriter(const std::string& fpath){ fp = fopen(fpath.c_str(), "wb"); is_ok = (fp != nullptr); }
+  ~CWriter(){ if( fp != nullptr ){ fclose(fp); } }
+  void Write(const void* p, size_t nbyte){
+    if( !is_ok || nbyte == 0 ){ return; }
+    is_ok = (fwrite(p, 1, nbyte, fp) == nbyte);
+  }
+  template <typename S>
+  void Array(const std::vector<S>& a){
+    const uint64_t nbyte = a.size()*sizeof(S);
+    this->Write(&nbyte, sizeof(nbyte));
+    this->Write(a.data(), nbyte);
+    const char pad[8] = {0,0,0,0,0,0,0,0};
+    this->Write(pad, (8-nbyte%8)%8);
+  }
+  bool Close(){
+    if( fp == nullptr ){ return false; }
+    is_ok = (fclose(fp) == 0) && is_ok;
+    fp = nullptr;
+    return is_ok;
+  }
+private:
+  FILE* fp;
+  bool is_ok;
+};
+
+// read from the memory-mapped file or from the stream
+class CReader
+{
+public:
+  CReader(const std::string& fpath, bool is_mmap) : fp(nullptr), pmap(nullptr), size(0), pos(0) {
+#if !defined(_WIN32)
+    if( is_mmap ){
+      const int fd = open(fpath.c_str(), O_RDONLY);
+      if( fd < 0 ){ return; }
+      struct stat st;
+      if( fstat(fd, &st) == 0 && st.st_size > 0 ){
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if( p != MAP_FAILED ){
+          pmap = (const char*)p;
+          size = (size_t)st.st_size;
+          madvise(p, size, MADV_SEQUENTIAL);
+        }
+      }
+      close(fd);
+      return;
+    }
+#endif
+    fp = fopen(fpath.c_str(), "rb");
+    if( fp == nullptr ){ return; }
+    if( fseek(fp, 0, SEEK_END) == 0 ){
+      const long n = ftell(fp);
+      if( n > 0 ){ size = (size_t)n; }
+    }
+    if( fseek(fp, 0, SEEK_SET) != 0 ){ size = 0; }
+  }
+  ~CReader(){
+#if !defined(_WIN32)
+    if( pmap != nullptr ){ munmap((void*)pmap, size); }
+#endif
+    if( fp != nullptr ){ fclose(fp); }
+  }
+  bool IsOpen() const { return size != 0; }
+  bool Read(void* p, size_t nbyte){
+    if( nbyte > size-pos ){ return false; }
+    if( pmap != nullptr ){ std::memcpy(p, pmap+pos, nbyte); }
+    else if( nbyte != 0 && fread(p, 1, nbyte, fp) != nbyte ){ return false; }
+    pos += nbyte;
+    return true;
+  }
+  bool Skip(size_t nbyte){
+    if( nbyte > size-pos ){ return false; }
+    if( pmap == nullptr && nbyte != 0 && fseek(fp, (long)nbyte, SEEK_CUR) != 0 ){ return false; }
+    pos += nbyte;
+    return true;
+  }
+  template <typename S>
+  bool Array(std::vector<S>& a){
+    uint64_t nbyte;
+    if( !this->Read(&nbyte, sizeof(nbyte)) ){ return false; }
+    if( nbyte % sizeof(S) != 0 || nbyte > size-pos ){ return false; }
+    a.resize(nbyte/sizeof(S));
+    if( !this->Read(a.data(), nbyte) ){ return false; }
+    return this->Skip((8-nbyte%8)%8);
+  }
+private:
+  FILE* fp;
+  const char* pmap;
+  size_t size;
+  size_t pos;
+};
+
+// -------------------------------------------------------
+// the arrays of CMatrixSparse
+
+const uint32_t NARRAY_MATSPARSE = 5;
+
+template <typename T>
+void WriteArrays(CWriter& w, const CMatrixSparse<T>& mat)
+{
+  const std::vector<unsigned int> aDim = {mat.nblk_col, mat.nblk_row, mat.len_col, mat.len_row};
+  w.Array(aDim);
+  w.Array(mat.colInd);
+  w.Array(mat.rowPtr);
+  w.Array(mat.valCrs);
+  w.Array(mat.valDia);
+}
+
+template <typename T>
+bool ReadArrays(CMatrixSparse<T>& mat, CReader& r)
+{
+  std::vector<unsigned int> aDim;
+  if( !r.Array(aDim) || aDim.size() != 4 ){ return false; }
+  mat.nblk_col = aDim[0];
+  mat.nblk_row = aDim[1];
+  mat.len_col = aDim[2];
+  mat.len_row = aDim[3];
+  return r.Array(mat.colInd) && r.Array(mat.rowPtr) && r.Array(mat.valCrs) && r.Array(mat.valDia);
+}
+
+template <typename T>
+bool IsValid(const CMatrixSparse<T>& mat)
+{
+  const unsigned int nblk = mat.nblk_col;
+  if( mat.colInd.size() != nblk+1 || mat.colInd[0] != 0 ){ return false; }
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    if( mat.colInd[iblk] > mat.colInd[iblk+1] ){ return false; }
+  }
+  const size_t ncrs = mat.colInd[nblk];
+  if( mat.rowPtr.size() != ncrs ){ return false; }
+  for(unsigned int icrs=0;icrs<ncrs;++icrs){
+    if( mat.rowPtr[icrs] >= mat.nblk_row ){ return false; }
+  }
+  const size_t blksize = (size_t)mat.len_col*mat.len_row;
+  if( mat.valCrs.size() != ncrs*blksize ){ return false; }
+  if( mat.valDia.empty() ){ return true; }
+  return mat.nblk_col == mat.nblk_row
+      && mat.len_col == mat.len_row
+      && mat.valDia.size() == nblk*blksize;
+}
+
+template <typename T>
+void MovePatternValue(CMatrixSparse<T>& dst, CMatrixSparse<T>& src)
+{
+  dst.nblk_col = src.nblk_col;
+  dst.nblk_row = src.nblk_row;
+  dst.len_col = src.len_col;
+  dst.len_row = src.len_row;
+  dst.colInd.swap(src.colInd);
+  dst.rowPtr.swap(src.rowPtr);
+  dst.valCrs.swap(src.valCrs);
+  dst.valDia.swap(src.valDia);
+  dst.splitRow.clear();
+  dst.splitCol.clear();
+  dst.colIndT.clear();
+  dst.rowPtrT.clear();
+  dst.crsT.clear();
+  if( dst.nthread > 1 ){ dst.SetNumThread(dst.nthread); }
+}
+
+// jagged array of the block rows for each level
+bool IsValidLevel(const std::vector<unsigned int>& aInd,
+                  const std::vector<unsigned int>& aBlk,
+                  unsigned int nblk)
+{
+  if( aInd.empty() ){ return aBlk.empty(); }
+  if( aInd[0] != 0 || aInd.back() != aBlk.size() ){ return false; }
+  for(unsigned int ilev=0;ilev+1<aInd.size();++ilev){
+    if( aInd[ilev] > aInd[ilev+1] ){ return false; }
+  }
+  for(unsigned int iblk : aBlk){
+    if( iblk >= nblk ){ return false; }
+  }
+  return true;
+}
+
+} // end namespace matsio
+} // end namespace delfem2
+
+// -------------------------------------------------------
+
+template <typename T>
+bool dfm2::Write_MatSparse_Binary
+(const std::string& fpath,
+ const CMatrixSparse<T>& mat)
+{
+  namespace io = dfm2::matsio;
+  io::CWriter w(fpath);
+  const io::CHeader h = io::MakeHeader<T>(io::KIND_MATSPARSE, io::NARRAY_MATSPARSE);
+  w.Write(&h, sizeof(h));
+  io::WriteArrays(w, mat);
+  return w.Close();
+}
+template bool dfm2::Write_MatSparse_Binary(const std::string& fpath, const CMatrixSparse<float>& mat);
+template bool dfm2::Write_MatSparse_Binary(const std::string& fpath, const CMatrixSparse<double>& mat);
+template bool dfm2::Write_MatSparse_Binary(const std::string& fpath, const CMatrixSparse<COMPLEX>& mat);
+
+
+template <typename T>
+bool dfm2::Read_MatSparse_Binary
+(CMatrixSparse<T>& mat,
+ const std::string& fpath,
+ bool is_mmap)
+{
+  namespace io = dfm2::matsio;
+  io::CReader r(fpath, is_mmap);
+  if( !r.IsOpen() ){ return false; }
+  io::CHeader h;
+  if( !r.Read(&h, sizeof(h)) ){ return false; }
+  if( !io::IsValidHeader<T>(h, io::KIND_MATSPARSE, io::NARRAY_MATSPARSE) ){ return false; }
+  CMatrixSparse<T> tmp;
+  if( !io::ReadArrays(tmp, r) || !io::IsValid(tmp) ){ return false; }
+  io::MovePatternValue(mat, tmp);
+  return true;
+}
+template bool dfm2::Read_MatSparse_Binary(CMatrixSparse<float>& mat, const std::string& fpath, bool is_mmap);
+template bool dfm2::Read_MatSparse_Binary(CMatrixSparse<double>& mat, const std::string& fpath, bool is_mmap);
+template bool dfm2::Read_MatSparse_Binary(CMatrixSparse<COMPLEX>& mat, const std::string& fpath, bool is_mmap);
+
+// -------------------------------------------------------
+
+template <typename T>
+bool dfm2::Write_PreconditionerILU_Binary
+(const std::string& fpath,
+ const CPreconditionerILU<T>& ilu)
+{
+  namespace io = dfm2::matsio;
+  io::CWriter w(fpath);
+  const io::CHeader h = io::MakeHeader<T>(io::KIND_ILU, io::NARRAY_MATSPARSE+5);
+  w.Write(&h, sizeof(h));
+  io::WriteArrays(w, ilu.mat);
+  w.Array(ilu.m_diaInd);
+  w.Array(ilu.m_levFwdInd);
+  w.Array(ilu.m_levFwdBlk);
+  w.Array(ilu.m_levBwdInd);
+  w.Array(ilu.m_levBwdBlk);
+  return w.Close();
+}
+template bool dfm2::Write_PreconditionerILU_Binary(const std::string& fpath, const CPreconditionerILU<float>& ilu);
+template bool dfm2::Write_PreconditionerILU_Binary(const std::string& fpath, const CPreconditionerILU<double>& ilu);
+template bool dfm2::Write_PreconditionerILU_Binary(const std::string& fpath, const CPreconditionerILU<COMPLEX>& ilu);
+
+
+template <typename T>
+bool dfm2::Read_PreconditionerILU_Binary
+(CPreconditionerILU<T>& ilu,
+ const std::string& fpath,
+ bool is_mmap)
+{
+  namespace io = dfm2::matsio;
+  io::CReader r(fpath, is_mmap);
+  if( !r.IsOpen() ){ return false; }
+  io::CHeader h;
+  if( !r.Read(&h, sizeof(h)) ){ return false; }
+  if( !io::IsValidHeader<T>(h, io::KIND_ILU, io::NARRAY_MATSPARSE+5) ){ return false; }
+  CMatrixSparse<T> mat;
+  std::vector<unsigned int> aDiaInd, aLevFwdInd, aLevFwdBlk, aLevBwdInd, aLevBwdBlk;
+  if( !io::ReadArrays(mat, r)
+     || !r.Array(aDiaInd)
+     || !r.Array(aLevFwdInd) || !r.Array(aLevFwdBlk)
+     || !r.Array(aLevBwdInd) || !r.Array(aLevBwdBlk) ){ return false; }
+  // the factors are square and have the diagonal blocks
+  if( !io::IsValid(mat) || mat.nblk_col != mat.nblk_row || mat.valDia.empty() ){ return false; }
+  const unsigned int nblk = mat.nblk_col;
+  if( aDiaInd.size() != nblk ){ return false; }
+  for(unsigned int iblk=0;iblk<nblk;++iblk){
+    if( aDiaInd[iblk] < mat.colInd[iblk] || aDiaInd[iblk] > mat.colInd[iblk+1] ){ return false; }
+  }
+  if( !io::IsValidLevel(aLevFwdInd, aLevFwdBlk, nblk) ){ return false; }
+  if( !io::IsValidLevel(aLevBwdInd, aLevBwdBlk, nblk) ){ return false; }
+  io::MovePatternValue(ilu.mat, mat);
+  ilu.m_diaInd.swap(aDiaInd);
+  ilu.m_levFwdInd.swap(aLevFwdInd);
+  ilu.m_levFwdBlk.swap(aLevFwdBlk);
+  ilu.m_levBwdInd.swap(aLevBwdInd);
+  ilu.m_levBwdBlk.swap(aLevBwdBlk);
+  return true;
+}
+template bool dfm2::Read_PreconditionerILU_Binary(CPreconditionerILU<float>& ilu, const std::string& fpath, bool is_mmap);
+template bool dfm2::Read_PreconditionerILU_Binary(CPreconditionerILU<double>& ilu, const std::string& fpath, bool is_mmap);
+template bool dfm2::Read_PreconditionerILU_Binary(CPreconditionerILU<COMPLEX>& ilu, const std::string& fpath, bool is_mmap);
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * @file matsio.h
+ * @brief binary snapshot of the sparse matrix and the ILU factors to skip the symbolic setup at the next launch
+ * @details The file starts with the header (the magic "DFM2MATS", the format version, the kind of the object,
+ * the value type and a tag to check the byte order) followed by the arrays of the object.
+ * Each array is stored as its size in bytes (64bit) and the raw data padded to 8 bytes, so all the arrays are
+ * aligned in the file and can be read directly from the memory-mapped file.
+ * The file is read only by the machine with the same byte order and the same value type.
+ */
+
+#ifndef DFM2_MATSIO_H
+#define DFM2_MATSIO_H
+
+#include <string>
+
+#include "delfem2/mats.h"
+#include "delfem2/ilu_mats.h"
+
+namespace delfem2 {
+
+/**
+ * @brief save the pattern and the values of the matrix
+ * @details the cache for the threads (splitRow, colIndT, ...) is not saved
+ * @return false if the file cannot be written
+ */
+template <typename T>
+bool Write_MatSparse_Binary(const std::string& fpath,
+                            const CMatrixSparse<T>& mat);
+
+/**
+ * @brief load the matrix saved with Write_MatSparse_Binary()
+ * @details The number of threads of mat is kept and the cache for the threads is rebuilt.
+ * If is_mmap is true, the file is memory-mapped and the arrays are copied from the mapped pages to the matrix
+ * without the buffering of the stream (the buffered read is used on the platform without mmap).
+ * @return false if the file cannot be read, the format is different or the arrays are inconsistent.
+ * mat is not changed in that case.
+ */
+template <typename T>
+bool Read_MatSparse_Binary(CMatrixSparse<T>& mat,
+                           const std::string& fpath,
+                           bool is_mmap = true);
+
+/**
+ * @brief save the pattern, the factors, the diagonal indices and the level schedules of the ILU preconditioner
+ * @details Saving after Initialize_ILU0() or Initialize_ILUk() and loading it skips the symbolic factorization.
+ * Call SetValueILU() and DoILUDecomp() after the load for the new values of the matrix.
+ * Saving after DoILUDecomp() keeps the numerical factors as well.
+ */
+template <typename T>
+bool Write_PreconditionerILU_Binary(const std::string& fpath,
+                                    const CPreconditionerILU<T>& ilu);
+
+/**
+ * @brief load the ILU preconditioner saved with Write_PreconditionerILU_Binary()
+ * @details the number of threads of ilu is kept. See Read_MatSparse_Binary() for is_mmap
+ * @return false if the file cannot be read, the format is different or the arrays are inconsistent.
+ * ilu is not changed in that case.
+ */
+template <typename T>
+bool Read_PreconditionerILU_Binary(CPreconditionerILU<T>& ilu,
+                                   const std::string& fpath,
+                                   bool is_mmap = true);
+
+} // end namespace delfem2
+
+#endif
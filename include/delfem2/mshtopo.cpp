@@ -11,6 +11,9 @@
 #include <stack>
 #include <set>
 #include <iostream>
+#include <climits>
+#include <cstdint>
+#include <algorithm>
 
 #include "delfem2/mshtopo.h"
 
@@ -354,6 +357,299 @@ void dfm2::JArray_ElSuP_MeshTri
                            aTri.data(), aTri.size()/3, 3, nXYZ);
 }
 
+unsigned int dfm2::ColoringElem_MeshElem
+(std::vector<unsigned int>& aColor,
+ //
+ const unsigned int* pElem,
+ unsigned int nElem,
+ unsigned int nPoEl,
+ const std::vector<unsigned int> &elsup_ind,
+ const std::vector<unsigned int> &elsup)
+{
+  const unsigned int nocolor = UINT_MAX;
+  aColor.assign(nElem,nocolor);
+  std::vector<unsigned int> aFlgColor; // aFlgColor[icolor]==ielem if icolor is used around ielem
+  unsigned int ncolor = 0;
+  for(unsigned int ielem=0;ielem<nElem;++ielem){
+    for(unsigned int inoel=0;inoel<nPoEl;++inoel){
+      const unsigned int ino1 = pElem[ielem*nPoEl+inoel];
+      for(unsigned int iesp=elsup_ind[ino1];iesp<elsup_ind[ino1+1];++iesp){
+        const unsigned int jelem = elsup[iesp];
+        const unsigned int jcolor = aColor[jelem];
+        if( jcolor == nocolor ){ continue; }
+        aFlgColor[jcolor] = ielem;
+      }
+    }
+    unsigned int icolor = 0;
+    for(;icolor<ncolor;++icolor){
+      if( aFlgColor[icolor] != ielem ){ break; }
+    }
+    if( icolor == ncolor ){
+      ncolor++;
+      aFlgColor.push_back(nocolor);
+    }
+    aColor[ielem] = icolor;
+  }
+  return ncolor;
+}
+
+void dfm2::JArray_ElemColor_MeshElem
+(std::vector<unsigned int>& color_ind,
+ std::vector<unsigned int>& color_elem,
+ //
+ const unsigned int* pElem,
+ unsigned int nElem,
+ unsigned int nPoEl,
+ unsigned int nPo)
+{
+  std::vector<unsigned int> elsup_ind, elsup;
+  JArray_ElSuP_MeshElem(elsup_ind, elsup,
+                        pElem, nElem, nPoEl, nPo);
+  std::vector<unsigned int> aColor;
+  const unsigned int ncolor = ColoringElem_MeshElem(aColor,
+                                                    pElem, nElem, nPoEl, elsup_ind, elsup);
+  color_ind.assign(ncolor+1,0);
+  for(unsigned int ielem=0;ielem<nElem;++ielem){ color_ind[aColor[ielem]+1] += 1; }
+  for(unsigned int icolor=0;icolor<ncolor;++icolor){ color_ind[icolor+1] += color_ind[icolor]; }
+  color_elem.resize(nElem);
+  std::vector<unsigned int> aCnt(color_ind.begin(),color_ind.end()-1);
+  for(unsigned int ielem=0;ielem<nElem;++ielem){
+    color_elem[aCnt[aColor[ielem]]++] = ielem;
+  }
+}
+
+// ---------------------------------------------
+
+// breadth first search from iroot among the points with aFlg[ip]==0.
+// aOrd (out) visited points in the order of the search. aLev (out) level of the visited points
+static void BFS_PSuP(
+    std::vector<unsigned int>& aOrd,
+    std::vector<int>& aLev,
+    unsigned int iroot,
+    const std::vector<int>& aFlg,
+    const std::vector<unsigned int>& psup_ind,
+    const std::vector<unsigned int>& psup)
+{
+  for(unsigned int ip : aOrd){ aLev[ip] = -1; }
+  aOrd.assign(1,iroot);
+  aLev[iroot] = 0;
+  for(unsigned int io=0;io<aOrd.size();++io){
+    const unsigned int ip0 = aOrd[io];
+    for(unsigned int ipsup=psup_ind[ip0];ipsup<psup_ind[ip0+1];++ipsup){
+      const unsigned int ip1 = psup[ipsup];
+      if( aFlg[ip1] != 0 || aLev[ip1] != -1 ){ continue; }
+      aLev[ip1] = aLev[ip0]+1;
+      aOrd.push_back(ip1);
+    }
+  }
+}
+
+void dfm2::Permutation_ReverseCuthillMcKee
+(std::vector<unsigned int>& aNew2Old,
+ //
+ const std::vector<unsigned int>& psup_ind,
+ const std::vector<unsigned int>& psup)
+{
+  assert( !psup_ind.empty() );
+  const unsigned int np = (unsigned int)psup_ind.size()-1;
+  aNew2Old.clear();
+  aNew2Old.reserve(np);
+  std::vector<int> aFlg(np,0), aLev(np,-1);
+  std::vector<unsigned int> aOrd, aNext;
+  for(unsigned int ip_seed=0;ip_seed<np;++ip_seed){
+    if( aFlg[ip_seed] != 0 ){ continue; }
+    // pseudo-peripheral point of the connected component
+    unsigned int iroot = ip_seed;
+    BFS_PSuP(aOrd,aLev, iroot,aFlg,psup_ind,psup);
+    for(int itr=0;itr<5;++itr){
+      const int nlev0 = aLev[aOrd.back()];
+      unsigned int ip1 = aOrd.back();
+      for(int io=(int)aOrd.size()-1;io>=0 && aLev[aOrd[io]]==nlev0;--io){ // minimum degree in the last level
+        const unsigned int ip0 = aOrd[io];
+        if( psup_ind[ip0+1]-psup_ind[ip0] < psup_ind[ip1+1]-psup_ind[ip1] ){ ip1 = ip0; }
+      }
+      BFS_PSuP(aOrd,aLev, ip1,aFlg,psup_ind,psup);
+      iroot = ip1;
+      if( aLev[aOrd.back()] <= nlev0 ){ break; }
+    }
+    for(unsigned int ip : aOrd){ aLev[ip] = -1; }
+    aOrd.clear();
+    // Cuthill-McKee: visit the neighbors in the ascending order of the degree
+    const unsigned int i0 = (unsigned int)aNew2Old.size();
+    aNew2Old.push_back(iroot);
+    aFlg[iroot] = 1;
+    for(unsigned int io=i0;io<aNew2Old.size();++io){
+      const unsigned int ip0 = aNew2Old[io];
+      aNext.clear();
+      for(unsigned int ipsup=psup_ind[ip0];ipsup<psup_ind[ip0+1];++ipsup){
+        const unsigned int ip1 = psup[ipsup];
+        if( aFlg[ip1] != 0 ){ continue; }
+        aFlg[ip1] = 1;
+        aNext.push_back(ip1);
+      }
+      std::stable_sort(aNext.begin(), aNext.end(), [&](unsigned int ip1, unsigned int ip2){
+        return psup_ind[ip1+1]-psup_ind[ip1] < psup_ind[ip2+1]-psup_ind[ip2]; });
+      aNew2Old.insert(aNew2Old.end(), aNext.begin(), aNext.end());
+    }
+  }
+  assert( aNew2Old.size() == np );
+  std::reverse(aNew2Old.begin(), aNew2Old.end());
+}
+
+void dfm2::Permutation_MultiColor
+(std::vector<unsigned int>& aNew2Old,
+ std::vector<unsigned int>& color_ind,
+ //
+ const std::vector<unsigned int>& psup_ind,
+ const std::vector<unsigned int>& psup)
+{
+  assert( !psup_ind.empty() );
+  const unsigned int np = (unsigned int)psup_ind.size()-1;
+  std::vector<int> aColor(np,-1);
+  std::vector<int> aFlg; // aFlg[icolor] == ip if the color is used by a neighbor of ip
+  int ncolor = 0;
+  for(unsigned int ip=0;ip<np;++ip){
+    for(unsigned int ipsup=psup_ind[ip];ipsup<psup_ind[ip+1];++ipsup){
+      const int ic = aColor[psup[ipsup]];
+      if( ic >= 0 ){ aFlg[ic] = (int)ip; }
+    }
+    int ic0 = 0;
+    for(;ic0<ncolor;++ic0){ if( aFlg[ic0] != (int)ip ){ break; } }
+    if( ic0 == ncolor ){ ncolor++; aFlg.push_back(-1); }
+    aColor[ip] = ic0;
+  }
+  color_ind.assign(ncolor+1,0);
+  for(unsigned int ip=0;ip<np;++ip){ color_ind[aColor[ip]+1] += 1; }
+  for(int ic=0;ic<ncolor;++ic){ color_ind[ic+1] += color_ind[ic]; }
+  aNew2Old.resize(np);
+  std::vector<unsigned int> aCnt(color_ind.begin(),color_ind.end()-1);
+  for(unsigned int ip=0;ip<np;++ip){ aNew2Old[aCnt[aColor[ip]]++] = ip; }
+}
+
+// spread the lower 21 bits of x such that there are two zero bits between them
+static std::uint64_t SpreadBits3(std::uint64_t x)
+{
+  x &= 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffULL;
+  x = (x | x << 16) & 0x1f0000ff0000ffULL;
+  x = (x | x << 8)  & 0x100f00f00f00f00fULL;
+  x = (x | x << 4)  & 0x10c30c30c30c30c3ULL;
+  x = (x | x << 2)  & 0x1249249249249249ULL;
+  return x;
+}
+
+// spread the lower 32 bits of x such that there is a zero bit between them
+static std::uint64_t SpreadBits2(std::uint64_t x)
+{
+  x &= 0xffffffffULL;
+  x = (x | x << 16) & 0x0000ffff0000ffffULL;
+  x = (x | x << 8)  & 0x00ff00ff00ff00ffULL;
+  x = (x | x << 4)  & 0x0f0f0f0f0f0f0f0fULL;
+  x = (x | x << 2)  & 0x3333333333333333ULL;
+  x = (x | x << 1)  & 0x5555555555555555ULL;
+  return x;
+}
+
+void dfm2::Permutation_MortonCode_Points
+(std::vector<unsigned int>& aNew2Old,
+ //
+ const double* aXYZ, unsigned int nXYZ,
+ unsigned int ndim)
+{
+  assert( ndim == 2 || ndim == 3 );
+  aNew2Old.resize(nXYZ);
+  if( nXYZ == 0 ){ return; }
+  double bbmin[3], bbmax[3];
+  for(unsigned int idim=0;idim<ndim;++idim){ bbmin[idim] = bbmax[idim] = aXYZ[idim]; }
+  for(unsigned int ip=0;ip<nXYZ;++ip){
+    for(unsigned int idim=0;idim<ndim;++idim){
+      bbmin[idim] = (aXYZ[ip*ndim+idim] < bbmin[idim]) ? aXYZ[ip*ndim+idim] : bbmin[idim];
+      bbmax[idim] = (aXYZ[ip*ndim+idim] > bbmax[idim]) ? aXYZ[ip*ndim+idim] : bbmax[idim];
+    }
+  }
+  // the same scale for all the axes to keep the aspect ratio
+  double len = 0.0;
+  for(unsigned int idim=0;idim<ndim;++idim){ len = (bbmax[idim]-bbmin[idim] > len) ? bbmax[idim]-bbmin[idim] : len; }
+  const double nres = (ndim == 3) ? (double)0x1fffff : (double)0xffffffffULL;
+  const double scale = (len > 0.0) ? nres/len : 0.0;
+  std::vector< std::pair<std::uint64_t,unsigned int> > aCode(nXYZ);
+  for(unsigned int ip=0;ip<nXYZ;++ip){
+    std::uint64_t code = 0;
+    for(unsigned int idim=0;idim<ndim;++idim){
+      const std::uint64_t ix = (std::uint64_t)((aXYZ[ip*ndim+idim]-bbmin[idim])*scale);
+      code |= (ndim == 3) ? SpreadBits3(ix) << idim : SpreadBits2(ix) << idim;
+    }
+    aCode[ip] = std::make_pair(code,ip);
+  }
+  std::sort(aCode.begin(), aCode.end());
+  for(unsigned int inew=0;inew<nXYZ;++inew){ aNew2Old[inew] = aCode[inew].second; }
+}
+
+void dfm2::InversePermutation
+(std::vector<unsigned int>& aOld2New,
+ //
+ const std::vector<unsigned int>& aNew2Old)
+{
+  aOld2New.resize(aNew2Old.size());
+  for(unsigned int inew=0;inew<aNew2Old.size();++inew){
+    aOld2New[aNew2Old[inew]] = inew;
+  }
+}
+
+void dfm2::PermutePoint_MeshElem
+(unsigned int* pElem,
+ unsigned int nElem,
+ unsigned int nPoEl,
+ const std::vector<unsigned int>& aOld2New)
+{
+  for(unsigned int i=0;i<nElem*nPoEl;++i){
+    assert( pElem[i] < aOld2New.size() );
+    pElem[i] = aOld2New[pElem[i]];
+  }
+}
+
+template <typename T>
+void dfm2::PermuteValue_Point
+(std::vector<T>& aVal,
+ unsigned int nval,
+ const std::vector<unsigned int>& aNew2Old)
+{
+  const unsigned int np = (unsigned int)aNew2Old.size();
+  assert( aVal.size() == np*nval );
+  const std::vector<T> aVal0 = aVal;
+  for(unsigned int inew=0;inew<np;++inew){
+    const unsigned int iold = aNew2Old[inew];
+    for(unsigned int ival=0;ival<nval;++ival){ aVal[inew*nval+ival] = aVal0[iold*nval+ival]; }
+  }
+}
+template void dfm2::PermuteValue_Point(std::vector<double>& aVal, unsigned int nval, const std::vector<unsigned int>& aNew2Old);
+template void dfm2::PermuteValue_Point(std::vector<float>& aVal, unsigned int nval, const std::vector<unsigned int>& aNew2Old);
+template void dfm2::PermuteValue_Point(std::vector<int>& aVal, unsigned int nval, const std::vector<unsigned int>& aNew2Old);
+template void dfm2::PermuteValue_Point(std::vector<unsigned int>& aVal, unsigned int nval, const std::vector<unsigned int>& aNew2Old);
+
+void dfm2::JArray_Permute
+(std::vector<unsigned int>& psup_ind,
+ std::vector<unsigned int>& psup,
+ const std::vector<unsigned int>& aNew2Old)
+{
+  const unsigned int np = (unsigned int)aNew2Old.size();
+  assert( psup_ind.size() == np+1 );
+  std::vector<unsigned int> aOld2New;
+  InversePermutation(aOld2New, aNew2Old);
+  std::vector<unsigned int> psup_ind1(np+1,0), psup1(psup.size());
+  for(unsigned int inew=0;inew<np;++inew){
+    const unsigned int iold = aNew2Old[inew];
+    psup_ind1[inew+1] = psup_ind1[inew] + psup_ind[iold+1] - psup_ind[iold];
+    unsigned int* p1 = psup1.data()+psup_ind1[inew];
+    for(unsigned int ipsup=psup_ind[iold];ipsup<psup_ind[iold+1];++ipsup){
+      *(p1++) = aOld2New[psup[ipsup]];
+    }
+    std::sort(psup1.data()+psup_ind1[inew], p1);
+  }
+  psup_ind.swap(psup_ind1);
+  psup.swap(psup1);
+}
+
 void dfm2::JArray_ElSuP_MeshMix
 (std::vector<unsigned int> &elsup_ind,
  std::vector<unsigned int> &elsup,
@@ -283,6 +283,123 @@ void JArray_ElSuP_MeshMix(
     const int nPo);
 
 
+// -----------------
+// coloring
+
+/**
+ * @brief greedy coloring of elements such that the elements sharing a point have different colors
+ * @param aColor (out) color of each element (size: nElem)
+ * @param elsup_ind jagged array index of "elem surrounding point" (see JArray_ElSuP_MeshElem)
+ * @param elsup jagged array value of "elem surrounding point"
+ * @return number of colors
+ * @details the elements in the same color can be merged into a sparse matrix concurrently
+ */
+unsigned int ColoringElem_MeshElem(
+    std::vector<unsigned int>& aColor,
+    //
+    const unsigned int* pElem,
+    unsigned int nElem,
+    unsigned int nPoEl,
+    const std::vector<unsigned int> &elsup_ind,
+    const std::vector<unsigned int> &elsup);
+
+/**
+ * @brief elements grouped by color as a jagged array
+ * @param color_ind (out) jagged array index. The elements with color ic are color_elem[color_ind[ic]] ~ color_elem[color_ind[ic+1]-1]
+ * @param color_elem (out) jagged array value (element index sorted in ascending order for each color)
+ */
+void JArray_ElemColor_MeshElem(
+    std::vector<unsigned int>& color_ind,
+    std::vector<unsigned int>& color_elem,
+    //
+    const unsigned int* pElem,
+    unsigned int nElem,
+    unsigned int nPoEl,
+    unsigned int nPo);
+
+// -----------------
+// permutation (reordering of the points)
+
+/**
+ * @brief reverse Cuthill-McKee ordering of the points to reduce the bandwidth of the sparse matrix
+ * @param aNew2Old (out) permutation. aNew2Old[inew] = iold
+ * @param psup_ind jagged array index of the adjacency (e.g., from JArray_PSuP_MeshElem)
+ * @param psup jagged array value of the adjacency
+ * @details each connected component starts from a pseudo-peripheral point
+ */
+void Permutation_ReverseCuthillMcKee(
+    std::vector<unsigned int>& aNew2Old,
+    //
+    const std::vector<unsigned int>& psup_ind,
+    const std::vector<unsigned int>& psup);
+
+/**
+ * @brief multicolor ordering. The points are colored such that the adjacent points have different colors,
+ * and they are numbered color by color.
+ * @param aNew2Old (out) permutation. aNew2Old[inew] = iold
+ * @param color_ind (out) the points with the color ic are [color_ind[ic], color_ind[ic+1]) in the new numbering
+ * @details greedy coloring in the original order. The points in the same color are independent of each other,
+ * so they can be processed concurrently (e.g., in Gauss-Seidel or incomplete factorization)
+ */
+void Permutation_MultiColor(
+    std::vector<unsigned int>& aNew2Old,
+    std::vector<unsigned int>& color_ind,
+    //
+    const std::vector<unsigned int>& psup_ind,
+    const std::vector<unsigned int>& psup);
+
+/**
+ * @brief order the points along the space-filling curve (Morton order) to improve the memory locality
+ * @param aNew2Old (out) permutation. aNew2Old[inew] = iold.
+ * Use PermutePoint_MeshElem and PermuteValue_Point to apply it.
+ * @param ndim 2 or 3
+ */
+void Permutation_MortonCode_Points(
+    std::vector<unsigned int>& aNew2Old,
+    //
+    const double* aXYZ, unsigned int nXYZ,
+    unsigned int ndim);
+
+/**
+ * @brief inverse of the permutation
+ * @param aOld2New (out) aOld2New[aNew2Old[i]] = i
+ */
+void InversePermutation(
+    std::vector<unsigned int>& aOld2New,
+    //
+    const std::vector<unsigned int>& aNew2Old);
+
+/**
+ * @brief renumber the points in the connectivity of the elements
+ * @param aOld2New (in) aOld2New[iold] = inew (see InversePermutation)
+ */
+void PermutePoint_MeshElem(
+    unsigned int* pElem,
+    unsigned int nElem,
+    unsigned int nPoEl,
+    const std::vector<unsigned int>& aOld2New);
+
+/**
+ * @brief reorder the values stored for each point (e.g., coordinates, BC flags and results)
+ * @param aVal (in,out) the values of the point ip are aVal[ip*nval] ~ aVal[ip*nval+nval-1]
+ * @param aNew2Old (in) aNew2Old[inew] = iold
+ * @details To put back the values in the original order, pass aOld2New instead of aNew2Old.
+ */
+template <typename T>
+void PermuteValue_Point(
+    std::vector<T>& aVal,
+    unsigned int nval,
+    const std::vector<unsigned int>& aNew2Old);
+
+/**
+ * @brief reorder the adjacency jagged array (e.g., the pattern of a sparse matrix) for the new numbering
+ * @details the values for each point are sorted in ascending order
+ */
+void JArray_Permute(
+    std::vector<unsigned int>& psup_ind,
+    std::vector<unsigned int>& psup,
+    const std::vector<unsigned int>& aNew2Old);
+
 // -----------------
 // elem sur elem
 
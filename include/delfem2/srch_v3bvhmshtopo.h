@@ -227,28 +227,24 @@ void delfem2::BVH_NearestPoint_MeshTri3D(
     const std::vector<delfem2::CNodeBVH2>& aBVH,
     const std::vector<T>& aBB)
 {
-  double min0, max0;
-  aBB[ibvh].Range_DistToPoint(min0,max0, px,py,pz);
-  assert( min0 >= 0 && max0 >= min0 );
-  ////
-  if( dist_min>=0 && min0>dist_min ){ return; }
-  const int ichild0 = aBVH[ibvh].ichild[0];
-  const int ichild1 = aBVH[ibvh].ichild[1];
-  if( ichild1 == -1 ){ // leaf
-    const unsigned int itri0 = ichild0;
+  auto dist_bv = [&](int jbvh){
+    double min0=+1.0, max0=-1.0;
+    aBB[jbvh].Range_DistToPoint(min0,max0, px,py,pz);
+    if( max0 < min0 ){ return -1.0; } // inactive bvh. the children should be inactive too
+    assert( min0 >= 0 );
+    return min0;
+  };
+  auto on_leaf = [&](int itri0, double, double& dist_cur){
     CPointElemSurf<REAL> pes_tmp;
     double dist = DistanceToTri(pes_tmp,
                                 CVec3<REAL>(px,py,pz),
                                 itri0, aXYZ,aTri);
-    if( dist_min<0 || dist < dist_min ){
-      dist_min = dist;
+    if( dist_cur<0 || dist < dist_cur ){
+      dist_cur = dist;
       pes = pes_tmp;
     }
-    return;
-  }
-  //
-  BVH_NearestPoint_MeshTri3D(dist_min,pes, px,py,pz,aXYZ,aTri, ichild0,aBVH,aBB);
-  BVH_NearestPoint_MeshTri3D(dist_min,pes, px,py,pz,aXYZ,aTri, ichild1,aBVH,aBB);
+  };
+  BVH_TraverseNearest(dist_min, ibvh, aBVH, dist_bv, on_leaf);
 }
 
 // potential maximum distance of the nearest point
@@ -266,18 +262,17 @@ void delfem2::BVH_NearestPoint_IncludedInBVH_MeshTri3D(
     const std::vector<delfem2::CNodeBVH2>& aBVH,
     const std::vector<BV>& aBB)
 {
-  double min0,max0;
-  aBB[ibvh].Range_DistToPoint(min0,max0,
-                              px,py,pz);
-  if( min0 > rad_exp ){ return; }
-  ////
-  const int ichild0 = aBVH[ibvh].ichild[0];
-  const int ichild1 = aBVH[ibvh].ichild[1];
-  if( ichild1 == -1 ){ // leaf
+  double min0 = 0.0; // distance to the bounding volume entered last
+  auto is_enter = [&](int jbvh){
+    double max0;
+    aBB[jbvh].Range_DistToPoint(min0,max0,
+                                px,py,pz);
+    return min0 <= rad_exp;
+  };
+  auto on_leaf = [&](int itri0){
     if( min0 < dist_bv ){ dist_bv = min0; }
     if( min0 == 0.0 ){
       dist_bv = 0.0;
-      const unsigned int itri0 = ichild0;
       CPointElemSurf<REAL> pes_tmp;
       const double dist0 = DistanceToTri(pes_tmp,
                                          CVec3<REAL>(px,py,pz),
@@ -287,16 +282,9 @@ void delfem2::BVH_NearestPoint_IncludedInBVH_MeshTri3D(
         pes = pes_tmp;
       }
     }
-    return;
-  }
-  BVH_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri,dist_bv, pes,
-                                           px,py,pz,rad_exp,
-                                           aXYZ,nXYZ,aTri,nTri,
-                                           ichild0,aBVH,aBB);
-  BVH_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri,dist_bv, pes,
-                                           px,py,pz,rad_exp,
-                                           aXYZ,nXYZ,aTri,nTri,
-                                           ichild1,aBVH,aBB);
+    return true;
+  };
+  BVH_Traverse(ibvh, aBVH, is_enter, on_leaf);
 }
 
 // ----------------------
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/**
+ * @file thread.h
+ * @brief small utilities to run loops on multiple std::thread (header only)
+ * @details with nthread <= 1, everything runs on the calling thread without creating any thread.
+ * ParallelThread() creates the threads for each call, so use CThreadPool for the kernels called in every iteration.
+ */
+
+#ifndef DFM2_THREAD_H
+#define DFM2_THREAD_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+namespace delfem2 {
+
+/**
+ * @brief call func(ithread) for ithread = 0,...,nthread-1 concurrently
+ * @details the calling thread runs ithread=0. this function returns after all the threads finished.
+ */
+template <typename FUNC>
+void ParallelThread(
+    unsigned int nthread,
+    const FUNC& func)
+{
+  if( nthread <= 1 ){ func(0); return; }
+  std::vector<std::thread> aThread;
+  aThread.reserve(nthread-1);
+  for(unsigned int ith=1;ith<nthread;++ith){
+    aThread.emplace_back(func,ith);
+  }
+  func(0);
+  for(auto& th : aThread){ th.join(); }
+}
+
+/**
+ * @class persistent worker threads to call func(ithread) for ithread = 0,...,nthread-1 many times
+ * @details the nthread-1 workers are created in the constructor and sleep between the calls of Run().
+ * Run() works like ParallelThread() (the calling thread runs ithread=0) but it does not create threads nor allocate.
+ * The calls of Run() from different threads are serialized. Do not call Run() inside the func.
+ */
+class CThreadPool
+{
+public:
+  explicit CThreadPool(unsigned int nthread0) :
+  nthread((nthread0==0) ? 1 : nthread0), igen(0), ndone(0), is_stop(false), pcall(nullptr), pfunc(nullptr)
+  {
+    aThread.reserve(nthread-1);
+    for(unsigned int ith=1;ith<nthread;++ith){
+      aThread.emplace_back([this,ith](){ this->Work(ith); });
+    }
+  }
+  CThreadPool(const CThreadPool&) = delete;
+  CThreadPool& operator=(const CThreadPool&) = delete;
+  ~CThreadPool(){
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      is_stop = true;
+    }
+    cv_start.notify_all();
+    for(auto& th : aThread){ th.join(); }
+  }
+  unsigned int NumThread() const { return nthread; }
+  template <typename FUNC>
+  void Run(const FUNC& func){
+    if( nthread <= 1 ){ func(0); return; }
+    std::lock_guard<std::mutex> lock_run(mtx_run);
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      pcall = &CThreadPool::Call<FUNC>;
+      pfunc = &func;
+      ndone = 0;
+      ++igen;
+    }
+    cv_start.notify_all();
+    func(0);
+    std::unique_lock<std::mutex> lock(mtx);
+    cv_done.wait(lock, [this](){ return ndone+1 == nthread; });
+  }
+private:
+  template <typename FUNC>
+  static void Call(const void* pfunc, unsigned int ith){
+    (*static_cast<const FUNC*>(pfunc))(ith);
+  }
+  void Work(unsigned int ith){
+    unsigned int igen0 = 0;
+    for(;;){
+      void (*pcall0)(const void*, unsigned int) = nullptr;
+      const void* pfunc0 = nullptr;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv_start.wait(lock, [&](){ return is_stop || igen != igen0; });
+        if( is_stop ){ return; }
+        igen0 = igen;
+        pcall0 = pcall;
+        pfunc0 = pfunc;
+      }
+      pcall0(pfunc0, ith);
+      bool is_last;
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        is_last = ( ++ndone+1 == nthread );
+      }
+      if( is_last ){ cv_done.notify_one(); }
+    }
+  }
+private:
+  const unsigned int nthread;
+  std::vector<std::thread> aThread;
+  std::mutex mtx_run; // serialize Run()
+  std::mutex mtx;
+  std::condition_variable cv_start, cv_done;
+  unsigned int igen; // incremented for each Run()
+  unsigned int ndone; // number of the workers finished the current Run()
+  bool is_stop;
+  void (*pcall)(const void*, unsigned int);
+  const void* pfunc;
+};
+
+/**
+ * @brief split [0,n) into nthread contiguous ranges such that the sum of weights in each range is similar
+ * @param aSplit (out) range boundaries with size of nthread+1. ithread-th range is [aSplit[ithread],aSplit[ithread+1])
+ * @param ind (in) accumulated weight with size of n+1 (e.g., the index of CRS). The weight of i is ind[i+1]-ind[i]
+ * @details an item with zero weight still counts one so that the ranges are balanced for very sparse rows
+ */
+inline void SplitRange_Weight(
+    std::vector<unsigned int>& aSplit,
+    unsigned int nthread,
+    const unsigned int* ind,
+    unsigned int n)
+{
+  if( nthread == 0 ){ nthread = 1; }
+  aSplit.assign(nthread+1,n);
+  aSplit[0] = 0;
+  const double wtot = (double)(ind[n]-ind[0]) + n;
+  unsigned int i = 0;
+  for(unsigned int ith=1;ith<nthread;++ith){
+    const double wtrg = wtot*ith/nthread;
+    while( i < n && (double)(ind[i]-ind[0]) + i < wtrg ){ ++i; }
+    aSplit[ith] = i;
+  }
+}
+
+/**
+ * @brief split [0,n) into nthread contiguous ranges with similar size
+ * @param aSplit (out) range boundaries with size of nthread+1
+ */
+inline void SplitRange_Uniform(
+    std::vector<unsigned int>& aSplit,
+    unsigned int nthread,
+    unsigned int n)
+{
+  if( nthread == 0 ){ nthread = 1; }
+  aSplit.resize(nthread+1);
+  for(unsigned int ith=0;ith<nthread+1;++ith){
+    aSplit[ith] = (unsigned int)(((unsigned long long)n*ith)/nthread);
+  }
+}
+
+/**
+ * @brief reusable barrier to synchronize a fixed number of threads (e.g., between stages of ParallelThread)
+ * @details the waiting threads spin with yield, as the stages are expected to be short
+ */
+class CBarrier
+{
+public:
+  explicit CBarrier(unsigned int nthread) : nthread(nthread), icnt(0), igen(0) {}
+  void Wait(){
+    if( nthread <= 1 ){ return; }
+    const unsigned int igen0 = igen.load(std::memory_order_acquire);
+    if( icnt.fetch_add(1,std::memory_order_acq_rel)+1 == nthread ){
+      icnt.store(0,std::memory_order_relaxed);
+      igen.fetch_add(1,std::memory_order_acq_rel);
+      return;
+    }
+    while( igen.load(std::memory_order_acquire) == igen0 ){ std::this_thread::yield(); }
+  }
+private:
+  const unsigned int nthread;
+  std::atomic<unsigned int> icnt;
+  std::atomic<unsigned int> igen;
+};
+
+} // delfem2
+
+#endif
@@ -9,7 +9,9 @@
 #include <cmath>
 #include <vector>
 #include <complex>
+#include <algorithm>
 #include "delfem2/vecxitrsol.h"
+#include "delfem2/instrument.h"
 
 typedef std::complex<double> COMPLEX;
 namespace dfm2 = delfem2;
@@ -59,6 +61,8 @@ T dfm2::DotX(
     const T* vb,
     unsigned int n)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_VECTOR);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_VECTOR, 2.0*n, 2.0*n*sizeof(T));
   T r = 0.0;
   for(unsigned int i=0;i<n;i++){ r += va[i]*vb[i]; }
   return r;
@@ -74,6 +78,8 @@ COMPLEX DotX
   const COMPLEX* vb,
   unsigned int n)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_VECTOR);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_VECTOR, 8.0*n, 2.0*n*sizeof(COMPLEX));
   double sr = 0.0;
   double si = 0.0;
   for(unsigned int i=0;i<n;i++){
@@ -121,6 +127,8 @@ void AXPY(
     VAL* y,
     unsigned int n)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_VECTOR);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_VECTOR, 2.0*n, 3.0*n*sizeof(VAL));
   for(unsigned int i=0;i<n;i++){ y[i] += a*x[i]; }
 }
 template void AXPY(float a, const float* x, float* y, unsigned int n);
@@ -138,6 +146,8 @@ void dfm2::ScaleX(
     VAL s,
     unsigned int n)
 {
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_VECTOR);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_VECTOR, 1.0*n, 2.0*n*sizeof(VAL));
   for(unsigned int i=0;i<n;++i){ p0[i] *= s; }
 }
 template void dfm2::ScaleX(float* p0, float s, unsigned int n);
@@ -279,6 +289,123 @@ void dfm2::XPlusAYBZCW
   }
 }
 
+template <typename T>
+void dfm2::XPlusAYBZ(
+    T* X,
+    T alpha,
+    const T* Y,
+    T beta,
+    const T* Z,
+    unsigned int n)
+{
+  for(unsigned int i=0;i<n;++i){ X[i] += alpha*Y[i] + beta*Z[i]; }
+}
+template void dfm2::XPlusAYBZ(float* X, float alpha, const float* Y, float beta, const float* Z, unsigned int n);
+template void dfm2::XPlusAYBZ(double* X, double alpha, const double* Y, double beta, const double* Z, unsigned int n);
+
+template <typename T>
+void dfm2::XPlusAYBZCW(
+    T* X,
+    T alpha,
+    const T* Y,
+    T beta,
+    const T* Z,
+    T gamma,
+    const T* W,
+    unsigned int n)
+{
+  for(unsigned int i=0;i<n;++i){ X[i] += alpha*Y[i] + beta*Z[i] + gamma*W[i]; }
+}
+template void dfm2::XPlusAYBZCW(float* X, float alpha, const float* Y, float beta, const float* Z,
+                                float gamma, const float* W, unsigned int n);
+template void dfm2::XPlusAYBZCW(double* X, double alpha, const double* Y, double beta, const double* Z,
+                                double gamma, const double* W, unsigned int n);
+
+template <typename T>
+void dfm2::DotX3(
+    T& ab,
+    T& cb,
+    T& aa,
+    const T* a,
+    const T* b,
+    const T* c,
+    unsigned int n)
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_VECTOR);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_VECTOR, 6.0*n, 3.0*n*sizeof(T));
+  T sab[4] = {0,0,0,0};
+  T scb[4] = {0,0,0,0};
+  T saa[4] = {0,0,0,0};
+  const unsigned int n4 = n - n%4;
+  for(unsigned int i=0;i<n4;i+=4){
+    for(unsigned int j=0;j<4;++j){
+      sab[j] += a[i+j]*b[i+j];
+      scb[j] += c[i+j]*b[i+j];
+      saa[j] += a[i+j]*a[i+j];
+    }
+  }
+  for(unsigned int i=n4;i<n;++i){
+    sab[0] += a[i]*b[i];
+    scb[0] += c[i]*b[i];
+    saa[0] += a[i]*a[i];
+  }
+  ab = (sab[0]+sab[1])+(sab[2]+sab[3]);
+  cb = (scb[0]+scb[1])+(scb[2]+scb[3]);
+  aa = (saa[0]+saa[1])+(saa[2]+saa[3]);
+}
+template void dfm2::DotX3(float& ab, float& cb, float& aa,
+                          const float* a, const float* b, const float* c, unsigned int n);
+template void dfm2::DotX3(double& ab, double& cb, double& aa,
+                          const double* a, const double* b, const double* c, unsigned int n);
+
+template <typename T>
+void dfm2::DotX_Multi(
+    T* ab,
+    const T* a,
+    const T* b,
+    unsigned int n,
+    unsigned int nvec)
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_VECTOR);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_VECTOR, 2.0*n*nvec, 2.0*n*nvec*sizeof(T));
+  for(unsigned int ivec=0;ivec<nvec;++ivec){ ab[ivec] = 0; }
+  for(unsigned int i=0;i<n;++i){
+    for(unsigned int ivec=0;ivec<nvec;++ivec){ ab[ivec] += a[i*nvec+ivec]*b[i*nvec+ivec]; }
+  }
+}
+template void dfm2::DotX_Multi(float* ab, const float* a, const float* b, unsigned int n, unsigned int nvec);
+template void dfm2::DotX_Multi(double* ab, const double* a, const double* b, unsigned int n, unsigned int nvec);
+
+template <typename T>
+void dfm2::UpdateX_PipelinedCG(
+    T* x,
+    T* r,
+    T* p,
+    T* s,
+    T* u,
+    const T* w,
+    T alpha,
+    T beta,
+    unsigned int n)
+{
+  DFM2_INSTRUMENT_SCOPE(INSTRUMENT_VECTOR);
+  DFM2_INSTRUMENT_COUNT(INSTRUMENT_VECTOR, 8.0*n, 11.0*n*sizeof(T));
+  for(unsigned int i=0;i<n;++i){
+    const T pi = u[i] + beta*p[i];
+    const T si = w[i] + beta*s[i];
+    const T ri = r[i] - alpha*si;
+    p[i] = pi;
+    s[i] = si;
+    x[i] += alpha*pi;
+    r[i] = ri;
+    u[i] = ri;
+  }
+}
+template void dfm2::UpdateX_PipelinedCG(float* x, float* r, float* p, float* s, float* u, const float* w,
+                                        float alpha, float beta, unsigned int n);
+template void dfm2::UpdateX_PipelinedCG(double* x, double* r, double* p, double* s, double* u, const double* w,
+                                        double alpha, double beta, unsigned int n);
+
 // -------------------------------------------------------------------
 
 
@@ -310,3 +437,270 @@ void dfm2::MatVec(double* y,
     }
   }
 }
+
+// -----------------------------------------------------
+
+void dfm2::EigenSym_Jacobi(
+    double* lam,
+    double* V,
+    double* A,
+    unsigned int n)
+{
+  for(unsigned int i=0;i<n*n;++i){ V[i] = 0.0; }
+  for(unsigned int i=0;i<n;++i){ V[i*n+i] = 1.0; }
+  double a_norm = 0.0;
+  for(unsigned int i=0;i<n*n;++i){ a_norm += A[i]*A[i]; }
+  for(unsigned int isweep=0;isweep<100;++isweep){
+    double off = 0.0;
+    for(unsigned int i=0;i<n;++i){
+      for(unsigned int j=i+1;j<n;++j){ off += A[i*n+j]*A[i*n+j]; }
+    }
+    if( off <= 1.0e-30*a_norm ){ break; }
+    for(unsigned int p=0;p<n;++p){
+      for(unsigned int q=p+1;q<n;++q){
+        const double apq = A[p*n+q];
+        if( fabs(apq) < 1.0e-300 ){ continue; }
+        // rotation angle that eliminates A[p][q]
+        const double theta = (A[q*n+q]-A[p*n+p])/(2*apq);
+        const double t = ((theta>=0) ? 1.0 : -1.0)/(fabs(theta)+sqrt(theta*theta+1));
+        const double c = 1.0/sqrt(t*t+1);
+        const double s = t*c;
+        for(unsigned int k=0;k<n;++k){ // A = A R
+          const double akp = A[k*n+p];
+          const double akq = A[k*n+q];
+          A[k*n+p] = c*akp - s*akq;
+          A[k*n+q] = s*akp + c*akq;
+        }
+        for(unsigned int k=0;k<n;++k){ // A = R^T A
+          const double apk = A[p*n+k];
+          const double aqk = A[q*n+k];
+          A[p*n+k] = c*apk - s*aqk;
+          A[q*n+k] = s*apk + c*aqk;
+        }
+        for(unsigned int k=0;k<n;++k){ // V = V R
+          const double vkp = V[k*n+p];
+          const double vkq = V[k*n+q];
+          V[k*n+p] = c*vkp - s*vkq;
+          V[k*n+q] = s*vkp + c*vkq;
+        }
+      }
+    }
+  }
+  // sort in ascending order
+  std::vector<unsigned int> aInd(n);
+  for(unsigned int i=0;i<n;++i){ aInd[i] = i; }
+  std::sort(aInd.begin(),aInd.end(),[&](unsigned int i, unsigned int j){ return A[i*n+i] < A[j*n+j]; });
+  const std::vector<double> V0(V,V+n*n);
+  for(unsigned int i=0;i<n;++i){
+    lam[i] = A[aInd[i]*n+aInd[i]];
+    for(unsigned int k=0;k<n;++k){ V[k*n+i] = V0[k*n+aInd[i]]; }
+  }
+}
+
+bool dfm2::GeneralizedEigenSym_Lowest(
+    double* lam,
+    double* C,
+    unsigned int m,
+    const double* G,
+    const double* H,
+    unsigned int n)
+{
+  assert( m <= n );
+  // scale by the diagonal of H: [D][H][D] and [D][G][D] with D_ii = 1/sqrt(H_ii)
+  std::vector<double> D(n);
+  for(unsigned int i=0;i<n;++i){
+    if( H[i*n+i] <= 0 ){ return false; }
+    D[i] = 1.0/sqrt(H[i*n+i]);
+  }
+  // Cholesky decomposition [D][H][D] = [L][L]^T
+  std::vector<double> L(n*n,0.0);
+  for(unsigned int j=0;j<n;++j){
+    double s = 1.0;
+    for(unsigned int k=0;k<j;++k){ s -= L[j*n+k]*L[j*n+k]; }
+    if( s < 1.0e-10 ){ return false; } // nearly linearly dependent
+    L[j*n+j] = sqrt(s);
+    for(unsigned int i=j+1;i<n;++i){
+      double t = D[i]*H[i*n+j]*D[j];
+      for(unsigned int k=0;k<j;++k){ t -= L[i*n+k]*L[j*n+k]; }
+      L[i*n+j] = t/L[j*n+j];
+    }
+  }
+  // [A] = [L]^-1 [D][G][D] [L]^-T
+  std::vector<double> A(n*n);
+  for(unsigned int i=0;i<n;++i){
+    for(unsigned int j=0;j<n;++j){ A[i*n+j] = D[i]*G[i*n+j]*D[j]; }
+  }
+  for(unsigned int j=0;j<n;++j){ // [A] = [L]^-1[A] (forward substitution for each column)
+    for(unsigned int i=0;i<n;++i){
+      double t = A[i*n+j];
+      for(unsigned int k=0;k<i;++k){ t -= L[i*n+k]*A[k*n+j]; }
+      A[i*n+j] = t/L[i*n+i];
+    }
+  }
+  for(unsigned int i=0;i<n;++i){ // [A] = [A][L]^-T (forward substitution for each row)
+    for(unsigned int j=0;j<n;++j){
+      double t = A[i*n+j];
+      for(unsigned int k=0;k<j;++k){ t -= A[i*n+k]*L[j*n+k]; }
+      A[i*n+j] = t/L[j*n+j];
+    }
+  }
+  for(unsigned int i=0;i<n;++i){ // symmetrize the round-off error
+    for(unsigned int j=i+1;j<n;++j){ A[i*n+j] = A[j*n+i] = 0.5*(A[i*n+j]+A[j*n+i]); }
+  }
+  std::vector<double> aLam(n), V(n*n);
+  EigenSym_Jacobi(aLam.data(), V.data(), A.data(), n);
+  // {c} = [D][L]^-T{v}
+  for(unsigned int i=0;i<m;++i){
+    lam[i] = aLam[i];
+    for(unsigned int j=n;j-->0;){
+      double t = V[j*n+i];
+      for(unsigned int k=j+1;k<n;++k){ t -= L[k*n+j]*C[k*m+i]; }
+      C[j*m+i] = t/L[j*n+j];
+    }
+  }
+  for(unsigned int j=0;j<n;++j){
+    for(unsigned int i=0;i<m;++i){ C[j*m+i] *= D[j]; }
+  }
+  return true;
+}
+
+// -----------------------------------------------------
+
+void dfm2::InnerProducts_Vectors(
+    double* G,
+    const double* A,
+    const double* B,
+    unsigned int ncol,
+    unsigned int n)
+{
+  const unsigned int nchunk = 256; // the vectors in a chunk stay in the cache
+  for(unsigned int i=0;i<ncol*ncol;++i){ G[i] = 0.0; }
+  for(unsigned int i0=0;i0<n;i0+=nchunk){
+    const unsigned int i1 = (i0+nchunk<n) ? i0+nchunk : n;
+    for(unsigned int icol=0;icol<ncol;++icol){
+      const double* a = A+icol*n;
+      for(unsigned int jcol=icol;jcol<ncol;++jcol){
+        const double* b = B+jcol*n;
+        double s = 0.0;
+        for(unsigned int idof=i0;idof<i1;++idof){ s += a[idof]*b[idof]; }
+        G[icol*ncol+jcol] += s;
+      }
+    }
+  }
+  for(unsigned int icol=0;icol<ncol;++icol){
+    for(unsigned int jcol=0;jcol<icol;++jcol){ G[icol*ncol+jcol] = G[jcol*ncol+icol]; }
+  }
+}
+
+void dfm2::LinearCombination_Vectors(
+    double* Y,
+    const double* S,
+    const double* C,
+    unsigned int ns,
+    unsigned int m,
+    unsigned int n)
+{
+  const unsigned int nchunk = 256;
+  for(unsigned int i0=0;i0<n;i0+=nchunk){
+    const unsigned int i1 = (i0+nchunk<n) ? i0+nchunk : n;
+    for(unsigned int i=0;i<m;++i){
+      double* y = Y+i*n;
+      for(unsigned int idof=i0;idof<i1;++idof){ y[idof] = 0.0; }
+      for(unsigned int j=0;j<ns;++j){
+        const double c = C[j*m+i];
+        const double* sj = S+j*n;
+        for(unsigned int idof=i0;idof<i1;++idof){ y[idof] += c*sj[idof]; }
+      }
+    }
+  }
+}
+
+// -----------------------------------------------------
+
+void dfm2::CKrylovDeflation::FactorizeWAW()
+{
+  const unsigned int nvec = m_nvec;
+  aL.resize(nvec*nvec);
+  InnerProducts_Vectors(aL.data(), aW.data(), aAW.data(), nvec, m_ndof);
+  for(unsigned int j=0;j<nvec;++j){ // Cholesky decomposition in place (lower triangle)
+    double s = aL[j*nvec+j];
+    for(unsigned int k=0;k<j;++k){ s -= aL[j*nvec+k]*aL[j*nvec+k]; }
+    if( s <= 1.0e-12*aL[j*nvec+j] ){ // the subspace is degenerated
+      m_nvec = 0;
+      return;
+    }
+    aL[j*nvec+j] = sqrt(s);
+    for(unsigned int i=j+1;i<nvec;++i){
+      double t = aL[i*nvec+j];
+      for(unsigned int k=0;k<j;++k){ t -= aL[i*nvec+k]*aL[j*nvec+k]; }
+      aL[i*nvec+j] = t/aL[j*nvec+j];
+    }
+  }
+}
+
+void dfm2::CKrylovDeflation::CoeffProjection(
+    double* c,
+    const double* v,
+    bool is_aw) const
+{
+  const unsigned int nvec = m_nvec;
+  const double* B = is_aw ? aAW.data() : aW.data();
+  for(unsigned int i=0;i<nvec;++i){ c[i] = DotX(B+i*m_ndof, v, m_ndof); }
+  for(unsigned int i=0;i<nvec;++i){ // [L]{y} = {c}
+    double t = c[i];
+    for(unsigned int k=0;k<i;++k){ t -= aL[i*nvec+k]*c[k]; }
+    c[i] = t/aL[i*nvec+i];
+  }
+  for(unsigned int i=nvec;i-->0;){ // [L]^T{c} = {y}
+    double t = c[i];
+    for(unsigned int k=i+1;k<nvec;++k){ t -= aL[k*nvec+i]*c[k]; }
+    c[i] = t/aL[i*nvec+i];
+  }
+}
+
+void dfm2::CKrylovDeflation::AddSubspace(
+    double* v,
+    double alpha,
+    const double* c,
+    bool is_aw) const
+{
+  const double* B = is_aw ? aAW.data() : aW.data();
+  for(unsigned int i=0;i<m_nvec;++i){ AXPY(alpha*c[i], B+i*m_ndof, v, m_ndof); }
+}
+
+void dfm2::CKrylovDeflation::Harvest(
+    const double* p,
+    const double* ap)
+{
+  if( m_nhvst >= m_nharvest ){ return; }
+  const unsigned int n = m_ndof;
+  const double s = 1.0/sqrt(DotX(p,p,n));
+  double* w = aW.data()+(m_nvec+m_nhvst)*n;
+  double* aw = aAW.data()+(m_nvec+m_nhvst)*n;
+  for(unsigned int i=0;i<n;++i){
+    w[i] = s*p[i];
+    aw[i] = s*ap[i];
+  }
+  m_nhvst++;
+}
+
+void dfm2::CKrylovDeflation::UpdateSubspace()
+{
+  if( m_nhvst == 0 ){ return; }
+  const unsigned int n = m_ndof;
+  const unsigned int nz = m_nvec+m_nhvst;
+  const unsigned int nvec1 = (m_nvec_max < nz) ? m_nvec_max : nz;
+  m_nhvst = 0;
+  // Ritz vectors: [Z]^T[A][Z]{y} = theta [Z]^T[Z]{y} for Z = [W, harvested directions]
+  std::vector<double> G(nz*nz), H(nz*nz), C(nz*nvec1), aTheta(nvec1);
+  InnerProducts_Vectors(G.data(), aW.data(), aAW.data(), nz, n);
+  InnerProducts_Vectors(H.data(), aW.data(), aW.data(), nz, n);
+  if( !GeneralizedEigenSym_Lowest(aTheta.data(), C.data(), nvec1, G.data(), H.data(), nz) ){
+    return; // keep the current subspace
+  }
+  LinearCombination_Vectors(aTmp.data(), aW.data(), C.data(), nz, nvec1, n);
+  for(unsigned int i=0;i<nvec1*n;++i){ aW[i] = aTmp[i]; }
+  LinearCombination_Vectors(aTmp.data(), aAW.data(), C.data(), nz, nvec1, n);
+  for(unsigned int i=0;i<nvec1*n;++i){ aAW[i] = aTmp[i]; }
+  m_nvec = nvec1;
+}
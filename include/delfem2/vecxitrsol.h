@@ -16,6 +16,9 @@
 #include <cassert>
 #include <complex>
 #include <iostream>
+#include <cstdint>
+
+#include "delfem2/instrument.h"
 
 namespace delfem2 {
 
@@ -91,6 +94,77 @@ void XPlusAYBZCW(std::vector<double> &X,
                  const std::vector<double> &W);
 
 
+/**
+ * @brief {X} += alpha*{Y} + beta*{Z} in one pass
+ * @details defined for "float" and "double". The loop is simple enough to be vectorized by the compiler.
+ */
+template <typename T>
+void XPlusAYBZ(
+    T *X,
+    T alpha,
+    const T *Y,
+    T beta,
+    const T *Z,
+    unsigned int n);
+
+/**
+ * @brief {X} += alpha*{Y} + beta*{Z} + gamma*{W} in one pass
+ */
+template <typename T>
+void XPlusAYBZCW(
+    T *X,
+    T alpha,
+    const T *Y,
+    T beta,
+    const T *Z,
+    T gamma,
+    const T *W,
+    unsigned int n);
+
+/**
+ * @brief compute the three inner products ({a},{b}), ({c},{b}) and ({a},{a}) in one pass
+ * @details defined for "float" and "double". Four partial sums are accumulated independently,
+ * so the reduction is vectorized without re-associating the floating point operations.
+ */
+template <typename T>
+void DotX3(
+    T& ab,
+    T& cb,
+    T& aa,
+    const T *a,
+    const T *b,
+    const T *c,
+    unsigned int n);
+
+/**
+ * @brief inner products of nvec pairs of the interleaved vectors: ab[ivec] = sum_i a[i*nvec+ivec]*b[i*nvec+ivec]
+ * @details defined for "float" and "double". n is the length of each vector
+ */
+template <typename T>
+void DotX_Multi(
+    T* ab,
+    const T *a,
+    const T *b,
+    unsigned int n,
+    unsigned int nvec);
+
+/**
+ * @brief fused update of the vectors in the pipelined conjugate gradient method
+ * @details in one pass, {p} = {u} + beta*{p}, {s} = {w} + beta*{s}, {x} += alpha*{p}, {r} -= alpha*{s} and
+ * {u} = {r} (the input of the preconditioner for the next iteration)
+ */
+template <typename T>
+void UpdateX_PipelinedCG(
+    T *x,
+    T *r,
+    T *p,
+    T *s,
+    T *u,
+    const T *w,
+    T alpha,
+    T beta,
+    unsigned int n);
+
 void NormalizeX(double *p0, unsigned int n);
 
 void OrthogonalizeToUnitVectorX(double *p1,
@@ -107,6 +181,128 @@ void MatVec(double* y,
             double* x);
 
 // --------------------------
+// dense operations for a small number of vectors (e.g., the Rayleigh-Ritz procedure)
+
+/**
+ * @brief eigenvalues and eigenvectors of a dense symmetric matrix with the cyclic Jacobi method
+ * @param lam (out) eigenvalues in ascending order (size: n)
+ * @param V (out) eigenvectors. the i-th eigenvector is the i-th column V[j*n+i]
+ * @param A (in/out) symmetric matrix (row major). destroyed
+ */
+void EigenSym_Jacobi(
+    double* lam,
+    double* V,
+    double* A,
+    unsigned int n);
+
+/**
+ * @brief lowest eigenpairs of the dense generalized symmetric eigenvalue problem [G]{c} = lambda [H]{c}
+ * @details [H] is scaled by its diagonal and factorized by the Cholesky decomposition.
+ * The eigenvectors are [H]-orthonormal.
+ * @param lam (out) the lowest m eigenvalues in ascending order
+ * @param C (out) the eigenvectors for the lowest m eigenvalues. the i-th eigenvector is the i-th column C[j*m+i]
+ * @param G (in) symmetric matrix (row major, size: n*n)
+ * @param H (in) symmetric positive definite matrix (row major, size: n*n)
+ * @return false if [H] is not numerically positive definite
+ */
+bool GeneralizedEigenSym_Lowest(
+    double* lam,
+    double* C,
+    unsigned int m,
+    const double* G,
+    const double* H,
+    unsigned int n);
+
+/**
+ * @brief inner products of the vectors G[i*ncol+j] = ({a_i},{b_j}) assuming the result is symmetric
+ * @details the vectors are stored as A[i*n+idof]. Only j>=i are computed and the vectors are read once in chunks.
+ */
+void InnerProducts_Vectors(
+    double* G,
+    const double* A,
+    const double* B,
+    unsigned int ncol,
+    unsigned int n);
+
+/**
+ * @brief linear combination of the vectors {y_i} = sum_j C[j*m+i]{s_j} for i<m and j<ns
+ * @details Y should not overlap with S
+ */
+void LinearCombination_Vectors(
+    double* Y,
+    const double* S,
+    const double* C,
+    unsigned int ns,
+    unsigned int m,
+    unsigned int n);
+
+// --------------------------
+// Krylov solvers
+//
+// The solvers below do not refer to the storage of the matrix. The matrix "MAT" is any class with the member function
+//   void MatVec(REAL* y, REAL alpha, const REAL* x, REAL beta) const;  // {y} = alpha*[A]{x} + beta*{y}
+// e.g., CMatrixSparse or a matrix-free operator that computes the product element-by-element.
+// The preconditioner "PREC" is any class with the member function
+//   void Solve(REAL* vec) const;  // {vec} = [M]^-1{vec}
+// e.g., CPreconditionerILU. The number of the unknowns is given by the argument or the size of the vector.
+// With DFM2_INSTRUMENT defined, the time of the matrix-vector products and the preconditioner is recorded and
+// the iteration can be stopped by the callback (see instrument.h).
+
+/**
+ * @class work vectors and the convergence history of the Krylov solvers kept over the solves
+ * @tparam T float, double or std::complex<double>
+ * @details The solvers taking this class as the last argument (e.g., Solve_PCG(r,x,N,tol,max,mat,prec,ws))
+ * do not allocate memory once the work vectors have the size of the problem (i.e., after Initialize() or
+ * the first solve), so they can be called in a real-time loop. The work vectors are aligned to the cache line (64 bytes).
+ * The history is recorded up to the length reserved in Initialize() only if is_history is true.
+ */
+template <typename T>
+class CKrylovWorkspace
+{
+public:
+  CKrylovWorkspace() : is_history(true), m_ndof(0), m_nvec(0), m_stride(0), m_offset(0) {}
+  /**
+   * @param nvec number of the work vectors. 2 for Solve_PCG() and 7 for Solve_PBiCGStab()
+   * @param max_nitr maximum number of the iterations. The history with length max_nitr+2 is reserved.
+   */
+  void Initialize(unsigned int ndof, unsigned int nvec, unsigned int max_nitr){
+    this->Reserve(ndof, nvec);
+    aHistory.clear();
+    if( is_history ){ aHistory.reserve(max_nitr+2); }
+  }
+  /**
+   * @brief make nvec work vectors with the size ndof. Memory is allocated only if the buffer is short.
+   */
+  void Reserve(unsigned int ndof, unsigned int nvec){
+    static_assert( 64 % sizeof(T) == 0, "the size of T needs to divide the cache line size" );
+    const unsigned int nalign = 64 / sizeof(T);
+    m_ndof = ndof;
+    m_nvec = nvec;
+    m_stride = ((ndof+nalign-1)/nalign)*nalign;
+    if( m_buff.size() < m_stride*nvec+nalign ){ m_buff.resize(m_stride*nvec+nalign); }
+    const std::size_t iadr = reinterpret_cast<std::uintptr_t>(m_buff.data());
+    m_offset = ((64 - iadr%64)%64)/sizeof(T);
+  }
+  T* Vec(unsigned int ivec){
+    assert( ivec < m_nvec );
+    return m_buff.data()+m_offset+ivec*m_stride;
+  }
+  void ClearHistory(){ aHistory.clear(); } // the capacity is kept
+  void AddHistory(double v){
+    if( !is_history || aHistory.size() == aHistory.capacity() ){ return; }
+    aHistory.push_back(v);
+  }
+public:
+  /**
+   * @param is_history record the history of the residual in aHistory. Set false before Initialize() to skip the recording.
+   */
+  bool is_history;
+  std::vector<double> aHistory;
+private:
+  unsigned int m_ndof, m_nvec;
+  std::size_t m_stride, m_offset;
+  std::vector<T> m_buff;
+};
 
 /**
  * @brief solve linear system using conjugate gradient method
@@ -132,7 +328,7 @@ Solve_CG(
   for (unsigned int iitr = 0; iitr < max_iteration; iitr++) {
     REAL alpha;
     {  // alpha = (r,r) / (p,Ap)
-      mat.MatVec(Ap_vec.data(),
+      Instrument_MatVec(mat, Ap_vec.data(),
                  1.0, p_vec.data(), 0.0);
       const REAL pAp = Dot(p_vec, Ap_vec);
       alpha = sqnorm_res / pAp;
@@ -165,22 +361,18 @@ Solve_CG_Complex(
     const MAT& mat)
 {
   using COMPLEX = std::complex<REAL>;
-  assert(!mat.valDia.empty());
-  assert(mat.nblk_col == mat.nblk_row);
-  assert(mat.len_col == mat.len_row);
-  const unsigned int ndof = mat.nblk_col * mat.len_col;
-  assert(r_vec.size() == ndof);
+  const unsigned int ndof = r_vec.size();
   std::vector<double> aConv;
   u_vec.assign(ndof, 0.0);   // {x} = 0
   double sqnorm_res = Dot(r_vec, r_vec).real();
   if (sqnorm_res < 1.0e-30) { return aConv; }
   const double inv_sqnorm_res_ini = 1.0 / sqnorm_res;
-  COMPLEX Ap_vec(ndof);
-  COMPLEX p_vec = r_vec;// {p} = {r} (Set Initial Serch Direction)
+  std::vector<COMPLEX> Ap_vec(ndof);
+  std::vector<COMPLEX> p_vec = r_vec;// {p} = {r} (Set Initial Serch Direction)
   for (unsigned int iitr = 0; iitr < max_iteration; iitr++) {
     double alpha;
     {  // alpha = (r,r) / (p,Ap)
-      mat.MatVec(Ap_vec.data(),
+      Instrument_MatVec(mat, Ap_vec.data(),
                  1.0, p_vec.data(), 0.0);
       COMPLEX C_pAp = Dot(p_vec, Ap_vec);
       assert(fabs(C_pAp.imag()) < 1.0e-3);
@@ -211,12 +403,7 @@ Solve_BiCGStab(
     unsigned int max_niter,
     const MAT& mat)
 {
-  assert(!mat.valDia.empty());
-  assert(mat.nblk_col == mat.nblk_row);
-  assert(mat.len_col == mat.len_row);
-  const unsigned int ndof = mat.nblk_col * mat.len_col;
-  assert(r_vec.size() == ndof);
-  
+  const unsigned int ndof = r_vec.size();
   std::vector<double> aConv;
   double sq_inv_norm_res_ini;
   {
@@ -238,7 +425,7 @@ Solve_BiCGStab(
   double r_r2 = Dot(r_vec, r2_vec);   // calc ({r},{r2})
   
   for (unsigned int iitr = 0; iitr < max_niter; iitr++) {
-    mat.MatVec(Ap_vec.data(),
+    Instrument_MatVec(mat, Ap_vec.data(),
                1.0, p_vec.data(), 0.0); // calc {Ap} = [A]*{p}
     double alpha;
     { // alhpa = ({r},{r2}) / ({Ap},{r2})
@@ -249,7 +436,7 @@ Solve_BiCGStab(
     s_vec = r_vec;
     AXPY(-alpha, Ap_vec, s_vec);
     // calc {As} = [A]*{s}
-    mat.MatVec(As_vec.data(),
+    Instrument_MatVec(mat, As_vec.data(),
                1.0, s_vec.data(), 0.0);
     // calc omega
     double omega;
@@ -293,12 +480,7 @@ Solve_BiCGSTAB_Complex(
     const MAT& mat)
 {
   using COMPLEX = std::complex<REAL>;
-  //
-  assert(!mat.valDia.empty());
-  assert(mat.nblk_col == mat.nblk_row);
-  assert(mat.len_col == mat.len_row);
-  const unsigned int ndof = mat.nblk_col * mat.len_col;
-  assert(r_vec.size() == ndof);
+  const unsigned int ndof = r_vec.size();
   
   std::vector<double> aConv;
   double sq_inv_norm_res_ini;
@@ -320,14 +502,14 @@ Solve_BiCGSTAB_Complex(
   COMPLEX r_r0 = Dot(r_vec, r0_vec);   // calc ({r},{r2})
   
   for (unsigned int iitr = 0; iitr < max_niter; iitr++) {
-    mat.MatVec(Ap_vec.data(),
+    Instrument_MatVec(mat, Ap_vec.data(),
                1.0, p_vec.data(), 0.0); // calc {Ap} = [A]*{p}
     const COMPLEX alpha = r_r0 / Dot(Ap_vec, r0_vec); // alhpa = ({r},{r2}) / ({Ap},{r2})
                                                             // {s} = {r} - alpha*{Ap}
     s_vec = r_vec;
     AXPY(-alpha, Ap_vec, s_vec);
     // calc {As} = [A]*{s}
-    mat.MatVec(As_vec.data(),
+    Instrument_MatVec(mat, As_vec.data(),
                1.0, s_vec.data(), 0.0);
     // calc omega
     const COMPLEX omega = Dot(s_vec, As_vec) / Dot(As_vec, As_vec).real();  // omega=({As},{s})/({As},{As})
@@ -356,20 +538,25 @@ Solve_BiCGSTAB_Complex(
   return aConv;
 }
 
+/**
+ * @brief solve a real-valued linear system using the BiCGStab method with preconditioner
+ * @param ndof number of the unknowns
+ * @param ws (in,out) work vectors and the history of the convergence ratio. No memory is allocated if ws has the size.
+ * @return number of the iterations
+ */
 template <typename REAL, typename MAT, typename PREC>
-std::vector<double> Solve_PBiCGStab
+unsigned int Solve_PBiCGStab
 (REAL* r_vec,
  REAL* x_vec,
+ unsigned int ndof,
  double conv_ratio_tol,
  unsigned int max_niter,
  const MAT& mat,
- const PREC& ilu)
+ const PREC& ilu,
+ CKrylovWorkspace<REAL>& ws)
 {
-  assert( !mat.valDia.empty() );
-  assert( mat.nblk_col == mat.nblk_row );
-  assert( mat.len_col == mat.len_row );
-  const unsigned int ndof = mat.nblk_col*mat.len_col;
-  std::vector<double> aResHistry;
+  ws.Reserve(ndof,7);
+  ws.ClearHistory();
   
   // {u} = 0
   for(unsigned int i=0;i<ndof;++i){ x_vec[i] = 0.0; }
@@ -378,144 +565,191 @@ std::vector<double> Solve_PBiCGStab
   {
     const double sq_norm_res_ini = DotX(r_vec,r_vec,ndof);
     if( sq_norm_res_ini < 1.0e-60 ){
-      aResHistry.push_back( sqrt( sq_norm_res_ini ) );
-      return aResHistry;
+      ws.AddHistory( sqrt( sq_norm_res_ini ) );
+      return 0;
     }
     sq_inv_norm_res_ini = 1.0 / sq_norm_res_ini;
   }
   
-  //    std::cout << "SqIniRes : " << ls.DOT(ir,ir) << std::endl;
+  REAL* s_vec = ws.Vec(0);
+  REAL* Ms_vec = ws.Vec(1);
+  REAL* AMs_vec = ws.Vec(2);
+  REAL* Mp_vec = ws.Vec(3);
+  REAL* AMp_vec = ws.Vec(4);
+  REAL* r0_vec = ws.Vec(5);
+  REAL* p_vec = ws.Vec(6);
   
-  std::vector<double> s_vec(ndof);
-  std::vector<double> Ms_vec(ndof);
-  std::vector<double> AMs_vec(ndof);
-  std::vector<double> Mp_vec(ndof);
-  std::vector<double> AMp_vec(ndof);
-  
-  const std::vector<double> r0_vec(r_vec,r_vec+ndof);   // {r2} = {r}
-  std::vector<double> p_vec(r_vec,r_vec+ndof);  // {p} = {r}
+  for(unsigned int i=0;i<ndof;++i){ r0_vec[i] = r_vec[i]; } // {r2} = {r}
+  for(unsigned int i=0;i<ndof;++i){ p_vec[i] = r_vec[i]; } // {p} = {r}
   
   for(unsigned int iitr=1;iitr<max_niter;iitr++){
     // {Mp_vec} = [M^-1]*{p}
-    Mp_vec = p_vec;
-    ilu.Solve(Mp_vec.data());
+    for(unsigned int i=0;i<ndof;++i){ Mp_vec[i] = p_vec[i]; }
+    Instrument_Precond(ilu, Mp_vec);
     // calc (r,r0*)
-    const double r_r2 = DotX(r_vec,r0_vec.data(),ndof);
+    const double r_r2 = DotX(r_vec,r0_vec,ndof);
     // calc {AMp_vec} = [A]*{Mp_vec}
-    mat.MatVec(AMp_vec.data(),
-               1.0, Mp_vec.data(), 0.0);
+    Instrument_MatVec(mat, AMp_vec,
+               1.0, Mp_vec, 0.0);
     // calc alpha
-    const double alpha = r_r2 / Dot(AMp_vec,r0_vec);
+    const double alpha = r_r2 / DotX(AMp_vec,r0_vec,ndof);
     // calc s_vector
-    s_vec.assign(r_vec,r_vec+ndof);
-    AXPY(-alpha,AMp_vec,s_vec);
+    for(unsigned int i=0;i<ndof;++i){ s_vec[i] = r_vec[i]; }
+    AXPY((REAL)-alpha,AMp_vec,s_vec,ndof);
     // {Ms_vec} = [M^-1]*{s}
-    Ms_vec = s_vec;
-    ilu.Solve(Ms_vec.data());
+    for(unsigned int i=0;i<ndof;++i){ Ms_vec[i] = s_vec[i]; }
+    Instrument_Precond(ilu, Ms_vec);
     // calc {AMs_vec} = [A]*{Ms_vec}
-    mat.MatVec(AMs_vec.data(),
-               1.0,Ms_vec.data(),0.0);
+    Instrument_MatVec(mat, AMs_vec,
+               1.0,Ms_vec,0.0);
     double omega;
     {  // calc omega
-      const double denominator = Dot(AMs_vec,AMs_vec);
-      const double numerator = Dot(s_vec,AMs_vec);
+      const double denominator = DotX(AMs_vec,AMs_vec,ndof);
+      const double numerator = DotX(s_vec,AMs_vec,ndof);
       omega = numerator / denominator;
     }
-    AXPY(alpha,Mp_vec.data(),x_vec,ndof);
-    AXPY(omega,Ms_vec.data(),x_vec,ndof);
+    AXPY((REAL)alpha,Mp_vec,x_vec,ndof);
+    AXPY((REAL)omega,Ms_vec,x_vec,ndof);
     for(unsigned int i=0;i<ndof;++i){ r_vec[i] = s_vec[i]; } // update residual
-    AXPY(-omega,AMs_vec.data(),r_vec,ndof);
+    AXPY((REAL)-omega,AMs_vec,r_vec,ndof);
     {
       const double sq_norm_res = DotX(r_vec,r_vec,ndof);
       const double conv_ratio = sqrt(sq_norm_res * sq_inv_norm_res_ini);
-      aResHistry.push_back( conv_ratio );
-      if( conv_ratio < conv_ratio_tol ){ return aResHistry; }
+      ws.AddHistory( conv_ratio );
+      if( DFM2_INSTRUMENT_IS_STOP(iitr, conv_ratio) ){ return iitr; }
+      if( conv_ratio < conv_ratio_tol ){ return iitr; }
     }
     double beta;
     {  // calc beta
-      const double tmp1 = DotX(r_vec,r0_vec.data(),ndof);
+      const double tmp1 = DotX(r_vec,r0_vec,ndof);
       beta = tmp1 * alpha / (r_r2*omega);
     }
     // update p_vector
     for(unsigned int i=0;i<ndof;++i){ p_vec[i] *= beta; }
-    AXPY(1.0,r_vec,p_vec.data(),ndof);
-    AXPY(-beta*omega,AMp_vec,p_vec);
+    AXPY((REAL)1.0,r_vec,p_vec,ndof);
+    AXPY((REAL)(-beta*omega),AMp_vec,p_vec,ndof);
   }
   
-  return aResHistry;
+  return (max_niter>0) ? max_niter-1 : 0;
 }
 
+/**
+ * @brief solve a real-valued linear system using the BiCGStab method with preconditioner
+ * @param ndof number of the unknowns
+ * @return history of the convergence ratio
+ */
 template <typename REAL, typename MAT, typename PREC>
-std::vector<double> Solve_PBiCGStab_Complex
-(std::complex<REAL>* r_vec,
- std::complex<REAL>* x_vec,
+std::vector<double> Solve_PBiCGStab
+(REAL* r_vec,
+ REAL* x_vec,
+ unsigned int ndof,
+ double conv_ratio_tol,
+ unsigned int max_niter,
+ const MAT& mat,
+ const PREC& ilu)
+{
+  CKrylovWorkspace<REAL> ws;
+  ws.Initialize(ndof, 7, max_niter);
+  Solve_PBiCGStab(r_vec, x_vec, ndof,
+                  conv_ratio_tol, max_niter, mat, ilu, ws);
+  return ws.aHistory;
+}
+
+/**
+ * @brief solve a real-valued linear system using the BiCGStab method with preconditioner
+ * @details the number of the unknowns is taken from the block sparse matrix (e.g., CMatrixSparse)
+ */
+template <typename REAL, typename MAT, typename PREC>
+std::vector<double> Solve_PBiCGStab
+(REAL* r_vec,
+ REAL* x_vec,
  double conv_ratio_tol,
  unsigned int max_niter,
  const MAT& mat,
  const PREC& ilu)
 {
-  using COMPLEX = std::complex<REAL>;
-  
-  assert( !mat.valDia.empty() );
   assert( mat.nblk_col == mat.nblk_row );
   assert( mat.len_col == mat.len_row );
-  const unsigned int ndof = mat.nblk_col*mat.len_col;
-  std::vector<double> aResHistry;
+  return Solve_PBiCGStab(r_vec, x_vec, mat.nblk_col*mat.len_col,
+                         conv_ratio_tol, max_niter, mat, ilu);
+}
+
+/**
+ * @brief solve a complex-valued linear system using the BiCGStab method with preconditioner
+ * @param ws (in,out) work vectors and the history of the convergence ratio. No memory is allocated if ws has the size.
+ * @return number of the iterations
+ */
+template <typename REAL, typename MAT, typename PREC>
+unsigned int Solve_PBiCGStab_Complex
+(std::complex<REAL>* r_vec,
+ std::complex<REAL>* x_vec,
+ unsigned int ndof,
+ double conv_ratio_tol,
+ unsigned int max_niter,
+ const MAT& mat,
+ const PREC& ilu,
+ CKrylovWorkspace<std::complex<REAL>>& ws)
+{
+  using COMPLEX = std::complex<REAL>;
+  ws.Reserve(ndof,7);
+  ws.ClearHistory();
   
   for(unsigned int i=0;i<ndof;++i){ x_vec[i] = COMPLEX(0.0,0.0); }   // {u} = 0
   
   double sq_inv_norm_res_ini;
   {
-    const double sq_norm_res_ini = Dot(r_vec,r_vec,ndof).real();
+    const double sq_norm_res_ini = DotX(r_vec,r_vec,ndof).real();
     if( sq_norm_res_ini < 1.0e-60 ){
-      aResHistry.push_back( sqrt( sq_norm_res_ini ) );
-      return aResHistry;
+      ws.AddHistory( sqrt( sq_norm_res_ini ) );
+      return 0;
     }
     sq_inv_norm_res_ini = 1.0 / sq_norm_res_ini;
   }
   
-  std::vector<COMPLEX> s_vec(ndof);
-  std::vector<COMPLEX> Ms_vec(ndof);
-  std::vector<COMPLEX> AMs_vec(ndof);
-  std::vector<COMPLEX> Mp_vec(ndof);
-  std::vector<COMPLEX> AMp_vec(ndof);
+  COMPLEX* s_vec = ws.Vec(0);
+  COMPLEX* Ms_vec = ws.Vec(1);
+  COMPLEX* AMs_vec = ws.Vec(2);
+  COMPLEX* Mp_vec = ws.Vec(3);
+  COMPLEX* AMp_vec = ws.Vec(4);
+  COMPLEX* r0_vec = ws.Vec(5);
+  COMPLEX* p_vec = ws.Vec(6);
   
-  const std::vector<COMPLEX> r0_vec(r_vec,r_vec+ndof);   // {r2} = {r}
-  std::vector<COMPLEX> p_vec(r_vec,r_vec+ndof);  // {p} = {r}
+  for(unsigned int i=0;i<ndof;++i){ r0_vec[i] = r_vec[i]; } // {r2} = {r}
+  for(unsigned int i=0;i<ndof;++i){ p_vec[i] = r_vec[i]; } // {p} = {r}
   
   // calc (r,r0*)
-  COMPLEX r_r0 = Dot(r_vec,r0_vec.data(),ndof);
+  COMPLEX r_r0 = DotX(r_vec,r0_vec,ndof);
   
   for(unsigned int itr=0;itr<max_niter;itr++){
     // {Mp_vec} = [M^-1]*{p}
-    Mp_vec.assign(p_vec.begin(),p_vec.end());
-    ilu.Solve(Mp_vec);
+    for(unsigned int i=0;i<ndof;++i){ Mp_vec[i] = p_vec[i]; }
+    Instrument_Precond(ilu, Mp_vec);
     // calc {AMp_vec} = [A]*{Mp_vec}
-    mat.MatVec(AMp_vec.data(),
-               COMPLEX(1,0), Mp_vec.data(), COMPLEX(0,0));
+    Instrument_MatVec(mat, AMp_vec,
+               COMPLEX(1,0), Mp_vec, COMPLEX(0,0));
     // calc alpha
-    const COMPLEX alpha = r_r0 / Dot(AMp_vec,r0_vec);
+    const COMPLEX alpha = r_r0 / DotX(AMp_vec,r0_vec,ndof);
     // calc s_vector
-    s_vec.assign(r_vec,r_vec+ndof);
-    AXPY(-alpha,AMp_vec,s_vec);
+    for(unsigned int i=0;i<ndof;++i){ s_vec[i] = r_vec[i]-alpha*AMp_vec[i]; }
     // {Ms_vec} = [M^-1]*{s}
-    Ms_vec.assign(s_vec.begin(),s_vec.end());
-    ilu.Solve(Ms_vec);
+    for(unsigned int i=0;i<ndof;++i){ Ms_vec[i] = s_vec[i]; }
+    Instrument_Precond(ilu, Ms_vec);
     // calc {AMs_vec} = [A]*{Ms_vec}
-    mat.MatVec(AMs_vec.data(),
-               COMPLEX(1,0),Ms_vec.data(), COMPLEX(0,0));
-    const COMPLEX omega = Dot(s_vec,AMs_vec) / Dot(AMs_vec,AMs_vec).real();
+    Instrument_MatVec(mat, AMs_vec,
+               COMPLEX(1,0),Ms_vec, COMPLEX(0,0));
+    const COMPLEX omega = DotX(s_vec,AMs_vec,ndof) / DotX(AMs_vec,AMs_vec,ndof).real();
     for(unsigned int i=0;i<ndof;++i){ x_vec[i] = x_vec[i]+alpha*Mp_vec[i]+omega*Ms_vec[i]; }
     for(unsigned int i=0;i<ndof;++i){ r_vec[i] = s_vec[i]-omega*AMs_vec[i]; }
     {
-      const double sq_norm_res = Dot(r_vec,r_vec,ndof).real();
+      const double sq_norm_res = DotX(r_vec,r_vec,ndof).real();
       const double conv_ratio = sqrt(sq_norm_res * sq_inv_norm_res_ini);
-      aResHistry.push_back( conv_ratio );
-      if( conv_ratio < conv_ratio_tol ){ return aResHistry; }
+      ws.AddHistory( conv_ratio );
+      if( DFM2_INSTRUMENT_IS_STOP(itr+1, conv_ratio) ){ return itr+1; }
+      if( conv_ratio < conv_ratio_tol ){ return itr+1; }
     }
     COMPLEX beta;
     {  // calc beta
-      const COMPLEX tmp1 = Dot(r_vec,r0_vec.data(),ndof);
+      const COMPLEX tmp1 = DotX(r_vec,r0_vec,ndof);
       beta = (tmp1*alpha)/(r_r0*omega);
       r_r0 = tmp1;
     }
@@ -523,66 +757,93 @@ std::vector<double> Solve_PBiCGStab_Complex
     for(unsigned int i=0;i<ndof;++i){ p_vec[i] = r_vec[i]+beta*(p_vec[i]-omega*AMp_vec[i]); }
   }
   
-  return aResHistry;
+  return max_niter;
 }
 
+template <typename REAL, typename MAT, typename PREC>
+std::vector<double> Solve_PBiCGStab_Complex
+(std::complex<REAL>* r_vec,
+ std::complex<REAL>* x_vec,
+ double conv_ratio_tol,
+ unsigned int max_niter,
+ const MAT& mat,
+ const PREC& ilu)
+{
+  assert( !mat.valDia.empty() );
+  assert( mat.nblk_col == mat.nblk_row );
+  assert( mat.len_col == mat.len_row );
+  const unsigned int ndof = mat.nblk_col*mat.len_col;
+  CKrylovWorkspace<std::complex<REAL>> ws;
+  ws.Initialize(ndof, 7, max_niter);
+  Solve_PBiCGStab_Complex(r_vec, x_vec, ndof,
+                          conv_ratio_tol, max_niter, mat, ilu, ws);
+  return ws.aHistory;
+}
 
 /**
  * @brief solve a real-valued linear system using the conjugate gradient method with preconditioner
+ * @details the work vectors have the type REAL, so MAT and PREC need to handle REAL (e.g., float or double)
+ * @param ws (in,out) work vectors and the history of the residual norm. No memory is allocated if ws has the size.
+ * @return number of the iterations
  */
 template <typename REAL, typename MAT, typename PREC>
-std::vector<double> Solve_PCG(
+unsigned int Solve_PCG(
     REAL *r_vec,
     REAL *x_vec,
     unsigned int N,
     double conv_ratio_tol,
     unsigned int max_nitr,
     const MAT &mat,
-    const PREC &ilu)
+    const PREC &ilu,
+    CKrylovWorkspace<REAL>& ws)
 {
-  std::vector<double> aResHistry;
+  ws.Reserve(N,2);
+  ws.ClearHistory();
   
   for (unsigned int i = 0; i < N; i++) { x_vec[i] = 0; }    // {x} = 0
   
   double inv_sqnorm_res0;
   {
     const double sqnorm_res0 = DotX(r_vec, r_vec, N);
-    aResHistry.push_back(sqrt(sqnorm_res0));
-    if (sqnorm_res0 < 1.0e-30) { return aResHistry; }
+    ws.AddHistory(sqrt(sqnorm_res0));
+    if (sqnorm_res0 < 1.0e-30) { return 0; }
     inv_sqnorm_res0 = 1.0 / sqnorm_res0;
   }
   
+  REAL* Pr_vec = ws.Vec(0);
+  REAL* p_vec = ws.Vec(1);
   // {Pr} = [P]{r}
-  std::vector<double> Pr_vec(r_vec, r_vec + N);
-  ilu.Solve(Pr_vec.data());
+  for (unsigned int i = 0; i < N; i++) { Pr_vec[i] = r_vec[i]; }
+  Instrument_Precond(ilu, Pr_vec);
   // {p} = {Pr}
-  std::vector<double> p_vec = Pr_vec;
+  for (unsigned int i = 0; i < N; i++) { p_vec[i] = Pr_vec[i]; }
   // rPr = ({r},{Pr})
-  double rPr = DotX(r_vec, Pr_vec.data(), N);
+  double rPr = DotX(r_vec, Pr_vec, N);
   for (unsigned int iitr = 0; iitr < max_nitr; iitr++) {
     {
-      std::vector<double> &Ap_vec = Pr_vec;
+      REAL* Ap_vec = Pr_vec;
       // {Ap} = [A]{p}
-      mat.MatVec(Ap_vec.data(),
-                 1.0, p_vec.data(), 0.0);
+      Instrument_MatVec(mat, Ap_vec,
+                 1.0, p_vec, 0.0);
       // alpha = ({r},{Pr})/({p},{Ap})
-      const double pAp = Dot(p_vec, Ap_vec);
+      const double pAp = DotX(p_vec, Ap_vec, N);
       double alpha = rPr / pAp;
-      AXPY(-alpha, Ap_vec.data(), r_vec, N);       // {r} = -alpha*{Ap} + {r}
-      AXPY(+alpha, p_vec.data(), x_vec, N);       // {x} = +alpha*{p } + {x}
+      AXPY((REAL)-alpha, Ap_vec, r_vec, N);       // {r} = -alpha*{Ap} + {r}
+      AXPY((REAL)+alpha, p_vec, x_vec, N);       // {x} = +alpha*{p } + {x}
     }
     {  // Converge Judgement
       const double sqnorm_res = DotX(r_vec, r_vec, N);
-      aResHistry.push_back(sqrt(sqnorm_res));
+      ws.AddHistory(sqrt(sqnorm_res));
       const double conv_ratio = sqrt(sqnorm_res * inv_sqnorm_res0);
-      if (conv_ratio < conv_ratio_tol) { return aResHistry; }
+      if (DFM2_INSTRUMENT_IS_STOP(iitr+1, conv_ratio)) { return iitr+1; }
+      if (conv_ratio < conv_ratio_tol) { return iitr+1; }
     }
     {  // calc beta
        // {Pr} = [P]{r}
       for (unsigned int i = 0; i < N; i++) { Pr_vec[i] = r_vec[i]; }
-      ilu.Solve(Pr_vec.data());
+      Instrument_Precond(ilu, Pr_vec);
       // rPr1 = ({r},{Pr})
-      const double rPr1 = DotX(r_vec, Pr_vec.data(), N);
+      const double rPr1 = DotX(r_vec, Pr_vec, N);
       // beta = rPr1/rPr
       double beta = rPr1 / rPr;
       rPr = rPr1;
@@ -593,67 +854,563 @@ std::vector<double> Solve_PCG(
   {
     // Converge Judgement
     double sq_norm_res = DotX(r_vec, r_vec, N);
-    aResHistry.push_back(sqrt(sq_norm_res));
+    ws.AddHistory(sqrt(sq_norm_res));
+  }
+  return max_nitr;
+}
+
+/**
+ * @brief solve a real-valued linear system using the conjugate gradient method with preconditioner
+ * @details the work vectors have the type REAL, so MAT and PREC need to handle REAL (e.g., float or double)
+ * @return history of the residual norm starting from the initial one
+ */
+template <typename REAL, typename MAT, typename PREC>
+std::vector<double> Solve_PCG(
+    REAL *r_vec,
+    REAL *x_vec,
+    unsigned int N,
+    double conv_ratio_tol,
+    unsigned int max_nitr,
+    const MAT &mat,
+    const PREC &ilu)
+{
+  CKrylovWorkspace<REAL> ws;
+  ws.Initialize(N, 2, max_nitr);
+  Solve_PCG(r_vec, x_vec, N,
+            conv_ratio_tol, max_nitr, mat, ilu, ws);
+  return ws.aHistory;
+}
+
+/**
+ * @class subspace recycled over the solves of the slowly varying linear systems (e.g., over the time steps)
+ * @details The subspace {W} approximates the eigenvectors of [A] for the smallest eigenvalues. Solve_PCG_Deflated()
+ * removes the components in {W} from the search space, and updates {W} after each solve from the Ritz vectors
+ * in the span of {W} and the first search directions of the solve.
+ * The work vectors of the solver are also stored here.
+ */
+class CKrylovDeflation
+{
+public:
+  CKrylovDeflation() : m_ndof(0), m_nvec_max(0), m_nharvest(0), m_nvec(0), m_nhvst(0) {}
+  /**
+   * @param nvec_max number of the vectors of the recycled subspace. 0 disables the recycling (warm start only).
+   * @param nharvest number of the search directions of each solve used to update the subspace
+   */
+  void Initialize(unsigned int ndof, unsigned int nvec_max, unsigned int nharvest){
+    m_ndof = ndof;
+    m_nvec_max = nvec_max;
+    m_nharvest = (nvec_max==0) ? 0 : nharvest;
+    m_nvec = 0;
+    m_nhvst = 0;
+    aW.resize((nvec_max+m_nharvest)*ndof);
+    aAW.resize((nvec_max+m_nharvest)*ndof);
+    aWork.resize(3*ndof);
+    aCoeff.resize(nvec_max);
+    aTmp.resize(nvec_max*ndof);
+  }
+  /**
+   * @brief discard the subspace (e.g., when the mesh is changed)
+   */
+  void Clear(){ m_nvec = 0; m_nhvst = 0; }
+  /**
+   * @brief number of the vectors in the current subspace
+   */
+  unsigned int NumVec() const { return m_nvec; }
+  /**
+   * @brief compute [A]{W} and the Cholesky factor of [W]^T[A][W] for the matrix of this solve
+   */
+  template <typename MAT>
+  void SetMatrix(const MAT& mat){
+    for(unsigned int ivec=0;ivec<m_nvec;++ivec){
+      Instrument_MatVec(mat, aAW.data()+ivec*m_ndof, 1.0, aW.data()+ivec*m_ndof, 0.0);
+    }
+    this->FactorizeWAW();
+  }
+  /**
+   * @brief {c} = ([W]^T[A][W])^-1 [B]^T{v} where B is {W} (is_aw=false) or [A]{W} (is_aw=true)
+   */
+  void CoeffProjection(double* c, const double* v, bool is_aw) const;
+  /**
+   * @brief {v} += alpha*[B]{c} where B is {W} (is_aw=false) or [A]{W} (is_aw=true)
+   */
+  void AddSubspace(double* v, double alpha, const double* c, bool is_aw) const;
+  /**
+   * @brief store the search direction {p} and [A]{p} of the current solve until nharvest of them are stored
+   */
+  void Harvest(const double* p, const double* ap);
+  /**
+   * @brief update the subspace with the Ritz vectors of [A] in the span of {W} and the harvested directions
+   */
+  void UpdateSubspace();
+private:
+  void FactorizeWAW();
+public:
+  std::vector<double> aHistory;
+  std::vector<double> aWork; // work vectors of the solver
+  std::vector<double> aCoeff; // coefficients of the subspace used in the solver
+private:
+  unsigned int m_ndof, m_nvec_max, m_nharvest;
+  unsigned int m_nvec, m_nhvst;
+  std::vector<double> aW, aAW; // the subspace followed by the harvested directions
+  std::vector<double> aL; // Cholesky factor of [W]^T[A][W]
+  std::vector<double> aTmp;
+};
+
+/**
+ * @brief solve a symmetric positive definite linear system with the deflated PCG warm-started from {x}
+ * @details The iteration starts from the input {x} (e.g., the solution of the previous time step), and
+ * the convergence is judged by the ratio to the norm of the right hand side, so a good initial guess reduces the
+ * iterations. The component in the subspace of defl is solved directly before the iteration and is removed
+ * from the search directions (Saad et al. 2000, "A deflated version of the conjugate gradient algorithm").
+ * After the solve, the subspace is updated for the next solve.
+ * Call defl.Initialize() once before the first solve. defl.aHistory stores the history of the residual norm.
+ * @param r_vec (in/out) the right hand side as input and the residual as output
+ * @param x_vec (in/out) the initial guess as input and the solution as output
+ * @return number of the iterations
+ */
+template <typename MAT, typename PREC>
+unsigned int Solve_PCG_Deflated(
+    double *r_vec,
+    double *x_vec,
+    unsigned int N,
+    double conv_ratio_tol,
+    unsigned int max_nitr,
+    const MAT &mat,
+    const PREC &ilu,
+    CKrylovDeflation& defl)
+{
+  assert( defl.aWork.size() == 3*N );
+  defl.aHistory.clear();
+  double* aC = defl.aCoeff.data();
+  double inv_sqnorm_b;
+  {
+    const double sqnorm_b = DotX(r_vec, r_vec, N);
+    if (sqnorm_b < 1.0e-30) {
+      for (unsigned int i = 0; i < N; i++) { x_vec[i] = 0; }
+      defl.aHistory.push_back(sqrt(sqnorm_b));
+      return 0;
+    }
+    inv_sqnorm_b = 1.0 / sqnorm_b;
+  }
+  Instrument_MatVec(mat, r_vec,
+             -1.0, x_vec, 1.0);  // {r} = {b} - [A]{x}
+  defl.SetMatrix(mat);
+  const unsigned int nvec = defl.NumVec();
+  if (nvec > 0) {  // {x} += [W]([W]^T[A][W])^-1[W]^T{r}, {r} -= [A][W]([W]^T[A][W])^-1[W]^T{r}
+    defl.CoeffProjection(aC, r_vec, false);
+    defl.AddSubspace(x_vec, +1.0, aC, false);
+    defl.AddSubspace(r_vec, -1.0, aC, true);
+  }
+  {
+    const double sqnorm_res = DotX(r_vec, r_vec, N);
+    defl.aHistory.push_back(sqrt(sqnorm_res));
+    if (sqrt(sqnorm_res * inv_sqnorm_b) < conv_ratio_tol) { return 0; }
+  }
+  double* Pr_vec = defl.aWork.data();
+  double* p_vec = defl.aWork.data() + N;
+  double* Ap_vec = defl.aWork.data() + 2 * N;
+  // {Pr} = [P]{r}
+  for (unsigned int i = 0; i < N; i++) { Pr_vec[i] = r_vec[i]; }
+  Instrument_Precond(ilu, Pr_vec);
+  // {p} = {Pr} - [W]([W]^T[A][W])^-1([A][W])^T{Pr}
+  for (unsigned int i = 0; i < N; i++) { p_vec[i] = Pr_vec[i]; }
+  if (nvec > 0) {
+    defl.CoeffProjection(aC, Pr_vec, true);
+    defl.AddSubspace(p_vec, -1.0, aC, false);
+  }
+  double rPr = DotX(r_vec, Pr_vec, N);
+  unsigned int nitr = max_nitr;
+  for (unsigned int iitr = 0; iitr < max_nitr; iitr++) {
+    // {Ap} = [A]{p}
+    Instrument_MatVec(mat, Ap_vec,
+               1.0, p_vec, 0.0);
+    defl.Harvest(p_vec, Ap_vec);
+    {
+      // alpha = ({r},{Pr})/({p},{Ap})
+      const double pAp = DotX(p_vec, Ap_vec, N);
+      const double alpha = rPr / pAp;
+      AXPY(-alpha, Ap_vec, r_vec, N);       // {r} = -alpha*{Ap} + {r}
+      AXPY(+alpha, p_vec, x_vec, N);        // {x} = +alpha*{p } + {x}
+    }
+    {  // Converge Judgement
+      const double sqnorm_res = DotX(r_vec, r_vec, N);
+      defl.aHistory.push_back(sqrt(sqnorm_res));
+      if (DFM2_INSTRUMENT_IS_STOP(iitr+1, sqrt(sqnorm_res * inv_sqnorm_b))) { nitr = iitr + 1; break; }
+      if (sqrt(sqnorm_res * inv_sqnorm_b) < conv_ratio_tol) { nitr = iitr + 1; break; }
+    }
+    {  // calc beta
+      for (unsigned int i = 0; i < N; i++) { Pr_vec[i] = r_vec[i]; }
+      Instrument_Precond(ilu, Pr_vec);
+      const double rPr1 = DotX(r_vec, Pr_vec, N);
+      const double beta = rPr1 / rPr;
+      rPr = rPr1;
+      // {p} = {Pr} + beta*{p} - [W]([W]^T[A][W])^-1([A][W])^T{Pr}
+      for (unsigned int i = 0; i < N; i++) { p_vec[i] = Pr_vec[i] + beta * p_vec[i]; }
+      if (nvec > 0) {
+        defl.CoeffProjection(aC, Pr_vec, true);
+        defl.AddSubspace(p_vec, -1.0, aC, false);
+      }
+    }
+  }
+  defl.UpdateSubspace();
+  return nitr;
+}
+
+/**
+ * @brief preconditioner applied in the lower precision REAL_LOW (e.g., CPreconditionerILU<float>) to a vector in double
+ * @details use this to keep the factors of the preconditioner in float inside the double-precision Solve_PCG().
+ * The memory traffic of the preconditioner is halved, while the convergence is almost the same as double.
+ * The work vector is stored in this class, so do not call Solve() concurrently for the same instance.
+ */
+template <typename REAL_LOW, typename PREC_LOW>
+class CPreconditionerLowPrecision
+{
+public:
+  CPreconditionerLowPrecision(const PREC_LOW& prec, unsigned int N) : prec(prec), aTmp(N) {}
+  void Solve(double* vec) const {
+    const unsigned int N = aTmp.size();
+    for(unsigned int i=0;i<N;++i){ aTmp[i] = (REAL_LOW)vec[i]; }
+    prec.Solve(aTmp.data());
+    for(unsigned int i=0;i<N;++i){ vec[i] = aTmp[i]; }
+  }
+private:
+  const PREC_LOW& prec;
+  mutable std::vector<REAL_LOW> aTmp;
+};
+
+/**
+ * @brief solve a real-valued linear system with the mixed-precision PCG (iterative refinement)
+ * @details the correction {d} of [A]{d}={r} is solved roughly by the PCG in REAL_LOW with mat_low and prec_low.
+ * The solution and the residual {r}={b}-[A]{x} are updated in double with mat, so the result has the accuracy of double.
+ * @tparam REAL_LOW value type of mat_low and prec_low (e.g., float)
+ * @param r_vec (in/out) the right hand side as input and the residual as output
+ * @param max_nitr maximum number of the PCG iterations in total
+ * @param mat (in) matrix in double (e.g., CMatrixSparse<double>)
+ * @param mat_low (in) matrix in REAL_LOW (e.g., CMatrixSparse<float> set by CMatrixSparse::SetCopy())
+ * @param prec_low (in) preconditioner in REAL_LOW (e.g., CPreconditionerILU<float>)
+ * @param conv_ratio_inner convergence ratio of each PCG in REAL_LOW
+ * @return the norm of the residual for the initial and after each refinement
+ */
+template <typename REAL_LOW, typename MAT, typename MAT_LOW, typename PREC_LOW>
+std::vector<double> Solve_PCG_MixedPrecision(
+    double *r_vec,
+    double *x_vec,
+    unsigned int N,
+    double conv_ratio_tol,
+    unsigned int max_nitr,
+    const MAT &mat,
+    const MAT_LOW &mat_low,
+    const PREC_LOW &prec_low,
+    double conv_ratio_inner = 1.0e-3)
+{
+  std::vector<double> aResHistry;
+  for (unsigned int i = 0; i < N; i++) { x_vec[i] = 0; }    // {x} = 0
+  const double norm_res0 = sqrt(DotX(r_vec, r_vec, N));
+  aResHistry.push_back(norm_res0);
+  if (norm_res0 < 1.0e-15) { return aResHistry; }
+  std::vector<REAL_LOW> r_low(N), d_low(N);
+  std::vector<double> d_vec(N);
+  double norm_res = norm_res0;
+  unsigned int nitr = 0;
+  while( nitr < max_nitr ){
+    // the residual is normalized to avoid the underflow in the low precision
+    for (unsigned int i = 0; i < N; i++) { r_low[i] = (REAL_LOW)(r_vec[i] / norm_res); }
+    const std::vector<double> aHist = Solve_PCG(r_low.data(), d_low.data(), N,
+                                                conv_ratio_inner, max_nitr - nitr,
+                                                mat_low, prec_low);
+    nitr += (aHist.size() > 2) ? (unsigned int)aHist.size() - 1 : 1;
+    for (unsigned int i = 0; i < N; i++) { d_vec[i] = d_low[i] * norm_res; }
+    AXPY(1.0, d_vec.data(), x_vec, N);     // {x} = {d} + {x}
+    Instrument_MatVec(mat, r_vec,
+               -1.0, d_vec.data(), 1.0);     // {r} = -[A]{d} + {r}
+    norm_res = sqrt(DotX(r_vec, r_vec, N));
+    aResHistry.push_back(norm_res);
+    if (norm_res < conv_ratio_tol * norm_res0) { return aResHistry; }
   }
   return aResHistry;
 }
 
+/**
+ * @brief solve a real-valued linear system using the pipelined conjugate gradient method with preconditioner
+ * @details The recurrence of Chronopoulos and Gear: the inner products of the iteration are computed
+ * together in one pass after the preconditioner and the matrix-vector product, and all the vectors are updated
+ * in another single pass. This reduces the memory traffic of the vectors per iteration compared with Solve_PCG().
+ * The arguments and the returned residual history are the same as Solve_PCG().
+ * In the exact arithmetic, the iterates are the same as Solve_PCG().
+ */
+template <typename REAL, typename MAT, typename PREC>
+std::vector<double> Solve_PCG_Pipelined(
+    REAL *r_vec,
+    REAL *x_vec,
+    unsigned int N,
+    double conv_ratio_tol,
+    unsigned int max_nitr,
+    const MAT &mat,
+    const PREC &ilu)
+{
+  std::vector<double> aResHistry;
+  
+  for (unsigned int i = 0; i < N; i++) { x_vec[i] = 0; }    // {x} = 0
+  
+  double inv_sqnorm_res0;
+  {
+    const double sqnorm_res0 = DotX(r_vec, r_vec, N);
+    aResHistry.push_back(sqrt(sqnorm_res0));
+    if (sqnorm_res0 < 1.0e-30) { return aResHistry; }
+    inv_sqnorm_res0 = 1.0 / sqnorm_res0;
+  }
+  
+  std::vector<REAL> u_vec(r_vec, r_vec + N);   // {u} = [P]{r}
+  std::vector<REAL> w_vec(N);                  // {w} = [A]{u}
+  std::vector<REAL> p_vec(N, 0), s_vec(N, 0);  // {s} = [A]{p}
+  Instrument_Precond(ilu, u_vec.data());
+  Instrument_MatVec(mat, w_vec.data(),
+             1.0, u_vec.data(), 0.0);
+  REAL gamma, delta, sqnorm_res;   // gamma = ({r},{u}), delta = ({w},{u})
+  DotX3(gamma, delta, sqnorm_res,
+        r_vec, u_vec.data(), w_vec.data(), N);
+  double gamma0 = 1, alpha0 = 1;
+  for (unsigned int iitr = 0; iitr < max_nitr; iitr++) {
+    double alpha, beta;
+    if( iitr == 0 ){
+      beta = 0;
+      alpha = gamma / delta;
+    }
+    else{
+      beta = gamma / gamma0;
+      alpha = gamma / (delta - beta * gamma / alpha0);
+    }
+    UpdateX_PipelinedCG(x_vec, r_vec,
+                        p_vec.data(), s_vec.data(), u_vec.data(), w_vec.data(),
+                        (REAL)alpha, (REAL)beta, N);
+    Instrument_Precond(ilu, u_vec.data());
+    Instrument_MatVec(mat, w_vec.data(),
+               1.0, u_vec.data(), 0.0);
+    gamma0 = gamma;
+    alpha0 = alpha;
+    DotX3(gamma, delta, sqnorm_res,
+          r_vec, u_vec.data(), w_vec.data(), N);
+    {  // Converge Judgement
+      aResHistry.push_back(sqrt(sqnorm_res));
+      const double conv_ratio = sqrt(sqnorm_res * inv_sqnorm_res0);
+      if (DFM2_INSTRUMENT_IS_STOP(iitr+1, conv_ratio)) { return aResHistry; }
+      if (conv_ratio < conv_ratio_tol) { return aResHistry; }
+    }
+  }
+  aResHistry.push_back(sqrt(sqnorm_res));
+  return aResHistry;
+}
 
+/**
+ * @brief solve the linear systems with the same matrix for nrhs right hand sides at once with the PCG method
+ * @details The vectors are interleaved as r_vec[idof*nrhs+irhs]. The matrix and the preconditioner are applied
+ * to all the vectors in one pass per iteration, so they are read once per iteration instead of nrhs times.
+ * MAT needs "void MatVecMulti(REAL* Y, REAL alpha, const REAL* X, REAL beta, unsigned int nvec) const;" and
+ * PREC needs "void SolveMulti(REAL* vec, unsigned int nvec) const;" (e.g., CMatrixSparse and CPreconditionerILU).
+ * Each system has its own step sizes, so the iterates of each system are the same as Solve_PCG().
+ * The active systems are stored interleaved in the work vectors. When a system converges, its solution and residual
+ * are written back and it is removed from the work vectors, so the later iterations apply the matrix and the
+ * preconditioner only to the systems that are not converged.
+ * @param r_vec (in/out) the right hand sides as input and the residuals as output (size: N*nrhs)
+ * @param x_vec (out) the solutions (size: N*nrhs)
+ * @param N number of the unknowns of each system
+ * @return history of the residual norm for each right hand side (same as Solve_PCG())
+ */
 template <typename REAL, typename MAT, typename PREC>
-std::vector<double> Solve_PCG_Complex
+std::vector< std::vector<double> > Solve_PCG_Multi(
+    REAL *r_vec,
+    REAL *x_vec,
+    unsigned int N,
+    unsigned int nrhs,
+    double conv_ratio_tol,
+    unsigned int max_nitr,
+    const MAT &mat,
+    const PREC &ilu)
+{
+  std::vector< std::vector<double> > aHistory(nrhs);
+  for (unsigned int i = 0; i < N*nrhs; i++) { x_vec[i] = 0; }    // {x} = 0
+  
+  std::vector<REAL> aDot(nrhs);
+  std::vector<double> inv_sqnorm_res0(nrhs);
+  std::vector<unsigned int> aMap; // index of the active systems
+  DotX_Multi(aDot.data(), r_vec, r_vec, N, nrhs);
+  for (unsigned int irhs = 0; irhs < nrhs; irhs++) {
+    aHistory[irhs].push_back(sqrt(aDot[irhs]));
+    if (aDot[irhs] < 1.0e-30) { continue; }
+    inv_sqnorm_res0[irhs] = 1.0 / aDot[irhs];
+    aMap.push_back(irhs);
+  }
+  unsigned int nact = aMap.size();
+  if (nact == 0) { return aHistory; }
+  
+  // {r} and {x} of the active systems interleaved as r_act[idof*nact+iact]
+  std::vector<REAL> r_act(N*nact), x_act(N*nact, 0);
+  for (unsigned int i = 0; i < N; i++) {
+    for (unsigned int iact = 0; iact < nact; iact++) { r_act[i*nact+iact] = r_vec[i*nrhs+aMap[iact]]; }
+  }
+  std::vector<REAL> Pr_vec = r_act;
+  ilu.SolveMulti(Pr_vec.data(), nact);  // {Pr} = [P]{r}
+  std::vector<REAL> p_vec = Pr_vec;     // {p} = {Pr}
+  std::vector<double> rPr(nact);
+  DotX_Multi(aDot.data(), r_act.data(), Pr_vec.data(), N, nact);
+  for (unsigned int iact = 0; iact < nact; iact++) { rPr[iact] = aDot[iact]; }  // rPr = ({r},{Pr})
+  std::vector<REAL> aAlpha(nrhs), aBeta(nrhs);
+  std::vector<int> aIsConv(nrhs);
+  auto WriteBack_Active = [&]() {  // the solutions and the residuals of the systems not converged
+    for (unsigned int i = 0; i < N; i++) {
+      for (unsigned int iact = 0; iact < nact; iact++) {
+        r_vec[i*nrhs+aMap[iact]] = r_act[i*nact+iact];
+        x_vec[i*nrhs+aMap[iact]] = x_act[i*nact+iact];
+      }
+    }
+  };
+  for (unsigned int iitr = 0; iitr < max_nitr; iitr++) {
+    {
+      REAL* Ap_vec = Pr_vec.data();
+      // {Ap} = [A]{p}
+      mat.MatVecMulti(Ap_vec,
+                      1.0, p_vec.data(), 0.0, nact);
+      // alpha = ({r},{Pr})/({p},{Ap})
+      DotX_Multi(aDot.data(), p_vec.data(), Ap_vec, N, nact);
+      for (unsigned int iact = 0; iact < nact; iact++) { aAlpha[iact] = (REAL)(rPr[iact] / aDot[iact]); }
+      for (unsigned int i = 0; i < N; i++) {
+        for (unsigned int iact = 0; iact < nact; iact++) {
+          r_act[i*nact+iact] -= aAlpha[iact] * Ap_vec[i*nact+iact];  // {r} = -alpha*{Ap} + {r}
+          x_act[i*nact+iact] += aAlpha[iact] * p_vec[i*nact+iact];   // {x} = +alpha*{p } + {x}
+        }
+      }
+    }
+    {  // Converge Judgement. the converged systems are written back and removed from the work vectors
+      DotX_Multi(aDot.data(), r_act.data(), r_act.data(), N, nact);
+      unsigned int nact1 = 0;
+      double conv_ratio_max = 0.0;
+      for (unsigned int iact = 0; iact < nact; iact++) {
+        const unsigned int irhs = aMap[iact];
+        aHistory[irhs].push_back(sqrt(aDot[iact]));
+        const double conv_ratio = sqrt(aDot[iact] * inv_sqnorm_res0[irhs]);
+        if (conv_ratio > conv_ratio_max) { conv_ratio_max = conv_ratio; }
+        aIsConv[iact] = (conv_ratio < conv_ratio_tol) ? 1 : 0;
+        if (!aIsConv[iact]) { nact1++; }
+      }
+      if (nact1 < nact) {
+        for (unsigned int i = 0; i < N; i++) {
+          unsigned int jact = 0;
+          for (unsigned int iact = 0; iact < nact; iact++) {
+            if (aIsConv[iact]) {
+              r_vec[i*nrhs+aMap[iact]] = r_act[i*nact+iact];
+              x_vec[i*nrhs+aMap[iact]] = x_act[i*nact+iact];
+              continue;
+            }
+            // in place because i*nact1+jact <= i*nact+iact
+            r_act[i*nact1+jact] = r_act[i*nact+iact];
+            x_act[i*nact1+jact] = x_act[i*nact+iact];
+            p_vec[i*nact1+jact] = p_vec[i*nact+iact];
+            jact++;
+          }
+        }
+        unsigned int jact = 0;
+        for (unsigned int iact = 0; iact < nact; iact++) {
+          if (aIsConv[iact]) { continue; }
+          aMap[jact] = aMap[iact];
+          rPr[jact] = rPr[iact];
+          jact++;
+        }
+        nact = nact1;
+      }
+      if (nact == 0) { return aHistory; }
+      if (DFM2_INSTRUMENT_IS_STOP(iitr+1, conv_ratio_max)) { WriteBack_Active(); return aHistory; }
+    }
+    {  // calc beta
+      // {Pr} = [P]{r}
+      for (unsigned int i = 0; i < N*nact; i++) { Pr_vec[i] = r_act[i]; }
+      ilu.SolveMulti(Pr_vec.data(), nact);
+      // rPr1 = ({r},{Pr})
+      DotX_Multi(aDot.data(), r_act.data(), Pr_vec.data(), N, nact);
+      for (unsigned int iact = 0; iact < nact; iact++) {
+        aBeta[iact] = (REAL)(aDot[iact] / rPr[iact]);  // beta = rPr1/rPr
+        rPr[iact] = aDot[iact];
+      }
+      // {p} = {Pr} + beta*{p}
+      for (unsigned int i = 0; i < N; i++) {
+        for (unsigned int iact = 0; iact < nact; iact++) {
+          p_vec[i*nact+iact] = Pr_vec[i*nact+iact] + aBeta[iact] * p_vec[i*nact+iact];
+        }
+      }
+    }
+  }
+  {
+    // Converge Judgement
+    DotX_Multi(aDot.data(), r_act.data(), r_act.data(), N, nact);
+    for (unsigned int iact = 0; iact < nact; iact++) { aHistory[aMap[iact]].push_back(sqrt(aDot[iact])); }
+  }
+  WriteBack_Active();
+  return aHistory;
+}
+
+/**
+ * @brief solve a hermitian linear system using the conjugate gradient method with preconditioner
+ * @param ws (in,out) work vectors and the history of the convergence. No memory is allocated if ws has the size.
+ * @return number of the iterations
+ */
+template <typename REAL, typename MAT, typename PREC>
+unsigned int Solve_PCG_Complex
 (std::complex<REAL> *r_vec,
  std::complex<REAL> *x_vec,
+ unsigned int ndof,
  double conv_ratio_tol,
  unsigned int max_nitr,
  const MAT &mat,
- const PREC &ilu)
+ const PREC &ilu,
+ CKrylovWorkspace<std::complex<REAL>>& ws)
 {
   using COMPLEX = std::complex<REAL>;
-
-  const unsigned int ndof = mat.nblk_col * mat.len_col;
-  std::vector<double> aResHistry;
+  ws.Reserve(ndof,2);
+  ws.ClearHistory();
   
   for (unsigned int i = 0; i < ndof; i++) { x_vec[i] = COMPLEX(0.0, 0.0); }    // {x} = 0
   
   double inv_sqnorm_res0;
   {
-    const double sqnorm_res0 = Dot(r_vec, r_vec, ndof).real();
-    aResHistry.push_back(sqnorm_res0);
-    if (sqnorm_res0 < 1.0e-30) { return aResHistry; }
+    const double sqnorm_res0 = DotX(r_vec, r_vec, ndof).real();
+    ws.AddHistory(sqnorm_res0);
+    if (sqnorm_res0 < 1.0e-30) { return 0; }
     inv_sqnorm_res0 = 1.0 / sqnorm_res0;
   }
   
+  COMPLEX* Pr_vec = ws.Vec(0);
+  COMPLEX* p_vec = ws.Vec(1);
   // {Pr} = [P]{r}
-  std::vector<COMPLEX> Pr_vec(r_vec, r_vec + ndof);
-  ilu.Solve(Pr_vec);
+  for (unsigned int i = 0; i < ndof; i++) { Pr_vec[i] = r_vec[i]; }
+  Instrument_Precond(ilu, Pr_vec);
   // {p} = {Pr}
-  std::vector<COMPLEX> p_vec = Pr_vec;
+  for (unsigned int i = 0; i < ndof; i++) { p_vec[i] = Pr_vec[i]; }
   // rPr = ({r},{Pr})
-  COMPLEX rPr = Dot(r_vec, Pr_vec.data(), ndof);
+  COMPLEX rPr = DotX(r_vec, Pr_vec, ndof);
   for (unsigned int iitr = 0; iitr < max_nitr; iitr++) {
     {
-      std::vector<COMPLEX> &Ap_vec = Pr_vec;
+      COMPLEX* Ap_vec = Pr_vec;
       // {Ap} = [A]{p}
-      mat.MatVec(Ap_vec.data(),
-                 1.0, p_vec.data(), 0.0);
+      Instrument_MatVec(mat, Ap_vec,
+                 COMPLEX(1,0), p_vec, COMPLEX(0,0));
       // alpha = ({r},{Pr})/({p},{Ap})
-      const double pAp = Dot(p_vec, Ap_vec).real();
+      const double pAp = DotX(p_vec, Ap_vec, ndof).real();
       COMPLEX alpha = rPr / pAp;
-      AXPY(-alpha, Ap_vec.data(), r_vec, ndof);       // {r} = -alpha*{Ap} + {r}
-      AXPY(+alpha, p_vec.data(), x_vec, ndof);       // {x} = +alpha*{p } + {x}
+      AXPY(-alpha, Ap_vec, r_vec, ndof);       // {r} = -alpha*{Ap} + {r}
+      AXPY(+alpha, p_vec, x_vec, ndof);       // {x} = +alpha*{p } + {x}
     }
     {  // Converge Judgement
-      double sqnorm_res = Dot(r_vec, r_vec, ndof).real();
+      double sqnorm_res = DotX(r_vec, r_vec, ndof).real();
       double conv_ratio = sqrt(sqnorm_res * inv_sqnorm_res0);
-      aResHistry.push_back(conv_ratio);
-      if (conv_ratio < conv_ratio_tol) { return aResHistry; }
+      ws.AddHistory(conv_ratio);
+      if (DFM2_INSTRUMENT_IS_STOP(iitr+1, conv_ratio)) { return iitr+1; }
+      if (conv_ratio < conv_ratio_tol) { return iitr+1; }
     }
     {  // calc beta
        // {Pr} = [P]{r}
       for (unsigned int i = 0; i < ndof; i++) { Pr_vec[i] = r_vec[i]; }
-      ilu.Solve(Pr_vec);
+      Instrument_Precond(ilu, Pr_vec);
       // rPr1 = ({r},{Pr})
-      const COMPLEX rPr1 = Dot(r_vec, Pr_vec.data(), ndof);
+      const COMPLEX rPr1 = DotX(r_vec, Pr_vec, ndof);
       // beta = rPr1/rPr
       COMPLEX beta = rPr1 / rPr;
       rPr = rPr1;
@@ -663,10 +1420,27 @@ std::vector<double> Solve_PCG_Complex
   }
   {
     // Converge Judgement
-    double sq_norm_res = Dot(r_vec, r_vec, ndof).real();
-    aResHistry.push_back(sqrt(sq_norm_res));
+    double sq_norm_res = DotX(r_vec, r_vec, ndof).real();
+    ws.AddHistory(sqrt(sq_norm_res));
   }
-  return aResHistry;
+  return max_nitr;
+}
+
+template <typename REAL, typename MAT, typename PREC>
+std::vector<double> Solve_PCG_Complex
+(std::complex<REAL> *r_vec,
+ std::complex<REAL> *x_vec,
+ double conv_ratio_tol,
+ unsigned int max_nitr,
+ const MAT &mat,
+ const PREC &ilu)
+{
+  const unsigned int ndof = mat.nblk_col * mat.len_col;
+  CKrylovWorkspace<std::complex<REAL>> ws;
+  ws.Initialize(ndof, 2, max_nitr);
+  Solve_PCG_Complex(r_vec, x_vec, ndof,
+                    conv_ratio_tol, max_nitr, mat, ilu, ws);
+  return ws.aHistory;
 }
 
 template <typename REAL, typename MAT, typename PREC>
@@ -700,13 +1474,13 @@ std::vector<double> Solve_PCOCG
   
   std::vector<COMPLEX> Ap_vec(ndof);
   std::vector<COMPLEX> w_vec(r_vec,r_vec+ndof);
-  ilu.Solve(w_vec.data());
+  Instrument_Precond(ilu, w_vec.data());
   
   std::vector<COMPLEX> p_vec = w_vec;  // {p} = {w}
   COMPLEX r_w = MultSumX(r_vec,w_vec.data(),ndof);
   
   for(unsigned int itr=0;itr<max_niter;itr++){
-    mat.MatVec(Ap_vec.data(),
+    Instrument_MatVec(mat, Ap_vec.data(),
                COMPLEX(1,0), p_vec.data(), COMPLEX(0,0));
     const COMPLEX alpha = r_w / MultSumX(p_vec.data(),Ap_vec.data(),ndof);
     AXPY(+alpha,p_vec.data(), x_vec,ndof);
@@ -715,10 +1489,11 @@ std::vector<double> Solve_PCOCG
       const double sq_norm_res = DotX(r_vec,r_vec,ndof).real();
       const double conv_ratio = sqrt(sq_norm_res * sq_inv_norm_res_ini);
       aResHistry.push_back( conv_ratio );
+      if( DFM2_INSTRUMENT_IS_STOP(itr+1, conv_ratio) ){ return aResHistry; }
       if( conv_ratio < conv_ratio_tol ){ return aResHistry; }
     }
     w_vec.assign(r_vec,r_vec+ndof);
-    ilu.Solve(w_vec.data());
+    Instrument_Precond(ilu, w_vec.data());
     COMPLEX beta;
     {  // calc beta
       const COMPLEX tmp1 = MultSumX(r_vec,w_vec.data(),ndof);
@@ -21,6 +21,7 @@
 #include "delfem2/sdf.h"
 
 #include "delfem2/ilu_mats.h"
+#include "delfem2/amg_mats.h"
 #include "delfem2/fem_emats.h"
 #include "delfem2/objfunc_v23.h"
 #include "delfem2/dtri_v2.h"
@@ -126,12 +127,13 @@ void LinearSystem_SetMasterSlave
 
 
 
+template <typename PREC>
 std::vector<double> PySolve_PCG
 (py::array_t<double>& vec_b,
  py::array_t<double>& vec_x,
  double conv_ratio, unsigned int iteration,
  const dfm2::CMatrixSparse<double>& mat_A,
- const dfm2::CPreconditionerILU<double>& ilu_A)
+ const PREC& ilu_A)
 {
   //  std::cout << "solve pcg" << std::endl;
   assert( vec_x.size() == vec_b.size() );
@@ -173,6 +175,25 @@ void PyPrecILU_SetPattern_ILUk
                           nlev_fill);
 }
 
+void PyPrecAMG_SetNearKernel_RigidBody
+ (dfm2::CPreconditionerAMG<double>& amg,
+  const py::array_t<double>& np_pos)
+{
+  assert( np_pos.ndim() == 2 );
+  amg.SetNearKernel_RigidBody(np_pos.data(),
+                              np_pos.shape()[0], np_pos.shape()[1]);
+}
+
+void PyMergePlan_Initialize
+ (dfm2::CMergePlan& plan,
+  const dfm2::CMatrixSparse<double>& mss,
+  const py::array_t<unsigned int>& np_elm)
+{
+  assert( np_elm.ndim() == 2 );
+  plan.Initialize(mss,
+                  np_elm.data(), np_elm.shape()[0], np_elm.shape()[1]);
+}
+
 // ------------------------------------------------------------
 
 void PyMergeLinSys_Poission
@@ -182,7 +203,8 @@ void PyMergeLinSys_Poission
  const py::array_t<double>& aXY,
  const py::array_t<unsigned int>& aElm,
  dfm2::MESHELEM_TYPE elem_type,
- const py::array_t<double>& aVal)
+ const py::array_t<double>& aVal,
+ const dfm2::CMergePlan* plan)
 {
   assert( aXY.shape()[1] == 2 || aXY.shape()[1] == 3 );
   assert( nNodeElem(elem_type) == aElm.shape()[1] );
@@ -193,7 +215,7 @@ void PyMergeLinSys_Poission
                                            alpha, source,
                                            aXY.data(), aXY.shape()[0],
                                            aElm.data(), aElm.shape()[0],
-                                           aVal.data());
+                                           aVal.data(), plan);
     }
   }
   if( aXY.shape()[1] == 3 ){
@@ -202,7 +224,7 @@ void PyMergeLinSys_Poission
                                            alpha, source,
                                            aXY.data(), aXY.shape()[0],
                                            aElm.data(), aElm.shape()[0],
-                                           aVal.data());
+                                           aVal.data(), plan);
     }
   }
 }
@@ -217,7 +239,8 @@ void PyMergeLinSys_Diffuse
  const py::array_t<unsigned int>& aElm,
  dfm2::MESHELEM_TYPE elem_type,
  const py::array_t<double>& aVal,
- const py::array_t<double>& aVelo)
+ const py::array_t<double>& aVelo,
+ const dfm2::CMergePlan* plan)
 {
   assert( aXY.shape()[1] == 2 || aXY.shape()[1] == 3 );
   assert( nNodeElem(elem_type) == aElm.shape()[1] );
@@ -229,7 +252,7 @@ void PyMergeLinSys_Diffuse
                                       dt_timestep, gamma_newmark,
                                       aXY.data(), aXY.shape()[0],
                                       aElm.data(), aElm.shape()[0],
-                                      aVal.data(), aVelo.data());
+                                      aVal.data(), aVelo.data(), plan);
     }
   }
   else if( aXY.shape()[1] == 3 ){
@@ -239,7 +262,7 @@ void PyMergeLinSys_Diffuse
                                       dt_timestep, gamma_newmark,
                                       aXY.data(), aXY.shape()[0],
                                       aElm.data(), aElm.shape()[0],
-                                      aVal.data(), aVelo.data());
+                                      aVal.data(), aVelo.data(), plan);
     }
   }
 }
@@ -255,7 +278,8 @@ void PyMergeLinSys_LinearSolidStatic
  const py::array_t<double>& aXY,
  const py::array_t<unsigned int>& aElm,
  dfm2::MESHELEM_TYPE elem_type,
- const py::array_t<double>& aVal)
+ const py::array_t<double>& aVal,
+ const dfm2::CMergePlan* plan)
 {
   assert( aXY.shape()[1] == 2 || aXY.shape()[1] == 3 );
   assert( nNodeElem(elem_type) == aElm.shape()[1] );
@@ -267,7 +291,7 @@ void PyMergeLinSys_LinearSolidStatic
                                               gravity[0], gravity[1],
                                               aXY.data(), aXY.shape()[0],
                                               aElm.data(), aElm.shape()[0],
-                                              aVal.data());
+                                              aVal.data(), plan);
     }
   }
   if( aXY.shape()[1] == 3 ){
@@ -276,7 +300,7 @@ void PyMergeLinSys_LinearSolidStatic
                                                      myu,lambda,rho,gravity.data(),
                                                      aXY.data(), aXY.shape()[0],
                                                      aElm.data(), aElm.shape()[0],
-                                                     aVal.data());
+                                                     aVal.data(), plan);
     }
   }
 }
@@ -293,7 +317,8 @@ void PyMergeLinSys_LinearSolidDynamic
  dfm2::MESHELEM_TYPE elem_type,
  const py::array_t<double>& aVal,
  const py::array_t<double>& aVelo,
- const py::array_t<double>& aAcc)
+ const py::array_t<double>& aAcc,
+ const dfm2::CMergePlan* plan)
 {
   auto buff_vecb = vec_b.request();
   assert( aXY.shape()[1] == 2 || aXY.shape()[1] == 3 );
@@ -305,7 +330,7 @@ void PyMergeLinSys_LinearSolidDynamic
                                                dt_timestep,gamma_newmark,beta_newmark,
                                                aXY.data(), aXY.shape()[0],
                                                aElm.data(), aElm.shape()[0],
-                                               aVal.data(),aVelo.data(),aAcc.data());
+                                               aVal.data(),aVelo.data(),aAcc.data(), plan);
     }
   }
   if( aXY.shape()[1] == 3 ){
@@ -315,7 +340,7 @@ void PyMergeLinSys_LinearSolidDynamic
                                                           dt_timestep,gamma_newmark,beta_newmark,
                                                           aXY.data(), aXY.shape()[0],
                                                           aElm.data(), aElm.shape()[0],
-                                                          aVal.data(),aVelo.data(),aAcc.data());
+                                                          aVal.data(),aVelo.data(),aAcc.data(), plan);
     }
   }
 }
@@ -717,9 +742,21 @@ void init_fem(py::module &m){
   .def("set_value",  &dfm2::CPreconditionerILU<double>::SetValueILU);
 
   m.def("cppPrecILU_SetPattern_ILUk",    &PyPrecILU_SetPattern_ILUk);
+
+  py::class_<dfm2::CPreconditionerAMG<double>>(m,"PreconditionerAMG")
+  .def(py::init<>())
+  .def("initialize", &dfm2::CPreconditionerAMG<double>::Initialize)
+  .def("num_level",  &dfm2::CPreconditionerAMG<double>::NumLevel);
+
+  m.def("cppPrecAMG_SetNearKernel_RigidBody", &PyPrecAMG_SetNearKernel_RigidBody);
+
+  py::class_<dfm2::CMergePlan>(m,"CppMergePlan")
+  .def(py::init<>())
+  .def("initialize", &PyMergePlan_Initialize);
   
   m.def("linearSystem_setMasterSlave",   &LinearSystem_SetMasterSlave);
-  m.def("linsys_solve_pcg",              &PySolve_PCG);
+  m.def("linsys_solve_pcg",              &PySolve_PCG<dfm2::CPreconditionerILU<double>>);
+  m.def("linsys_solve_pcg",              &PySolve_PCG<dfm2::CPreconditionerAMG<double>>);
   m.def("linsys_solve_bicgstab",         &PySolve_PBiCGStab);
   
   m.def("cppMassPoint_Mesh",                    &PyMassPointMesh);
@@ -727,10 +764,32 @@ void init_fem(py::module &m){
   
   m.def("cppFEM_Merge_PointMass",         &PyMergeLinSys_MassPoint);
   m.def("cppFEM_Merge_PointContact",      &PyMergeLinSys_Contact);
-  m.def("cppFEM_Merge_ScalarPoission",    &PyMergeLinSys_Poission);
-  m.def("cppFEM_Merge_ScalarDiffuse",     &PyMergeLinSys_Diffuse);
-  m.def("cppFEM_Merge_SolidLinearStatic", &PyMergeLinSys_LinearSolidStatic);
-  m.def("cppFEM_Merge_SolidLinearDynamic",&PyMergeLinSys_LinearSolidDynamic);
+  m.def("cppFEM_Merge_ScalarPoission",    &PyMergeLinSys_Poission,
+        py::arg("mat"), py::arg("vec_b"),
+        py::arg("alpha"), py::arg("source"),
+        py::arg("np_pos"), py::arg("np_elm"), py::arg("elem_type"),
+        py::arg("np_val"),
+        py::arg("merge_plan") = py::none());
+  m.def("cppFEM_Merge_ScalarDiffuse",     &PyMergeLinSys_Diffuse,
+        py::arg("mat"), py::arg("vec_b"),
+        py::arg("alpha"), py::arg("rho"), py::arg("source"),
+        py::arg("dt_timestep"), py::arg("gamma_newmark"),
+        py::arg("np_pos"), py::arg("np_elm"), py::arg("elem_type"),
+        py::arg("np_val"), py::arg("np_velo"),
+        py::arg("merge_plan") = py::none());
+  m.def("cppFEM_Merge_SolidLinearStatic", &PyMergeLinSys_LinearSolidStatic,
+        py::arg("mat"), py::arg("vec_b"),
+        py::arg("myu"), py::arg("lambda"), py::arg("rho"), py::arg("gravity"),
+        py::arg("np_pos"), py::arg("np_elm"), py::arg("elem_type"),
+        py::arg("np_val"),
+        py::arg("merge_plan") = py::none());
+  m.def("cppFEM_Merge_SolidLinearDynamic",&PyMergeLinSys_LinearSolidDynamic,
+        py::arg("mat"), py::arg("vec_b"),
+        py::arg("myu"), py::arg("lambda"), py::arg("rho"), py::arg("gravity"),
+        py::arg("dt_timestep"), py::arg("gamma_newmark"), py::arg("beta_newmark"),
+        py::arg("np_pos"), py::arg("np_elm"), py::arg("elem_type"),
+        py::arg("np_val"), py::arg("np_velo"), py::arg("np_acc"),
+        py::arg("merge_plan") = py::none());
   m.def("cppFEM_Merge_FluidStorksStatic", &PyMergeLinSys_StorksStatic2D);
   m.def("cppFEM_Merge_FluidStorksDynamic",&PyMergeLinSys_StorksDynamic2D);
   m.def("cppFEM_Merge_FluidNavierStorks", &PyMergeLinSys_NavierStorks2D);
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// benchmark of the BVH traversal used in Project_PointsIncludedInBVH_Outside.
+// the search with the fixed-size stack (BVH_Traverse) is compared to the recursive search.
+// build in Release mode and run without arguments.
+
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "delfem2/vec3.h"
+#include "delfem2/bv.h"
+#include "delfem2/bvh.h"
+#include "delfem2/primitive.h"
+#include "delfem2/mshmisc.h"
+#include "delfem2/srchuni_v3.h"
+#include "delfem2/srch_v3bvhmshtopo.h"
+
+namespace dfm2 = delfem2;
+
+// recursive search of BVH_NearestPoint_IncludedInBVH_MeshTri3D before the iterative traversal
+template <typename BV>
+void Recursive_NearestPoint_IncludedInBVH_MeshTri3D(
+    double& dist_tri,
+    double& dist_bv,
+    dfm2::CPointElemSurf<double>& pes,
+    double px, double py, double pz,
+    double rad_exp,
+    const std::vector<double>& aXYZ,
+    const std::vector<unsigned int>& aTri,
+    int ibvh,
+    const std::vector<dfm2::CNodeBVH2>& aBVH,
+    const std::vector<BV>& aBB)
+{
+  double min0=+1.0, max0=-1.0;
+  aBB[ibvh].Range_DistToPoint(min0,max0, px,py,pz);
+  if( max0 < min0 ){ return; } // inactive bvh
+  if( min0 > rad_exp ){ return; }
+  const int ichild0 = aBVH[ibvh].ichild[0];
+  const int ichild1 = aBVH[ibvh].ichild[1];
+  if( ichild1 == -1 ){ // leaf
+    if( min0 < dist_bv ){ dist_bv = min0; }
+    if( min0 == 0.0 ){
+      dist_bv = 0.0;
+      dfm2::CPointElemSurf<double> pes_tmp;
+      const double dist0 = dfm2::DistanceToTri(pes_tmp, dfm2::CVec3d(px,py,pz), ichild0, aXYZ,aTri);
+      if( dist_tri<0 || dist0 < dist_tri ){
+        dist_tri = dist0;
+        pes = pes_tmp;
+      }
+    }
+    return;
+  }
+  Recursive_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri,dist_bv,pes, px,py,pz,rad_exp, aXYZ,aTri, ichild0,aBVH,aBB);
+  Recursive_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri,dist_bv,pes, px,py,pz,rad_exp, aXYZ,aTri, ichild1,aBVH,aBB);
+}
+
+int main()
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTri;
+  dfm2::MeshTri3D_Sphere(aXYZ, aTri, 1.0, 128, 64);
+  std::vector<double> aNorm(aXYZ.size());
+  dfm2::Normal_MeshTri3D(aNorm.data(),
+                         aXYZ.data(), aXYZ.size()/3, aTri.data(), aTri.size()/3);
+  dfm2::CBVH_MeshTri3D<dfm2::CBV3d_Sphere, double> bvh;
+  bvh.Init(aXYZ.data(), aXYZ.size()/3,
+           aTri.data(), aTri.size()/3,
+           0.05);
+  std::vector<double> aXYZt(100000*3);
+  {
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<> udist(-1.0, 1.0);
+    for(unsigned int ip=0;ip<aXYZt.size()/3;++ip){
+      dfm2::CVec3d p0(udist(rng), udist(rng), udist(rng));
+      p0.SetNormalizedVector();
+      p0 *= 1.0+0.05*udist(rng);
+      p0.CopyValueTo(aXYZt.data()+ip*3);
+    }
+  }
+  const unsigned int np = aXYZt.size()/3;
+  std::cout << "ntri: " << aTri.size()/3 << "  npoint: " << np << std::endl;
+  typedef std::chrono::steady_clock CLOCK;
+  double t_rec = 1.0e10, t_itr = 1.0e10, t_prj = 1.0e10; // minimum of the repeated runs
+  double sum_rec = 0.0, sum_itr = 0.0;
+  for(int irep=0;irep<5;++irep){
+    sum_rec = 0.0;
+    sum_itr = 0.0;
+    const CLOCK::time_point t0 = CLOCK::now();
+    for(unsigned int ip=0;ip<np;++ip){
+      const double* p0 = aXYZt.data()+ip*3;
+      dfm2::CPointElemSurf<double> pes;
+      double dist_tri = -1, dist_bv = 0.0;
+      Recursive_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri,dist_bv,pes,
+                                                     p0[0],p0[1],p0[2],0.0,
+                                                     aXYZ,aTri,
+                                                     bvh.iroot_bvh, bvh.aNodeBVH, bvh.aBB_BVH);
+      sum_rec += dist_tri;
+    }
+    const CLOCK::time_point t1 = CLOCK::now();
+    for(unsigned int ip=0;ip<np;++ip){
+      const double* p0 = aXYZt.data()+ip*3;
+      dfm2::CPointElemSurf<double> pes;
+      double dist_tri = -1, dist_bv = 0.0;
+      dfm2::BVH_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri,dist_bv,pes,
+                                                     p0[0],p0[1],p0[2],0.0,
+                                                     aXYZ.data(), aXYZ.size()/3,
+                                                     aTri.data(), aTri.size()/3,
+                                                     bvh.iroot_bvh, bvh.aNodeBVH, bvh.aBB_BVH);
+      sum_itr += dist_tri;
+    }
+    const CLOCK::time_point t2 = CLOCK::now();
+    std::vector<double> aXYZt1 = aXYZt;
+    const CLOCK::time_point t3 = CLOCK::now();
+    dfm2::Project_PointsIncludedInBVH_Outside(aXYZt1, 0.01, bvh,
+                                              aXYZ, aTri, aNorm);
+    const CLOCK::time_point t4 = CLOCK::now();
+    t_rec = std::min(t_rec, std::chrono::duration<double>(t1-t0).count());
+    t_itr = std::min(t_itr, std::chrono::duration<double>(t2-t1).count());
+    t_prj = std::min(t_prj, std::chrono::duration<double>(t4-t3).count());
+  }
+  std::cout << "search recursive: " << t_rec << "s" << std::endl;
+  std::cout << "search iterative: " << t_itr << "s" << std::endl;
+  std::cout << "Project_PointsIncludedInBVH_Outside: " << t_prj << "s" << std::endl;
+  if( sum_rec != sum_itr ){
+    std::cout << "error: the results of the searches differ" << std::endl;
+    return 1;
+  }
+  return 0;
+}
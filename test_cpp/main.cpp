@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include <random>
+#include <algorithm>
 #include "gtest/gtest.h"
 
 #include "delfem2/vec2.h"
@@ -375,6 +376,74 @@ TEST(meshtopo,quad_subdiv1)
   EXPECT_EQ(aQuad0a.size(),14*4);
 }
 
+TEST(meshtopo,permutation)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTri;
+  {
+    std::vector<double> aXY;
+    std::vector<unsigned int> aQuad;
+    dfm2::MeshQuad2D_Grid(aXY, aQuad, 20, 15);
+    dfm2::convert2Tri_Quad(aTri, aQuad);
+    aXYZ = aXY;
+  }
+  const unsigned int np = aXYZ.size()/2;
+  { // shuffle the points
+    std::vector<unsigned int> aNew2Old(np);
+    for(unsigned int ip=0;ip<np;++ip){ aNew2Old[ip] = ip; }
+    std::shuffle(aNew2Old.begin(), aNew2Old.end(), std::mt19937(0));
+    std::vector<unsigned int> aOld2New;
+    dfm2::InversePermutation(aOld2New, aNew2Old);
+    dfm2::PermuteValue_Point(aXYZ, 2, aNew2Old);
+    dfm2::PermutePoint_MeshElem(aTri.data(), aTri.size()/3, 3, aOld2New);
+  }
+  // average distance of the indices of the adjacent points
+  auto bandwidth = [](const std::vector<unsigned int>& psup_ind, const std::vector<unsigned int>& psup){
+    double sum = 0.0;
+    for(unsigned int ip=0;ip+1<psup_ind.size();++ip){
+      for(unsigned int ipsup=psup_ind[ip];ipsup<psup_ind[ip+1];++ipsup){
+        const unsigned int jp = psup[ipsup];
+        sum += (jp>ip) ? jp-ip : ip-jp;
+      }
+    }
+    return sum/psup.size();
+  };
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aTri.data(), aTri.size()/3, 3, np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  const double nbw0 = bandwidth(psup_ind,psup);
+  for(int itype=0;itype<2;++itype){
+    std::vector<unsigned int> aNew2Old;
+    if( itype == 0 ){ dfm2::Permutation_ReverseCuthillMcKee(aNew2Old, psup_ind, psup); }
+    else{ dfm2::Permutation_MortonCode_Points(aNew2Old, aXYZ.data(), np, 2); }
+    ASSERT_EQ(aNew2Old.size(), np);
+    std::vector<unsigned int> aOld2New;
+    dfm2::InversePermutation(aOld2New, aNew2Old);
+    for(unsigned int ip=0;ip<np;++ip){ EXPECT_EQ(aNew2Old[aOld2New[ip]], ip); }
+    // permuting the pattern is the same as computing the pattern from the permuted mesh
+    std::vector<unsigned int> aTri1 = aTri;
+    dfm2::PermutePoint_MeshElem(aTri1.data(), aTri1.size()/3, 3, aOld2New);
+    std::vector<unsigned int> psup_ind1, psup1;
+    dfm2::JArray_PSuP_MeshElem(psup_ind1, psup1,
+                               aTri1.data(), aTri1.size()/3, 3, np);
+    dfm2::JArray_Sort(psup_ind1, psup1);
+    std::vector<unsigned int> psup_ind2 = psup_ind, psup2 = psup;
+    dfm2::JArray_Permute(psup_ind2, psup2, aNew2Old);
+    EXPECT_EQ(psup_ind1, psup_ind2);
+    EXPECT_EQ(psup1, psup2);
+    EXPECT_LT(bandwidth(psup_ind1,psup1)*4, nbw0);
+    // values are put back to the original order with the inverse map
+    std::vector<double> aXYZ1 = aXYZ;
+    dfm2::PermuteValue_Point(aXYZ1, 2, aNew2Old);
+    for(unsigned int ip=0;ip<np;++ip){
+      EXPECT_EQ(aXYZ1[aOld2New[ip]*2+0], aXYZ[ip*2+0]);
+    }
+    dfm2::PermuteValue_Point(aXYZ1, 2, aOld2New);
+    EXPECT_EQ(aXYZ1, aXYZ);
+  }
+}
+
 
 TEST(mathfunc,sherical_harmonics_orthgonality)
 {
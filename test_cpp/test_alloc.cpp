@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2019 Nobuyuki Umetani
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// the global operator new is replaced in this file to count the heap allocations.
+// the counting is enabled only inside the scope of CAllocCounter, so the other tests are not affected.
+
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "delfem2/vecxitrsol.h"
+#include "delfem2/mats.h"
+#include "delfem2/mshtopo.h"
+#include "delfem2/primitive.h"
+#include "delfem2/fem_emats.h"
+#include "delfem2/ilu_mats.h"
+#include "delfem2/ic_mats.h"
+
+namespace dfm2 = delfem2;
+
+static std::atomic<bool> is_count_alloc(false);
+static std::atomic<unsigned int> nalloc(0);
+
+static void* AllocCounted(std::size_t size){
+  if( is_count_alloc.load(std::memory_order_relaxed) ){ nalloc.fetch_add(1,std::memory_order_relaxed); }
+  return std::malloc(size==0 ? 1 : size);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#  pragma GCC diagnostic ignored "-Wmismatched-new-delete" // the replaced operator new uses malloc()
+#endif
+
+void* operator new(std::size_t size){
+  void* p = AllocCounted(size);
+  if( p == nullptr ){ throw std::bad_alloc(); }
+  return p;
+}
+void* operator new[](std::size_t size){
+  void* p = AllocCounted(size);
+  if( p == nullptr ){ throw std::bad_alloc(); }
+  return p;
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return AllocCounted(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return AllocCounted(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+/**
+ * @brief count the allocations on all the threads during the lifetime of this object (not nestable)
+ */
+class CAllocCounter
+{
+public:
+  CAllocCounter(){
+    nalloc = 0;
+    is_count_alloc = true;
+  }
+  ~CAllocCounter(){ is_count_alloc = false; }
+  unsigned int Count() const { return nalloc.load(); }
+};
+
+static void MakeLinSys_Poisson
+(dfm2::CMatrixSparse<double>& mat,
+ std::vector<double>& vec_b)
+{
+  std::vector<double> aXY;
+  std::vector<unsigned int> aQuad, aTri;
+  dfm2::MeshQuad2D_Grid(aXY, aQuad, 32, 24);
+  dfm2::convert2Tri_Quad(aTri, aQuad);
+  const unsigned int np = aXY.size()/2;
+  const unsigned int nTri = aTri.size()/3;
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aTri.data(), nTri, 3, np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  mat.Initialize(np, 1, true);
+  mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+  mat.SetZero();
+  vec_b.assign(np, 0.0);
+  std::vector<double> aVal(np, 0.0);
+  dfm2::MergeLinSys_Poission_MeshTri2D(mat, vec_b.data(), 1.0, 1.0,
+                                       aXY.data(), np, aTri.data(), nTri,
+                                       aVal.data());
+  std::vector<int> aBCFlag(np, 0);
+  for(unsigned int ip=0;ip<np;++ip){
+    if( aXY[ip*2+0] < aXY[0]+1.0e-10 ){ aBCFlag[ip] = 1; }
+  }
+  mat.SetFixedBC(aBCFlag.data());
+  dfm2::setRHS_Zero(vec_b, aBCFlag, 0);
+}
+
+// the Krylov solvers with the workspace and the preconditioners do not allocate once they are set up
+TEST(alloc,krylov_workspace)
+{
+  dfm2::CMatrixSparse<double> mat;
+  std::vector<double> vec_b;
+  MakeLinSys_Poisson(mat, vec_b);
+  const unsigned int np = vec_b.size();
+  for(unsigned int nthread : {1, 4}){
+    mat.SetNumThread(nthread);
+    dfm2::CPreconditionerILU<double> ilu;
+    ilu.Initialize_ILU0(mat);
+    ilu.SetNumThread(nthread);
+    ilu.SetValueILU(mat);
+    ilu.DoILUDecomp();
+    std::vector<double> r(np), x(np);
+    { // PCG
+      dfm2::CKrylovWorkspace<double> ws;
+      ws.Initialize(np, 2, 1000);
+      CAllocCounter counter;
+      for(unsigned int itr=0;itr<3;++itr){
+        for(unsigned int i=0;i<np;++i){ r[i] = vec_b[i]; }
+        const unsigned int nitr = dfm2::Solve_PCG(r.data(), x.data(), np, 1.0e-8, 1000, mat, ilu, ws);
+        EXPECT_LT(nitr, 1000u);
+      }
+      EXPECT_EQ(counter.Count(), 0u);
+    }
+    { // BiCGStab
+      dfm2::CKrylovWorkspace<double> ws;
+      ws.Initialize(np, 7, 1000);
+      CAllocCounter counter;
+      for(unsigned int itr=0;itr<3;++itr){
+        for(unsigned int i=0;i<np;++i){ r[i] = vec_b[i]; }
+        const unsigned int nitr = dfm2::Solve_PBiCGStab(r.data(), x.data(), np, 1.0e-8, 1000, mat, ilu, ws);
+        EXPECT_LT(nitr, 1000u);
+      }
+      EXPECT_EQ(counter.Count(), 0u);
+    }
+    { // PCG with IC. the factorization is repeated as well
+      dfm2::CPreconditionerIC<double> ic;
+      ic.Initialize_IC0(mat, true);
+      ic.SetNumThread(nthread);
+      dfm2::CKrylovWorkspace<double> ws;
+      ws.Initialize(np, 2, 1000);
+      CAllocCounter counter;
+      for(unsigned int itr=0;itr<3;++itr){
+        ic.SetValueIC(mat);
+        EXPECT_TRUE(ic.DoICDecomp());
+        for(unsigned int i=0;i<np;++i){ r[i] = vec_b[i]; }
+        const unsigned int nitr = dfm2::Solve_PCG(r.data(), x.data(), np, 1.0e-8, 1000, mat, ic, ws);
+        EXPECT_LT(nitr, 1000u);
+      }
+      EXPECT_EQ(counter.Count(), 0u);
+    }
+  }
+}
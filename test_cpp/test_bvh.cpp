@@ -7,12 +7,14 @@
 
 #include <iostream>
 #include <random>
+#include <algorithm>
 
 #include "gtest/gtest.h"
 
 #include "delfem2/vec3.h"
 #include "delfem2/bv.h"
 #include "delfem2/bvh.h"
+#include "delfem2/bvh4.h"
 #include "delfem2/sdf.h"
 #include "delfem2/primitive.h"
 #include "delfem2/mshmisc.h"
@@ -554,3 +556,496 @@ TEST(bvh,morton_code)
     }
   }
 }
+
+TEST(bvh,morton_code_parallel)
+{
+  const double min_xyz[3] = {-1,-1,-1};
+  const double max_xyz[3] = {+1,+1,+1};
+  std::vector<double> aXYZ;
+  {
+    const unsigned int N = 100000;
+    aXYZ.resize(N*3);
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<> udist(-1.0, 1.0);
+    for(unsigned int i=0;i<N*3;++i){ aXYZ[i] = udist(rng); }
+    for(unsigned int i=0;i<100;++i){ // hash collision
+      for(int idim=0;idim<3;++idim){ aXYZ[(N-1-i)*3+idim] = aXYZ[i*3+idim]; }
+    }
+  }
+  std::vector<unsigned int> aSortedId0, aSortedMc0;
+  dfm2::SortedMortenCode_Points3(aSortedId0,aSortedMc0,
+                                 aXYZ,min_xyz,max_xyz);
+  std::vector<dfm2::CNodeBVH2> aNodeBVH0;
+  dfm2::BVHTopology_Morton(aNodeBVH0,
+                           aSortedId0,aSortedMc0);
+  for(unsigned int nthread=1;nthread<=4;nthread+=3){
+    std::vector<unsigned int> aSortedId1, aSortedMc1;
+    dfm2::SortedMortenCode_Points3_Parallel(aSortedId1,aSortedMc1,
+                                            aXYZ,min_xyz,max_xyz,nthread);
+    EXPECT_EQ(aSortedId0,aSortedId1);
+    EXPECT_EQ(aSortedMc0,aSortedMc1);
+    std::vector<dfm2::CNodeBVH2> aNodeBVH1;
+    dfm2::BVHTopology_Morton_Parallel(aNodeBVH1,
+                                      aSortedId1,aSortedMc1,nthread);
+    ASSERT_EQ(aNodeBVH0.size(),aNodeBVH1.size());
+    for(unsigned int ibvh=0;ibvh<aNodeBVH0.size();++ibvh){
+      EXPECT_EQ(aNodeBVH0[ibvh].iroot,aNodeBVH1[ibvh].iroot);
+      EXPECT_EQ(aNodeBVH0[ibvh].ichild[0],aNodeBVH1[ibvh].ichild[0]);
+      EXPECT_EQ(aNodeBVH0[ibvh].ichild[1],aNodeBVH1[ibvh].ichild[1]);
+    }
+  }
+  // ---------------
+  std::vector<double> aXYZ1;
+  std::vector<unsigned int> aTri;
+  dfm2::MeshTri3D_Sphere(aXYZ1, aTri, 1.0, 64, 32);
+  const unsigned int ntri = aTri.size()/3;
+  std::vector<double> aCent(ntri*3);
+  for(unsigned int itri=0;itri<ntri;++itri){
+    for(int idim=0;idim<3;++idim){
+      aCent[itri*3+idim] = (aXYZ1[aTri[itri*3+0]*3+idim]
+                          + aXYZ1[aTri[itri*3+1]*3+idim]
+                          + aXYZ1[aTri[itri*3+2]*3+idim])/3.0;
+    }
+  }
+  std::vector<unsigned int> aSortedId, aSortedMc;
+  dfm2::SortedMortenCode_Points3_Parallel(aSortedId,aSortedMc,
+                                          aCent,min_xyz,max_xyz,4);
+  std::vector<dfm2::CNodeBVH2> aNodeBVH;
+  dfm2::BVHTopology_Morton_Parallel(aNodeBVH,
+                                    aSortedId,aSortedMc,4);
+  std::vector<dfm2::CBV3d_AABB> aBB0, aBB1;
+  dfm2::BVH_BuildBVHGeometry_Mesh(aBB0, 0, aNodeBVH, 0.01,
+                                  aXYZ1.data(), aXYZ1.size()/3,
+                                  aTri.data(), 3, ntri);
+  dfm2::BVH_BuildBVHGeometry_Mesh_Parallel(aBB1, aNodeBVH, 0.01,
+                                           aXYZ1.data(), aXYZ1.size()/3,
+                                           aTri.data(), 3, ntri, 4);
+  ASSERT_EQ(aBB0.size(),aBB1.size());
+  for(unsigned int ibb=0;ibb<aBB0.size();++ibb){
+    for(int idim=0;idim<3;++idim){
+      EXPECT_EQ(aBB0[ibb].bbmin[idim],aBB1[ibb].bbmin[idim]);
+      EXPECT_EQ(aBB0[ibb].bbmax[idim],aBB1[ibb].bbmax[idim]);
+    }
+  }
+}
+
+template <typename MC>
+unsigned int MaxDepth_MortonBVH(
+    const std::vector<double>& aXYZ,
+    const double min_xyz[3], const double max_xyz[3])
+{
+  std::vector<unsigned int> aSortedId;
+  std::vector<MC> aSortedMc;
+  dfm2::SortedMortenCode_Points3(aSortedId,aSortedMc,
+                                 aXYZ,min_xyz,max_xyz);
+  const unsigned int N = aXYZ.size()/3;
+  std::vector<dfm2::CNodeBVH2> aNode;
+  dfm2::BVHTopology_Morton(aNode,
+                           aSortedId,aSortedMc);
+  {
+    std::vector<int> aFlgBranch(N-1,0);
+    std::vector<int> aFlgLeaf(N,0);
+    std::vector<int> aFlgID(N,0);
+    mark_child(aFlgBranch,aFlgLeaf,aFlgID, N,
+               0,aNode);
+    for(unsigned int i=0;i<N;++i){
+      EXPECT_EQ(aFlgLeaf[i],1);
+      EXPECT_EQ(aFlgID[i],1);
+    }
+    for(unsigned int i=0;i<N-1;++i){
+      EXPECT_EQ(aFlgBranch[i],1);
+    }
+  }
+  unsigned int depth_max = 0;
+  for(unsigned int inode=N-1;inode<2*N-1;++inode){
+    unsigned int depth = 0;
+    for(int jnode=inode;aNode[jnode].iroot!=-1;jnode=aNode[jnode].iroot){ depth++; }
+    depth_max = (depth > depth_max) ? depth : depth_max;
+  }
+  return depth_max;
+}
+
+TEST(bvh,morton_code64)
+{
+  const double min_xyz[3] = {-1,-1,-1};
+  const double max_xyz[3] = {+1,+1,+1};
+  std::vector<double> aXYZ;
+  { // uniform points and dense clusters
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<> udist(-1.0, 1.0);
+    std::uniform_real_distribution<> udist_small(-1.0e-4, 1.0e-4);
+    for(unsigned int ip=0;ip<5000;++ip){
+      for(int idim=0;idim<3;++idim){ aXYZ.push_back(udist(rng)); }
+    }
+    for(unsigned int icluster=0;icluster<4;++icluster){
+      const double c[3] = {udist(rng), udist(rng), udist(rng)};
+      for(unsigned int ip=0;ip<2000;++ip){ // exactly the same point
+        for(int idim=0;idim<3;++idim){ aXYZ.push_back(c[idim]); }
+      }
+      for(unsigned int ip=0;ip<2000;++ip){ // points within a cell of the 30-bit code
+        for(int idim=0;idim<3;++idim){ aXYZ.push_back(c[idim]+udist_small(rng)); }
+      }
+    }
+  }
+  const unsigned int N = aXYZ.size()/3;
+  const unsigned int depth32 = MaxDepth_MortonBVH<std::uint32_t>(aXYZ,min_xyz,max_xyz);
+  const unsigned int depth64 = MaxDepth_MortonBVH<std::uint64_t>(aXYZ,min_xyz,max_xyz);
+  EXPECT_LT(depth32, 64);
+  EXPECT_LT(depth64, 64);
+  // ---------------
+  std::vector<unsigned int> aSortedId0, aSortedId1;
+  std::vector<std::uint64_t> aSortedMc0, aSortedMc1;
+  dfm2::SortedMortenCode_Points3(aSortedId0,aSortedMc0,
+                                 aXYZ,min_xyz,max_xyz);
+  dfm2::SortedMortenCode_Points3_Parallel(aSortedId1,aSortedMc1,
+                                          aXYZ,min_xyz,max_xyz,4);
+  EXPECT_EQ(aSortedId0,aSortedId1);
+  EXPECT_EQ(aSortedMc0,aSortedMc1);
+  for(unsigned int imc=0;imc<N;++imc){
+    const unsigned int ip = aSortedId0[imc];
+    const double* p = aXYZ.data()+ip*3;
+    EXPECT_EQ(aSortedMc0[imc], dfm2::MortonCode64((p[0]+1)*0.5, (p[1]+1)*0.5, (p[2]+1)*0.5));
+  }
+  { // the 64-bit code distinguishes the points in the cluster
+    std::vector<unsigned int> aSortedId2, aSortedMc2;
+    dfm2::SortedMortenCode_Points3(aSortedId2,aSortedMc2,
+                                   aXYZ,min_xyz,max_xyz);
+    std::vector<std::uint64_t> aSortedMc3 = aSortedMc0;
+    const auto nuniq32 = std::unique(aSortedMc2.begin(),aSortedMc2.end()) - aSortedMc2.begin();
+    const auto nuniq64 = std::unique(aSortedMc3.begin(),aSortedMc3.end()) - aSortedMc3.begin();
+    EXPECT_GT(nuniq64, nuniq32+4000);
+  }
+  std::vector<dfm2::CNodeBVH2> aNodeBVH0, aNodeBVH1;
+  dfm2::BVHTopology_Morton(aNodeBVH0,
+                           aSortedId0,aSortedMc0);
+  dfm2::BVHTopology_Morton_Parallel(aNodeBVH1,
+                                    aSortedId1,aSortedMc1,4);
+  ASSERT_EQ(aNodeBVH0.size(),aNodeBVH1.size());
+  for(unsigned int ibvh=0;ibvh<aNodeBVH0.size();++ibvh){
+    EXPECT_EQ(aNodeBVH0[ibvh].iroot,aNodeBVH1[ibvh].iroot);
+    EXPECT_EQ(aNodeBVH0[ibvh].ichild[0],aNodeBVH1[ibvh].ichild[0]);
+    EXPECT_EQ(aNodeBVH0[ibvh].ichild[1],aNodeBVH1[ibvh].ichild[1]);
+  }
+}
+
+TEST(bvh,sah)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTri;
+  { // make a unit sphere
+    dfm2::MeshTri3D_Sphere(aXYZ, aTri, 1.0, 256, 128);
+    dfm2::Rotate_Points3(aXYZ,
+                         0.2, 0.3, 0.4);
+  }
+  const unsigned int ntri = aTri.size()/3;
+  std::vector<dfm2::CNodeBVH2> aNodeBVH;
+  dfm2::BVHTopology_SAH_MeshElem(aNodeBVH,
+                                 aXYZ.data(), aXYZ.size()/3,
+                                 aTri.data(), 3, ntri, 1);
+  ASSERT_EQ(aNodeBVH.size(), ntri*2-1);
+  { // the output does not depend on the number of threads
+    std::vector<dfm2::CNodeBVH2> aNodeBVH1;
+    dfm2::BVHTopology_SAH_MeshElem(aNodeBVH1,
+                                   aXYZ.data(), aXYZ.size()/3,
+                                   aTri.data(), 3, ntri, 4);
+    ASSERT_EQ(aNodeBVH.size(),aNodeBVH1.size());
+    for(unsigned int ibvh=0;ibvh<aNodeBVH.size();++ibvh){
+      EXPECT_EQ(aNodeBVH[ibvh].iroot,aNodeBVH1[ibvh].iroot);
+      EXPECT_EQ(aNodeBVH[ibvh].ichild[0],aNodeBVH1[ibvh].ichild[0]);
+      EXPECT_EQ(aNodeBVH[ibvh].ichild[1],aNodeBVH1[ibvh].ichild[1]);
+    }
+  }
+  { // each element is in one leaf
+    EXPECT_EQ(aNodeBVH[0].iroot, -1);
+    std::vector<int> aFlg(ntri,0);
+    for(unsigned int ibvh=0;ibvh<aNodeBVH.size();++ibvh){
+      const dfm2::CNodeBVH2& node = aNodeBVH[ibvh];
+      if( node.ichild[1] == -1 ){
+        ASSERT_LT(node.ichild[0], (int)ntri);
+        aFlg[node.ichild[0]] += 1;
+        continue;
+      }
+      EXPECT_EQ(aNodeBVH[node.ichild[0]].iroot, (int)ibvh);
+      EXPECT_EQ(aNodeBVH[node.ichild[1]].iroot, (int)ibvh);
+    }
+    for(unsigned int itri=0;itri<ntri;++itri){ EXPECT_EQ(aFlg[itri],1); }
+  }
+  { // lower SAH cost than the tree with Morton code
+    std::vector<double> aCent(ntri*3);
+    for(unsigned int itri=0;itri<ntri;++itri){
+      for(int idim=0;idim<3;++idim){
+        aCent[itri*3+idim] = (aXYZ[aTri[itri*3+0]*3+idim]
+                            + aXYZ[aTri[itri*3+1]*3+idim]
+                            + aXYZ[aTri[itri*3+2]*3+idim])/3.0;
+      }
+    }
+    const double min_xyz[3] = {-1,-1,-1};
+    const double max_xyz[3] = {+1,+1,+1};
+    std::vector<unsigned int> aSortedId, aSortedMc;
+    dfm2::SortedMortenCode_Points3(aSortedId,aSortedMc,
+                                   aCent,min_xyz,max_xyz);
+    std::vector<dfm2::CNodeBVH2> aNodeBVH1;
+    dfm2::BVHTopology_Morton(aNodeBVH1,
+                             aSortedId,aSortedMc);
+    std::vector<dfm2::CBV3d_AABB> aBB0, aBB1;
+    dfm2::BVH_BuildBVHGeometry_Mesh(aBB0, 0, aNodeBVH, 0.0,
+                                    aXYZ.data(), aXYZ.size()/3,
+                                    aTri.data(), 3, ntri);
+    dfm2::BVH_BuildBVHGeometry_Mesh(aBB1, 0, aNodeBVH1, 0.0,
+                                    aXYZ.data(), aXYZ.size()/3,
+                                    aTri.data(), 3, ntri);
+    const double cost0 = dfm2::BVH_CostSAH(0, aNodeBVH, aBB0);
+    const double cost1 = dfm2::BVH_CostSAH(0, aNodeBVH1, aBB1);
+    EXPECT_GT(cost0, 1.0+1.0); // at least the root and a leaf
+    EXPECT_LT(cost0, cost1);
+  }
+  std::vector<dfm2::CBV3d_Sphere> aBB;
+  dfm2::BVH_BuildBVHGeometry_Mesh(aBB, 0, aNodeBVH, 1.0e-5,
+                                  aXYZ.data(), aXYZ.size()/3,
+                                  aTri.data(), 3, ntri);
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<> udist(-1.5, 1.5);
+  for(int itr=0;itr<30;++itr){
+    dfm2::CVec3d s0(udist(rng), udist(rng), udist(rng));
+    dfm2::CVec3d d0(udist(rng), udist(rng), udist(rng));
+    d0.SetNormalizedVector();
+    std::vector<int> aIndElem;
+    dfm2::BVH_GetIndElem_IntersectRay(aIndElem, s0.p, d0.p,
+                                      0, aNodeBVH, aBB);
+    std::vector<int> aFlg(ntri,0);
+    for(int itri0 : aIndElem){ aFlg[itri0] = 1; }
+    for(unsigned int itri=0;itri<ntri;++itri){
+      dfm2::CBV3d_Sphere bb;
+      for(int inoel=0;inoel<3;++inoel){
+        const int ino0 = aTri[itri*3+inoel];
+        bb.AddPoint(aXYZ.data()+ino0*3, 1.0e-5);
+      }
+      EXPECT_EQ( bb.IsIntersectRay(s0.p, d0.p), aFlg[itri] == 1 );
+    }
+  }
+}
+
+TEST(bvh,wide4)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTri;
+  { // make a unit sphere
+    dfm2::MeshTri3D_Sphere(aXYZ, aTri, 1.0, 64, 32);
+    dfm2::Rotate_Points3(aXYZ,
+                         0.2, 0.3, 0.4);
+  }
+  const unsigned int ntri = aTri.size()/3;
+  std::vector<dfm2::CNodeBVH2> aNodeBVH;
+  dfm2::BVHTopology_SAH_MeshElem(aNodeBVH,
+                                 aXYZ.data(), aXYZ.size()/3,
+                                 aTri.data(), 3, ntri, 1);
+  std::vector<dfm2::CBV3d_AABB> aBB;
+  dfm2::BVH_BuildBVHGeometry_Mesh(aBB, 0, aNodeBVH, 0.03,
+                                  aXYZ.data(), aXYZ.size()/3,
+                                  aTri.data(), 3, ntri);
+  std::vector<dfm2::CNodeBVH4> aNode4;
+  dfm2::BVH4_Collapse(aNode4, 0, aNodeBVH, aBB);
+  EXPECT_LT(aNode4.size(), aNodeBVH.size()/4);
+  { // each element is in one leaf
+    std::vector<int> aFlg(ntri,0);
+    for(const auto& node4 : aNode4){
+      for(int ichild : node4.ichild){
+        if( ichild >= 0 ){ EXPECT_LT(ichild, (int)aNode4.size()); }
+        if( ichild <= -2 ){ aFlg[-2-ichild] += 1; }
+      }
+    }
+    for(unsigned int itri=0;itri<ntri;++itri){ EXPECT_EQ(aFlg[itri],1); }
+  }
+  std::vector<dfm2::CBV3d_AABB> aBBTri(ntri);
+  for(unsigned int itri=0;itri<ntri;++itri){
+    for(int inoel=0;inoel<3;++inoel){
+      aBBTri[itri].AddPoint(aXYZ.data()+aTri[itri*3+inoel]*3, 0.03);
+    }
+  }
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<> udist(-1.5, 1.5);
+  for(int itr=0;itr<100;++itr){
+    const double p0[3] = {udist(rng), udist(rng), udist(rng)};
+    double d0[3] = {udist(rng), udist(rng), udist(rng)};
+    if( itr % 10 == 0 ){ d0[itr/10%3] = 0.0; } // axis-aligned ray
+    { // point inclusion
+      std::vector<int> aIndElem0, aIndElem1;
+      dfm2::BVH_GetIndElem_IncludePoint(aIndElem0, p0[0], p0[1], p0[2],
+                                        0, aNodeBVH, aBB);
+      dfm2::BVH4_GetIndElem_IncludePoint(aIndElem1, p0[0], p0[1], p0[2],
+                                         aNode4);
+      std::sort(aIndElem0.begin(),aIndElem0.end());
+      std::sort(aIndElem1.begin(),aIndElem1.end());
+      EXPECT_EQ(aIndElem0, aIndElem1);
+    }
+    { // ray
+      std::vector<int> aIndElem0, aIndElem1;
+      dfm2::BVH_GetIndElem_IntersectRay(aIndElem0, p0, d0,
+                                        0, aNodeBVH, aBB);
+      dfm2::BVH4_GetIndElem_IntersectRay(aIndElem1, p0, d0,
+                                         aNode4);
+      std::vector<int> aFlg(ntri,0);
+      for(int itri0 : aIndElem1){ aFlg[itri0] += 1; }
+      for(unsigned int itri=0;itri<ntri;++itri){
+        EXPECT_EQ( aBBTri[itri].IsIntersectRay(p0,d0), aFlg[itri] == 1 );
+      }
+      std::sort(aIndElem0.begin(),aIndElem0.end());
+      std::sort(aIndElem1.begin(),aIndElem1.end());
+      EXPECT_EQ(aIndElem0, aIndElem1);
+    }
+  }
+  // ------------
+  { // nearest point
+    std::vector<double> aXYZ1(3000*3);
+    for(double& v : aXYZ1){ v = udist(rng); }
+    const double min_xyz[3] = {-1.5,-1.5,-1.5};
+    const double max_xyz[3] = {+1.5,+1.5,+1.5};
+    std::vector<unsigned int> aSortedId, aSortedMc;
+    dfm2::SortedMortenCode_Points3(aSortedId,aSortedMc,
+                                   aXYZ1,min_xyz,max_xyz);
+    std::vector<dfm2::CNodeBVH2> aNodeBVH1;
+    dfm2::BVHTopology_Morton(aNodeBVH1,
+                             aSortedId,aSortedMc);
+    std::vector<dfm2::CBV3d_AABB> aBB1;
+    dfm2::BVHGeometry_Points(aBB1, 0, aNodeBVH1,
+                             aXYZ1.data(), aXYZ1.size()/3);
+    std::vector<dfm2::CNodeBVH4> aNode41;
+    dfm2::BVH4_Collapse(aNode41, 0, aNodeBVH1, aBB1);
+    for(int itr=0;itr<100;++itr){
+      const double p0[3] = {udist(rng)*2, udist(rng)*2, udist(rng)*2};
+      unsigned int ip_nearest = 0;
+      double dist = -1;
+      dfm2::BVH4_IndPoint_NearestPoint(ip_nearest, dist, p0,
+                                       aNode41);
+      EXPECT_NEAR(dist, dfm2::Distance3(p0, aXYZ1.data()+ip_nearest*3), 1.0e-10);
+      for(unsigned int ip=0;ip<aXYZ1.size()/3;++ip){
+        EXPECT_GE(dfm2::Distance3(p0, aXYZ1.data()+ip*3), dist);
+      }
+    }
+  }
+}
+
+// recursive reference of BVH_NearestPoint_IncludedInBVH_MeshTri3D before the iterative traversal
+template <typename BV>
+void Recursive_NearestPoint_IncludedInBVH_MeshTri3D(
+    double& dist_tri,
+    double& dist_bv,
+    dfm2::CPointElemSurf<double>& pes,
+    double px, double py, double pz,
+    double rad_exp,
+    const std::vector<double>& aXYZ,
+    const std::vector<unsigned int>& aTri,
+    int ibvh,
+    const std::vector<dfm2::CNodeBVH2>& aBVH,
+    const std::vector<BV>& aBB)
+{
+  double min0=+1.0, max0=-1.0;
+  aBB[ibvh].Range_DistToPoint(min0,max0, px,py,pz);
+  if( max0 < min0 ){ return; } // inactive bvh
+  if( min0 > rad_exp ){ return; }
+  const int ichild0 = aBVH[ibvh].ichild[0];
+  const int ichild1 = aBVH[ibvh].ichild[1];
+  if( ichild1 == -1 ){ // leaf
+    if( min0 < dist_bv ){ dist_bv = min0; }
+    if( min0 == 0.0 ){
+      dist_bv = 0.0;
+      dfm2::CPointElemSurf<double> pes_tmp;
+      const double dist0 = dfm2::DistanceToTri(pes_tmp, dfm2::CVec3d(px,py,pz), ichild0, aXYZ,aTri);
+      if( dist_tri<0 || dist0 < dist_tri ){
+        dist_tri = dist0;
+        pes = pes_tmp;
+      }
+    }
+    return;
+  }
+  Recursive_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri,dist_bv,pes, px,py,pz,rad_exp, aXYZ,aTri, ichild0,aBVH,aBB);
+  Recursive_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri,dist_bv,pes, px,py,pz,rad_exp, aXYZ,aTri, ichild1,aBVH,aBB);
+}
+
+TEST(bvh,traverse)
+{
+  std::mt19937 rng(0);
+  std::uniform_real_distribution<> udist(-1.0, 1.0);
+  { // tree deeper than the fixed-size stack
+    const unsigned int N = 3*dfm2::BVH_NSTACK;
+    std::vector<double> aXYZ(N*3);
+    for(double& v : aXYZ){ v = udist(rng); }
+    std::vector<dfm2::CNodeBVH2> aNodeBVH(2*N-1);
+    for(unsigned int ib=0;ib<N-1;++ib){ // chain: branch ib has the leaf of the point ib and the branch ib+1
+      aNodeBVH[ib].iroot = (int)ib-1;
+      aNodeBVH[ib].ichild[0] = N-1+ib;
+      aNodeBVH[ib].ichild[1] = (ib==N-2) ? 2*N-2 : ib+1;
+    }
+    for(unsigned int ip=0;ip<N;++ip){
+      aNodeBVH[N-1+ip].iroot = (ip==N-1) ? N-2 : ip;
+      aNodeBVH[N-1+ip].ichild[0] = ip;
+      aNodeBVH[N-1+ip].ichild[1] = -1;
+    }
+    std::vector<dfm2::CBV3_Sphere<double>> aBB;
+    dfm2::BVHGeometry_Points(aBB, 0, aNodeBVH,
+                             aXYZ.data(), N);
+    for(int itr=0;itr<100;++itr){
+      const double p0[3] = {udist(rng)*1.5, udist(rng)*1.5, udist(rng)*1.5};
+      std::vector<int> aIndElem;
+      dfm2::BVH_GetIndElem_InsideRange(aIndElem, 0.0, 1.0, p0[0],p0[1],p0[2], 0, aNodeBVH, aBB);
+      std::vector<int> aIndElem0;
+      for(unsigned int ip=0;ip<N;++ip){
+        if( dfm2::Distance3(p0, aXYZ.data()+ip*3) <= 1.0 ){ aIndElem0.push_back(ip); }
+      }
+      EXPECT_EQ(aIndElem, aIndElem0); // same order as the recursion
+      unsigned int ip_nearest = 0;
+      double dist = -1;
+      dfm2::BVH_IndPoint_NearestPoint(ip_nearest, dist, p0, 0, aNodeBVH, aBB);
+      for(unsigned int ip=0;ip<N;++ip){
+        EXPECT_GE(dfm2::Distance3(p0, aXYZ.data()+ip*3), dist);
+      }
+      EXPECT_NEAR(dist, dfm2::Distance3(p0, aXYZ.data()+ip_nearest*3), 1.0e-10);
+      // stop at the first hit
+      int ielem_first = -1;
+      const bool is_finished = dfm2::BVH_Traverse(
+          0, aNodeBVH,
+          [&](int ibvh){
+            double min0=+1.0, max0=-1.0;
+            aBB[ibvh].Range_DistToPoint(min0,max0, p0[0],p0[1],p0[2]);
+            if( max0 < min0 ){ return false; }
+            return min0 <= 1.0 && max0 >= 0.0;
+          },
+          [&](int ielem){ ielem_first = ielem; return false; });
+      EXPECT_EQ(is_finished, aIndElem.empty());
+      if( !aIndElem.empty() ){ EXPECT_EQ(ielem_first, aIndElem[0]); }
+    }
+  }
+  // ------------
+  { // nearest point included in the bounding volumes compared to the recursive search
+    std::vector<double> aXYZ;
+    std::vector<unsigned int> aTri;
+    dfm2::MeshTri3D_Sphere(aXYZ, aTri, 1.0, 64, 32);
+    dfm2::CBVH_MeshTri3D<dfm2::CBV3d_Sphere, double> bvh;
+    bvh.Init(aXYZ.data(), aXYZ.size()/3,
+             aTri.data(), aTri.size()/3,
+             0.05);
+    for(int itr=0;itr<10000;++itr){
+      dfm2::CVec3d p0(udist(rng), udist(rng), udist(rng));
+      p0.SetNormalizedVector();
+      p0 *= 1.0+0.1*udist(rng);
+      const double rad_exp = (itr%2==0) ? 0.0 : 0.1;
+      dfm2::CPointElemSurf<double> pes0, pes1;
+      double dist_tri0 = -1, dist_bv0 = rad_exp;
+      Recursive_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri0,dist_bv0,pes0,
+                                                     p0.x(),p0.y(),p0.z(),rad_exp,
+                                                     aXYZ,aTri,
+                                                     bvh.iroot_bvh, bvh.aNodeBVH, bvh.aBB_BVH);
+      double dist_tri1 = -1, dist_bv1 = rad_exp;
+      dfm2::BVH_NearestPoint_IncludedInBVH_MeshTri3D(dist_tri1,dist_bv1,pes1,
+                                                     p0.x(),p0.y(),p0.z(),rad_exp,
+                                                     aXYZ.data(), aXYZ.size()/3,
+                                                     aTri.data(), aTri.size()/3,
+                                                     bvh.iroot_bvh, bvh.aNodeBVH, bvh.aBB_BVH);
+      EXPECT_EQ(dist_tri0, dist_tri1);
+      EXPECT_EQ(dist_bv0, dist_bv1);
+      EXPECT_EQ(pes0.itri, pes1.itri);
+      EXPECT_EQ(pes0.r0, pes1.r0);
+      EXPECT_EQ(pes0.r1, pes1.r1);
+    }
+  }
+}
@@ -19,10 +19,140 @@
 #include "delfem2/objfunc_v23.h"
 #include "delfem2/dtri_v2.h"
 #include "delfem2/ilu_mats.h"
+#include "delfem2/amg_mats.h"
+#include "delfem2/ldl_mats.h"
+#include "delfem2/ic_mats.h"
+#include "delfem2/lobpcg_mats.h"
+#include "delfem2/matsio.h"
+#include "delfem2/instrument.h"
 #include "delfem2/fem_emats.h"
+#include "delfem2/primitive.h"
+#include "delfem2/mshmisc.h"
 
 namespace dfm2 = delfem2;
 
+// --------------------------------------
+// fixtures for the solver tests
+
+// tetrahedral mesh extruded from the triangulated nx*ny grid
+static void MeshTet3D_ExtrudedGrid(
+    std::vector<double>& aXYZ,
+    std::vector<unsigned int>& aTet,
+    unsigned int nx, unsigned int ny,
+    unsigned int nlayer, double height)
+{
+  std::vector<double> aXY;
+  std::vector<unsigned int> aQuad, aTri;
+  dfm2::MeshQuad2D_Grid(aXY, aQuad, nx, ny);
+  dfm2::convert2Tri_Quad(aTri, aQuad);
+  dfm2::ExtrudeTri2Tet(nlayer, height, aXYZ, aTet, aXY, aTri);
+}
+
+// zero matrix with the point adjacency pattern of the tetrahedral mesh
+static void MatrixPattern_MeshTet3D(
+    dfm2::CMatrixSparse<double>& mat,
+    unsigned int len,
+    const std::vector<double>& aXYZ,
+    const std::vector<unsigned int>& aTet)
+{
+  const unsigned int np = aXYZ.size()/3;
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aTet.data(), aTet.size()/4, 4, np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  mat.Initialize(np, len, true);
+  mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+  mat.SetZero();
+}
+
+// all the dofs of the points at the bottom (z=0) are fixed
+static std::vector<int> BCFlag_FixBottom(
+    const std::vector<double>& aXYZ,
+    unsigned int len)
+{
+  const unsigned int np = aXYZ.size()/3;
+  std::vector<int> aBCFlag(np*len, 0);
+  for(unsigned int ip=0;ip<np;++ip){
+    if( aXYZ[ip*3+2] > 1.0e-10 ){ continue; }
+    for(unsigned int idim=0;idim<len;++idim){ aBCFlag[ip*len+idim] = 1; }
+  }
+  return aBCFlag;
+}
+
+// Poisson (len==1) or linear solid (len==3) system fixed at the bottom
+static void LinSys_PoissonSolid_MeshTet3D(
+    dfm2::CMatrixSparse<double>& mat,
+    std::vector<double>& vec_b,
+    unsigned int len,
+    const std::vector<double>& aXYZ,
+    const std::vector<unsigned int>& aTet)
+{
+  const unsigned int np = aXYZ.size()/3;
+  const unsigned int nTet = aTet.size()/4;
+  MatrixPattern_MeshTet3D(mat, len, aXYZ, aTet);
+  vec_b.assign(np*len, 0.0);
+  std::vector<double> aVal(np*len, 0.0);
+  if( len == 1 ){
+    dfm2::MergeLinSys_Poission_MeshTet3D(mat, vec_b.data(),
+                                         1.0, 1.0,
+                                         aXYZ.data(), np, aTet.data(), nTet,
+                                         aVal.data());
+  }
+  else{
+    const double g[3] = {0.3, -1.0, 0.1};
+    dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D(mat, vec_b.data(),
+                                                   1.0, 0.3, 1.0, g,
+                                                   aXYZ.data(), np, aTet.data(), nTet,
+                                                   aVal.data());
+  }
+  const std::vector<int> aBCFlag = BCFlag_FixBottom(aXYZ, len);
+  mat.SetFixedBC(aBCFlag.data());
+  dfm2::setRHS_Zero(vec_b, aBCFlag, 0);
+}
+
+// stiffness matrix of the linear solid without the boundary condition
+static void MatrixStiffness_SolidLinear_MeshTet3D(
+    dfm2::CMatrixSparse<double>& mat_K,
+    const std::vector<double>& aXYZ,
+    const std::vector<unsigned int>& aTet)
+{
+  const unsigned int np = aXYZ.size()/3;
+  MatrixPattern_MeshTet3D(mat_K, 3, aXYZ, aTet);
+  std::vector<double> aDisp(np*3, 0.0), aR(np*3, 0.0);
+  const double gravity[3] = {0,0,0};
+  dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D(mat_K, aR.data(),
+                                                 1.0, 1.0, 1.0, gravity,
+                                                 aXYZ.data(), np, aTet.data(), aTet.size()/4,
+                                                 aDisp.data());
+}
+
+// random symmetric positive definite element matrix of a tetrahedron, reordered to the blocks
+static void EMat_RandomSPD_Tet(
+    std::vector<double>& emat,
+    unsigned int len,
+    std::mt19937& rndeng)
+{
+  std::uniform_real_distribution<double> dist(-1,1);
+  const unsigned int n = 4*len;
+  std::vector<double> B(n*n), A(n*n,0.0);
+  emat.resize(n*n);
+  for(auto& b : B){ b = dist(rndeng); }
+  for(unsigned int i=0;i<n;++i){
+    for(unsigned int j=0;j<n;++j){
+      for(unsigned int k=0;k<n;++k){ A[i*n+j] += B[i*n+k]*B[j*n+k]; }
+    }
+  }
+  for(unsigned int ino=0;ino<4;++ino){
+    for(unsigned int jno=0;jno<4;++jno){
+      for(unsigned int i=0;i<len;++i){
+        for(unsigned int j=0;j<len;++j){
+          emat[((ino*4+jno)*len+i)*len+j] = A[(ino*len+i)*n+jno*len+j];
+        }
+      }
+    }
+  }
+}
+
 // --------------------------------------
 
 TEST(objfunc_v23, Check_CdC_TriStrain){
@@ -712,3 +842,1351 @@ TEST(fem,plate_bending_mitc3_cantilever)
     }
   }
 }
+
+TEST(matrix,matvec_thread)
+{
+  std::vector<double> aXY;
+  std::vector<unsigned int> aQuad;
+  dfm2::MeshQuad2D_Grid(aXY, aQuad, 23, 17);
+  const unsigned int np = aXY.size()/2;
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aQuad.data(), aQuad.size()/4, 4,
+                             (int)np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(-1,1);
+  for(unsigned int len=1;len<6;++len){
+    dfm2::CMatrixSparse<double> mat;
+    mat.Initialize(np, len, true);
+    mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+    for(auto& v : mat.valCrs){ v = dist(rndeng); }
+    for(auto& v : mat.valDia){ v = dist(rndeng); }
+    const unsigned int ndof = np*len;
+    std::vector<double> x(ndof), y0(ndof);
+    for(auto& v : x){ v = dist(rndeng); }
+    for(auto& v : y0){ v = dist(rndeng); }
+    std::vector<double> y1 = y0, y1t = y0;
+    mat.MatVec(y1.data(), 0.7, x.data(), 0.3);
+    mat.MatTVec(y1t.data(), 0.7, x.data(), 0.3);
+    for(unsigned int nthread=2;nthread<6;++nthread){
+      mat.SetNumThread(nthread);
+      EXPECT_EQ(mat.splitRow.size(), nthread+1);
+      std::vector<double> y2 = y0, y2t = y0;
+      mat.MatVec(y2.data(), 0.7, x.data(), 0.3);
+      mat.MatTVec(y2t.data(), 0.7, x.data(), 0.3);
+      for(unsigned int i=0;i<ndof;++i){
+        EXPECT_EQ(y1[i], y2[i]);
+        EXPECT_EQ(y1t[i], y2t[i]);
+      }
+    }
+  }
+}
+
+TEST(matrix,merge)
+{
+  // three blocks in a row. the blocks 0 and 2 are not adjacent
+  const unsigned int colind[4] = {0,1,3,4};
+  const unsigned int rowptr[4] = {1, 0,2, 1};
+  for(unsigned int len=1;len<4;++len){
+    const unsigned int blksize = len*len;
+    dfm2::CMatrixSparse<double> mat;
+    mat.Initialize(3, len, true);
+    mat.SetPattern(colind,4, rowptr,4);
+    mat.SetZero();
+    { // the row blocks of the element are in the different order from the column blocks
+      const unsigned int aIP_col[2] = {0,1};
+      const unsigned int aIP_row[2] = {1,0};
+      std::vector<double> emat(4*blksize);
+      for(unsigned int i=0;i<emat.size();++i){ emat[i] = i+1; }
+      std::vector<int> buffer; // Mearge() initializes the buffer
+      mat.Mearge(2,aIP_col, 2,aIP_row, blksize, emat.data(), buffer);
+      for(unsigned int i=0;i<blksize;++i){
+        EXPECT_EQ(mat.valDia[0*blksize+i], emat[(0*2+1)*blksize+i]); // block (0,0)
+        EXPECT_EQ(mat.valDia[1*blksize+i], emat[(1*2+0)*blksize+i]); // block (1,1)
+        EXPECT_EQ(mat.valCrs[0*blksize+i], emat[(0*2+0)*blksize+i]); // block (0,1)
+        EXPECT_EQ(mat.valCrs[1*blksize+i], emat[(1*2+1)*blksize+i]); // block (1,0)
+      }
+    }
+    mat.SetZero();
+    { // the blocks (0,2) and (2,0) are not in the pattern and they are ignored
+      const unsigned int aIP[2] = {0,2};
+      std::vector<double> emat(4*blksize, 1.0);
+      std::vector<int> buffer;
+      mat.Mearge(2,aIP, 2,aIP, blksize, emat.data(), buffer);
+      for(double v : mat.valCrs){ EXPECT_EQ(v, 0.0); }
+      for(unsigned int i=0;i<blksize;++i){
+        EXPECT_EQ(mat.valDia[0*blksize+i], 1.0);
+        EXPECT_EQ(mat.valDia[1*blksize+i], 0.0);
+        EXPECT_EQ(mat.valDia[2*blksize+i], 1.0);
+      }
+    }
+  }
+}
+
+TEST(matrix,ilu_blksize)
+{
+  std::vector<double> aXY;
+  std::vector<unsigned int> aQuad;
+  dfm2::MeshQuad2D_Grid(aXY, aQuad, 7, 5);
+  const unsigned int np = aXY.size()/2;
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aQuad.data(), aQuad.size()/4, 4,
+                             (int)np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(-1,1);
+  for(unsigned int len=1;len<8;++len){
+    const unsigned int blksize = len*len;
+    dfm2::CMatrixSparse<double> mat;
+    mat.Initialize(np, len, true);
+    mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+    mat.SetZero();
+    std::vector<int> tmp_buffer(np,-1);
+    for(unsigned int iq=0;iq<aQuad.size()/4;++iq){ // random symmetric element matrices
+      std::vector<double> emat(16*blksize);
+      for(unsigned int i=0;i<4*len;++i){
+        for(unsigned int j=i;j<4*len;++j){
+          const double v = (i==j) ? 8.0*len : dist(rndeng);
+          const unsigned int ino = i/len, idim = i%len;
+          const unsigned int jno = j/len, jdim = j%len;
+          emat[(ino*4+jno)*blksize+idim*len+jdim] = v;
+          emat[(jno*4+ino)*blksize+jdim*len+idim] = v;
+        }
+      }
+      mat.Mearge(4, aQuad.data()+iq*4, 4, aQuad.data()+iq*4, blksize, emat.data(), tmp_buffer);
+    }
+    EXPECT_LT(dfm2::CheckSymmetry(mat), 1.0e-20);
+    const unsigned int ndof = np*len;
+    std::vector<double> b(ndof), x(ndof), r(ndof);
+    for(auto& v : b){ v = dist(rndeng); }
+    dfm2::CPreconditionerILU<double> ilu;
+    ilu.Initialize_ILUk(mat, -1); // complete factorization
+    ilu.SetValueILU(mat);
+    EXPECT_TRUE(ilu.DoILUDecomp());
+    x = b;
+    ilu.Solve(x.data());
+    r = b;
+    mat.MatVec(r.data(), -1.0, x.data(), 1.0);
+    EXPECT_LT(dfm2::DotX(r.data(),r.data(),ndof), 1.0e-20);
+  }
+}
+
+TEST(fem,merge_parallel_tet)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 6, 5, 4, 1.0);
+  const unsigned int np = aXYZ.size()/3;
+  const unsigned int nTet = aTet.size()/4;
+  std::vector<unsigned int> color_ind, color_elem;
+  dfm2::JArray_ElemColor_MeshElem(color_ind, color_elem,
+                                  aTet.data(), nTet, 4, np);
+  EXPECT_EQ(color_elem.size(), nTet);
+  for(unsigned int ic=0;ic+1<color_ind.size();++ic){ // elements in the same color do not share a point
+    std::vector<int> aFlg(np,0);
+    for(unsigned int ie=color_ind[ic];ie<color_ind[ic+1];++ie){
+      const unsigned int itet = color_elem[ie];
+      for(int inoel=0;inoel<4;++inoel){
+        const unsigned int ip = aTet[itet*4+inoel];
+        EXPECT_EQ(aFlg[ip], 0);
+        aFlg[ip] = 1;
+      }
+    }
+  }
+  const double g[3] = {0.3, -1.0, 0.1};
+  std::vector<double> aDisp(np*3, 0.0);
+  dfm2::CMatrixSparse<double> mat0, mat1;
+  std::vector<double> vec0(np*3, 0.0), vec1(np*3, 0.0);
+  MatrixPattern_MeshTet3D(mat0, 3, aXYZ, aTet);
+  dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D(mat0, vec0.data(),
+                                                 1.0, 0.3, 1.0, g,
+                                                 aXYZ.data(), np, aTet.data(), nTet,
+                                                 aDisp.data());
+  for(unsigned int nthread=1;nthread<5;++nthread){
+    mat1 = mat0;
+    mat1.SetZero();
+    std::vector<double> vec2(np*3, 0.0);
+    dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D_Parallel(mat1, vec2.data(),
+                                                            1.0, 0.3, 1.0, g,
+                                                            aXYZ.data(), np, aTet.data(),
+                                                            color_ind, color_elem, nthread,
+                                                            aDisp.data());
+    if( nthread == 1 ){ vec1 = vec2; }
+    for(unsigned int i=0;i<mat0.valCrs.size();++i){ EXPECT_NEAR(mat0.valCrs[i], mat1.valCrs[i], 1.0e-10); }
+    for(unsigned int i=0;i<mat0.valDia.size();++i){ EXPECT_NEAR(mat0.valDia[i], mat1.valDia[i], 1.0e-10); }
+    for(unsigned int i=0;i<np*3;++i){
+      EXPECT_NEAR(vec0[i], vec2[i], 1.0e-10);
+      EXPECT_EQ(vec1[i], vec2[i]); // independent of the number of threads
+    }
+  }
+}
+
+TEST(fem,merge_plan)
+{
+  { // poisson 2D
+    std::vector<double> aXY;
+    std::vector<unsigned int> aQuad, aTri;
+    dfm2::MeshQuad2D_Grid(aXY, aQuad, 9, 7);
+    dfm2::convert2Tri_Quad(aTri, aQuad);
+    const unsigned int np = aXY.size()/2;
+    const unsigned int nTri = aTri.size()/3;
+    std::vector<unsigned int> psup_ind, psup;
+    dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                               aTri.data(), nTri, 3, np);
+    dfm2::JArray_Sort(psup_ind, psup);
+    std::vector<double> aVal(np, 0.0);
+    for(unsigned int ip=0;ip<np;++ip){ aVal[ip] = aXY[ip*2+0]*aXY[ip*2+1]; }
+    dfm2::CMatrixSparse<double> mat0, mat1;
+    mat0.Initialize(np, 1, true);
+    mat0.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+    mat0.SetZero();
+    mat1 = mat0;
+    dfm2::CMergePlan plan;
+    plan.Initialize(mat0, aTri.data(), nTri, 3);
+    EXPECT_EQ(plan.aCrs.size(), nTri*9);
+    std::vector<double> vec0(np, 0.0), vec1(np, 0.0);
+    dfm2::MergeLinSys_Poission_MeshTri2D(mat0, vec0.data(), 1.0, 1.0,
+                                         aXY.data(), np, aTri.data(), nTri,
+                                         aVal.data());
+    dfm2::MergeLinSys_Poission_MeshTri2D(mat1, vec1.data(), 1.0, 1.0,
+                                         aXY.data(), np, aTri.data(), nTri,
+                                         aVal.data(), &plan);
+    EXPECT_EQ(mat0.valCrs, mat1.valCrs); // same order of the accumulation
+    EXPECT_EQ(mat0.valDia, mat1.valDia);
+    EXPECT_EQ(vec0, vec1);
+  }
+  { // solid 3D with multiple threads
+    std::vector<double> aXYZ;
+    std::vector<unsigned int> aTet;
+    MeshTet3D_ExtrudedGrid(aXYZ, aTet, 6, 5, 4, 1.0);
+    const unsigned int np = aXYZ.size()/3;
+    const unsigned int nTet = aTet.size()/4;
+    std::vector<unsigned int> color_ind, color_elem;
+    dfm2::JArray_ElemColor_MeshElem(color_ind, color_elem,
+                                    aTet.data(), nTet, 4, np);
+    const double g[3] = {0.3, -1.0, 0.1};
+    std::vector<double> aDisp(np*3, 0.0);
+    for(unsigned int i=0;i<np*3;++i){ aDisp[i] = 0.01*sin(i); }
+    dfm2::CMatrixSparse<double> mat0, mat1;
+    MatrixPattern_MeshTet3D(mat0, 3, aXYZ, aTet);
+    dfm2::CMergePlan plan;
+    plan.Initialize(mat0, aTet.data(), nTet, 4);
+    std::vector<double> vec0(np*3, 0.0);
+    dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D(mat0, vec0.data(),
+                                                   1.0, 0.3, 1.0, g,
+                                                   aXYZ.data(), np, aTet.data(), nTet,
+                                                   aDisp.data());
+    for(unsigned int nthread=1;nthread<4;++nthread){
+      mat1 = mat0;
+      mat1.SetZero();
+      std::vector<double> vec1(np*3, 0.0);
+      dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D_Parallel(mat1, vec1.data(),
+                                                              1.0, 0.3, 1.0, g,
+                                                              aXYZ.data(), np, aTet.data(),
+                                                              color_ind, color_elem, nthread,
+                                                              aDisp.data(), &plan);
+      for(unsigned int i=0;i<mat0.valCrs.size();++i){ EXPECT_NEAR(mat0.valCrs[i], mat1.valCrs[i], 1.0e-10); }
+      for(unsigned int i=0;i<mat0.valDia.size();++i){ EXPECT_NEAR(mat0.valDia[i], mat1.valDia[i], 1.0e-10); }
+      for(unsigned int i=0;i<np*3;++i){ EXPECT_NEAR(vec0[i], vec1[i], 1.0e-10); }
+    }
+  }
+}
+
+TEST(matrix,ilu_level_schedule)
+{
+  std::vector<double> aXY;
+  std::vector<unsigned int> aQuad;
+  dfm2::MeshQuad2D_Grid(aXY, aQuad, 13, 11);
+  const unsigned int np = aXY.size()/2;
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aQuad.data(), aQuad.size()/4, 4,
+                             (int)np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(-1,1);
+  { // double
+    const unsigned int len = 3;
+    dfm2::CMatrixSparse<double> mat;
+    mat.Initialize(np, len, true);
+    mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+    for(auto& v : mat.valCrs){ v = dist(rndeng); }
+    for(auto& v : mat.valDia){ v = dist(rndeng); }
+    mat.AddDia(30.0);
+    for(int ifill=0;ifill<3;++ifill){
+      dfm2::CPreconditionerILU<double> ilu;
+      ilu.Initialize_ILUk(mat, ifill);
+      EXPECT_GT(ilu.NumLevelForward(), 1);
+      EXPECT_LT(ilu.NumLevelForward(), np);
+      EXPECT_GT(ilu.NumLevelBackward(), 1);
+      EXPECT_LT(ilu.NumLevelBackward(), np);
+      ilu.SetValueILU(mat);
+      EXPECT_TRUE(ilu.DoILUDecomp());
+      std::vector<double> x0(np*len);
+      for(auto& v : x0){ v = dist(rndeng); }
+      std::vector<double> x1 = x0;
+      ilu.Solve(x1.data());
+      for(unsigned int nthread=2;nthread<5;++nthread){
+        ilu.SetNumThread(nthread);
+        std::vector<double> x2 = x0;
+        ilu.Solve(x2.data());
+        for(unsigned int i=0;i<x0.size();++i){ EXPECT_EQ(x1[i], x2[i]); }
+      }
+    }
+  }
+  { // complex
+    typedef std::complex<double> COMPLEX;
+    dfm2::CMatrixSparse<COMPLEX> mat;
+    mat.Initialize(np, 1, true);
+    mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+    for(auto& v : mat.valCrs){ v = COMPLEX(dist(rndeng),dist(rndeng)); }
+    for(auto& v : mat.valDia){ v = COMPLEX(dist(rndeng)+10.0,dist(rndeng)); }
+    dfm2::CPreconditionerILU<COMPLEX> ilu;
+    ilu.Initialize_ILU0(mat);
+    EXPECT_GT(ilu.NumLevelForward(), 1);
+    EXPECT_LT(ilu.NumLevelForward(), np);
+    ilu.SetValueILU(mat);
+    ilu.DoILUDecomp();
+    std::vector<COMPLEX> x0(np);
+    for(auto& v : x0){ v = COMPLEX(dist(rndeng),dist(rndeng)); }
+    std::vector<COMPLEX> x1 = x0;
+    ilu.Solve(x1.data());
+    ilu.SetNumThread(3);
+    std::vector<COMPLEX> x2 = x0;
+    ilu.Solve(x2.data());
+    for(unsigned int i=0;i<x0.size();++i){ EXPECT_EQ(x1[i], x2[i]); }
+  }
+}
+
+TEST(matrix,binary_snapshot)
+{
+  std::vector<double> aXY;
+  std::vector<unsigned int> aQuad;
+  dfm2::MeshQuad2D_Grid(aXY, aQuad, 13, 11);
+  const unsigned int np = aXY.size()/2;
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aQuad.data(), aQuad.size()/4, 4,
+                             (int)np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(-1,1);
+  const unsigned int len = 2;
+  dfm2::CMatrixSparse<double> mat;
+  mat.Initialize(np, len, true);
+  mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+  for(auto& v : mat.valCrs){ v = dist(rndeng); }
+  for(auto& v : mat.valDia){ v = dist(rndeng); }
+  mat.AddDia(20.0);
+  dfm2::CPreconditionerILU<double> ilu;
+  ilu.Initialize_ILUk(mat, 1);
+  const std::string path_mat = "tmp_snapshot_mat.bin";
+  const std::string path_ilu = "tmp_snapshot_ilu.bin";
+  EXPECT_TRUE(dfm2::Write_MatSparse_Binary(path_mat, mat));
+  EXPECT_TRUE(dfm2::Write_PreconditionerILU_Binary(path_ilu, ilu)); // symbolic factorization only
+  ilu.SetValueILU(mat);
+  EXPECT_TRUE(ilu.DoILUDecomp());
+  std::vector<double> x0(np*len);
+  for(auto& v : x0){ v = dist(rndeng); }
+  std::vector<double> y0(np*len), y1(np*len);
+  mat.MatVec(y0.data(), 1.0, x0.data(), 0.0);
+  std::vector<double> z0 = x0;
+  ilu.Solve(z0.data());
+  for(int is_mmap=0;is_mmap<2;++is_mmap){
+    dfm2::CMatrixSparse<double> mat1;
+    mat1.SetNumThread(2);
+    EXPECT_TRUE(dfm2::Read_MatSparse_Binary(mat1, path_mat, is_mmap==1));
+    EXPECT_EQ(mat1.colInd, mat.colInd);
+    EXPECT_EQ(mat1.rowPtr, mat.rowPtr);
+    mat1.MatVec(y1.data(), 1.0, x0.data(), 0.0);
+    for(unsigned int i=0;i<y0.size();++i){ EXPECT_EQ(y0[i], y1[i]); }
+    dfm2::CPreconditionerILU<double> ilu1;
+    EXPECT_TRUE(dfm2::Read_PreconditionerILU_Binary(ilu1, path_ilu, is_mmap==1));
+    EXPECT_EQ(ilu1.mat.rowPtr, ilu.mat.rowPtr);
+    EXPECT_EQ(ilu1.NumLevelForward(), ilu.NumLevelForward());
+    ilu1.SetValueILU(mat1);
+    EXPECT_TRUE(ilu1.DoILUDecomp());
+    ilu1.SetNumThread(2);
+    std::vector<double> z1 = x0;
+    ilu1.Solve(z1.data());
+    for(unsigned int i=0;i<z0.size();++i){ EXPECT_EQ(z0[i], z1[i]); }
+  }
+  { // the file of the different kind or the different value type is rejected and the object is not changed
+    dfm2::CMatrixSparse<float> matf;
+    EXPECT_FALSE(dfm2::Read_MatSparse_Binary(matf, path_mat));
+    dfm2::CMatrixSparse<double> mat1;
+    EXPECT_FALSE(dfm2::Read_MatSparse_Binary(mat1, path_ilu));
+    EXPECT_FALSE(dfm2::Read_MatSparse_Binary(mat1, "tmp_snapshot_not_exist.bin"));
+    EXPECT_EQ(mat1.nblk_col, 0);
+    EXPECT_TRUE(mat1.colInd.empty());
+  }
+  std::remove(path_mat.c_str());
+  std::remove(path_ilu.c_str());
+}
+
+TEST(matrix,spgemm)
+{
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(-1,1);
+  // random block sparse matrix. about the ratio of the off-diagonal blocks are non-zero
+  auto make_random = [&](unsigned int nblk_col, unsigned int nblk_row,
+                         unsigned int len_col, unsigned int len_row,
+                         bool is_dia, double ratio){
+    dfm2::CMatrixSparse<double> m;
+    m.nblk_col = nblk_col;  m.nblk_row = nblk_row;
+    m.len_col = len_col;  m.len_row = len_row;
+    m.colInd.assign(nblk_col+1,0);
+    for(unsigned int iblk=0;iblk<nblk_col;++iblk){
+      for(unsigned int jblk=0;jblk<nblk_row;++jblk){
+        if( is_dia && iblk == jblk ){ continue; }
+        if( dist(rndeng)*0.5+0.5 > ratio ){ continue; }
+        m.rowPtr.push_back(jblk);
+      }
+      m.colInd[iblk+1] = m.rowPtr.size();
+    }
+    m.valCrs.resize(m.rowPtr.size()*len_col*len_row);
+    for(auto& v : m.valCrs){ v = dist(rndeng); }
+    if( is_dia ){
+      m.valDia.resize(nblk_col*len_col*len_row);
+      for(auto& v : m.valDia){ v = dist(rndeng); }
+    }
+    return m;
+  };
+  auto dense = [](const dfm2::CMatrixSparse<double>& m){
+    const unsigned int nr = m.nblk_col*m.len_col, nc = m.nblk_row*m.len_row;
+    std::vector<double> d(nr*nc, 0.0);
+    const unsigned int nblksize = m.len_col*m.len_row;
+    for(unsigned int iblk=0;iblk<m.nblk_col;++iblk){
+      for(unsigned int icrs=m.colInd[iblk];icrs<m.colInd[iblk+1];++icrs){
+        for(unsigned int i=0;i<m.len_col;++i){
+          for(unsigned int j=0;j<m.len_row;++j){
+            d[(iblk*m.len_col+i)*nc+m.rowPtr[icrs]*m.len_row+j] += m.valCrs[icrs*nblksize+i*m.len_row+j];
+          }
+        }
+      }
+      if( m.valDia.empty() ){ continue; }
+      for(unsigned int i=0;i<m.len_col;++i){
+        for(unsigned int j=0;j<m.len_row;++j){
+          d[(iblk*m.len_col+i)*nc+iblk*m.len_row+j] += m.valDia[iblk*nblksize+i*m.len_row+j];
+        }
+      }
+    }
+    return d;
+  };
+  { // [C] = [A][B]
+    dfm2::CMatrixSparse<double> A = make_random(40, 30, 2, 3, false, 0.1);
+    dfm2::CMatrixSparse<double> B = make_random(30, 40, 3, 2, false, 0.1);
+    dfm2::CMatrixSparse<double> C;
+    dfm2::MatSparse_MatMat_Symbolic(C, A, B);
+    EXPECT_EQ(C.nblk_col, 40);
+    EXPECT_EQ(C.nblk_row, 40);
+    EXPECT_EQ(C.valDia.size(), 40*2*2); // square product has the diagonal blocks
+    for(int itr=0;itr<2;++itr){ // the pattern is reused for the new values
+      for(auto& v : A.valCrs){ v = dist(rndeng); }
+      dfm2::MatSparse_MatMat_Numeric(C, A, B);
+      const std::vector<double> dA = dense(A), dB = dense(B), dC = dense(C);
+      for(unsigned int i=0;i<80;++i){
+        for(unsigned int j=0;j<80;++j){
+          double s = 0.0;
+          for(unsigned int k=0;k<90;++k){ s += dA[i*90+k]*dB[k*80+j]; }
+          EXPECT_NEAR(dC[i*80+j], s, 1.0e-12);
+        }
+      }
+    }
+    dfm2::CMatrixSparse<double> C1;
+    C1.SetNumThread(3);
+    dfm2::MatSparse_MatMat_Symbolic(C1, A, B);
+    dfm2::MatSparse_MatMat_Numeric(C1, A, B);
+    EXPECT_EQ(C1.rowPtr, C.rowPtr);
+    EXPECT_EQ(C1.valCrs, C.valCrs);
+    EXPECT_EQ(C1.valDia, C.valDia);
+  }
+  { // [Ac] = [R]^T[A][P]
+    dfm2::CMatrixSparse<double> A = make_random(50, 50, 2, 2, true, 0.1);
+    const dfm2::CMatrixSparse<double> P = make_random(50, 12, 2, 3, false, 0.15);
+    const dfm2::CMatrixSparse<double> R = make_random(50, 7, 2, 1, false, 0.15);
+    for(int iR=0;iR<2;++iR){
+      const dfm2::CMatrixSparse<double>& RR = (iR==0) ? P : R;
+      const unsigned int nr = RR.nblk_row*RR.len_row;
+      dfm2::CMatrixSparse<double> Ac;
+      dfm2::CTripleProductPlan<double> plan;
+      plan.Initialize(Ac, RR, A, P);
+      EXPECT_EQ(Ac.valDia.empty(), iR==1);
+      for(int itr=0;itr<2;++itr){
+        for(auto& v : A.valDia){ v = dist(rndeng); }
+        plan.SetValue(Ac, RR, A, P);
+        const std::vector<double> dR = dense(RR), dA = dense(A), dP = dense(P), dAc = dense(Ac);
+        for(unsigned int i=0;i<nr;++i){
+          for(unsigned int j=0;j<36;++j){
+            double s = 0.0;
+            for(unsigned int k=0;k<100;++k){
+              for(unsigned int l=0;l<100;++l){ s += dR[k*nr+i]*dA[k*100+l]*dP[l*36+j]; }
+            }
+            EXPECT_NEAR(dAc[i*36+j], s, 1.0e-12);
+          }
+        }
+      }
+      dfm2::CMatrixSparse<double> Ac1;
+      Ac1.SetNumThread(2);
+      dfm2::CTripleProductPlan<double> plan1;
+      plan1.Initialize(Ac1, RR, A, P);
+      plan1.SetValue(Ac1, RR, A, P);
+      EXPECT_EQ(Ac1.valCrs, Ac.valCrs);
+      EXPECT_EQ(Ac1.valDia, Ac.valDia);
+    }
+  }
+}
+
+TEST(matrix,amg_pcg)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 12, 12, 12, 1.0);
+  const unsigned int np = aXYZ.size()/3;
+  for(unsigned int len=1;len<4;len+=2){ // Poisson and linear solid
+    dfm2::CMatrixSparse<double> mat;
+    std::vector<double> vec_b;
+    LinSys_PoissonSolid_MeshTet3D(mat, vec_b, len, aXYZ, aTet);
+    // ILU(0)
+    unsigned int nitr_ilu;
+    {
+      dfm2::CPreconditionerILU<double> ilu;
+      ilu.Initialize_ILU0(mat);
+      ilu.SetValueILU(mat);
+      ilu.DoILUDecomp();
+      std::vector<double> r = vec_b, x(np*len);
+      nitr_ilu = dfm2::Solve_PCG(r.data(), x.data(), np*len, 1.0e-8, 1000, mat, ilu).size();
+    }
+    // AMG
+    dfm2::CPreconditionerAMG<double> amg;
+    if( len == 3 ){ amg.SetNearKernel_RigidBody(aXYZ.data(), np, 3); }
+    amg.Initialize(mat);
+    EXPECT_GT(amg.NumLevel(), 1);
+    std::vector<double> r = vec_b, x(np*len);
+    const unsigned int nitr_amg = dfm2::Solve_PCG(r.data(), x.data(), np*len, 1.0e-8, 1000, mat, amg).size();
+    EXPECT_LT(nitr_amg, 1000);
+    EXPECT_LT(nitr_amg, nitr_ilu);
+    r = vec_b;
+    mat.MatVec(r.data(), -1.0, x.data(), 1.0);
+    EXPECT_LT(dfm2::DotX(r.data(),r.data(),np*len), 1.0e-12*dfm2::DotX(vec_b.data(),vec_b.data(),np*len));
+//    std::cout << "len:" << len << " nlevel:" << amg.NumLevel() << " itr ilu:" << nitr_ilu << " amg:" << nitr_amg << std::endl;
+  }
+}
+
+TEST(matrix,pcg_mixed_precision)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 10, 10, 10, 1.0);
+  const unsigned int np = aXYZ.size()/3;
+  for(unsigned int len=1;len<4;len+=2){ // Poisson and linear solid
+    const unsigned int ndof = np*len;
+    dfm2::CMatrixSparse<double> mat;
+    std::vector<double> vec_b;
+    LinSys_PoissonSolid_MeshTet3D(mat, vec_b, len, aXYZ, aTet);
+    const double sqnorm_b = dfm2::DotX(vec_b.data(),vec_b.data(),ndof);
+    unsigned int nitr_dbl;
+    {
+      dfm2::CPreconditionerILU<double> ilu;
+      ilu.Initialize_ILU0(mat);
+      ilu.SetValueILU(mat);
+      ilu.DoILUDecomp();
+      std::vector<double> r = vec_b, x(ndof);
+      nitr_dbl = dfm2::Solve_PCG(r.data(), x.data(), ndof, 1.0e-10, 1000, mat, ilu).size();
+    }
+    dfm2::CMatrixSparse<float> mat_f;
+    mat_f.SetCopy(mat);
+    dfm2::CPreconditionerILU<float> ilu_f;
+    ilu_f.Initialize_ILU0(mat_f);
+    ilu_f.SetValueILU(mat_f);
+    EXPECT_TRUE(ilu_f.DoILUDecomp());
+    { // double PCG with the float ILU factors
+      dfm2::CPreconditionerLowPrecision<float, dfm2::CPreconditionerILU<float> > prec(ilu_f, ndof);
+      std::vector<double> r = vec_b, x(ndof);
+      const unsigned int nitr = dfm2::Solve_PCG(r.data(), x.data(), ndof, 1.0e-10, 1000, mat, prec).size();
+      EXPECT_LT(nitr, nitr_dbl*1.2);
+      r = vec_b;
+      mat.MatVec(r.data(), -1.0, x.data(), 1.0);
+      EXPECT_LT(dfm2::DotX(r.data(),r.data(),ndof), 1.0e-18*sqnorm_b);
+    }
+    { // iterative refinement with the float matrix and the float ILU
+      std::vector<double> r = vec_b, x(ndof);
+      const std::vector<double> aHist = dfm2::Solve_PCG_MixedPrecision<float>(r.data(), x.data(), ndof, 1.0e-10, 1000,
+                                                                             mat, mat_f, ilu_f);
+      EXPECT_GT(aHist.size(), 2);
+      EXPECT_LT(aHist.back(), 1.0e-10*aHist[0]);
+      r = vec_b;
+      mat.MatVec(r.data(), -1.0, x.data(), 1.0);
+      EXPECT_LT(dfm2::DotX(r.data(),r.data(),ndof), 1.0e-18*sqnorm_b);
+    }
+  }
+}
+
+TEST(matrix,pcg_pipelined)
+{
+  { // fused kernels
+    std::mt19937 rndeng(0);
+    std::uniform_real_distribution<double> dist(-1,1);
+    const unsigned int n = 103;
+    std::vector<double> a(n), b(n), c(n), d(n);
+    for(unsigned int i=0;i<n;++i){ a[i] = dist(rndeng); b[i] = dist(rndeng); c[i] = dist(rndeng); d[i] = dist(rndeng); }
+    double ab, cb, aa;
+    dfm2::DotX3(ab, cb, aa, a.data(), b.data(), c.data(), n);
+    EXPECT_NEAR(ab, dfm2::DotX(a.data(),b.data(),n), 1.0e-12);
+    EXPECT_NEAR(cb, dfm2::DotX(c.data(),b.data(),n), 1.0e-12);
+    EXPECT_NEAR(aa, dfm2::DotX(a.data(),a.data(),n), 1.0e-12);
+    std::vector<double> x = a;
+    dfm2::XPlusAYBZCW(x.data(), 0.3, b.data(), -0.2, c.data(), 0.7, d.data(), n);
+    for(unsigned int i=0;i<n;++i){ EXPECT_NEAR(x[i], a[i]+0.3*b[i]-0.2*c[i]+0.7*d[i], 1.0e-12); }
+  }
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 10, 10, 10, 1.0);
+  const unsigned int np = aXYZ.size()/3;
+  for(unsigned int len=1;len<4;len+=2){ // Poisson and linear solid
+    const unsigned int ndof = np*len;
+    dfm2::CMatrixSparse<double> mat;
+    std::vector<double> vec_b;
+    LinSys_PoissonSolid_MeshTet3D(mat, vec_b, len, aXYZ, aTet);
+    dfm2::CPreconditionerILU<double> ilu;
+    ilu.Initialize_ILU0(mat);
+    ilu.SetValueILU(mat);
+    ilu.DoILUDecomp();
+    std::vector<double> r0 = vec_b, x0(ndof);
+    const std::vector<double> aHist0 = dfm2::Solve_PCG(r0.data(), x0.data(), ndof, 1.0e-10, 1000, mat, ilu);
+    std::vector<double> r1 = vec_b, x1(ndof);
+    const std::vector<double> aHist1 = dfm2::Solve_PCG_Pipelined(r1.data(), x1.data(), ndof, 1.0e-10, 1000, mat, ilu);
+    EXPECT_LT(aHist1.size(), 1000);
+    EXPECT_LE(aHist1.size(), aHist0.size()+2);
+    EXPECT_LE(aHist0.size(), aHist1.size()+2);
+    for(unsigned int ihist=0;ihist<10;++ihist){
+      EXPECT_NEAR(aHist0[ihist], aHist1[ihist], 1.0e-8*aHist0[0]);
+    }
+    std::vector<double> r = vec_b;
+    mat.MatVec(r.data(), -1.0, x1.data(), 1.0);
+    const double sqnorm_b = dfm2::DotX(vec_b.data(),vec_b.data(),ndof);
+    EXPECT_LT(dfm2::DotX(r.data(),r.data(),ndof), 1.0e-18*sqnorm_b);
+  }
+}
+
+TEST(fem,matrix_free_stiffwarp)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 6, 5, 7, 1.0);
+  const unsigned int np = aXYZ.size()/3;
+  const unsigned int nTet = aTet.size()/4;
+  const unsigned int ndof = np*3;
+  std::vector<double> aR(np*9);
+  for(unsigned int ip=0;ip<np;++ip){ // rotation around z-axis after x-axis
+    const double a = 0.3*aXYZ[ip*3+0]+0.1*aXYZ[ip*3+2];
+    const double b = 0.2*aXYZ[ip*3+1];
+    const double ca = cos(a), sa = sin(a), cb = cos(b), sb = sin(b);
+    const double R[9] = {
+      ca, -sa*cb, +sa*sb,
+      sa, +ca*cb, -ca*sb,
+      0,  sb,     cb };
+    for(int i=0;i<9;++i){ aR[ip*9+i] = R[i]; }
+  }
+  const std::vector<int> aBCFlag = BCFlag_FixBottom(aXYZ, 3);
+  const double myu = 1.0, lambda = 0.5, rho = 1.0, dt = 0.1;
+  const double g[3] = {0.3, -1.0, 0.1};
+  dfm2::CMatrixSparse<double> mat;
+  MatrixPattern_MeshTet3D(mat, 3, aXYZ, aTet);
+  std::vector<double> vec_b(ndof, 0.0);
+  {
+    const std::vector<double> aDisp(ndof, 0.0), aVelo(ndof, 0.0);
+    dfm2::MergeLinSys_SolidStiffwarp_BEuler_MeshTet3D(mat, vec_b.data(),
+                                                      myu, lambda, rho, g, dt,
+                                                      aXYZ.data(), np, aTet.data(), nTet,
+                                                      aDisp.data(), aVelo.data(), aR);
+  }
+  mat.SetFixedBC(aBCFlag.data());
+  dfm2::setRHS_Zero(vec_b, aBCFlag, 0);
+  const dfm2::CMatrixFree_SolidStiffwarp_BEuler_MeshTet3D matfree(myu, lambda, rho, dt,
+                                                                 aXYZ.data(), np, aTet.data(), nTet,
+                                                                 aR.data(), aBCFlag.data());
+  { // the product is the same as the assembled matrix
+    std::mt19937 rndeng(0);
+    std::uniform_real_distribution<double> dist(-1,1);
+    std::vector<double> x(ndof), y0(ndof), y1(ndof);
+    for(unsigned int i=0;i<ndof;++i){ x[i] = dist(rndeng); y0[i] = y1[i] = dist(rndeng); }
+    mat.MatVec(y0.data(), 1.5, x.data(), 0.5);
+    matfree.MatVec(y1.data(), 1.5, x.data(), 0.5);
+    for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(y0[i], y1[i], 1.0e-10*(1.0+fabs(y0[i]))); }
+  }
+  std::vector<double> x0(ndof);
+  {
+    dfm2::CPreconditionerILU<double> ilu;
+    ilu.Initialize_ILU0(mat);
+    ilu.SetValueILU(mat);
+    ilu.DoILUDecomp();
+    std::vector<double> r = vec_b;
+    dfm2::Solve_PBiCGStab(r.data(), x0.data(), 1.0e-10, 1000, mat, ilu);
+    // the matrix-free operator with the preconditioner made from the assembled matrix
+    std::vector<double> x1(ndof);
+    r = vec_b;
+    const std::vector<double> aHist = dfm2::Solve_PBiCGStab(r.data(), x1.data(), ndof,
+                                                           1.0e-10, 1000, matfree, ilu);
+    EXPECT_LT(aHist.size(), 1000);
+    for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(x0[i], x1[i], 1.0e-7); }
+  }
+  { // without the preconditioner
+    std::vector<double> r = vec_b, x1(ndof);
+    const std::vector<double> aHist = dfm2::Solve_BiCGStab(r, x1, 1.0e-10, 1000, matfree);
+    EXPECT_LT(aHist.size(), 1000);
+    for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(x0[i], x1[i], 1.0e-7); }
+  }
+}
+
+TEST(matrix,sparse_ldl)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 10, 9, 8, 1.0);
+  const unsigned int np = aXYZ.size()/3;
+  const unsigned int nTet = aTet.size()/4;
+  const double g[3] = {0.3, -1.0, 0.1};
+  dfm2::CMatrixSparse<double> mat;
+  MatrixPattern_MeshTet3D(mat, 3, aXYZ, aTet);
+  dfm2::CSparseLDL<double> ldl;
+  ldl.Initialize(mat); // symbolic factorization is reused below
+  EXPECT_LT(ldl.NumSuperNode(), np);
+  EXPECT_LT(ldl.NumNonZero(), (size_t)np*3*(np*3+1)/2);
+  std::vector<double> aDisp(np*3, 0.0);
+  const std::vector<int> aBCFlag = BCFlag_FixBottom(aXYZ, 3);
+  std::vector<double> x1;
+  for(int imass=0;imass<2;++imass){
+    mat.SetZero();
+    std::vector<double> vec_b(np*3, 0.0);
+    dfm2::MergeLinSys_SolidLinear_Static_MeshTet3D(mat, vec_b.data(),
+                                                   1.0, 0.3, 1.0, g,
+                                                   aXYZ.data(), np, aTet.data(), nTet,
+                                                   aDisp.data());
+    mat.AddDia(imass*0.1);
+    mat.SetFixedBC(aBCFlag.data());
+    dfm2::setRHS_Zero(vec_b, aBCFlag, 0);
+    for(unsigned int nthread=1;nthread<4;++nthread){
+      ldl.SetNumThread(nthread);
+      EXPECT_TRUE(ldl.Factorize(mat));
+      std::vector<double> x = vec_b;
+      ldl.Solve(x.data());
+      if( nthread == 1 ){ x1 = x; }
+      for(unsigned int i=0;i<np*3;++i){ EXPECT_EQ(x[i], x1[i]); } // independent of the number of threads
+      std::vector<double> r = vec_b;
+      mat.MatVec(r.data(), -1.0, x.data(), 1.0);
+      EXPECT_LT(dfm2::DotX(r.data(),r.data(),np*3), 1.0e-20*dfm2::DotX(vec_b.data(),vec_b.data(),np*3));
+    }
+  }
+}
+
+TEST(matrix,krylov_workspace)
+{
+  std::vector<double> aXY;
+  std::vector<unsigned int> aQuad, aTri;
+  dfm2::MeshQuad2D_Grid(aXY, aQuad, 16, 12);
+  dfm2::convert2Tri_Quad(aTri, aQuad);
+  const unsigned int np = aXY.size()/2;
+  const unsigned int nTri = aTri.size()/3;
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aTri.data(), nTri, 3, np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  dfm2::CMatrixSparse<double> mat;
+  mat.Initialize(np, 1, true);
+  mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+  mat.SetZero();
+  std::vector<double> vec_b(np, 0.0), aVal(np, 0.0);
+  dfm2::MergeLinSys_Poission_MeshTri2D(mat, vec_b.data(), 1.0, 1.0,
+                                       aXY.data(), np, aTri.data(), nTri,
+                                       aVal.data());
+  std::vector<int> aBCFlag(np, 0);
+  for(unsigned int ip=0;ip<np;++ip){
+    if( aXY[ip*2+0] < aXY[0]+1.0e-10 ){ aBCFlag[ip] = 1; }
+  }
+  mat.SetFixedBC(aBCFlag.data());
+  dfm2::setRHS_Zero(vec_b, aBCFlag, 0);
+  dfm2::CPreconditionerILU<double> ilu;
+  ilu.Initialize_ILU0(mat);
+  ilu.SetValueILU(mat);
+  ilu.DoILUDecomp();
+  { // PCG
+    std::vector<double> r0 = vec_b, x0(np);
+    const std::vector<double> aHist0 = dfm2::Solve_PCG(r0.data(), x0.data(), np, 1.0e-8, 1000, mat, ilu);
+    dfm2::CKrylovWorkspace<double> ws;
+    ws.Initialize(np, 2, 1000);
+    const double* pBuff = ws.Vec(0); // the buffers are not re-allocated in the solver
+    const double* pHist = ws.aHistory.data();
+    const std::size_t ncap = ws.aHistory.capacity();
+    std::vector<double> r1(np), x1(np);
+    for(unsigned int itr=0;itr<3;++itr){
+      for(unsigned int i=0;i<np;++i){ r1[i] = vec_b[i]; }
+      const unsigned int nitr = dfm2::Solve_PCG(r1.data(), x1.data(), np, 1.0e-8, 1000, mat, ilu, ws);
+      EXPECT_EQ(ws.Vec(0), pBuff);
+      EXPECT_EQ(ws.aHistory.data(), pHist);
+      EXPECT_EQ(ws.aHistory.capacity(), ncap);
+      EXPECT_EQ(nitr+1, aHist0.size()); // initial residual + iterations
+      EXPECT_EQ(ws.aHistory, aHist0);
+      EXPECT_EQ(x1, x0);
+    }
+    ws.is_history = false; // no history mode
+    ws.Initialize(np, 2, 1000);
+    for(unsigned int i=0;i<np;++i){ r1[i] = vec_b[i]; }
+    dfm2::Solve_PCG(r1.data(), x1.data(), np, 1.0e-8, 1000, mat, ilu, ws);
+    EXPECT_EQ(ws.Vec(0), pBuff);
+    EXPECT_TRUE(ws.aHistory.empty());
+    EXPECT_EQ(x1, x0);
+  }
+  { // BiCGStab. the work vectors are allocated in the first solve
+    std::vector<double> r0 = vec_b, x0(np);
+    const std::vector<double> aHist0 = dfm2::Solve_PBiCGStab(r0.data(), x0.data(), np, 1.0e-8, 1000, mat, ilu);
+    dfm2::CKrylovWorkspace<double> ws;
+    ws.is_history = false;
+    std::vector<double> r1(np), x1(np);
+    const double* pBuff = nullptr;
+    for(unsigned int itr=0;itr<3;++itr){
+      for(unsigned int i=0;i<np;++i){ r1[i] = vec_b[i]; }
+      const unsigned int nitr = dfm2::Solve_PBiCGStab(r1.data(), x1.data(), np, 1.0e-8, 1000, mat, ilu, ws);
+      if( itr > 0 ){ EXPECT_EQ(ws.Vec(0), pBuff); }
+      pBuff = ws.Vec(0);
+      EXPECT_EQ(nitr, aHist0.size());
+      EXPECT_EQ(x1, x0);
+    }
+  }
+  { // complex. the system is the real one scaled by (1+0.5i)
+    using COMPLEX = std::complex<double>;
+    std::vector<double> r0 = vec_b, x0(np);
+    dfm2::Solve_PCG(r0.data(), x0.data(), np, 1.0e-10, 1000, mat, ilu);
+    dfm2::CMatrixSparse<COMPLEX> matc;
+    matc.SetCopy(mat);
+    dfm2::CPreconditionerILU<COMPLEX> iluc;
+    iluc.Initialize_ILU0(matc);
+    iluc.SetValueILU(matc);
+    iluc.DoILUDecomp();
+    dfm2::CKrylovWorkspace<COMPLEX> ws;
+    ws.Initialize(np, 7, 1000);
+    const COMPLEX* pBuff = ws.Vec(0);
+    const double* pHist = ws.aHistory.data();
+    std::vector<COMPLEX> r(np), x(np);
+    for(unsigned int itr=0;itr<4;++itr){
+      for(unsigned int i=0;i<np;++i){ r[i] = COMPLEX(1.0,0.5)*vec_b[i]; }
+      if( itr % 2 == 0 ){ dfm2::Solve_PCG_Complex(r.data(), x.data(), np, 1.0e-10, 1000, matc, iluc, ws); }
+      else{ dfm2::Solve_PBiCGStab_Complex(r.data(), x.data(), np, 1.0e-10, 1000, matc, iluc, ws); }
+      EXPECT_EQ(ws.Vec(0), pBuff);
+      EXPECT_EQ(ws.aHistory.data(), pHist);
+      for(unsigned int i=0;i<np;++i){ EXPECT_LT(std::abs(x[i]-COMPLEX(1.0,0.5)*x0[i]), 1.0e-6); }
+    }
+  }
+}
+
+TEST(matrix,symmetric_storage)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 6, 5, 4, 1.0);
+  const unsigned int np = aXYZ.size()/3;
+  const unsigned int nTet = aTet.size()/4;
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aTet.data(), nTet, 4, np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(-1,1);
+  for(unsigned int len=1;len<4;len+=2){
+    const unsigned int ndof = np*len;
+    dfm2::CMatrixSparse<double> mat;
+    mat.Initialize(np, len, true);
+    mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+    mat.SetZero();
+    dfm2::CMatrixSparseSym<double> mats;
+    mats.Initialize(np, len);
+    mats.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+    mats.SetZero();
+    EXPECT_EQ(mats.rowPtr.size()*2, mat.rowPtr.size());
+    std::vector<int> tmp_buffer;
+    std::vector<double> emat;
+    for(unsigned int itet=0;itet<nTet;++itet){
+      EMat_RandomSPD_Tet(emat, len, rndeng);
+      mat.Mearge(4, aTet.data()+itet*4, 4, aTet.data()+itet*4, len*len, emat.data(), tmp_buffer);
+      mats.Mearge(4, aTet.data()+itet*4, len*len, emat.data(), tmp_buffer);
+    }
+    const std::vector<int> aBCFlag = BCFlag_FixBottom(aXYZ, len);
+    mat.SetFixedBC(aBCFlag.data());
+    mats.SetFixedBC(aBCFlag.data());
+    { // matrix-vector product
+      std::vector<double> x(ndof), y0(ndof), y1(ndof);
+      for(unsigned int i=0;i<ndof;++i){ x[i] = dist(rndeng); y0[i] = y1[i] = dist(rndeng); }
+      mat.MatVec(y0.data(), 0.7, x.data(), 0.3);
+      mats.MatVec(y1.data(), 0.7, x.data(), 0.3);
+      for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(y0[i], y1[i], 1.0e-10); }
+    }
+    { // conversion
+      dfm2::CMatrixSparse<double> mat1;
+      mats.GetFull(mat1);
+      EXPECT_EQ(mat1.colInd, mat.colInd);
+      EXPECT_EQ(mat1.rowPtr, mat.rowPtr);
+      for(unsigned int i=0;i<mat.valCrs.size();++i){ EXPECT_NEAR(mat1.valCrs[i], mat.valCrs[i], 1.0e-10); }
+      dfm2::CMatrixSparseSym<double> mats1;
+      mats1.SetUpper(mat);
+      EXPECT_EQ(mats1.rowPtr, mats.rowPtr);
+      for(unsigned int i=0;i<mats.valCrs.size();++i){ EXPECT_NEAR(mats1.valCrs[i], mats.valCrs[i], 1.0e-10); }
+    }
+    { // preconditioner and solver
+      std::vector<double> vec_b(ndof);
+      for(unsigned int i=0;i<ndof;++i){ vec_b[i] = (aBCFlag[i]==0) ? dist(rndeng) : 0.0; }
+      dfm2::CPreconditionerILU<double> ilu0, ilu1;
+      ilu0.Initialize_ILU0(mat);
+      ilu0.SetValueILU(mat);
+      EXPECT_TRUE(ilu0.DoILUDecomp());
+      ilu1.Initialize_ILU0(mats);
+      ilu1.SetValueILU(mats);
+      EXPECT_TRUE(ilu1.DoILUDecomp());
+      for(unsigned int i=0;i<ilu0.mat.valCrs.size();++i){ EXPECT_NEAR(ilu0.mat.valCrs[i], ilu1.mat.valCrs[i], 1.0e-10); }
+      std::vector<double> r0 = vec_b, x0(ndof), r1 = vec_b, x1(ndof);
+      const std::vector<double> aHist0 = dfm2::Solve_PCG(r0.data(), x0.data(), ndof, 1.0e-10, 1000, mat, ilu0);
+      const std::vector<double> aHist1 = dfm2::Solve_PCG(r1.data(), x1.data(), ndof, 1.0e-10, 1000, mats, ilu1);
+      EXPECT_EQ(aHist0.size(), aHist1.size());
+      for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(x0[i], x1[i], 1.0e-8); }
+    }
+  }
+}
+
+TEST(matrix,ic_pcg)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 8, 6, 5, 1.0);
+  const unsigned int np = aXYZ.size()/3;
+  const unsigned int nTet = aTet.size()/4;
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(-1,1);
+  for(unsigned int len=1;len<4;len+=2){
+    const unsigned int ndof = np*len;
+    dfm2::CMatrixSparse<double> mat;
+    MatrixPattern_MeshTet3D(mat, len, aXYZ, aTet);
+    std::vector<int> tmp_buffer;
+    std::vector<double> emat;
+    for(unsigned int itet=0;itet<nTet;++itet){
+      EMat_RandomSPD_Tet(emat, len, rndeng);
+      mat.Mearge(4, aTet.data()+itet*4, 4, aTet.data()+itet*4, len*len, emat.data(), tmp_buffer);
+    }
+    const std::vector<int> aBCFlag = BCFlag_FixBottom(aXYZ, len);
+    mat.SetFixedBC(aBCFlag.data());
+    dfm2::CMatrixSparseSym<double> mats;
+    mats.SetUpper(mat);
+    std::vector<double> vec_b(ndof);
+    for(unsigned int i=0;i<ndof;++i){ vec_b[i] = (aBCFlag[i]==0) ? dist(rndeng) : 0.0; }
+    // ILU(0) for the reference
+    std::vector<double> x_ilu(ndof);
+    unsigned int nitr_ilu;
+    {
+      dfm2::CPreconditionerILU<double> ilu;
+      ilu.Initialize_ILU0(mat);
+      ilu.SetValueILU(mat);
+      EXPECT_TRUE(ilu.DoILUDecomp());
+      std::vector<double> r = vec_b;
+      nitr_ilu = dfm2::Solve_PCG(r.data(), x_ilu.data(), ndof, 1.0e-10, 1000, mat, ilu).size();
+      EXPECT_LT(nitr_ilu, 1000);
+    }
+    { // IC(0) is equivalent to ILU(0) for the symmetric matrix
+      dfm2::CPreconditionerIC<double> ic0, ic1;
+      ic0.Initialize_IC0(mat);
+      ic0.SetValueIC(mat);
+      EXPECT_TRUE(ic0.DoICDecomp());
+      ic1.Initialize_IC0(mats);
+      ic1.SetValueIC(mats);
+      EXPECT_TRUE(ic1.DoICDecomp());
+      EXPECT_EQ(ic0.m_matU.rowPtr, mats.rowPtr);
+      for(unsigned int i=0;i<ic0.m_matU.valCrs.size();++i){ EXPECT_NEAR(ic0.m_matU.valCrs[i], ic1.m_matU.valCrs[i], 1.0e-10); }
+      std::vector<double> r = vec_b, x(ndof);
+      const unsigned int nitr = dfm2::Solve_PCG(r.data(), x.data(), ndof, 1.0e-10, 1000, mat, ic0).size();
+      EXPECT_EQ(nitr, nitr_ilu);
+      for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(x[i], x_ilu[i], 1.0e-8); }
+    }
+    { // multicolor ordering. the result does not depend on the number of threads
+      dfm2::CPreconditionerIC<double> ic;
+      ic.Initialize_IC0(mats, true);
+      EXPECT_LT(ic.NumLevel(), 30);
+      EXPECT_EQ(ic.m_aNew2Old.size(), np);
+      ic.SetValueIC(mats);
+      EXPECT_TRUE(ic.DoICDecomp());
+      std::vector<double> r0 = vec_b, x0(ndof);
+      const unsigned int nitr0 = dfm2::Solve_PCG(r0.data(), x0.data(), ndof, 1.0e-10, 1000, mats, ic).size();
+      EXPECT_LT(nitr0, 1000);
+      for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(x0[i], x_ilu[i], 1.0e-8); }
+      const std::vector<double> aValU = ic.m_matU.valCrs;
+      ic.SetNumThread(3);
+      ic.SetValueIC(mats);
+      EXPECT_TRUE(ic.DoICDecomp());
+      for(unsigned int i=0;i<aValU.size();++i){ EXPECT_EQ(aValU[i], ic.m_matU.valCrs[i]); }
+      std::vector<double> r1 = vec_b, x1(ndof);
+      const unsigned int nitr1 = dfm2::Solve_PCG(r1.data(), x1.data(), ndof, 1.0e-10, 1000, mats, ic).size();
+      EXPECT_EQ(nitr0, nitr1);
+      for(unsigned int i=0;i<ndof;++i){ EXPECT_EQ(x0[i], x1[i]); }
+    }
+    { // IC(1) has more fill-in and converges faster than IC(0)
+      dfm2::CPreconditionerIC<double> ic;
+      ic.Initialize_ICk(mat, 1);
+      EXPECT_GT(ic.m_matU.rowPtr.size(), mats.rowPtr.size());
+      ic.SetValueIC(mat);
+      EXPECT_TRUE(ic.DoICDecomp());
+      std::vector<double> r = vec_b, x(ndof);
+      const unsigned int nitr = dfm2::Solve_PCG(r.data(), x.data(), ndof, 1.0e-10, 1000, mat, ic).size();
+      EXPECT_LE(nitr, nitr_ilu);
+      for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(x[i], x_ilu[i], 1.0e-8); }
+    }
+  }
+}
+
+TEST(matrix,pcg_multi_rhs)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 8, 6, 5, 1.0);
+  const unsigned int np = aXYZ.size()/3;
+  const unsigned int nTet = aTet.size()/4;
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(-1,1);
+  for(unsigned int len=1;len<4;len+=2){
+    const unsigned int ndof = np*len;
+    dfm2::CMatrixSparse<double> mat;
+    MatrixPattern_MeshTet3D(mat, len, aXYZ, aTet);
+    std::vector<int> tmp_buffer;
+    std::vector<double> emat;
+    for(unsigned int itet=0;itet<nTet;++itet){
+      EMat_RandomSPD_Tet(emat, len, rndeng);
+      mat.Mearge(4, aTet.data()+itet*4, 4, aTet.data()+itet*4, len*len, emat.data(), tmp_buffer);
+    }
+    const std::vector<int> aBCFlag = BCFlag_FixBottom(aXYZ, len);
+    mat.SetFixedBC(aBCFlag.data());
+    dfm2::CPreconditionerILU<double> ilu;
+    ilu.Initialize_ILU0(mat);
+    ilu.SetValueILU(mat);
+    EXPECT_TRUE(ilu.DoILUDecomp());
+    const unsigned int nrhs = 4;
+    std::vector<double> aB(ndof*nrhs, 0.0); // interleaved. the last right hand side is zero
+    for(unsigned int i=0;i<ndof;++i){
+      if( aBCFlag[i] != 0 ){ continue; }
+      for(unsigned int irhs=0;irhs<nrhs-1;++irhs){ aB[i*nrhs+irhs] = dist(rndeng); }
+    }
+    for(unsigned int nthread=1;nthread<4;nthread+=2){
+      mat.SetNumThread(nthread);
+      ilu.SetNumThread(nthread);
+      { // matrix-vector product and the preconditioner for multiple vectors
+        std::vector<double> aY(ndof*nrhs), aZ = aB;
+        for(unsigned int i=0;i<ndof*nrhs;++i){ aY[i] = dist(rndeng); }
+        std::vector<double> aY0 = aY;
+        mat.MatVecMulti(aY.data(), 0.7, aB.data(), 0.3, nrhs);
+        ilu.SolveMulti(aZ.data(), nrhs);
+        for(unsigned int irhs=0;irhs<nrhs;++irhs){
+          std::vector<double> b(ndof), y(ndof), z(ndof);
+          for(unsigned int i=0;i<ndof;++i){ b[i] = aB[i*nrhs+irhs]; y[i] = aY0[i*nrhs+irhs]; }
+          mat.MatVec(y.data(), 0.7, b.data(), 0.3);
+          z = b;
+          ilu.Solve(z.data());
+          for(unsigned int i=0;i<ndof;++i){
+            EXPECT_NEAR(y[i], aY[i*nrhs+irhs], 1.0e-10);
+            EXPECT_NEAR(z[i], aZ[i*nrhs+irhs], 1.0e-10);
+          }
+        }
+      }
+      { // the iterates of each system are the same as the single right hand side solver
+        std::vector<double> aR = aB, aX(ndof*nrhs);
+        const std::vector< std::vector<double> > aHist = dfm2::Solve_PCG_Multi(aR.data(), aX.data(),
+                                                                                ndof, nrhs, 1.0e-10, 1000, mat, ilu);
+        ASSERT_EQ(aHist.size(), nrhs);
+        EXPECT_EQ(aHist[nrhs-1].size(), 1);
+        for(unsigned int irhs=0;irhs<nrhs-1;++irhs){
+          std::vector<double> r(ndof), x(ndof);
+          for(unsigned int i=0;i<ndof;++i){ r[i] = aB[i*nrhs+irhs]; }
+          const std::vector<double> aHist0 = dfm2::Solve_PCG(r.data(), x.data(), ndof, 1.0e-10, 1000, mat, ilu);
+          EXPECT_LT(aHist0.size(), 1000);
+          EXPECT_NEAR(aHist[irhs].size(), aHist0.size(), 1);
+          for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(x[i], aX[i*nrhs+irhs], 1.0e-8); }
+          std::vector<double> res(ndof), xi(ndof); // the residual of the converged system is written back
+          for(unsigned int i=0;i<ndof;++i){ res[i] = aB[i*nrhs+irhs]; xi[i] = aX[i*nrhs+irhs]; }
+          mat.MatVec(res.data(), -1.0, xi.data(), 1.0);
+          for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(res[i], aR[i*nrhs+irhs], 1.0e-10); }
+        }
+        for(unsigned int i=0;i<ndof;++i){ EXPECT_EQ(aX[i*nrhs+nrhs-1], 0.0); }
+      }
+    }
+  }
+}
+
+TEST(matrix,lobpcg)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 4, 2, 3, 0.5);
+  const unsigned int np = aXYZ.size()/3;
+  const unsigned int nTet = aTet.size()/4;
+  const unsigned int ndof = np*3;
+  dfm2::CMatrixSparse<double> mat_K;
+  MatrixStiffness_SolidLinear_MeshTet3D(mat_K, aXYZ, aTet);
+  std::vector<double> aMass(np);
+  dfm2::MassPoint_Tet3D(aMass.data(), 1.0, aXYZ.data(), np, aTet.data(), nTet);
+  // eigenvalues of the dense matrix [M]^-1/2[K][M]^-1/2 for the dofs with aFlag==0
+  auto EigenValueDense = [&](const dfm2::CMatrixSparse<double>& K, const std::vector<int>& aFlag){
+    std::vector<unsigned int> aMap;
+    for(unsigned int i=0;i<ndof;++i){ if( aFlag[i] == 0 ){ aMap.push_back(i); } }
+    std::vector<double> Kd(ndof*ndof, 0.0);
+    for(unsigned int ip=0;ip<np;++ip){
+      for(unsigned int icrs=K.colInd[ip];icrs<K.colInd[ip+1]+1;++icrs){
+        const unsigned int jp = (icrs<K.colInd[ip+1]) ? K.rowPtr[icrs] : ip;
+        const double* a = (icrs<K.colInd[ip+1]) ? K.valCrs.data()+icrs*9 : K.valDia.data()+ip*9;
+        for(unsigned int i=0;i<3;++i){
+          for(unsigned int j=0;j<3;++j){ Kd[(ip*3+i)*ndof+jp*3+j] = a[i*3+j]; }
+        }
+      }
+    }
+    const unsigned int n = aMap.size();
+    std::vector<double> A(n*n), lam(n), V(n*n);
+    for(unsigned int i=0;i<n;++i){
+      for(unsigned int j=0;j<n;++j){
+        A[i*n+j] = Kd[aMap[i]*ndof+aMap[j]]/sqrt(aMass[aMap[i]/3]*aMass[aMap[j]/3]);
+      }
+    }
+    dfm2::EigenSym_Jacobi(lam.data(), V.data(), A.data(), n);
+    return lam;
+  };
+  const unsigned int nmode = 4;
+  std::mt19937 rndeng(0);
+  std::uniform_real_distribution<double> dist(-1,1);
+  { // fixed at the bottom
+    dfm2::CMatrixSparse<double> K = mat_K;
+    std::vector<int> aBCFlag(ndof, 0);
+    std::vector<double> aMassBC = aMass;
+    for(unsigned int ip=0;ip<np;++ip){
+      if( aXYZ[ip*3+2] > 1.0e-10 ){ continue; }
+      aBCFlag[ip*3+0] = aBCFlag[ip*3+1] = aBCFlag[ip*3+2] = 1;
+      aMassBC[ip] = 0.0;
+    }
+    K.SetFixedBC(aBCFlag.data());
+    const std::vector<double> aLamRef = EigenValueDense(K, aBCFlag);
+    dfm2::CPreconditionerILU<double> ilu;
+    ilu.Initialize_ILU0(K);
+    ilu.SetValueILU(K);
+    EXPECT_TRUE(ilu.DoILUDecomp());
+    const dfm2::CMatrixLumpedMass mat_M(aMassBC.data(), np, 3);
+    std::vector<double> aEigVal(nmode), aEigVec(nmode*ndof);
+    for(unsigned int i=0;i<nmode*ndof;++i){ aEigVec[i] = (aBCFlag[i%ndof]==0) ? dist(rndeng) : 0.0; }
+    const std::vector<double> aHist = dfm2::Solve_LOBPCG(aEigVal.data(), aEigVec.data(), nmode, ndof,
+                                                         1.0e-6, 300, K, mat_M, ilu);
+    ASSERT_FALSE(aHist.empty());
+    EXPECT_LT(aHist.back(), 1.0e-6);
+    EXPECT_LT(aHist.size(), 300);
+    for(unsigned int i=0;i<nmode;++i){ EXPECT_NEAR(aEigVal[i], aLamRef[i], 1.0e-8*aLamRef[nmode]); }
+    for(unsigned int i=0;i<nmode;++i){ // [M]-orthonormal
+      std::vector<double> mx(ndof);
+      mat_M.MatVec(mx.data(), 1.0, aEigVec.data()+i*ndof, 0.0);
+      for(unsigned int j=0;j<nmode;++j){
+        EXPECT_NEAR(dfm2::DotX(mx.data(), aEigVec.data()+j*ndof, ndof), (i==j) ? 1.0 : 0.0, 1.0e-8);
+      }
+      for(unsigned int idof=0;idof<ndof;++idof){
+        if( aBCFlag[idof] != 0 ){ EXPECT_NEAR(aEigVec[i*ndof+idof], 0.0, 1.0e-10); }
+      }
+    }
+  }
+  { // free body. the rigid-body modes are removed
+    std::vector<double> aKer(6*ndof, 0.0);
+    for(unsigned int ip=0;ip<np;++ip){
+      const double x0 = aXYZ[ip*3+0], y0 = aXYZ[ip*3+1], z0 = aXYZ[ip*3+2];
+      for(unsigned int idim=0;idim<3;++idim){ aKer[idim*ndof+ip*3+idim] = 1.0; }
+      aKer[3*ndof+ip*3+1] = +z0;  aKer[3*ndof+ip*3+2] = -y0;
+      aKer[4*ndof+ip*3+2] = +x0;  aKer[4*ndof+ip*3+0] = -z0;
+      aKer[5*ndof+ip*3+0] = +y0;  aKer[5*ndof+ip*3+1] = -x0;
+    }
+    const std::vector<double> aLamRef = EigenValueDense(mat_K, std::vector<int>(ndof,0));
+    for(unsigned int i=0;i<6;++i){ EXPECT_NEAR(aLamRef[i], 0.0, 1.0e-8*aLamRef[6]); }
+    dfm2::CMatrixSparse<double> K_shift = mat_K; // [K]+sigma[M] for the preconditioner
+    K_shift.AddDia_LumpedMass(aMass.data(), 1.0e-2*aLamRef[6]);
+    dfm2::CPreconditionerILU<double> ilu;
+    ilu.Initialize_ILU0(K_shift);
+    ilu.SetValueILU(K_shift);
+    EXPECT_TRUE(ilu.DoILUDecomp());
+    const dfm2::CMatrixLumpedMass mat_M(aMass.data(), np, 3);
+    std::vector<double> aEigVal(nmode), aEigVec(nmode*ndof);
+    for(double& v : aEigVec){ v = dist(rndeng); }
+    const std::vector<double> aHist = dfm2::Solve_LOBPCG(aEigVal.data(), aEigVec.data(), nmode, ndof,
+                                                         1.0e-6, 300, mat_K, mat_M, ilu,
+                                                         aKer.data(), 6);
+    ASSERT_FALSE(aHist.empty());
+    EXPECT_LT(aHist.back(), 1.0e-6);
+    for(unsigned int i=0;i<nmode;++i){ EXPECT_NEAR(aEigVal[i], aLamRef[6+i], 1.0e-8*aLamRef[6+nmode]); }
+  }
+}
+
+TEST(matrix,pcg_deflated)
+{
+  std::vector<double> aXYZ;
+  std::vector<unsigned int> aTet;
+  MeshTet3D_ExtrudedGrid(aXYZ, aTet, 12, 3, 3, 0.3);
+  const unsigned int np = aXYZ.size()/3;
+  const unsigned int nTet = aTet.size()/4;
+  const unsigned int ndof = np*3;
+  dfm2::CMatrixSparse<double> mat_K;
+  MatrixStiffness_SolidLinear_MeshTet3D(mat_K, aXYZ, aTet);
+  std::vector<double> aMass(np);
+  dfm2::MassPoint_Tet3D(aMass.data(), 1.0, aXYZ.data(), np, aTet.data(), nTet);
+  std::vector<int> aBCFlag(ndof, 0);
+  for(unsigned int ip=0;ip<np;++ip){
+    if( aXYZ[ip*3+0] > 1.0e-10 ){ continue; }
+    aBCFlag[ip*3+0] = aBCFlag[ip*3+1] = aBCFlag[ip*3+2] = 1;
+  }
+  dfm2::CPreconditionerILU<double> ilu;
+  ilu.Initialize_ILU0(mat_K);
+  // slowly varying systems [A] = (1+0.02*iframe)[K] + [M] with the slowly varying load
+  dfm2::CKrylovDeflation defl0, defl1;
+  defl0.Initialize(ndof, 0, 0); // warm start only
+  defl1.Initialize(ndof, 8, 20); // warm start and the recycled subspace
+  std::vector<double> x0(ndof, 0.0), x1(ndof, 0.0);
+  unsigned int nitr_cold = 0, nitr_warm = 0, nitr_defl = 0;
+  for(unsigned int iframe=0;iframe<6;++iframe){
+    dfm2::CMatrixSparse<double> mat_A = mat_K;
+    for(double& v : mat_A.valCrs){ v *= 1.0+0.02*iframe; }
+    for(double& v : mat_A.valDia){ v *= 1.0+0.02*iframe; }
+    mat_A.AddDia_LumpedMass(aMass.data(), 1.0);
+    mat_A.SetFixedBC(aBCFlag.data());
+    ilu.SetValueILU(mat_A);
+    EXPECT_TRUE(ilu.DoILUDecomp());
+    std::vector<double> vec_b(ndof);
+    for(unsigned int ip=0;ip<np;++ip){
+      const double t = 0.1*iframe;
+      vec_b[ip*3+0] = 0.0;
+      vec_b[ip*3+1] = aMass[ip]*sin(t);
+      vec_b[ip*3+2] = -aMass[ip]*(1.0+0.1*aXYZ[ip*3+0]*cos(t));
+    }
+    dfm2::setRHS_Zero(vec_b, aBCFlag, 0);
+    std::vector<double> x_cold(ndof);
+    {
+      std::vector<double> r = vec_b;
+      const std::vector<double> aHist = dfm2::Solve_PCG(r.data(), x_cold.data(), ndof, 1.0e-8, 1000, mat_A, ilu);
+      nitr_cold += aHist.size()-1;
+    }
+    {
+      std::vector<double> r = vec_b;
+      nitr_warm += dfm2::Solve_PCG_Deflated(r.data(), x0.data(), ndof, 1.0e-8, 1000, mat_A, ilu, defl0);
+      EXPECT_EQ(defl0.NumVec(), 0);
+    }
+    {
+      std::vector<double> r = vec_b;
+      nitr_defl += dfm2::Solve_PCG_Deflated(r.data(), x1.data(), ndof, 1.0e-8, 1000, mat_A, ilu, defl1);
+      EXPECT_EQ(defl1.NumVec(), 8);
+      std::vector<double> res = vec_b; // the residual is consistent with the solution
+      mat_A.MatVec(res.data(), -1.0, x1.data(), 1.0);
+      for(unsigned int i=0;i<ndof;++i){ EXPECT_NEAR(res[i], r[i], 1.0e-10); }
+    }
+    const double norm_x = sqrt(dfm2::DotX(x_cold.data(), x_cold.data(), ndof));
+    for(unsigned int i=0;i<ndof;++i){
+      EXPECT_NEAR(x0[i], x_cold[i], 1.0e-5*norm_x);
+      EXPECT_NEAR(x1[i], x_cold[i], 1.0e-5*norm_x);
+    }
+  }
+  EXPECT_LT(nitr_warm, nitr_cold);
+  EXPECT_LT(nitr_defl, nitr_warm);
+}
+
+#if defined(DFM2_INSTRUMENT)
+TEST(matrix,instrument)
+{
+  std::vector<double> aXY;
+  std::vector<unsigned int> aQuad, aTri;
+  dfm2::MeshQuad2D_Grid(aXY, aQuad, 16, 12);
+  dfm2::convert2Tri_Quad(aTri, aQuad);
+  const unsigned int np = aXY.size()/2;
+  const unsigned int nTri = aTri.size()/3;
+  std::vector<unsigned int> psup_ind, psup;
+  dfm2::JArray_PSuP_MeshElem(psup_ind, psup,
+                             aTri.data(), nTri, 3, np);
+  dfm2::JArray_Sort(psup_ind, psup);
+  dfm2::CMatrixSparse<double> mat;
+  mat.Initialize(np, 1, true);
+  mat.SetPattern(psup_ind.data(), psup_ind.size(), psup.data(),psup.size());
+  mat.SetZero();
+  std::vector<double> vec_b(np, 0.0), aVal(np, 0.0);
+  dfm2::CInstrument inst;
+  dfm2::CPreconditionerILU<double> ilu;
+  dfm2::CKrylovWorkspace<double> ws;
+  ws.Initialize(np, 2, 1000);
+  std::vector<double> r(np), x(np);
+  unsigned int nitr0;
+  {
+    dfm2::CInstrumentBind bind(inst);
+    dfm2::MergeLinSys_Poission_MeshTri2D(mat, vec_b.data(), 1.0, 1.0,
+                                         aXY.data(), np, aTri.data(), nTri,
+                                         aVal.data());
+    std::vector<int> aBCFlag(np, 0);
+    for(unsigned int ip=0;ip<np;++ip){
+      if( aXY[ip*2+0] < aXY[0]+1.0e-10 ){ aBCFlag[ip] = 1; }
+    }
+    mat.SetFixedBC(aBCFlag.data());
+    dfm2::setRHS_Zero(vec_b, aBCFlag, 0);
+    ilu.Initialize_ILU0(mat);
+    ilu.SetValueILU(mat);
+    ilu.DoILUDecomp();
+    r = vec_b;
+    nitr0 = dfm2::Solve_PCG(r.data(), x.data(), np, 1.0e-8, 1000, mat, ilu, ws);
+  }
+  EXPECT_GT(nitr0, 5);
+  EXPECT_EQ(inst.aCall[dfm2::INSTRUMENT_ASSEMBLY], 1);
+  EXPECT_EQ(inst.aCall[dfm2::INSTRUMENT_FACTORIZE], 1);
+  EXPECT_EQ(inst.aCall[dfm2::INSTRUMENT_MATVEC], nitr0);
+  EXPECT_EQ(inst.aCall[dfm2::INSTRUMENT_PRECOND], nitr0);  // the last iteration does not apply the preconditioner
+  EXPECT_EQ(inst.nitr, nitr0);
+  const double nnz = mat.valCrs.size()+mat.valDia.size();
+  EXPECT_EQ(inst.aFlop[dfm2::INSTRUMENT_MATVEC], 2.0*nnz*nitr0);
+  EXPECT_GT(inst.aFlop[dfm2::INSTRUMENT_VECTOR], 0.0);
+  EXPECT_GT(inst.aByte[dfm2::INSTRUMENT_PRECOND], 0.0);
+  EXPECT_GT(inst.TimeTotal(), 0.0);
+  { // stop the solver with the callback
+    inst.Clear();
+    std::vector<double> aRatio;
+    inst.callback_iteration = [&aRatio](unsigned int iitr, double conv_ratio){
+      aRatio.push_back(conv_ratio);
+      return iitr < 5;
+    };
+    dfm2::CInstrumentBind bind(inst);
+    r = vec_b;
+    const unsigned int nitr1 = dfm2::Solve_PCG(r.data(), x.data(), np, 1.0e-8, 1000, mat, ilu, ws);
+    EXPECT_EQ(nitr1, 5);
+    EXPECT_EQ(aRatio.size(), 5);
+    EXPECT_EQ(inst.aCall[dfm2::INSTRUMENT_MATVEC], 5);
+    { // multiple right hand sides
+      aRatio.clear();
+      const unsigned int nrhs = 2;
+      std::vector<double> aR(np*nrhs), aX(np*nrhs);
+      for(unsigned int i=0;i<np;++i){ aR[i*nrhs+0] = vec_b[i]; aR[i*nrhs+1] = 2.0*vec_b[i]; }
+      const std::vector< std::vector<double> > aHist = dfm2::Solve_PCG_Multi(aR.data(), aX.data(),
+                                                                              np, nrhs, 1.0e-8, 1000, mat, ilu);
+      EXPECT_EQ(aRatio.size(), 5);
+      EXPECT_EQ(aHist[0].size(), 6); // initial residual + iterations
+      EXPECT_EQ(aHist[1].size(), 6);
+    }
+    { // complex orthogonal conjugate gradient
+      using COMPLEX = std::complex<double>;
+      aRatio.clear();
+      dfm2::CMatrixSparse<COMPLEX> matc;
+      matc.SetCopy(mat);
+      dfm2::CPreconditionerILU<COMPLEX> iluc;
+      iluc.Initialize_ILU0(matc);
+      iluc.SetValueILU(matc);
+      iluc.DoILUDecomp();
+      std::vector<COMPLEX> rc(np), xc(np);
+      for(unsigned int i=0;i<np;++i){ rc[i] = COMPLEX(1.0,0.5)*vec_b[i]; }
+      const std::vector<double> aHist = dfm2::Solve_PCOCG(rc.data(), xc.data(), 1.0e-8, 1000, matc, iluc);
+      EXPECT_EQ(aRatio.size(), 5);
+      EXPECT_EQ(aHist.size(), 5);
+    }
+  }
+  { // nothing is recorded without the binding
+    inst.Clear();
+    r = vec_b;
+    EXPECT_EQ(dfm2::Solve_PCG(r.data(), x.data(), np, 1.0e-8, 1000, mat, ilu, ws), nitr0);
+    EXPECT_EQ(inst.nitr, 0);
+    EXPECT_EQ(inst.aCall[dfm2::INSTRUMENT_MATVEC], 0);
+  }
+}
+#endif